@@ -22,6 +22,41 @@ pub struct LdtDescriptorParams {
 pub const VM86_IRQ_TIMER: u32 = 1 << 0;
 pub const VM86_IRQ_KEYBOARD: u32 = 1 << 1;
 
+/// Virtual interrupt flag, stored in the eflags of VMRegisters.
+/// CLI, STI, PUSHF, POPF and IRET are emulated by the kernel without leaving
+/// v86 mode, and act on this flag instead of the real IF. enter_8086 reads it
+/// on entry, and it is updated when the syscall returns.
+pub const VM86_VIF: u32 = 1 << 19;
+
+/// Bitmap of interrupt vectors that the kernel reflects directly into the
+/// v86 program's IVT handler, without returning from enter_8086.
+/// Bit N set = INT N is reflected.
+#[derive(Clone, Copy)]
+#[repr(C)]
+pub struct VM86ReflectedInts(pub [u32; 8]);
+
+impl VM86ReflectedInts {
+    pub const fn none() -> Self {
+        Self([0; 8])
+    }
+
+    pub const fn all() -> Self {
+        Self([0xffff_ffff; 8])
+    }
+
+    pub fn set(&mut self, int_num: u8) {
+        self.0[int_num as usize / 32] |= 1 << (int_num % 32);
+    }
+
+    pub fn clear(&mut self, int_num: u8) {
+        self.0[int_num as usize / 32] &= !(1 << (int_num % 32));
+    }
+
+    pub fn is_set(&self, int_num: u8) -> bool {
+        self.0[int_num as usize / 32] & (1 << (int_num % 32)) != 0
+    }
+}
+
 #[derive(Clone)]
 pub struct VMRegisters {
     pub eax: u32,
@@ -23,6 +23,7 @@ pub enum DriverCommand {
     Unlink,
     Rmdir,
     Rename,
+    ReadDir,
     // Every time a new command is added, modify the method below that decodes the command
     Invalid = 0xffffffff,
 }
@@ -45,6 +46,7 @@ impl DriverCommand {
             13 => DriverCommand::Unlink,
             14 => DriverCommand::Rmdir,
             15 => DriverCommand::Rename,
+            16 => DriverCommand::ReadDir,
             _ => DriverCommand::Invalid,
         }
     }
@@ -159,6 +161,16 @@ pub trait AsyncDriver {
                 self.release_buffer(buffer_ptr, buffer_len);
                 Some(result)
             }
+            DriverCommand::ReadDir => {
+                let file_ref = DriverFileReference(message.args[0]);
+                let buffer_ptr = message.args[1] as *mut u8;
+                let buffer_len = message.args[2] as usize;
+                let first_index = message.args[3];
+                let buffer = unsafe { core::slice::from_raw_parts_mut(buffer_ptr, buffer_len) };
+                let result = self.read_dir(file_ref, buffer, first_index);
+                self.release_buffer(buffer_ptr, buffer_len);
+                Some(result)
+            }
             DriverCommand::Write => {
                 let file_ref = DriverFileReference(message.args[0]);
                 let buffer_ptr = message.args[1] as *mut u8;
@@ -343,6 +355,23 @@ pub trait AsyncDriver {
         Err(IoError::UnsupportedOperation)
     }
 
+    /// Read the entries of an open directory, along with each entry's type,
+    /// size and modification time, so that listing a directory doesn't need
+    /// a separate open and stat for every entry. The driver fills the buffer
+    /// with whole `DirEntryHeader` records, starting from the entry at
+    /// `first_index`, and returns the number of bytes written. Zero bytes
+    /// indicates there are no more entries.
+    /// Drivers that don't implement this can still be listed with `read`,
+    /// which returns the entry names alone.
+    fn read_dir(
+        &mut self,
+        file_ref: DriverFileReference,
+        buffer: &mut [u8],
+        first_index: u32,
+    ) -> IoResult {
+        Err(IoError::UnsupportedOperation)
+    }
+
     /// Write to a file reference from a buffer. The driver writes data from the
     /// buffer to the file, starting at the given offset.
     /// On success, the driver returns the number of bytes written, which may be
@@ -26,3 +26,96 @@ impl FileStatus {
         }
     }
 }
+
+/// Header of each record produced by FILE_OP_READDIR. Records are packed back
+/// to back in the caller's buffer: each header is followed by the entry's
+/// name, without a terminator, and then by padding up to a 4-byte boundary.
+/// A driver only ever writes whole records, so a buffer of at least
+/// `DirEntryHeader::MAX_RECORD_LEN` bytes always makes progress.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct DirEntryHeader {
+    /// Length of the whole record, including header, name and padding
+    pub record_len: u16,
+    /// Length of the name, in bytes
+    pub name_len: u16,
+    /// Bitmap indicating the type of the file, as in FileStatus
+    pub file_type: u32,
+    /// Size of the file, in bytes
+    pub byte_size: u32,
+    /// System timestamp of last modification
+    pub modification_time: u32,
+}
+
+impl DirEntryHeader {
+    pub const SIZE: usize = core::mem::size_of::<DirEntryHeader>();
+    /// Largest record a driver may produce, for a 255-byte name
+    pub const MAX_RECORD_LEN: usize = Self::record_len_for(255);
+
+    pub const fn record_len_for(name_len: usize) -> usize {
+        (Self::SIZE + name_len + 3) & !3
+    }
+
+    /// Append a record for `name` to the start of `buffer`, returning the
+    /// number of bytes used, or None if the record doesn't fit.
+    pub fn write_record(
+        buffer: &mut [u8],
+        name: &[u8],
+        file_type: u32,
+        byte_size: u32,
+        modification_time: u32,
+    ) -> Option<usize> {
+        let name_len = name.len().min(255);
+        let record_len = Self::record_len_for(name_len);
+        if record_len > buffer.len() {
+            return None;
+        }
+        let header = DirEntryHeader {
+            record_len: record_len as u16,
+            name_len: name_len as u16,
+            file_type,
+            byte_size,
+            modification_time,
+        };
+        unsafe {
+            core::ptr::write_unaligned(buffer.as_mut_ptr() as *mut DirEntryHeader, header);
+        }
+        buffer[Self::SIZE..Self::SIZE + name_len].copy_from_slice(&name[..name_len]);
+        buffer[Self::SIZE + name_len..record_len].fill(0);
+        Some(record_len)
+    }
+}
+
+/// Iterator over the records in a buffer filled by FILE_OP_READDIR, yielding
+/// each header along with the entry's name
+pub struct DirEntryRecords<'buffer> {
+    remaining: &'buffer [u8],
+}
+
+impl<'buffer> DirEntryRecords<'buffer> {
+    pub fn new(buffer: &'buffer [u8]) -> Self {
+        Self { remaining: buffer }
+    }
+}
+
+impl<'buffer> Iterator for DirEntryRecords<'buffer> {
+    type Item = (DirEntryHeader, &'buffer [u8]);
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.remaining.len() < DirEntryHeader::SIZE {
+            return None;
+        }
+        let header =
+            unsafe { core::ptr::read_unaligned(self.remaining.as_ptr() as *const DirEntryHeader) };
+        let record_len = header.record_len as usize;
+        let name_end = DirEntryHeader::SIZE + header.name_len as usize;
+        if record_len < name_end || record_len > self.remaining.len() {
+            // Malformed record; stop rather than read past it
+            self.remaining = &[];
+            return None;
+        }
+        let name = &self.remaining[DirEntryHeader::SIZE..name_end];
+        self.remaining = &self.remaining[record_len..];
+        Some((header, name))
+    }
+}
@@ -79,6 +79,17 @@ pub fn stat_sync(handle: Handle) -> Result<super::file::FileStatus, IoError> {
     Ok(status)
 }
 
+/// Read directory entries with their attributes, starting from the entry at
+/// `first_index`. The buffer is filled with records that can be walked with
+/// `DirEntryRecords`; a return value of 0 means the listing is complete.
+pub fn read_dir_sync(handle: Handle, buffer: &mut [u8], first_index: u32) -> IoResult {
+    use crate::io::FILE_OP_READDIR;
+
+    let buffer_ptr = buffer.as_ptr() as u32;
+    let buffer_len = buffer.len() as u32;
+    io_sync(handle, FILE_OP_READDIR, buffer_ptr, buffer_len, first_index)
+}
+
 pub fn ioctl_sync(handle: Handle, ioctl: u32, arg: u32, arg_len: u32) -> IoResult {
     use crate::io::FILE_OP_IOCTL;
 
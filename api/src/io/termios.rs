@@ -25,6 +25,13 @@ pub const TGETPAL: u32 = 0x6003;
 pub const TSETPAL: u32 = 0x6004;
 /// Set the console window title (expects a byte string, max 40 bytes)
 pub const TSETTITLE: u32 = 0x6005;
+/// Submit damaged regions of the graphics surface (expects a SurfaceDamage
+/// struct). The compositor copies only those regions to the screen. The
+/// request does not complete until the compositor has consumed the damaged
+/// pixels, at which point it returns the fence value from the struct. This
+/// makes the op itself a frame-done fence: once it resolves, the client is
+/// free to start drawing the next frame into the surface.
+pub const TGFXDAMAGE: u32 = 0x6006;
 
 pub const PALETTE_ENTRIES: usize = 256;
 pub const PALETTE_SIZE: usize = PALETTE_ENTRIES * 3;
@@ -85,3 +92,69 @@ pub struct GraphicsMode {
     /// to local memory space to draw graphics to the screen
     pub framebuffer: u32,
 }
+
+/// Maximum number of rects that can be submitted in a single TGFXDAMAGE call
+pub const MAX_DAMAGE_RECTS: usize = 16;
+
+// DAMAGE RECT: a region of the graphics surface, in surface pixels
+#[repr(C, packed)]
+#[derive(Clone, Copy)]
+pub struct DamageRect {
+    pub x: u16,
+    pub y: u16,
+    pub width: u16,
+    pub height: u16,
+}
+
+// SURFACE DAMAGE: argument to TGFXDAMAGE
+#[repr(C, packed)]
+pub struct SurfaceDamage {
+    /// value returned by the ioctl once the damage has been composited. The
+    /// top bit is reserved for errors and will be cleared.
+    pub fence: u32,
+    /// number of valid entries in `rects`. Zero marks the whole surface.
+    pub rect_count: u32,
+    pub rects: [DamageRect; MAX_DAMAGE_RECTS],
+}
+
+impl SurfaceDamage {
+    pub const fn new(fence: u32) -> Self {
+        Self {
+            fence,
+            rect_count: 0,
+            rects: [DamageRect {
+                x: 0,
+                y: 0,
+                width: 0,
+                height: 0,
+            }; MAX_DAMAGE_RECTS],
+        }
+    }
+
+    /// Add a rect to the damage list. If the list is already full, the last
+    /// entry grows to cover the new rect as well.
+    pub fn push(&mut self, x: u16, y: u16, width: u16, height: u16) {
+        let count = self.rect_count as usize;
+        if count < MAX_DAMAGE_RECTS {
+            self.rects[count] = DamageRect {
+                x,
+                y,
+                width,
+                height,
+            };
+            self.rect_count += 1;
+            return;
+        }
+        let last = self.rects[MAX_DAMAGE_RECTS - 1];
+        let x1 = last.x.min(x);
+        let y1 = last.y.min(y);
+        let x2 = last.x.saturating_add(last.width).max(x.saturating_add(width));
+        let y2 = last.y.saturating_add(last.height).max(y.saturating_add(height));
+        self.rects[MAX_DAMAGE_RECTS - 1] = DamageRect {
+            x: x1,
+            y: y1,
+            width: x2 - x1,
+            height: y2 - y1,
+        };
+    }
+}
@@ -3,5 +3,6 @@
 pub mod compat;
 pub mod io;
 pub mod ipc;
+pub mod stats;
 pub mod syscall;
 pub mod time;
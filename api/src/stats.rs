@@ -0,0 +1,141 @@
+//! Layouts of the kernel's diagnostic files in sysfs.
+//!
+//! `SYS:\EVENTS.BIN` holds the kernel's event counters. It is an
+//! `EventsHeader` followed by `cpu_count` `CpuEvents` records, one per CPU in
+//! order of CPU index. Every counter is a free-running u32 that wraps around,
+//! so rates should be computed from the difference between two reads. The
+//! same numbers are available as text in `SYS:\EVENTS`.
+//!
+//! `SYS:\PROFILE` holds samples from the sampling profiler; see
+//! `ProfileHeader`.
+//!
+//! `SYS:\LATENCY` is a text listing of the latency histograms kept for each
+//! syscall number, IRQ line and driver.
+
+/// Bumped whenever the layout of `EventsHeader` or `CpuEvents` changes
+pub const EVENTS_VERSION: u32 = 1;
+
+/// Syscalls are counted by number. Numbers past the end of the table, like
+/// the 0xffff debug call, share the last bucket.
+pub const SYSCALL_BUCKETS: usize = 0x80;
+
+/// IRQ lines on the pair of PICs
+pub const IRQ_LINES: usize = 16;
+
+/// I/O is counted by driver ID. DEV is driver 0, and drivers with IDs past the
+/// end of the table share the last slot.
+pub const DRIVER_SLOTS: usize = 32;
+
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct EventsHeader {
+    pub version: u32,
+    pub cpu_count: u32,
+    /// Size of each `CpuEvents` record, so that readers built against an
+    /// older layout can still step over them
+    pub cpu_record_size: u32,
+    /// Kernel heap, in bytes
+    pub heap_size: u32,
+    pub heap_in_use: u32,
+    pub heap_allocations: u32,
+    pub heap_frees: u32,
+    /// Scratch pages mapped for editing another address space
+    pub scratch_maps: u32,
+    /// Times a scratch page slot was found taken by another user
+    pub scratch_contended: u32,
+}
+
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct CpuEvents {
+    pub context_switches: u32,
+    /// Faults on user-space addresses, whether paged in or fatal
+    pub page_faults: u32,
+    /// Timer IPIs received from the BSP
+    pub ipis: u32,
+    pub syscalls: [u32; SYSCALL_BUCKETS],
+    pub irqs: [u32; IRQ_LINES],
+    pub driver_reads: [u32; DRIVER_SLOTS],
+    pub driver_writes: [u32; DRIVER_SLOTS],
+    /// Bytes asked for by reads and writes, not necessarily transferred
+    pub driver_read_bytes: [u32; DRIVER_SLOTS],
+    pub driver_write_bytes: [u32; DRIVER_SLOTS],
+}
+
+impl CpuEvents {
+    pub const fn empty() -> Self {
+        Self {
+            context_switches: 0,
+            page_faults: 0,
+            ipis: 0,
+            syscalls: [0; SYSCALL_BUCKETS],
+            irqs: [0; IRQ_LINES],
+            driver_reads: [0; DRIVER_SLOTS],
+            driver_writes: [0; DRIVER_SLOTS],
+            driver_read_bytes: [0; DRIVER_SLOTS],
+            driver_write_bytes: [0; DRIVER_SLOTS],
+        }
+    }
+}
+
+/// Bumped whenever the layout of `SYS:\PROFILE` changes
+pub const PROFILE_VERSION: u32 = 1;
+
+/// Start the sampling profiler. The argument is how many timer ticks to wait
+/// between samples on each CPU, where 0 and 1 both mean every tick. Starting
+/// again while running discards any samples not yet read.
+/// Linux style, where the top bits are a magic number (0x50 for 'P'rofile).
+pub const PROFILE_IOCTL_START: u32 = 0x5001;
+/// Stop the sampling profiler. Samples already taken can still be read.
+pub const PROFILE_IOCTL_STOP: u32 = 0x5002;
+
+/// The sample interrupted ring 3 or VM86 code, rather than the kernel
+pub const SAMPLE_USER: u8 = 1;
+/// The sample interrupted VM86 code, so `eip` is relative to `cs * 16`
+pub const SAMPLE_VM86: u8 = 2;
+
+/// Longest task filename kept in a `ProfileTask`; longer names are cut short
+pub const PROFILE_NAME_LEN: usize = 60;
+
+/// Opening `SYS:\PROFILE` takes every sample collected since it was last
+/// opened. The file is a `ProfileHeader`, then `sample_count` samples, then a
+/// `ProfileTask` for each task that appears in them and still existed when
+/// the file was opened.
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct ProfileHeader {
+    pub version: u32,
+    pub sample_count: u32,
+    pub task_count: u32,
+    /// Samples lost because a CPU's ring was full or busy being read
+    pub dropped: u32,
+    /// Time between samples on each CPU
+    pub interval_ms: u32,
+}
+
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct ProfileSample {
+    pub eip: u32,
+    pub task: u32,
+    pub cs: u16,
+    pub cpu: u8,
+    pub flags: u8,
+}
+
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct ProfileTask {
+    pub id: u32,
+    /// The task's filename, padded with zeros
+    pub name: [u8; PROFILE_NAME_LEN],
+}
+
+/// Latency histograms have one bucket per power of two: bucket `n` counts
+/// events that took from `2^n` up to `2^(n+1) - 1` TSC cycles, and the last
+/// bucket also takes anything longer.
+pub const LATENCY_BUCKETS: usize = 32;
+
+/// Clear every latency histogram. Sent to `SYS:\LATENCY`, with the magic
+/// number 0x4c for 'L'atency.
+pub const LATENCY_IOCTL_RESET: u32 = 0x4c01;
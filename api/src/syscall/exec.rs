@@ -31,10 +31,106 @@ pub fn load_executable(task_id: u32, path: &str) -> bool {
     result != 0xffff_ffff
 }
 
+/// `spawn` gives the child a copy of a handle; the caller keeps its own
+pub const SPAWN_DUP: u32 = 1;
+/// `spawn` moves a handle to the child
+pub const SPAWN_TRANSFER: u32 = 2;
+/// `spawn` closes one of the caller's handles once the child is running
+pub const SPAWN_CLOSE: u32 = 3;
+/// `spawn` opens a path and gives the resulting handle to the child
+pub const SPAWN_OPEN: u32 = 4;
+
+/// One handle action for `spawn`. Every action except a close hands the
+/// child a handle, numbered from 0 in the order the actions are listed, so
+/// the first two usually become its stdin and stdout.
+#[repr(C)]
+pub struct SpawnAction {
+    pub kind: u32,
+    pub handle: u32,
+    pub path_ptr: u32,
+    pub path_len: u32,
+    pub flags: u32,
+}
+
+impl SpawnAction {
+    pub fn dup(handle: Handle) -> Self {
+        Self::for_handle(SPAWN_DUP, handle)
+    }
+
+    pub fn transfer(handle: Handle) -> Self {
+        Self::for_handle(SPAWN_TRANSFER, handle)
+    }
+
+    pub fn close(handle: Handle) -> Self {
+        Self::for_handle(SPAWN_CLOSE, handle)
+    }
+
+    /// Open `path` with the given open flags for the child. The path is
+    /// only borrowed, so it has to outlive the `spawn` call.
+    pub fn open(path: &str, flags: u32) -> Self {
+        Self {
+            kind: SPAWN_OPEN,
+            handle: 0,
+            path_ptr: path.as_ptr() as u32,
+            path_len: path.len() as u32,
+            flags,
+        }
+    }
+
+    fn for_handle(kind: u32, handle: Handle) -> Self {
+        Self {
+            kind,
+            handle: handle.as_u32(),
+            path_ptr: 0,
+            path_len: 0,
+            flags: 0,
+        }
+    }
+}
+
+#[repr(C)]
+pub struct SpawnRequest {
+    pub path_ptr: u32,
+    pub path_len: u32,
+    pub args_ptr: u32,
+    pub args_len: u32,
+    pub actions_ptr: u32,
+    pub action_count: u32,
+}
+
+/// Create a task, give it args and handles, and load the executable at
+/// `path` into it, all in one call. `args` is in the format `add_args`
+/// takes. Nothing the caller can see changes unless the whole spawn
+/// succeeds: transferred and closed handles are only let go of once the
+/// child has been loaded. Returns the handle to the child and its task ID.
+pub fn spawn(path: &str, args: &[u8], actions: &[SpawnAction]) -> Result<(Handle, u32), ()> {
+    let request = SpawnRequest {
+        path_ptr: path.as_ptr() as u32,
+        path_len: path.len() as u32,
+        args_ptr: args.as_ptr() as u32,
+        args_len: args.len() as u32,
+        actions_ptr: actions.as_ptr() as u32,
+        action_count: actions.len() as u32,
+    };
+    let (handle, task_id) = super::syscall_2(0x0d, &request as *const SpawnRequest as u32, 0, 0);
+    if handle == 0xffff_ffff {
+        Err(())
+    } else {
+        Ok((Handle::new(handle), task_id))
+    }
+}
+
 pub fn enter_8086(regs: &mut VMRegisters, flags: u32) -> u32 {
     super::syscall(0x07, regs as *mut VMRegisters as u32, flags, 0)
 }
 
+/// Choose which software interrupts from v86 code are dispatched straight to
+/// the program's own IVT handlers. All other INT instructions return from
+/// enter_8086 so they can be emulated.
+pub fn set_vm86_reflected_ints(reflected: &crate::compat::VM86ReflectedInts) {
+    super::syscall(0x0c, reflected as *const crate::compat::VM86ReflectedInts as u32, 0, 0);
+}
+
 pub fn enter_protected_mode(regs: &mut VMRegisters) -> u32 {
     super::syscall(0x0b, regs as *mut VMRegisters as u32, 0, 0)
 }
@@ -63,8 +63,66 @@ pub fn unmap_memory(address: u32, size: u32) -> Result<(), ()> {
     }
 }
 
+/// Find out which pages of a mapped region have been written to since the
+/// last call, and mark them clean again. Bit N of `bitmap` is set if the Nth
+/// page of the region is dirty, so it needs at least one bit per page.
+/// Returns the number of dirty pages.
+pub fn collect_dirty_pages(address: u32, size: u32, bitmap: &mut [u32]) -> Result<u32, ()> {
+    let page_count = (size + 0xfff) / 0x1000;
+    if (bitmap.len() as u32) * 32 < page_count {
+        return Err(());
+    }
+    let result = syscall(0x33, address, size, bitmap.as_mut_ptr() as u32);
+    if result == 0xffff_ffff {
+        Err(())
+    } else {
+        Ok(result)
+    }
+}
+
+/// Change the access allowed to a range of mapped memory, as PROT_* bits.
+/// The whole range has to be mapped. Pages already present are updated
+/// straight away, and a read-only shared file mapping can't be made
+/// writable.
+pub fn protect_memory(address: u32, size: u32, protection: u32) -> Result<(), ()> {
+    let result = syscall(0x36, address, size, protection);
+    if result == 0xffff_ffff {
+        Err(())
+    } else {
+        Ok(())
+    }
+}
+
+/// Usage hints for `advise_memory`
+pub const MEM_ADVICE_NORMAL: u32 = 0;
+pub const MEM_ADVICE_RANDOM: u32 = 1;
+pub const MEM_ADVICE_SEQUENTIAL: u32 = 2;
+pub const MEM_ADVICE_WILLNEED: u32 = 3;
+pub const MEM_ADVICE_DONTNEED: u32 = 4;
+
+/// Tell the kernel how a mapped region is about to be used. Sequential
+/// access makes page faults in file-backed regions read ahead; will-need
+/// pages the whole range in now.
+pub fn advise_memory(address: u32, size: u32, advice: u32) -> Result<(), ()> {
+    let result = syscall(0x34, address, size, advice);
+    if result == 0xffff_ffff {
+        Err(())
+    } else {
+        Ok(())
+    }
+}
+
 pub const MMAP_SHARED: u32 = 1;
 
+/// Access a task is allowed to a mapping. Pages that can be written or
+/// executed can always be read as well, since 32-bit paging has no way to
+/// say otherwise, and without PAE there is no no-execute bit either, so
+/// PROT_EXEC is recorded but not enforced.
+pub const PROT_NONE: u32 = 0;
+pub const PROT_READ: u32 = 1;
+pub const PROT_WRITE: u32 = 2;
+pub const PROT_EXEC: u32 = 4;
+
 #[repr(C)]
 pub struct FileMapping {
     pub virtual_address: u32,
@@ -73,6 +131,10 @@ pub struct FileMapping {
     pub path_len: u32,
     pub file_offset: u32,
     pub flags: u32,
+    /// Bytes of the mapping that come from the file; the rest is zero-filled
+    pub file_size: u32,
+    /// PROT_* bits. Shared mappings can't be writable.
+    pub protection: u32,
 }
 
 pub fn map_file(
@@ -81,6 +143,25 @@ pub fn map_file(
     path: &str,
     file_offset: u32,
     flags: u32,
+    protection: u32,
+) -> Result<u32, ()> {
+    let whole_pages = (size + 0xfff) & !0xfff;
+    map_file_segment(virtual_address, size, path, file_offset, whole_pages, flags, protection)
+}
+
+/// Map a file the way a loader maps an ELF segment: only the first
+/// `file_size` bytes are read from the file, and everything after them,
+/// including the rest of that page, reads as zero. Pages past the file data
+/// aren't touched until they're used. Shared mappings must keep `file_size`
+/// page-aligned.
+pub fn map_file_segment(
+    virtual_address: Option<u32>,
+    size: u32,
+    path: &str,
+    file_offset: u32,
+    file_size: u32,
+    flags: u32,
+    protection: u32,
 ) -> Result<u32, ()> {
     let path_bytes = path.as_bytes();
     let mapping = FileMapping {
@@ -90,6 +171,8 @@ pub fn map_file(
         path_len: path_bytes.len() as u32,
         file_offset,
         flags,
+        file_size,
+        protection,
     };
 
     let result = syscall(0x31, &mapping as *const FileMapping as u32, 0, 0);
@@ -100,3 +183,46 @@ pub fn map_file(
         Ok(result)
     }
 }
+
+/// One region in a `map_file_segments` call: `size` bytes at
+/// `virtual_address`, the first `file_size` of which come from the file at
+/// `file_offset`, like the arguments to `map_file_segment`
+#[repr(C)]
+pub struct SegmentMapping {
+    pub virtual_address: u32,
+    pub size: u32,
+    pub file_offset: u32,
+    pub file_size: u32,
+    pub flags: u32,
+    pub protection: u32,
+}
+
+#[repr(C)]
+pub struct SegmentMappings {
+    pub path_ptr: u32,
+    pub path_len: u32,
+    pub segments_ptr: u32,
+    pub segment_count: u32,
+}
+
+/// Map any number of regions of one file in a single call, as a loader does
+/// with the segments of an executable. The kernel resolves the path and sets
+/// up the file mapping once for all of them. Each region is placed at
+/// exactly its requested address; if any one can't be, none are mapped.
+pub fn map_file_segments(path: &str, segments: &[SegmentMapping]) -> Result<(), ()> {
+    let path_bytes = path.as_bytes();
+    let mappings = SegmentMappings {
+        path_ptr: path_bytes.as_ptr() as u32,
+        path_len: path_bytes.len() as u32,
+        segments_ptr: segments.as_ptr() as u32,
+        segment_count: segments.len() as u32,
+    };
+
+    let result = syscall(0x35, &mappings as *const SegmentMappings as u32, 0, 0);
+
+    if result == 0xffff_ffff {
+        Err(())
+    } else {
+        Ok(())
+    }
+}
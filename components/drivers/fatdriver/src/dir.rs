@@ -111,6 +111,10 @@ impl DirEntry {
         self.attributes & 0x10 != 0
     }
 
+    pub fn byte_size(&self) -> u32 {
+        self.byte_size
+    }
+
     pub fn set_size(&mut self, size: u32) {
         self.byte_size = size;
     }
@@ -469,7 +473,9 @@ pub enum DirectoryType {
 
 pub struct Directory {
     dir_type: DirectoryType,
-    entries_fetched: bool,
+    /// Entries read from disk the first time the directory is listed
+    listing: Option<Vec<DirEntry>>,
+    /// Null-separated entry names, built from the listing for `read`
     entries: Vec<u8>,
 }
 
@@ -488,7 +494,7 @@ impl Directory {
     pub fn from_dir_entry(dir_entry: DirEntry) -> Self {
         Self {
             dir_type: DirectoryType::Subdir(dir_entry),
-            entries_fetched: false,
+            listing: None,
             entries: Vec::new(),
         }
     }
@@ -496,11 +502,30 @@ impl Directory {
     pub fn from_root_dir(root: RootDirectory) -> Self {
         Self {
             dir_type: DirectoryType::Root(root),
-            entries_fetched: false,
+            listing: None,
             entries: Vec::new(),
         }
     }
 
+    /// The directory's entries, read from disk on first use
+    pub fn listing<D: DiskIO>(
+        &mut self,
+        table: &AllocationTable,
+        disk: &mut DiskAccess<D>,
+    ) -> &[DirEntry] {
+        if self.listing.is_none() {
+            let listing = match &self.dir_type {
+                DirectoryType::Root(root) => root.iter(disk).map(|(entry, _)| entry).collect(),
+                DirectoryType::Subdir(entry) => {
+                    let subdir = SubDirectory::new(entry.first_file_cluster() as u32);
+                    subdir.iter(table, disk).map(|(entry, _)| entry).collect()
+                }
+            };
+            self.listing = Some(listing);
+        }
+        self.listing.as_deref().unwrap()
+    }
+
     pub fn read<D: DiskIO>(
         &mut self,
         buffer: &mut [u8],
@@ -508,26 +533,13 @@ impl Directory {
         table: AllocationTable,
         disk: &mut DiskAccess<D>,
     ) -> u32 {
-        if !self.entries_fetched {
-            match &self.dir_type {
-                DirectoryType::Root(root) => {
-                    for (entry, _offset) in root.iter(disk) {
-                        let name = entry.get_full_name();
-                        self.entries.extend_from_slice(name.as_bytes());
-                        self.entries.push(0);
-                    }
-                    self.entries_fetched = true;
-                }
-                DirectoryType::Subdir(entry) => {
-                    let subdir = SubDirectory::new(entry.first_file_cluster() as u32);
-                    for (dir_entry, _offset) in subdir.iter(&table, disk) {
-                        let name = dir_entry.get_full_name();
-                        self.entries.extend_from_slice(name.as_bytes());
-                        self.entries.push(0);
-                    }
-                    self.entries_fetched = true;
-                }
+        if self.entries.is_empty() {
+            let mut names = Vec::new();
+            for entry in self.listing(&table, disk) {
+                names.extend_from_slice(entry.get_full_name().as_bytes());
+                names.push(0);
             }
+            self.entries = names;
         }
 
         let mut bytes_written = 0;
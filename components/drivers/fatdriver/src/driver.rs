@@ -154,6 +154,48 @@ impl<D: DiskIO> FatDriver<D> {
         Ok(written)
     }
 
+    /// List a directory along with each entry's attributes, starting from the
+    /// entry at `first_index`. `emit` is called with each entry in turn, and
+    /// returns false once the caller has no room for it. Returns the number
+    /// of entries emitted.
+    pub fn read_dir<F>(&mut self, file_ref: u32, first_index: u32, mut emit: F) -> FatResult
+    where
+        F: FnMut(&str, &FileStatusInfo) -> bool,
+    {
+        let table = self.get_table();
+        let handle = self
+            .open_handle_map
+            .get_mut(file_ref as usize)
+            .ok_or(FatError::FileHandleInvalid)?;
+        let dir = match &mut handle.handle_entity {
+            Entity::Dir(d) => d,
+            Entity::File(_) => return Err(FatError::InvalidArgument),
+        };
+        let mut fs = self.fs.borrow_mut();
+        let listing = dir.listing(&table, &mut fs.disk);
+        let mut emitted = 0;
+        for entry in listing.iter().skip(first_index as usize) {
+            let info = if entry.is_directory() {
+                FileStatusInfo {
+                    byte_size: 0,
+                    file_type: FileTypeInfo::Dir,
+                    modification_time: entry.get_modification_timestamp(),
+                }
+            } else {
+                FileStatusInfo {
+                    byte_size: entry.byte_size(),
+                    file_type: FileTypeInfo::File,
+                    modification_time: entry.get_modification_timestamp(),
+                }
+            };
+            if !emit(&entry.get_full_name(), &info) {
+                break;
+            }
+            emitted += 1;
+        }
+        Ok(emitted)
+    }
+
     pub fn write(
         &mut self,
         file_ref: u32,
@@ -21,7 +21,7 @@ use fatdriver::driver::{FatDriver, FatError, FileTypeInfo};
 
 use idos_api::io::driver::{AsyncDriver, DriverFileReference, DriverMappingToken};
 use idos_api::io::error::{IoError, IoResult};
-use idos_api::io::file::{FileStatus, FileType};
+use idos_api::io::file::{DirEntryHeader, FileStatus, FileType};
 use idos_api::io::sync::{close_sync, io_sync, open_sync, read_sync, write_sync};
 use idos_api::io::Handle;
 use idos_sdk::log::SysLogger;
@@ -101,6 +101,45 @@ impl AsyncDriver for IdosFatDriver {
             .map_err(fat_error_to_io_error)
     }
 
+    fn read_dir(
+        &mut self,
+        file_ref: DriverFileReference,
+        buffer: &mut [u8],
+        first_index: u32,
+    ) -> IoResult {
+        let mut written = 0;
+        let mut truncated = false;
+        self.inner
+            .read_dir(*file_ref, first_index, |name, info| {
+                let file_type = match info.file_type {
+                    FileTypeInfo::File => FileType::File as u32,
+                    FileTypeInfo::Dir => FileType::Dir as u32,
+                };
+                match DirEntryHeader::write_record(
+                    &mut buffer[written..],
+                    name.as_bytes(),
+                    file_type,
+                    info.byte_size,
+                    info.modification_time,
+                ) {
+                    Some(len) => {
+                        written += len;
+                        true
+                    }
+                    None => {
+                        truncated = true;
+                        false
+                    }
+                }
+            })
+            .map_err(fat_error_to_io_error)?;
+        if truncated && written == 0 {
+            // The next entry doesn't fit in the buffer at all
+            return Err(IoError::InvalidArgument);
+        }
+        Ok(written as u32)
+    }
+
     fn write(
         &mut self,
         file_ref: DriverFileReference,
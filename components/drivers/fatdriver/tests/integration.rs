@@ -201,6 +201,58 @@ fn test_directory_listing() {
     driver.close(dir_ref).unwrap();
 }
 
+#[test]
+fn test_read_dir_with_attributes() {
+    let disk_path = create_test_disk("readdir", 1440);
+
+    mcopy_to_image(&disk_path, b"aaa", "FILE1.TXT");
+    mcopy_to_image(&disk_path, b"bbbbbb", "FILE2.DAT");
+
+    let mut driver = create_driver(&disk_path);
+    driver.mkdir("SUBDIR").unwrap();
+    let dir_ref = driver.open("", 0).unwrap();
+
+    let mut entries = Vec::new();
+    let emitted = driver
+        .read_dir(dir_ref, 0, |name, info| {
+            entries.push((name.to_string(), info.byte_size, matches!(info.file_type, fatdriver::driver::FileTypeInfo::Dir)));
+            true
+        })
+        .unwrap();
+    assert_eq!(emitted as usize, entries.len());
+    assert!(entries.contains(&("FILE1.TXT".to_string(), 3, false)));
+    assert!(entries.contains(&("FILE2.DAT".to_string(), 6, false)));
+    assert!(entries.contains(&("SUBDIR".to_string(), 0, true)));
+
+    // Resuming from an index picks up where the last call stopped
+    let mut first = None;
+    let emitted = driver
+        .read_dir(dir_ref, 0, |name, _| {
+            if first.is_some() {
+                return false;
+            }
+            first = Some(name.to_string());
+            true
+        })
+        .unwrap();
+    assert_eq!(emitted, 1);
+    let mut rest = Vec::new();
+    driver.read_dir(dir_ref, 1, |name, _| {
+        rest.push(name.to_string());
+        true
+    }).unwrap();
+    assert_eq!(rest.len(), entries.len() - 1);
+    assert!(!rest.contains(first.as_ref().unwrap()));
+
+    // The name-only listing still works on the same handle
+    let mut buffer = [0u8; 256];
+    let read = driver.read(dir_ref, &mut buffer, 0).unwrap();
+    let listing = core::str::from_utf8(&buffer[..read as usize]).unwrap();
+    assert!(listing.split('\0').any(|s| s == "SUBDIR"));
+
+    driver.close(dir_ref).unwrap();
+}
+
 #[test]
 fn test_mkdir_and_subdir_operations() {
     let disk_path = create_test_disk("mkdir", 1440);
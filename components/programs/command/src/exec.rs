@@ -9,19 +9,20 @@ use alloc::string::{String, ToString};
 use alloc::vec::Vec;
 
 use idos_api::io::{
-    handle::dup_handle,
-    sync::{close_sync, open_sync, read_sync, share_sync, write_sync},
+    file::{DirEntryRecords, FileType},
+    sync::{close_sync, open_sync, read_dir_sync, read_sync, write_sync},
+    Handle,
 };
 use idos_api::syscall::io::create_file_handle;
 use idos_api::syscall::memory::map_memory;
 use idos_api::time::DateTime;
-use idos_api::{io::file::FileStatus, syscall::exec::create_task};
 use idos_api::{
-    io::{
-        error::IoError, sync::io_sync, FILE_OP_MKDIR, FILE_OP_RENAME, FILE_OP_RMDIR, FILE_OP_STAT,
-        FILE_OP_UNLINK, OPEN_FLAG_CREATE,
-    },
-    syscall::exec::load_executable,
+    io::file::FileStatus,
+    syscall::exec::{spawn, SpawnAction},
+};
+use idos_api::io::{
+    error::IoError, sync::io_sync, FILE_OP_MKDIR, FILE_OP_RENAME, FILE_OP_RMDIR, FILE_OP_STAT,
+    FILE_OP_UNLINK, OPEN_FLAG_CREATE,
 };
 
 static IO_BUFFER: AtomicPtr<u8> = AtomicPtr::new(0xffff_ffff as *mut u8);
@@ -66,7 +67,8 @@ pub fn exec_command_tree(env: &mut Environment, tree: CommandTree) {
                 name.to_ascii_uppercase().as_str(),
                 "CD" | "CHDIR" | "CLS" | "COLOR" | "COPY" | "DEL" | "DIR" | "DRIVES"
                     | "APPEND" | "ECHO" | "ERASE" | "HELP" | "MD" | "MKDIR" | "MOVE"
-                    | "PROMPT" | "RD" | "RMDIR" | "REN" | "RENAME" | "TYPE" | "VER"
+                    | "PROFILE" | "PROMPT" | "RD" | "RMDIR" | "REN" | "RENAME" | "TOP"
+                    | "TYPE" | "VER"
             );
 
             // Set up redirect if present
@@ -85,9 +87,11 @@ pub fn exec_command_tree(env: &mut Environment, tree: CommandTree) {
                 "HELP" => help(env),
                 "MD" | "MKDIR" => mkdir_cmd(env, args),
                 "MOVE" => move_cmd(env, args),
+                "PROFILE" => profile(env, args),
                 "PROMPT" => prompt(env, args),
                 "RD" | "RMDIR" => rmdir_cmd(env, args),
                 "REN" | "RENAME" => ren(env, args),
+                "TOP" => top(env, args),
                 "TYPE" => type_file(env, args),
                 "VER" => ver(env),
                 _ => {
@@ -285,6 +289,188 @@ fn drives(env: &mut Environment) {
     let _ = close_sync(handle);
 }
 
+fn profile(env: &mut Environment, args: &Vec<String>) {
+    use idos_api::io::sync::ioctl_sync;
+    use idos_api::stats::{PROFILE_IOCTL_START, PROFILE_IOCTL_STOP};
+
+    let (ioctl, arg) = match args.first().map(|a| a.to_ascii_uppercase()) {
+        Some(a) if a == "ON" => {
+            let interval = match args.get(1) {
+                Some(n) => match n.parse::<u32>() {
+                    Ok(n) => n,
+                    Err(_) => {
+                        env.write(b"Interval must be a number of ticks\n");
+                        return;
+                    }
+                },
+                None => 1,
+            };
+            (PROFILE_IOCTL_START, interval)
+        }
+        Some(a) if a == "OFF" => (PROFILE_IOCTL_STOP, 0),
+        _ => {
+            env.write(b"Usage: PROFILE ON [ticks] | PROFILE OFF\n  Sample every CPU each [ticks] timer ticks\n  Collect samples with COPY SYS:\\PROFILE <file>\n");
+            return;
+        }
+    };
+
+    let handle = create_file_handle();
+    if open_sync(handle, "SYS:\\PROFILE", 0).is_err() {
+        env.write(b"Failed to open profiler\n");
+        return;
+    }
+    if ioctl_sync(handle, ioctl, arg, 0).is_err() {
+        env.write(b"Profiler request failed\n");
+    }
+    let _ = close_sync(handle);
+}
+
+/// One task's counters, as listed in its TASK:\<id> file
+struct TaskUsage {
+    id: u32,
+    name: String,
+    state: String,
+    cpu_ms: u32,
+    faults: u32,
+    read_bytes: u32,
+    write_bytes: u32,
+    pages: u32,
+}
+
+/// Read a small file into memory, for the text files under TASK: and SYS:
+fn read_whole_file(path: &str) -> Option<Vec<u8>> {
+    let handle = create_file_handle();
+    if open_sync(handle, path, 0).is_err() {
+        return None;
+    }
+    let buffer = get_io_buffer();
+    let mut content = Vec::new();
+    loop {
+        let len = match read_sync(handle, buffer, content.len() as u32) {
+            Ok(len) => len as usize,
+            Err(_) => break,
+        };
+        content.extend_from_slice(&buffer[..len]);
+        if len < buffer.len() {
+            break;
+        }
+    }
+    let _ = close_sync(handle);
+    Some(content)
+}
+
+fn read_task_usage() -> Vec<TaskUsage> {
+    let listing = match read_whole_file("TASK:\\") {
+        Some(listing) => listing,
+        None => return Vec::new(),
+    };
+    let mut tasks = Vec::new();
+    for id in listing.split(|&b| b == 0).filter(|id| !id.is_empty()) {
+        let id = match core::str::from_utf8(id).ok().and_then(|id| id.parse::<u32>().ok()) {
+            Some(id) => id,
+            None => continue,
+        };
+        // The task may have exited since the listing was taken
+        let content = match read_whole_file(&alloc::format!("TASK:\\{}", id)) {
+            Some(content) => content,
+            None => continue,
+        };
+        let mut usage = TaskUsage {
+            id,
+            name: String::new(),
+            state: String::new(),
+            cpu_ms: 0,
+            faults: 0,
+            read_bytes: 0,
+            write_bytes: 0,
+            pages: 0,
+        };
+        for line in String::from_utf8_lossy(&content).lines() {
+            let Some((key, value)) = line.split_once(": ") else {
+                continue;
+            };
+            let number = value.split(' ').next().and_then(|n| n.parse::<u32>().ok()).unwrap_or(0);
+            match key {
+                "Name" => usage.name = String::from(value),
+                "State" => usage.state = String::from(value),
+                "User Time" | "Kernel Time" => usage.cpu_ms += number,
+                "Page Faults" => usage.faults = number,
+                "Read Bytes" => usage.read_bytes = number,
+                "Write Bytes" => usage.write_bytes = number,
+                "Resident Pages" => usage.pages = number,
+                _ => (),
+            }
+        }
+        tasks.push(usage);
+    }
+    tasks
+}
+
+/// Sample every task's counters twice, and list the tasks by how much CPU
+/// time they used in between
+fn top(env: &mut Environment, args: &Vec<String>) {
+    use idos_api::syscall::time::{get_monotonic_ms, sleep_ms};
+
+    let seconds = match args.first() {
+        Some(n) => match n.parse::<u32>() {
+            Ok(n) if n > 0 => n,
+            _ => {
+                env.write(b"Usage: TOP [seconds]\n");
+                return;
+            }
+        },
+        None => 1,
+    };
+
+    let before = read_task_usage();
+    let start = get_monotonic_ms();
+    sleep_ms(seconds * 1000);
+    let after = read_task_usage();
+    let elapsed = (get_monotonic_ms() - start).max(1) as u32;
+
+    // Deltas over the interval, for tasks seen both times. Anything started
+    // during the interval is charged from zero.
+    let delta = |now: &TaskUsage, field: fn(&TaskUsage) -> u32| {
+        let then = before.iter().find(|t| t.id == now.id).map(field).unwrap_or(0);
+        field(now).wrapping_sub(then)
+    };
+    let mut rows: Vec<(u32, u32, u32, u32, &TaskUsage)> = after
+        .iter()
+        .map(|t| {
+            (
+                delta(t, |u| u.cpu_ms),
+                delta(t, |u| u.faults),
+                delta(t, |u| u.read_bytes),
+                delta(t, |u| u.write_bytes),
+                t,
+            )
+        })
+        .collect();
+    rows.sort_by(|a, b| b.0.cmp(&a.0).then(a.4.id.cmp(&b.4.id)));
+
+    let mut out = alloc::format!(
+        "Over {} ms:\n{:>5} {:<12} {:<11} {:>6} {:>7} {:>8} {:>8} {:>6}\n",
+        elapsed, "ID", "NAME", "STATE", "CPU%", "FAULTS", "READ KB", "WRITE KB", "PAGES"
+    );
+    for (cpu_ms, faults, read_bytes, write_bytes, task) in rows.iter() {
+        let tenths = cpu_ms * 1000 / elapsed;
+        let name = task.name.rsplit(['\\', ':']).next().unwrap_or(&task.name);
+        out.push_str(&alloc::format!(
+            "{:>5} {:<12.12} {:<11.11} {:>4}.{} {:>7} {:>8} {:>8} {:>6}\n",
+            task.id,
+            name,
+            task.state,
+            tenths / 10,
+            tenths % 10,
+            faults,
+            read_bytes / 1024,
+            write_bytes / 1024,
+            task.pages,
+        ));
+    }
+    env.write(out.as_bytes());
+}
+
 fn ver(env: &mut Environment) {
     env.write(b"\n");
     let handle = create_file_handle();
@@ -501,24 +687,30 @@ struct DirEntry {
     is_dir: bool,
 }
 
-fn dir(env: &mut Environment, args: &Vec<String>) {
-    let file_read_buffer = get_io_buffer();
-
-    let mut output = String::from(
-        " Volume in drive is UNKNOWN\n Volume Serial Number is UNKNOWN\n Directory of ",
-    );
-    output.push_str(env.cwd_string());
-    output.push_str("\n\n");
-    env.write(output.as_bytes());
-
-    let dir_handle = create_file_handle();
-    match open_sync(dir_handle, env.cwd_string(), 0) {
-        Ok(_) => (),
-        Err(_) => {
-            env.write(b"Failed to open directory...\n");
-            return;
+/// List a directory with each entry's attributes in one request per buffer.
+/// Returns None if the filesystem doesn't support it.
+fn list_dir_with_attributes(dir_handle: Handle, buffer: &mut [u8]) -> Option<Vec<DirEntry>> {
+    let mut entries: Vec<DirEntry> = Vec::new();
+    loop {
+        let bytes_read = match read_dir_sync(dir_handle, buffer, entries.len() as u32) {
+            Ok(0) => return Some(entries),
+            Ok(n) => n as usize,
+            Err(_) if entries.is_empty() => return None,
+            Err(_) => return Some(entries),
+        };
+        for (header, name) in DirEntryRecords::new(&buffer[..bytes_read]) {
+            entries.push(DirEntry {
+                name: String::from_utf8_lossy(name).to_string(),
+                size: header.byte_size,
+                mod_timestamp: header.modification_time,
+                is_dir: header.file_type & FileType::Dir as u32 != 0,
+            });
         }
     }
+}
+
+/// List a directory by reading its entry names, then stat each one
+fn list_dir_names(env: &Environment, dir_handle: Handle, file_read_buffer: &mut [u8]) -> Vec<DirEntry> {
     let mut entries: Vec<DirEntry> = Vec::new();
     let mut read_offset = 0;
     loop {
@@ -541,7 +733,6 @@ fn dir(env: &mut Environment, args: &Vec<String>) {
             break;
         }
     }
-    let _ = close_sync(dir_handle);
 
     for entry in entries.iter_mut() {
         let stat_handle = create_file_handle();
@@ -560,12 +751,38 @@ fn dir(env: &mut Environment, args: &Vec<String>) {
                 );
                 entry.size = file_status.byte_size;
                 entry.mod_timestamp = file_status.modification_time;
-                entry.is_dir = file_status.file_type & 2 != 0;
+                entry.is_dir = file_status.file_type & FileType::Dir as u32 != 0;
                 let _ = close_sync(stat_handle);
             }
             Err(_) => {}
         }
     }
+    entries
+}
+
+fn dir(env: &mut Environment, args: &Vec<String>) {
+    let file_read_buffer = get_io_buffer();
+
+    let mut output = String::from(
+        " Volume in drive is UNKNOWN\n Volume Serial Number is UNKNOWN\n Directory of ",
+    );
+    output.push_str(env.cwd_string());
+    output.push_str("\n\n");
+    env.write(output.as_bytes());
+
+    let dir_handle = create_file_handle();
+    match open_sync(dir_handle, env.cwd_string(), 0) {
+        Ok(_) => (),
+        Err(_) => {
+            env.write(b"Failed to open directory...\n");
+            return;
+        }
+    }
+    let entries = match list_dir_with_attributes(dir_handle, file_read_buffer) {
+        Some(entries) => entries,
+        None => list_dir_names(env, dir_handle, file_read_buffer),
+    };
+    let _ = close_sync(dir_handle);
 
     for entry in entries.iter() {
         let mut row = String::from("");
@@ -620,9 +837,11 @@ ECHO [text]           Display a message
 HELP                  Show this help
 MKDIR/MD <dir>        Create a directory
 MOVE <src> <dest>     Move a file (works across drives)
+PROFILE ON [n]/OFF    Start or stop the sampling profiler
 PROMPT [format]       Change the command prompt
 REN/RENAME <old> <new>  Rename a file or directory
 RMDIR/RD <dir>        Remove an empty directory
+TOP [seconds]         Show which tasks use the most CPU
 TYPE <file>           Display file contents
 VER                   Display version info
 ");
@@ -970,15 +1189,6 @@ fn set_console_title(env: &Environment, title: &[u8]) {
 }
 
 fn try_exec(env: &Environment, exec_path: &str, args: &Vec<String>) -> bool {
-    let exec_handle = create_file_handle();
-    match open_sync(exec_handle, exec_path, 0) {
-        Ok(_) => {
-            let _ = close_sync(exec_handle);
-        }
-        Err(_) => return false,
-    }
-    let (child_handle, child_id) = create_task();
-
     // Build arg structure: argv[0] = program path, then any additional args
     // Format: [u16 len][bytes][u16 len][bytes]...
     let arg_structure_size: usize =
@@ -998,27 +1208,15 @@ fn try_exec(env: &Environment, exec_path: &str, args: &Vec<String>) -> bool {
         arg_structure_buffer.push(len_high);
         arg_structure_buffer.extend_from_slice(arg.as_bytes());
     }
-    idos_api::syscall::exec::add_args(
-        child_id,
-        arg_structure_buffer.as_ptr(),
-        arg_structure_size as u32,
-    );
-
-    let stdin_dup = dup_handle(env.stdin).unwrap();
-    let stdout_dup = dup_handle(env.stdout).unwrap();
-
-    // Share handles BEFORE load_executable, because load_executable makes
-    // the child runnable immediately. If we share after, the child may start
-    // running before its stdin/stdout handles exist (race condition).
-    share_sync(stdin_dup, child_id).unwrap();
-    share_sync(stdout_dup, child_id).unwrap();
 
-    if !load_executable(child_id, exec_path) {
-        // exec failed — clean up the handles we created
-        // TODO: the shares already completed, would need to revoke them
-        let _ = close_sync(child_handle);
-        return false;
-    }
+    // The child gets copies of our stdin and stdout as its handles 0 and 1.
+    // The kernel hands them over before the child can run, and fails the
+    // whole spawn if the program can't be loaded.
+    let actions = [SpawnAction::dup(env.stdin), SpawnAction::dup(env.stdout)];
+    let child_handle = match spawn(exec_path, &arg_structure_buffer, &actions) {
+        Ok((handle, _child_id)) => handle,
+        Err(()) => return false,
+    };
 
     set_console_title(env, exec_path.as_bytes());
     let _ = read_sync(child_handle, &mut [0u8], 0);
@@ -33,6 +33,7 @@ pub(crate) fn bios_keyboard(regs: &mut VMRegisters) {
                 return;
             }
             // Block on stdin (console), which supports blocking reads.
+            super::graphics::flush_graphics_buffer();
             let stdin = Handle::new(0);
             loop {
                 let mut buf = [0u8; 1];
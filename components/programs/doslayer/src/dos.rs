@@ -5,6 +5,7 @@
 //! tracking, and path resolution.
 
 use crate::dpmi::DPMI_ACTIVE;
+use crate::filebuf;
 use crate::memory::{dos_arena_alloc, dos_arena_free, dos_arena_largest, dos_arena_resize};
 
 use idos_api::{
@@ -30,7 +31,7 @@ pub(crate) const DOS_MEM_TOP: u32 = 0xA000_0;
 /// Top of memory as a segment
 pub(crate) const DOS_MEM_TOP_SEGMENT: u16 = (DOS_MEM_TOP / 16) as u16;
 
-const MAX_DOS_FILES: usize = 20;
+const MAX_DOS_FILES: usize = filebuf::FILE_BUFFER_SLOTS;
 /// Flag: this descriptor refers to a character device (stdin/stdout/etc.)
 const FD_DEVICE: u8 = 0x80;
 /// Flag: this descriptor is currently open
@@ -353,6 +354,7 @@ fn read_stdin_with_echo(regs: &mut VMRegisters) {
 
     let mut buffer: [u8; 1] = [0; 1];
 
+    super::graphics::flush_graphics_buffer();
     match read_sync(stdin, &mut buffer, 0) {
         Ok(len) if len == 1 => {
             let _ = write_sync(stdout, &mut buffer, 0);
@@ -591,6 +593,7 @@ fn dos_open_common(regs: &mut VMRegisters, create: bool) {
     let flags = if create { OPEN_FLAG_CREATE } else { 0 };
     match open_sync(idos_handle, path_str, flags) {
         Ok(_) => {
+            filebuf::reset(dos_fd as usize);
             unsafe {
                 DOS_FDS[dos_fd as usize] = DosFileDescriptor {
                     handle: idos_handle,
@@ -629,13 +632,22 @@ fn close_file(regs: &mut VMRegisters) {
     let dos_handle = (regs.ebx & 0xffff) as u16;
     match get_dos_fd(dos_handle) {
         Some(fd) => {
+            let mut flushed = Ok(0);
             if !fd.is_device() {
+                flushed = filebuf::flush(dos_handle as usize, fd.handle);
+                filebuf::reset(dos_handle as usize);
                 let _ = close_sync(fd.handle);
             }
             unsafe {
                 DOS_FDS[dos_handle as usize].flags = 0;
             }
-            regs.eflags &= !1;
+            if flushed.is_err() {
+                // The handle is closed either way, but deferred writes failed
+                regs.eflags |= 1;
+                regs.set_ax(0x05); // access denied
+            } else {
+                regs.eflags &= !1;
+            }
         }
         None => {
             regs.eflags |= 1;
@@ -661,12 +673,18 @@ fn read_file(regs: &mut VMRegisters) {
     // canonical mode so the console buffers a full line.
     let is_stdin = dos_handle == 0;
     if is_stdin {
+        super::graphics::flush_graphics_buffer();
         super::set_stdin_canonical(true);
     }
 
     match get_dos_fd_mut(dos_handle) {
         Some(fd) => {
-            match read_sync(fd.handle, buffer, fd.cursor) {
+            let result = if fd.is_device() {
+                read_sync(fd.handle, buffer, fd.cursor)
+            } else {
+                filebuf::read(dos_handle as usize, fd.handle, fd.cursor, buffer)
+            };
+            match result {
                 Ok(bytes_read) => {
                     if !fd.is_device() {
                         fd.cursor += bytes_read;
@@ -706,7 +724,12 @@ fn write_file(regs: &mut VMRegisters) {
 
     match get_dos_fd_mut(dos_handle) {
         Some(fd) => {
-            match write_sync(fd.handle, buffer, fd.cursor) {
+            let result = if fd.is_device() {
+                write_sync(fd.handle, buffer, fd.cursor)
+            } else {
+                filebuf::write(dos_handle as usize, fd.handle, fd.cursor, buffer)
+            };
+            match result {
                 Ok(bytes_written) => {
                     if !fd.is_device() {
                         fd.cursor += bytes_written;
@@ -745,6 +768,14 @@ fn seek_file(regs: &mut VMRegisters) {
                 return;
             }
 
+            // Pending writes land before the cursor moves, and may extend
+            // the file size used by SEEK_END
+            if filebuf::flush(dos_handle as usize, fd.handle).is_err() {
+                regs.eflags |= 1;
+                regs.set_ax(0x05); // access denied
+                return;
+            }
+
             let new_pos: i64 = match origin {
                 0 => offset as i64,                    // SEEK_SET
                 1 => fd.cursor as i64 + offset as i64, // SEEK_CUR
@@ -968,7 +999,37 @@ fn get_global_code_page(regs: &mut VMRegisters) {
 
 /// AH=0x68 - Commit/flush file
 /// Input: BX=handle
+/// Output: CF=0 on success, CF=1 AX=error on failure
 fn commit_file(regs: &mut VMRegisters) {
-    // Stub: always succeed
-    regs.eflags &= !1;
+    let dos_handle = (regs.ebx & 0xffff) as u16;
+    match get_dos_fd(dos_handle) {
+        Some(fd) if fd.is_device() => {
+            regs.eflags &= !1;
+        }
+        Some(fd) => match filebuf::flush(dos_handle as usize, fd.handle) {
+            Ok(_) => {
+                regs.eflags &= !1;
+            }
+            Err(_) => {
+                regs.eflags |= 1;
+                regs.set_ax(0x05); // access denied
+            }
+        },
+        None => {
+            regs.eflags |= 1;
+            regs.set_ax(0x06); // invalid handle
+        }
+    }
+}
+
+/// Write out buffered data for every open file. Called before the DOS
+/// program exits, since it may never close its handles.
+pub(crate) fn flush_all_files() {
+    for dos_handle in 0..MAX_DOS_FILES as u16 {
+        if let Some(fd) = get_dos_fd(dos_handle) {
+            if !fd.is_device() {
+                let _ = filebuf::flush(dos_handle as usize, fd.handle);
+            }
+        }
+    }
 }
@@ -13,8 +13,9 @@ use super::{dos_log, exit, fmt_unsupported, handle_interrupt, resolve_ptr};
 use super::{IRET_STUB_OFFSET, IRET_STUB_SEGMENT, VM86_IRQ_MASK};
 use crate::dos::{dos_api, PSP_BASE};
 use crate::memory::{
-    dos_arena_alloc, dos_arena_free, dos_arena_largest, dos_arena_resize, dpmi_high_mem_free,
-    dpmi_high_mem_record,
+    dos_arena_alloc, dos_arena_free, dos_arena_largest, dos_arena_resize, dpmi_high_mem_alloc,
+    dpmi_high_mem_free, dpmi_high_mem_largest, dpmi_high_mem_resize, dpmi_phys_map,
+    dpmi_phys_unmap,
 };
 
 // ---------------------------------------------------------------------------
@@ -568,33 +569,36 @@ fn dpmi_int31(regs: &mut VMRegisters) {
         }
 
         // ---- Memory management (AH=05) ----
+        0x0500 => {
+            // Get free memory information
+            // ES:EDI = pointer to 48-byte buffer
+            // Only the first field (largest available block) is reported,
+            // the rest are marked unavailable with -1
+            let info = resolve_ptr(regs.es, regs.edi) as *mut u32;
+            unsafe {
+                core::ptr::write_volatile(info, dpmi_high_mem_largest());
+                for i in 1..12 {
+                    core::ptr::write_volatile(info.add(i), 0xffff_ffff);
+                }
+            }
+            regs.eflags &= !1;
+        }
+
         0x0501 => {
             // Allocate memory block (above 1 MB)
             // BX:CX = size in bytes
             // Returns: BX:CX = linear address, SI:DI = handle
             let size = ((regs.ebx & 0xffff) << 16) | (regs.ecx & 0xffff);
-            if size == 0 {
-                regs.eflags |= 1;
-                return;
-            }
-            // Round up to page size
-            let alloc_size = (size + 0xFFF) & !0xFFF;
-            match map_memory(None, alloc_size, None) {
-                Ok(addr) => {
-                    // Record in our tracking table
-                    if let Some(handle) = dpmi_high_mem_record(addr, alloc_size) {
-                        regs.ebx = (regs.ebx & 0xffff0000) | ((addr >> 16) & 0xffff);
-                        regs.ecx = (regs.ecx & 0xffff0000) | (addr & 0xffff);
-                        regs.esi = (regs.esi & 0xffff0000) | ((handle >> 16) & 0xffff);
-                        regs.edi = (regs.edi & 0xffff0000) | (handle & 0xffff);
-                        regs.eflags &= !1;
-                    } else {
-                        // Table full, unmap and fail
-                        let _ = idos_api::syscall::memory::unmap_memory(addr, alloc_size);
-                        regs.eflags |= 1;
-                    }
+            match dpmi_high_mem_alloc(size) {
+                Some((addr, handle)) => {
+                    regs.ebx = (regs.ebx & 0xffff0000) | ((addr >> 16) & 0xffff);
+                    regs.ecx = (regs.ecx & 0xffff0000) | (addr & 0xffff);
+                    regs.esi = (regs.esi & 0xffff0000) | ((handle >> 16) & 0xffff);
+                    regs.edi = (regs.edi & 0xffff0000) | (handle & 0xffff);
+                    regs.eflags &= !1;
                 }
-                Err(_) => {
+                None => {
+                    regs.set_ax(0x8013); // physical memory unavailable
                     regs.eflags |= 1;
                 }
             }
@@ -607,6 +611,73 @@ fn dpmi_int31(regs: &mut VMRegisters) {
             if dpmi_high_mem_free(handle) {
                 regs.eflags &= !1;
             } else {
+                regs.set_ax(0x8023); // invalid handle
+                regs.eflags |= 1;
+            }
+        }
+
+        0x0503 => {
+            // Resize memory block
+            // BX:CX = new size in bytes, SI:DI = handle
+            // Returns: BX:CX = new linear address, SI:DI = handle (unchanged)
+            let size = ((regs.ebx & 0xffff) << 16) | (regs.ecx & 0xffff);
+            let handle = ((regs.esi & 0xffff) << 16) | (regs.edi & 0xffff);
+            match dpmi_high_mem_resize(handle, size) {
+                Some(addr) => {
+                    regs.ebx = (regs.ebx & 0xffff0000) | ((addr >> 16) & 0xffff);
+                    regs.ecx = (regs.ecx & 0xffff0000) | (addr & 0xffff);
+                    regs.eflags &= !1;
+                }
+                None => {
+                    regs.set_ax(0x8013); // physical memory unavailable
+                    regs.eflags |= 1;
+                }
+            }
+        }
+
+        // ---- Page locking (AH=06) and paging hints (AH=07) ----
+        // Memory is never paged out to disk, so locking and discarding are
+        // accepted and have no effect.
+        0x0600 | 0x0601 | 0x0602 | 0x0603 | 0x0702 | 0x0703 => {
+            regs.eflags &= !1;
+        }
+
+        0x0604 => {
+            // Get page size
+            // Returns: BX:CX = page size in bytes
+            regs.ebx &= 0xffff0000;
+            regs.ecx = (regs.ecx & 0xffff0000) | 0x1000;
+            regs.eflags &= !1;
+        }
+
+        // ---- Physical address mapping (AH=08) ----
+        0x0800 => {
+            // Map physical address
+            // BX:CX = physical address, SI:DI = size in bytes
+            // Returns: BX:CX = linear address
+            let phys_addr = ((regs.ebx & 0xffff) << 16) | (regs.ecx & 0xffff);
+            let size = ((regs.esi & 0xffff) << 16) | (regs.edi & 0xffff);
+            match dpmi_phys_map(phys_addr, size) {
+                Some(addr) => {
+                    regs.ebx = (regs.ebx & 0xffff0000) | ((addr >> 16) & 0xffff);
+                    regs.ecx = (regs.ecx & 0xffff0000) | (addr & 0xffff);
+                    regs.eflags &= !1;
+                }
+                None => {
+                    regs.set_ax(0x8021); // invalid value
+                    regs.eflags |= 1;
+                }
+            }
+        }
+
+        0x0801 => {
+            // Free physical address mapping
+            // BX:CX = linear address returned by 0x0800
+            let addr = ((regs.ebx & 0xffff) << 16) | (regs.ecx & 0xffff);
+            if dpmi_phys_unmap(addr) {
+                regs.eflags &= !1;
+            } else {
+                regs.set_ax(0x8025); // invalid linear address
                 regs.eflags |= 1;
             }
         }
@@ -0,0 +1,171 @@
+//! Read-ahead and write-behind buffering for DOS file handles.
+//!
+//! DOS programs commonly read and write files in small records (128 or 512
+//! bytes at a time). Passing each of these straight through to the
+//! filesystem driver costs a full round trip per record, so every disk file
+//! handle gets a buffer that serves sequential small transfers from memory.
+//!
+//! The read-ahead window starts small and doubles each time a sequential read
+//! runs off the end of the buffered data, up to FILE_BUFFER_MAX. A read that
+//! isn't sequential resets the window. Transfers at least as large as the
+//! window bypass the buffer entirely.
+//!
+//! Writes accumulate in the buffer while they remain contiguous, and are
+//! written out when the buffer fills, on seek, close, commit (AH=68h), and
+//! when the program exits.
+//!
+//! This is a leaf module: callers pass in the IDOS handle and file offset,
+//! and remain responsible for tracking the cursor.
+
+use idos_api::io::{
+    error::IoResult,
+    sync::{read_sync, write_sync},
+    Handle,
+};
+
+/// Number of buffer slots, one per DOS file handle
+pub(crate) const FILE_BUFFER_SLOTS: usize = 20;
+/// Initial read-ahead window, matching the most common DOS record size
+const FILE_BUFFER_MIN: usize = 512;
+/// Largest read-ahead window, and the capacity of the write-behind buffer
+const FILE_BUFFER_MAX: usize = 8192;
+
+#[derive(Copy, Clone)]
+struct FileBuffer {
+    /// File offset of the first byte in `data`
+    start: u32,
+    /// Number of bytes in `data` that are valid (or pending, when dirty)
+    len: usize,
+    /// When set, `data[..len]` has been written by the program but not yet
+    /// passed to the filesystem
+    dirty: bool,
+    /// Current read-ahead size
+    window: usize,
+    data: [u8; FILE_BUFFER_MAX],
+}
+
+impl FileBuffer {
+    const fn empty() -> Self {
+        Self {
+            start: 0,
+            len: 0,
+            dirty: false,
+            window: FILE_BUFFER_MIN,
+            data: [0; FILE_BUFFER_MAX],
+        }
+    }
+
+    fn end(&self) -> u32 {
+        self.start + self.len as u32
+    }
+}
+
+static mut FILE_BUFFERS: [FileBuffer; FILE_BUFFER_SLOTS] =
+    [FileBuffer::empty(); FILE_BUFFER_SLOTS];
+
+fn get_buffer(slot: usize) -> &'static mut FileBuffer {
+    unsafe { &mut (*core::ptr::addr_of_mut!(FILE_BUFFERS))[slot] }
+}
+
+/// Discard all state for a slot. Call when a handle is opened or closed,
+/// after any pending writes have been flushed.
+pub(crate) fn reset(slot: usize) {
+    let buf = get_buffer(slot);
+    buf.start = 0;
+    buf.len = 0;
+    buf.dirty = false;
+    buf.window = FILE_BUFFER_MIN;
+}
+
+/// Write out any pending data for a slot. Buffered reads stay valid.
+pub(crate) fn flush(slot: usize, handle: Handle) -> IoResult {
+    flush_buffer(get_buffer(slot), handle)
+}
+
+fn flush_buffer(buf: &mut FileBuffer, handle: Handle) -> IoResult {
+    if !buf.dirty {
+        return Ok(0);
+    }
+    buf.dirty = false;
+    let pending = buf.len;
+    // Once written, the data doubles as a valid read cache
+    let result = write_sync(handle, &buf.data[..pending], buf.start);
+    if result.is_err() {
+        buf.len = 0;
+    }
+    result
+}
+
+/// Read into `buffer` from `offset`, serving as much as possible from the
+/// read-ahead buffer. Returns the number of bytes read, which is short only
+/// at the end of the file.
+pub(crate) fn read(slot: usize, handle: Handle, offset: u32, buffer: &mut [u8]) -> IoResult {
+    let buf = get_buffer(slot);
+    flush_buffer(buf, handle)?;
+
+    let mut copied = 0;
+    if offset >= buf.start && offset < buf.end() {
+        let from = (offset - buf.start) as usize;
+        copied = buffer.len().min(buf.len - from);
+        buffer[..copied].copy_from_slice(&buf.data[from..from + copied]);
+        if copied == buffer.len() {
+            return Ok(copied as u32);
+        }
+    }
+
+    let position = offset + copied as u32;
+    let sequential = buf.len > 0 && position == buf.end();
+    if sequential {
+        buf.window = (buf.window * 2).min(FILE_BUFFER_MAX);
+    } else {
+        buf.window = FILE_BUFFER_MIN;
+    }
+
+    let remaining = buffer.len() - copied;
+    if remaining >= buf.window {
+        // Large reads go straight to the caller's memory
+        buf.len = 0;
+        let direct = read_sync(handle, &mut buffer[copied..], position)?;
+        return Ok(copied as u32 + direct);
+    }
+
+    let window = buf.window;
+    buf.start = position;
+    buf.len = 0;
+    let fetched = match read_sync(handle, &mut buf.data[..window], position) {
+        Ok(fetched) => fetched as usize,
+        // An error after some data was copied is reported as a short read
+        Err(_) if copied > 0 => 0,
+        Err(e) => return Err(e),
+    };
+    buf.len = fetched;
+    let count = remaining.min(fetched);
+    buffer[copied..copied + count].copy_from_slice(&buf.data[..count]);
+    Ok((copied + count) as u32)
+}
+
+/// Write `data` at `offset`. Small contiguous writes are collected in the
+/// buffer, so a failure may only be reported by a later flush.
+pub(crate) fn write(slot: usize, handle: Handle, offset: u32, data: &[u8]) -> IoResult {
+    let buf = get_buffer(slot);
+    if data.is_empty() {
+        // A zero-length write truncates the file, so it can't be deferred
+        flush_buffer(buf, handle)?;
+        buf.len = 0;
+        return write_sync(handle, data, offset);
+    }
+    let appends = buf.dirty && offset == buf.end();
+    if !appends || buf.len + data.len() > FILE_BUFFER_MAX {
+        flush_buffer(buf, handle)?;
+        // Cached read data may overlap the region being written
+        buf.len = 0;
+        if data.len() >= FILE_BUFFER_MAX {
+            return write_sync(handle, data, offset);
+        }
+        buf.start = offset;
+    }
+    buf.data[buf.len..buf.len + data.len()].copy_from_slice(data);
+    buf.len += data.len();
+    buf.dirty = true;
+    Ok(data.len() as u32)
+}
@@ -2,13 +2,26 @@
 //!
 //! Manages the VGA mode state, graphics buffer mapping, palette, and BDA
 //! (BIOS Data Area) updates when the video mode changes.
+//!
+//! The v86 program draws into shadow RAM at 0xA0000. Rather than copying the
+//! whole window into the console's graphics buffer after every interrupt,
+//! syncs are limited to the display refresh rate, and only the pages that
+//! the program has written since the last sync are copied. The console is
+//! told exactly which rows changed through a damage submission, and the next
+//! sync waits until that submission has been composited.
 
 use idos_api::{
     io::{
         sync::ioctl_sync,
-        Handle,
+        termios::{SurfaceDamage, TGFXDAMAGE},
+        AsyncOp, Handle, FILE_OP_IOCTL,
+    },
+    syscall::{
+        exec::futex_wait_u32,
+        io::append_io_op,
+        memory::{collect_dirty_pages, map_memory},
+        time::get_monotonic_ms,
     },
-    syscall::memory::map_memory,
 };
 
 use super::STDIN;
@@ -23,6 +36,24 @@ pub(crate) static mut GFX_BUFFER_VADDR: u32 = 0;
 /// Size of the mapped graphics buffer in bytes.
 pub(crate) static mut GFX_BUFFER_SIZE: u32 = 0;
 
+/// Shadow VGA window that v86 programs draw into
+const VGA_WINDOW: u32 = 0xA0000;
+/// Size of the VGA window, in pages
+const VGA_WINDOW_PAGES: u32 = 16;
+/// Minimum time between two syncs, roughly one frame at 60Hz
+const SYNC_INTERVAL_MS: u64 = 16;
+
+/// Timestamp of the last sync
+static mut LAST_SYNC_MS: u64 = 0;
+/// Set when the next sync must copy the whole window, regardless of which
+/// pages have been written
+static mut FULL_SYNC: bool = false;
+/// Damage list handed to the console. It has to stay in place until the
+/// console has read it, so it lives alongside the op that submits it.
+static mut DAMAGE: SurfaceDamage = SurfaceDamage::new(0);
+/// The most recent damage submission, if any
+static mut DAMAGE_OP: Option<AsyncOp> = None;
+
 /// VGA palette: 256 entries of (R, G, B), used for INT 10h AH=10h palette ops.
 /// Initialized to the standard VGA 256-color palette.
 pub(crate) static mut VGA_PALETTE: [u8; 768] = [0; 768];
@@ -35,6 +66,9 @@ pub(crate) fn init() {
         GFX_BUFFER_VADDR = 0;
         GFX_BUFFER_SIZE = 0;
         VGA_PALETTE = [0; 768];
+        LAST_SYNC_MS = 0;
+        FULL_SYNC = false;
+        DAMAGE_OP = None;
     }
 }
 
@@ -77,6 +111,7 @@ pub(crate) fn enter_graphics_mode(width: u16, height: u16, bpp: u8) {
         GFX_BUFFER_PADDR = paddr;
         GFX_BUFFER_VADDR = vaddr;
         GFX_BUFFER_SIZE = pixel_bytes;
+        FULL_SYNC = true;
     }
 
     // Read the kernel's default palette into our local copy
@@ -97,25 +132,99 @@ pub(crate) fn exit_graphics_mode() {
     }
 }
 
-/// Copy the shadow VGA framebuffer at 0xA0000 into the IDOS graphics buffer
-/// and mark it dirty so the compositor redraws.
+/// Copy recent changes to the shadow VGA framebuffer at 0xA0000 into the
+/// IDOS graphics buffer. This is called frequently, so it does nothing if
+/// the last sync was less than a frame ago, or if the console has not yet
+/// composited the previous one.
 pub(crate) fn sync_graphics_buffer() {
+    unsafe {
+        if core::ptr::read_volatile(&GFX_BUFFER_VADDR) == 0 {
+            return;
+        }
+        if let Some(op) = (*core::ptr::addr_of!(DAMAGE_OP)).as_ref() {
+            if !op.is_complete() {
+                return;
+            }
+        }
+        let now = get_monotonic_ms();
+        if now.wrapping_sub(LAST_SYNC_MS) < SYNC_INTERVAL_MS {
+            return;
+        }
+    }
+    flush_graphics_buffer();
+}
+
+/// Immediately copy every page of the shadow VGA framebuffer that has been
+/// written since the last sync, and submit the changed rows as damage.
+/// Used before blocking, so the screen is current while the program waits.
+pub(crate) fn flush_graphics_buffer() {
     unsafe {
         let vaddr = core::ptr::read_volatile(&GFX_BUFFER_VADDR);
         let size = core::ptr::read_volatile(&GFX_BUFFER_SIZE);
         if vaddr == 0 || size == 0 {
             return;
         }
-        let src = 0xA0000 as *const u8;
-        let dst = (vaddr + 8) as *mut u8;
-        core::ptr::copy_nonoverlapping(src, dst, size as usize);
-
-        // Write dirty rect header: full screen
-        let header = vaddr as *mut u16;
-        core::ptr::write_volatile(header, 0); // x
-        core::ptr::write_volatile(header.add(1), 0); // y
-        core::ptr::write_volatile(header.add(2), 0xFFFF); // w (full)
-        core::ptr::write_volatile(header.add(3), 0xFFFF); // h (full)
+        LAST_SYNC_MS = get_monotonic_ms();
+
+        let mut dirty: [u32; 1] = [0];
+        let full = FULL_SYNC
+            || collect_dirty_pages(VGA_WINDOW, VGA_WINDOW_PAGES * 0x1000, &mut dirty).is_err();
+        if full {
+            // Dirty bits from before the full copy are irrelevant
+            let _ = collect_dirty_pages(VGA_WINDOW, VGA_WINDOW_PAGES * 0x1000, &mut dirty);
+            dirty[0] = (1 << VGA_WINDOW_PAGES) - 1;
+            FULL_SYNC = false;
+        }
+        if dirty[0] == 0 {
+            return;
+        }
+
+        // The console may still be reading the previous damage list. This
+        // is at most one frame, and only happens when flushing before a
+        // blocking call.
+        if let Some(op) = (*core::ptr::addr_of!(DAMAGE_OP)).as_ref() {
+            while !op.is_complete() {
+                futex_wait_u32(&op.signal, 0, None);
+            }
+        }
+
+        let damage = &mut *core::ptr::addr_of_mut!(DAMAGE);
+        *damage = SurfaceDamage::new(damage.fence.wrapping_add(1));
+        let row_bytes = 320;
+        let mut page = 0;
+        while page < VGA_WINDOW_PAGES {
+            if dirty[0] & (1 << page) == 0 {
+                page += 1;
+                continue;
+            }
+            let run_start = page;
+            while page < VGA_WINDOW_PAGES && dirty[0] & (1 << page) != 0 {
+                page += 1;
+            }
+            let start = run_start * 0x1000;
+            let end = (page * 0x1000).min(size);
+            if start >= end {
+                continue;
+            }
+            core::ptr::copy_nonoverlapping(
+                (VGA_WINDOW + start) as *const u8,
+                (vaddr + 8 + start) as *mut u8,
+                (end - start) as usize,
+            );
+            // Pages don't line up with scanlines, so extend the run to
+            // cover every row it touches
+            let first_row = start / row_bytes;
+            let last_row = (end - 1) / row_bytes;
+            damage.push(0, first_row as u16, row_bytes as u16, (last_row - first_row + 1) as u16);
+        }
+
+        let op = (*core::ptr::addr_of_mut!(DAMAGE_OP)).insert(AsyncOp::new(
+            FILE_OP_IOCTL,
+            TGFXDAMAGE,
+            damage as *const SurfaceDamage as u32,
+            core::mem::size_of::<SurfaceDamage>() as u32,
+        ));
+        append_io_op(STDIN, op, None);
     }
 }
 
@@ -16,6 +16,7 @@ extern crate idos_api;
 pub mod bios;
 pub mod dos;
 pub mod dpmi;
+pub mod filebuf;
 pub mod graphics;
 pub mod memory;
 pub mod panic;
@@ -180,6 +181,8 @@ pub(crate) fn set_stdin_canonical(enable: bool) {
 }
 
 pub(crate) fn exit(code: u32) -> ! {
+    dos::flush_all_files();
+
     // exit graphics mode if active
     unsafe {
         if graphics::GFX_BUFFER_PADDR != 0 {
@@ -510,15 +513,29 @@ fn compat_start(mut vm_regs: VMRegisters) -> ! {
     let _ = open_sync(log, "LOG:\\DOSLAYER", 0);
     LOG_HANDLE.store(log.as_u32(), core::sync::atomic::Ordering::Relaxed);
 
+    // Every interrupt we don't emulate goes straight to the program's IVT
+    // handler without leaving v86 mode. Vectors nobody has hooked point at
+    // the IRET stub, which the kernel also handles in place.
+    let mut reflected = idos_api::compat::VM86ReflectedInts::all();
+    for int_num in [0x10, 0x16, 0x21, 0x2f, DPMI_ENTRY_INT] {
+        reflected.clear(int_num);
+    }
+    idos_api::syscall::exec::set_vm86_reflected_ints(&reflected);
+
     loop {
+        // The kernel holds delivery of the IRQs while the virtual IF is clear
         let irq_mask = unsafe {
             if VM86_IF {
-                VM86_IRQ_MASK
+                vm_regs.eflags |= idos_api::compat::VM86_VIF;
             } else {
-                0
+                vm_regs.eflags &= !idos_api::compat::VM86_VIF;
             }
+            VM86_IRQ_MASK
         };
         let exit_reason = idos_api::syscall::exec::enter_8086(&mut vm_regs, irq_mask);
+        unsafe {
+            VM86_IF = vm_regs.eflags & idos_api::compat::VM86_VIF != 0;
+        }
 
         match exit_reason {
             idos_api::compat::VM86_EXIT_GPF => unsafe {
@@ -533,6 +550,9 @@ fn compat_start(mut vm_regs: VMRegisters) -> ! {
                 // Deliver pending virtual interrupts
                 let pending = exit_reason >> 8;
                 deliver_pending_irqs(pending, &mut vm_regs);
+                // Programs that draw without calling any interrupts still
+                // need their frames presented
+                graphics::sync_graphics_buffer();
             }
             _ => break,
         }
@@ -552,7 +572,7 @@ unsafe fn handle_fault(vm_regs: &mut VMRegisters) -> bool {
             // PUSHF — push flags onto the v86 stack
             vm_regs.esp = (vm_regs.esp & 0xffff).wrapping_sub(2);
             let stack_addr = (vm_regs.ss << 4) + (vm_regs.esp & 0xffff);
-            core::ptr::write_volatile(stack_addr as *mut u16, vm_regs.eflags as u16);
+            core::ptr::write_volatile(stack_addr as *mut u16, virtual_flags(vm_regs.eflags));
             vm_regs.eip += 1;
         }
         0x9d => {
@@ -561,6 +581,7 @@ unsafe fn handle_fault(vm_regs: &mut VMRegisters) -> bool {
             let flags = core::ptr::read_volatile(stack_addr as *const u16) as u32;
             // Preserve VM flag and IOPL, update the rest
             vm_regs.eflags = (vm_regs.eflags & 0xFFF20000) | (flags & 0x0000FFFF);
+            VM86_IF = flags & 0x200 != 0;
             vm_regs.esp = (vm_regs.esp & 0xffff).wrapping_add(2);
             vm_regs.eip += 1;
         }
@@ -580,6 +601,7 @@ unsafe fn handle_fault(vm_regs: &mut VMRegisters) -> bool {
             vm_regs.eip = ip;
             vm_regs.cs = cs;
             vm_regs.eflags = (vm_regs.eflags & 0xFFF20000) | (flags & 0x0000FFFF);
+            VM86_IF = flags & 0x200 != 0;
             vm_regs.esp = (vm_regs.esp & 0xffff).wrapping_add(6);
             return true; // don't advance EIP, we set it directly
         }
@@ -682,7 +704,7 @@ fn deliver_pending_irqs(pending: u32, vm_regs: &mut VMRegisters) {
         unsafe {
             vm_regs.esp = (vm_regs.esp & 0xffff).wrapping_sub(2);
             let sp = (vm_regs.ss << 4) + (vm_regs.esp & 0xffff);
-            core::ptr::write_volatile(sp as *mut u16, vm_regs.eflags as u16);
+            core::ptr::write_volatile(sp as *mut u16, virtual_flags(vm_regs.eflags));
 
             vm_regs.esp = (vm_regs.esp & 0xffff).wrapping_sub(2);
             let sp = (vm_regs.ss << 4) + (vm_regs.esp & 0xffff);
@@ -692,8 +714,22 @@ fn deliver_pending_irqs(pending: u32, vm_regs: &mut VMRegisters) {
             let sp = (vm_regs.ss << 4) + (vm_regs.esp & 0xffff);
             core::ptr::write_volatile(sp as *mut u16, vm_regs.eip as u16);
         }
-        // Set CS:IP to the handler
+        // Set CS:IP to the handler. Like a real interrupt, this masks
+        // further IRQs until the handler returns.
         vm_regs.cs = vec_segment;
         vm_regs.eip = vec_offset;
+        unsafe {
+            VM86_IF = false;
+        }
+    }
+}
+
+/// The flags image seen by the v86 program, with IF reflecting the virtual
+/// interrupt flag rather than the real one.
+fn virtual_flags(eflags: u32) -> u16 {
+    let mut flags = eflags & !0x300;
+    if unsafe { VM86_IF } {
+        flags |= 0x200;
     }
+    flags as u16
 }
@@ -16,13 +16,34 @@ static mut DOS_ARENA: [(u16, u16); DOS_ARENA_MAX_BLOCKS] = [(0, 0); DOS_ARENA_MA
 /// Start of free conventional memory (paragraph/segment). Set after program load.
 static mut DOS_ARENA_START: u16 = 0;
 
-// ---- High memory block tracker ----
+// ---- DPMI extended memory ----
 
-/// High memory block tracker for DPMI 0x501/0x502.
+/// Extended memory blocks are carved out of large regions that are reserved
+/// up front with a single map_memory call. Pages are only backed on first
+/// touch, so reserving a region is cheap, and allocating or freeing a block
+/// inside one needs no syscalls at all. Blocks too large for a standard
+/// region get a dedicated region of their own.
+const DPMI_REGION_SIZE: u32 = 0x40_0000;
+const DPMI_MAX_REGIONS: usize = 16;
+/// Ceiling on the linear address space all regions together may reserve.
+/// Within it, regions are limited by the physical memory that is free, read
+/// from SYS:\MEMORY, since reserving is cheap but every page of a block
+/// may get touched. Raise this if DOS programs need more than 1GB.
+const DPMI_LINEAR_LIMIT: u32 = 0x4000_0000;
 /// Each entry: (linear_address, size_bytes). address=0 means free slot.
-const DPMI_HIGH_MEM_MAX: usize = 32;
+static mut DPMI_REGIONS: [(u32, u32); DPMI_MAX_REGIONS] = [(0, 0); DPMI_MAX_REGIONS];
+
+/// High memory block tracker for DPMI 0x501-0x503. A block's handle is its
+/// 1-based index in this table, and stays the same if the block moves.
+/// Each entry: (linear_address, size_bytes). address=0 means free slot.
+const DPMI_HIGH_MEM_MAX: usize = 128;
 static mut DPMI_HIGH_MEM: [(u32, u32); DPMI_HIGH_MEM_MAX] = [(0, 0); DPMI_HIGH_MEM_MAX];
 
+/// Physical address mappings created by DPMI 0x800.
+/// Each entry: (linear_address, size_bytes). address=0 means free slot.
+const DPMI_PHYS_MAP_MAX: usize = 16;
+static mut DPMI_PHYS_MAPS: [(u32, u32); DPMI_PHYS_MAP_MAX] = [(0, 0); DPMI_PHYS_MAP_MAX];
+
 /// Zero out all memory allocator state. Call once at startup.
 pub(crate) fn init() {
     unsafe {
@@ -33,6 +54,12 @@ pub(crate) fn init() {
         for i in 0..DPMI_HIGH_MEM_MAX {
             DPMI_HIGH_MEM[i] = (0, 0);
         }
+        for i in 0..DPMI_MAX_REGIONS {
+            DPMI_REGIONS[i] = (0, 0);
+        }
+        for i in 0..DPMI_PHYS_MAP_MAX {
+            DPMI_PHYS_MAPS[i] = (0, 0);
+        }
     }
 }
 
@@ -204,20 +231,153 @@ pub(crate) fn dos_arena_largest() -> u16 {
     }
 }
 
-/// Record a high-memory allocation. Returns a handle (1-based index) or None.
-pub(crate) fn dpmi_high_mem_record(addr: u32, size: u32) -> Option<u32> {
+/// Find the lowest page-aligned gap of at least `size` bytes within a region,
+/// ignoring the block at index `skip` (used when resizing).
+fn dpmi_region_find_gap(region: (u32, u32), size: u32, skip: usize) -> Option<u32> {
+    let (region_start, region_size) = region;
+    let region_end = region_start + region_size;
     unsafe {
+        // Collect the blocks in this region, sorted by address
+        let mut occupied = [(0u32, 0u32); DPMI_HIGH_MEM_MAX];
+        let mut n = 0;
         for i in 0..DPMI_HIGH_MEM_MAX {
-            if DPMI_HIGH_MEM[i].0 == 0 {
-                DPMI_HIGH_MEM[i] = (addr, size);
-                return Some((i + 1) as u32); // 1-based handle
+            let (addr, blk_size) = DPMI_HIGH_MEM[i];
+            if i == skip || addr < region_start || addr >= region_end {
+                continue;
+            }
+            let mut j = n;
+            while j > 0 && occupied[j - 1].0 > addr {
+                occupied[j] = occupied[j - 1];
+                j -= 1;
+            }
+            occupied[j] = (addr, blk_size);
+            n += 1;
+        }
+        let mut cursor = region_start;
+        for i in 0..n {
+            if cursor + size <= occupied[i].0 {
+                return Some(cursor);
+            }
+            cursor = cursor.max(occupied[i].0 + occupied[i].1);
+        }
+        if cursor + size <= region_end {
+            Some(cursor)
+        } else {
+            None
+        }
+    }
+}
+
+/// Find space for a block of `size` bytes (page-aligned), reserving a new
+/// region if none of the existing ones have room.
+fn dpmi_place_block(size: u32, skip: usize) -> Option<u32> {
+    unsafe {
+        for r in 0..DPMI_MAX_REGIONS {
+            if DPMI_REGIONS[r].0 == 0 {
+                continue;
+            }
+            if let Some(addr) = dpmi_region_find_gap(DPMI_REGIONS[r], size, skip) {
+                return Some(addr);
+            }
+        }
+        let slot = (0..DPMI_MAX_REGIONS).find(|&r| DPMI_REGIONS[r].0 == 0)?;
+        let unreserved = dpmi_unreserved();
+        if size > unreserved {
+            return None;
+        }
+        // Near the end of the budget, the last region shrinks to what's left
+        let region_size = size.max(DPMI_REGION_SIZE.min(unreserved));
+        let base = idos_api::syscall::memory::map_memory(None, region_size, None).ok()?;
+        DPMI_REGIONS[slot] = (base, region_size);
+        Some(base)
+    }
+}
+
+/// Address space that new regions can still reserve: what is left below
+/// the linear limit, but no more than the physical memory currently free
+fn dpmi_unreserved() -> u32 {
+    let reserved: u32 = unsafe { (0..DPMI_MAX_REGIONS).map(|r| DPMI_REGIONS[r].1).sum() };
+    let linear = DPMI_LINEAR_LIMIT.saturating_sub(reserved);
+    match free_physical_memory() {
+        Some(free) => linear.min(free) & !0xfff,
+        None => linear,
+    }
+}
+
+/// Free physical memory in bytes, from the "Free Memory: N KiB" line of
+/// SYS:\MEMORY
+fn free_physical_memory() -> Option<u32> {
+    use idos_api::io::sync::{close_sync, open_sync, read_sync};
+
+    let handle = idos_api::syscall::io::create_file_handle();
+    let mut content = [0u8; 128];
+    let len = match open_sync(handle, "SYS:\\MEMORY", 0) {
+        Ok(_) => read_sync(handle, &mut content, 0).unwrap_or(0) as usize,
+        Err(_) => 0,
+    };
+    let _ = close_sync(handle);
+
+    let content = &content[..len.min(content.len())];
+    let label = b"Free Memory: ";
+    let start = content.windows(label.len()).position(|w| w == label)? + label.len();
+    let mut kib: u32 = 0;
+    let mut digits = 0;
+    for &byte in &content[start..] {
+        if !byte.is_ascii_digit() {
+            break;
+        }
+        kib = kib.saturating_mul(10).saturating_add((byte - b'0') as u32);
+        digits += 1;
+    }
+    if digits == 0 {
+        return None;
+    }
+    Some(kib.saturating_mul(1024))
+}
+
+/// Release any region that no longer holds blocks. One empty standard region
+/// is kept reserved, so a program that repeatedly frees and reallocates its
+/// only block doesn't map and unmap each time.
+fn dpmi_release_empty_regions() {
+    unsafe {
+        let mut kept_spare = false;
+        for r in 0..DPMI_MAX_REGIONS {
+            let (base, size) = DPMI_REGIONS[r];
+            if base == 0 {
+                continue;
+            }
+            let in_use = (0..DPMI_HIGH_MEM_MAX).any(|i| {
+                let addr = DPMI_HIGH_MEM[i].0;
+                addr >= base && addr < base + size
+            });
+            if in_use {
+                continue;
             }
+            if size == DPMI_REGION_SIZE && !kept_spare {
+                kept_spare = true;
+                continue;
+            }
+            let _ = idos_api::syscall::memory::unmap_memory(base, size);
+            DPMI_REGIONS[r] = (0, 0);
         }
-        None
     }
 }
 
-/// Free a high-memory block by handle. Unmaps the memory.
+/// Allocate an extended memory block. Returns (linear_address, handle).
+pub(crate) fn dpmi_high_mem_alloc(size: u32) -> Option<(u32, u32)> {
+    if size == 0 {
+        return None;
+    }
+    let size = (size + 0xfff) & !0xfff;
+    unsafe {
+        let idx = (0..DPMI_HIGH_MEM_MAX).find(|&i| DPMI_HIGH_MEM[i].0 == 0)?;
+        let addr = dpmi_place_block(size, DPMI_HIGH_MEM_MAX)?;
+        DPMI_HIGH_MEM[idx] = (addr, size);
+        Some((addr, (idx + 1) as u32)) // 1-based handle
+    }
+}
+
+/// Free an extended memory block by handle.
 pub(crate) fn dpmi_high_mem_free(handle: u32) -> bool {
     if handle == 0 {
         return false;
@@ -227,9 +387,117 @@ pub(crate) fn dpmi_high_mem_free(handle: u32) -> bool {
         if idx >= DPMI_HIGH_MEM_MAX || DPMI_HIGH_MEM[idx].0 == 0 {
             return false;
         }
-        let (addr, size) = DPMI_HIGH_MEM[idx];
-        let _ = idos_api::syscall::memory::unmap_memory(addr, size);
         DPMI_HIGH_MEM[idx] = (0, 0);
-        true
     }
+    dpmi_release_empty_regions();
+    true
+}
+
+/// Resize an extended memory block. The block grows or shrinks in place when
+/// possible, and otherwise moves, keeping its contents and handle.
+/// Returns the (possibly new) linear address.
+pub(crate) fn dpmi_high_mem_resize(handle: u32, new_size: u32) -> Option<u32> {
+    if handle == 0 || new_size == 0 {
+        return None;
+    }
+    let idx = (handle - 1) as usize;
+    let new_size = (new_size + 0xfff) & !0xfff;
+    unsafe {
+        if idx >= DPMI_HIGH_MEM_MAX || DPMI_HIGH_MEM[idx].0 == 0 {
+            return None;
+        }
+        let (addr, size) = DPMI_HIGH_MEM[idx];
+        if new_size <= size {
+            DPMI_HIGH_MEM[idx].1 = new_size;
+            return Some(addr);
+        }
+        // Grow in place if nothing follows the block within its region
+        let region = (0..DPMI_MAX_REGIONS)
+            .map(|r| DPMI_REGIONS[r])
+            .find(|&(base, region_size)| addr >= base && addr < base + region_size)?;
+        let region_end = region.0 + region.1;
+        let blocked = addr + new_size > region_end
+            || (0..DPMI_HIGH_MEM_MAX).any(|i| {
+                let (other, _) = DPMI_HIGH_MEM[i];
+                i != idx && other >= addr + size && other < addr + new_size
+            });
+        if !blocked {
+            DPMI_HIGH_MEM[idx].1 = new_size;
+            return Some(addr);
+        }
+        let new_addr = dpmi_place_block(new_size, idx)?;
+        core::ptr::copy(addr as *const u8, new_addr as *mut u8, size as usize);
+        DPMI_HIGH_MEM[idx] = (new_addr, new_size);
+    }
+    dpmi_release_empty_regions();
+    unsafe { Some(DPMI_HIGH_MEM[idx].0) }
+}
+
+/// Largest block that can currently be allocated, in bytes: the biggest gap
+/// in an existing region, or while region slots remain, whatever is left of
+/// the address space budget for a new one.
+pub(crate) fn dpmi_high_mem_largest() -> u32 {
+    unsafe {
+        let mut largest = 0;
+        if (0..DPMI_MAX_REGIONS).any(|r| DPMI_REGIONS[r].0 == 0) {
+            largest = dpmi_unreserved();
+        }
+        for r in 0..DPMI_MAX_REGIONS {
+            let (base, size) = DPMI_REGIONS[r];
+            if base == 0 {
+                continue;
+            }
+            // Binary search on the largest gap, in pages
+            let (mut lo, mut hi) = (0u32, size / 0x1000);
+            while lo < hi {
+                let mid = (lo + hi + 1) / 2;
+                if dpmi_region_find_gap((base, size), mid * 0x1000, DPMI_HIGH_MEM_MAX).is_some() {
+                    lo = mid;
+                } else {
+                    hi = mid - 1;
+                }
+            }
+            largest = largest.max(lo * 0x1000);
+        }
+        largest
+    }
+}
+
+/// Map a range of physical memory (DPMI 0x800). Memory below 1MB is already
+/// mapped at its physical address.
+pub(crate) fn dpmi_phys_map(phys_addr: u32, size: u32) -> Option<u32> {
+    if size == 0 {
+        return None;
+    }
+    let end = phys_addr.checked_add(size)?;
+    if end <= 0x10_0000 {
+        return Some(phys_addr);
+    }
+    let page_start = phys_addr & !0xfff;
+    let map_size = ((end - page_start) + 0xfff) & !0xfff;
+    unsafe {
+        let slot = (0..DPMI_PHYS_MAP_MAX).find(|&i| DPMI_PHYS_MAPS[i].0 == 0)?;
+        let base =
+            idos_api::syscall::memory::map_memory(None, map_size, Some(page_start)).ok()?;
+        DPMI_PHYS_MAPS[slot] = (base, map_size);
+        Some(base + (phys_addr & 0xfff))
+    }
+}
+
+/// Unmap a physical address mapping created by dpmi_phys_map (DPMI 0x801).
+pub(crate) fn dpmi_phys_unmap(linear_addr: u32) -> bool {
+    if linear_addr < 0x10_0000 {
+        return true;
+    }
+    let base = linear_addr & !0xfff;
+    unsafe {
+        for i in 0..DPMI_PHYS_MAP_MAX {
+            if DPMI_PHYS_MAPS[i].0 == base {
+                let _ = idos_api::syscall::memory::unmap_memory(base, DPMI_PHYS_MAPS[i].1);
+                DPMI_PHYS_MAPS[i] = (0, 0);
+                return true;
+            }
+        }
+    }
+    false
 }
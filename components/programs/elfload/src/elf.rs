@@ -42,4 +42,6 @@ pub struct ProgramHeader {
 
 pub const ELF_MAGIC: [u8; 4] = [0x7f, 0x45, 0x4c, 0x46];
 pub const SEGMENT_TYPE_LOAD: u32 = 1;
+pub const SEGMENT_FLAG_EXEC: u32 = 1 << 0;
 pub const SEGMENT_FLAG_WRITE: u32 = 1 << 1;
+pub const SEGMENT_FLAG_READ: u32 = 1 << 2;
@@ -8,12 +8,18 @@ mod elf;
 mod panic;
 
 use core::arch::{asm, global_asm};
-use elf::{ElfHeader, ProgramHeader, ELF_MAGIC, SEGMENT_FLAG_WRITE, SEGMENT_TYPE_LOAD};
+use elf::{
+    ElfHeader, ProgramHeader, ELF_MAGIC, SEGMENT_FLAG_EXEC, SEGMENT_FLAG_READ, SEGMENT_FLAG_WRITE,
+    SEGMENT_TYPE_LOAD,
+};
 use idos_api::{
     io::sync::{close_sync, open_sync, read_sync},
     syscall::{
         io::create_file_handle,
-        memory::{map_file, map_memory, MMAP_SHARED},
+        memory::{
+            map_file_segments, map_memory, unmap_memory, SegmentMapping, MMAP_SHARED, PROT_EXEC,
+            PROT_READ, PROT_WRITE,
+        },
     },
 };
 
@@ -31,11 +37,11 @@ struct LoadInfoHeader {
     argc: u32,
     argv_offset: u32,
     argv_total_len: u32,
+    /// Nonzero if the kernel already mapped the executable from its image
+    /// cache, in which case this is the entry point
+    entry_point: u32,
 }
 
-// Maximum number of program headers we support
-const MAX_PROGRAM_HEADERS: usize = 16;
-
 global_asm!(
     r#"
 .global _start
@@ -55,6 +61,11 @@ pub extern "C" fn loader_start(load_info_addr: u32) -> ! {
         idos_api::syscall::exec::terminate(0xff);
     }
 
+    // A cached image is already mapped; only the stack is left to do
+    if header.entry_point != 0 {
+        setup_stack_and_jump(load_info_addr, header, header.entry_point);
+    }
+
     // Extract the executable path
     let exec_path = unsafe {
         let path_ptr = (load_info_addr + header.exec_path_offset) as *const u8;
@@ -86,96 +97,129 @@ pub extern "C" fn loader_start(load_info_addr: u32) -> ! {
 
     let entry_point = elf_header.entry_point;
     let ph_count = elf_header.program_header_count as usize;
-    let ph_size = elf_header.program_header_size as u32;
+    let ph_size = elf_header.program_header_size as usize;
 
-    if ph_count > MAX_PROGRAM_HEADERS {
+    if ph_size < core::mem::size_of::<ProgramHeader>() {
         idos_api::syscall::exec::terminate(0xfb);
     }
 
-    // Read and process program headers
-    let mut ph_offset = elf_header.program_header_offset;
-    for _ in 0..ph_count {
-        let mut ph = ProgramHeader::default();
-        let ph_bytes = unsafe {
-            core::slice::from_raw_parts_mut(
-                &mut ph as *mut ProgramHeader as *mut u8,
-                core::mem::size_of::<ProgramHeader>(),
-            )
-        };
-        if read_sync(file_handle, ph_bytes, ph_offset).is_err() {
-            idos_api::syscall::exec::terminate(0xfa);
-        }
+    // Any number of program headers is fine: the whole table is read in one
+    // go into scratch memory, followed by room for a segment per header
+    let table_size = ph_count * ph_size;
+    let segments_offset = (table_size + 3) & !3;
+    let scratch_size =
+        (segments_offset + ph_count * core::mem::size_of::<SegmentMapping>()).max(1) as u32;
+    let scratch = match map_memory(None, scratch_size, None) {
+        Ok(addr) => addr,
+        Err(_) => idos_api::syscall::exec::terminate(0xfb),
+    };
+    let table = unsafe { core::slice::from_raw_parts_mut(scratch as *mut u8, table_size) };
+    match read_sync(file_handle, table, elf_header.program_header_offset) {
+        Ok(read) if read as usize == table_size => (),
+        _ => idos_api::syscall::exec::terminate(0xfa),
+    }
+    let _ = close_sync(file_handle);
 
+    let segments = unsafe {
+        core::slice::from_raw_parts_mut(
+            (scratch as usize + segments_offset) as *mut SegmentMapping,
+            ph_count,
+        )
+    };
+    let mut segment_count = 0;
+    for i in 0..ph_count {
+        let ph = unsafe {
+            core::ptr::read_unaligned(table[i * ph_size..].as_ptr() as *const ProgramHeader)
+        };
         if ph.segment_type == SEGMENT_TYPE_LOAD {
-            map_load_segment(exec_path_str, &ph);
+            segment_count = add_load_segment(segments, segment_count, &ph);
         }
-
-        ph_offset += ph_size;
     }
 
-    let _ = close_sync(file_handle);
+    // One syscall maps them all
+    if map_file_segments(exec_path_str, &segments[..segment_count]).is_err() {
+        idos_api::syscall::exec::terminate(0xf9);
+    }
+    let _ = unmap_memory(scratch, (scratch_size + 0xfff) & !0xfff);
 
     // Set up the stack with argc/argv and jump to the entry point
     setup_stack_and_jump(load_info_addr, header, entry_point);
 }
 
-/// Map a single PT_LOAD segment from the executable file.
-fn map_load_segment(exec_path: &str, ph: &ProgramHeader) {
+/// Describe a PT_LOAD segment for the batched mapping call, after the
+/// `count` segments already in `segments`. Returns the new count.
+///
+/// The whole segment, BSS included, is one file mapping whose file data ends
+/// at `file_size`. The kernel clears the rest of that last file page when it
+/// is first touched and hands out the remaining BSS pages as demand-zero
+/// memory, so nothing here writes to the segment and large static buffers
+/// cost nothing until they're used.
+fn add_load_segment(segments: &mut [SegmentMapping], count: usize, ph: &ProgramHeader) -> usize {
     let vaddr = ph.virtual_address;
     let file_offset = ph.offset;
     let file_size = ph.file_size;
     let memory_size = ph.memory_size;
     let writable = ph.flags & SEGMENT_FLAG_WRITE != 0;
+    let mut protection = 0;
+    if ph.flags & SEGMENT_FLAG_READ != 0 {
+        protection |= PROT_READ;
+    }
+    if writable {
+        protection |= PROT_WRITE;
+    }
+    if ph.flags & SEGMENT_FLAG_EXEC != 0 {
+        protection |= PROT_EXEC;
+    }
+    let has_bss = memory_size > file_size;
 
     // Page-align everything
     let vaddr_aligned = vaddr & 0xfffff000;
     let file_offset_aligned = file_offset & 0xfffff000;
     let end_addr = (vaddr + memory_size + 0xfff) & 0xfffff000;
-    let file_end_addr = (vaddr + file_size + 0xfff) & 0xfffff000;
-    let mapped_size = file_end_addr - vaddr_aligned;
-
-    // Map the file-backed portion
-    if mapped_size > 0 {
-        let flags = if writable { 0 } else { MMAP_SHARED };
-        if map_file(
-            Some(vaddr_aligned),
-            mapped_size,
-            exec_path,
-            file_offset_aligned,
-            flags,
-        )
-        .is_err()
-        {
-            panic!("map_file failed");
-        }
+    let mapped_size = end_addr - vaddr_aligned;
+    if mapped_size == 0 {
+        return count;
     }
 
-    // If memory_size > file_size, we need to zero-fill BSS.
-    // The last file-backed page may contain a partial page where file data
-    // ends partway through. The tail of that page (BSS portion) must be
-    // explicitly zeroed, since map_file loads the full page from the file.
-    if memory_size > file_size {
-        let bss_vaddr = vaddr + file_size;
-        let bss_page_offset = bss_vaddr & 0xfff;
-        if bss_page_offset != 0 {
-            // Zero from bss_vaddr to end of its page
-            let zero_len = 0x1000 - bss_page_offset;
-            unsafe {
-                core::ptr::write_bytes(bss_vaddr as *mut u8, 0, zero_len as usize);
-            }
-        }
-
-        // Map additional whole pages for remaining BSS and zero them
-        let bss_start = file_end_addr;
-        if end_addr > bss_start {
-            let bss_size = end_addr - bss_start;
-            if let Ok(addr) = map_memory(Some(bss_start), bss_size, None) {
-                unsafe {
-                    core::ptr::write_bytes(addr as *mut u8, 0, bss_size as usize);
-                }
+    // Without BSS the last page is mapped whole, as the file has it. With
+    // BSS, the page where the file data ends gets zeroed past that point,
+    // which needs a private copy even for a read-only segment.
+    let mapped_file_size = if has_bss {
+        vaddr + file_size - vaddr_aligned
+    } else {
+        mapped_size
+    };
+    let flags = if writable || has_bss { 0 } else { MMAP_SHARED };
+
+    // Segments that share a page with the previous one (rodata straight
+    // after code, say) extend its mapping instead, as long as the file lines
+    // up with memory across both. Sharing only survives if both allow it,
+    // and the page gets whatever access either segment needs.
+    if count > 0 {
+        let prev = &mut segments[count - 1];
+        let prev_end = prev.virtual_address + prev.size;
+        if vaddr_aligned < prev_end {
+            let delta = vaddr_aligned - prev.virtual_address;
+            if file_offset_aligned != prev.file_offset + delta {
+                idos_api::syscall::exec::terminate(0xf8);
             }
+            prev.size = prev.size.max(end_addr - prev.virtual_address);
+            prev.file_size = prev.file_size.max(delta + mapped_file_size);
+            prev.flags &= flags;
+            prev.protection |= protection;
+            return count;
         }
     }
+
+    segments[count] = SegmentMapping {
+        virtual_address: vaddr_aligned,
+        size: mapped_size,
+        file_offset: file_offset_aligned,
+        file_size: mapped_file_size,
+        flags,
+        protection,
+    };
+    count + 1
 }
 
 /// Set up argc/argv on the stack and jump to the executable's entry point.
@@ -7,10 +7,22 @@ extern crate idos_sdk;
 use core::sync::atomic::Ordering;
 
 use idos_api::{
-    io::{termios::Termios, AsyncOp, Handle, ASYNC_OP_READ},
+    io::{
+        termios::{SurfaceDamage, Termios, TGFXDAMAGE},
+        AsyncOp, Handle, ASYNC_OP_READ,
+    },
     syscall::{exec::futex_wait_u32, io::append_io_op},
 };
 
+fn submit_damage(handle: Handle, damage: &SurfaceDamage) {
+    let _ = idos_api::io::sync::ioctl_sync(
+        handle,
+        TGFXDAMAGE,
+        damage as *const SurfaceDamage as u32,
+        core::mem::size_of::<SurfaceDamage>() as u32,
+    );
+}
+
 #[no_mangle]
 pub extern "C" fn main() {
     let stdin = Handle::new(0);
@@ -86,20 +98,18 @@ pub extern "C" fn main() {
 
     let framebuffer_ptr = framebuffer_vaddr as *mut u8;
     let full_buffer = unsafe { core::slice::from_raw_parts_mut(framebuffer_ptr, total_size as usize) };
-    // Dirty rect header is bytes 0..8, pixel data starts at byte 8
-    let header = unsafe { core::slice::from_raw_parts_mut(framebuffer_ptr as *mut u16, 4) };
+    // Pixel data starts after the 8-byte header. Damage is submitted with
+    // TGFXDAMAGE instead of the header, so the compositor doesn't poll us.
     let framebuffer = &mut full_buffer[8..];
 
     for byte in framebuffer.iter_mut() {
         *byte = 0x0c;
     }
-    // Signal full dirty rect
-    header[0] = 0;    // x
-    header[1] = 0;    // y
-    header[2] = 200;  // width
-    header[3] = 200;  // height
+    // An empty damage list marks the whole surface
+    let mut frame: u32 = 0;
+    submit_damage(stdin, &SurfaceDamage::new(frame));
 
-    let mut read_buffer: [u8; 1] = [0; 1];
+    let mut read_buffer: [u8; 16] = [0; 16];
     let mut read_op = AsyncOp::new(
         ASYNC_OP_READ,
         &mut read_buffer[0] as *mut u8 as u32,
@@ -116,6 +126,11 @@ pub extern "C" fn main() {
         if read_op.is_complete() {
             let return_value = read_op.return_value.load(Ordering::SeqCst);
             if return_value & 0x80000000 == 0 {
+                // Every pixel drawn for this batch of input is submitted
+                // together, so a frame costs one round trip to the
+                // compositor however many pixels changed
+                frame += 1;
+                let mut damage = SurfaceDamage::new(frame);
                 let mut i = 0;
                 while i < return_value {
                     let byte = read_buffer[i as usize];
@@ -125,13 +140,18 @@ pub extern "C" fn main() {
                     } else {
                         // draw a pixel at a random position
                         framebuffer[pixel_offset] = 0x0f;
+                        let x = (pixel_offset % 200) as u16;
+                        let y = (pixel_offset / 200) as u16;
                         pixel_offset += 10;
-                        // Signal dirty
-                        header[2] = 200;
-                        header[3] = 200;
+                        // Only the new pixel needs to be composited
+                        damage.push(x, y, 1, 1);
                     }
                     i += 1;
                 }
+                // This blocks until the frame has been consumed
+                if damage.rect_count > 0 {
+                    submit_damage(stdin, &damage);
+                }
             }
 
             read_op = AsyncOp::new(
@@ -2,21 +2,25 @@ use crate::task::{
     actions::{handle::open_message_queue, io::read_struct_sync, send_message},
     id::TaskID,
 };
-use alloc::vec::Vec;
+use alloc::collections::VecDeque;
 use idos_api::ipc::Message;
-use spin::RwLock;
+use spin::{Mutex, RwLock};
 
 static CLEANUP_ID: RwLock<TaskID> = RwLock::new(TaskID::new(0));
 
+/// Tasks that have terminated and are waiting to have their resources
+/// reclaimed, in the order they exited.
+static REAP_QUEUE: Mutex<VecDeque<TaskID>> = Mutex::new(VecDeque::new());
+
 /// The cleanup task is a resident that is created by the kernel and runs in the
 /// background. It is responsible for cleaning up the resources of terminated
 /// tasks. This is because a task cannot clean itself it -- cleanup must be done
 /// in a different address space. The cleanup resident is a convenient place to
 /// do this.
-/// It blocks on reading a message queue; whenever a task is terminated, the
-/// kernel wakes the cleanup task by sending it a message. The cleanup task
-/// loops over all tasks, looking for terminated tasks and reclaiming their
-/// resources.
+/// Terminating a task only marks it and queues its ID for reaping, so the exit
+/// path stays short no matter how much memory the task had. The kernel then
+/// wakes the cleanup task with a message, and it drains the queue, reclaiming
+/// each task's resources in turn.
 pub fn cleanup_resident() -> ! {
     let own_id = crate::task::switching::get_current_id();
 
@@ -27,30 +31,33 @@ pub fn cleanup_resident() -> ! {
     crate::kprint!("Cleanup Task ready\n");
 
     let mut incoming_message = Message::empty();
-    let mut terminated: Vec<TaskID> = Vec::new();
 
     loop {
         let _ = read_struct_sync(messages, &mut incoming_message, 0);
 
-        crate::task::map::for_each_task_mutfn(|t| {
-            let task = t.read();
-            if task.is_terminated() {
-                terminated.push(task.id);
-            }
-        });
-
-        while !terminated.is_empty() {
-            if let Some(id) = terminated.pop() {
-                crate::task::switching::clean_up_task(id);
-                // Remove the task from the global map. When the last Arc
-                // reference drops, the Task's Drop impl frees the kernel stack.
-                crate::task::map::take_task(id);
-            }
+        // Wake messages can be coalesced, so keep going until the queue is
+        // empty rather than reaping one task per message. The lock is only
+        // held long enough to pop, since tasks may exit while we work.
+        loop {
+            let next = REAP_QUEUE.lock().pop_front();
+            let Some(id) = next else {
+                break;
+            };
+            crate::task::switching::clean_up_task(id);
+            // Remove the task from the global map. When the last Arc
+            // reference drops, the Task's Drop impl frees the kernel stack.
+            crate::task::map::take_task(id);
         }
     }
 }
 
-pub fn wake_cleanup_resident() {
+/// Queue a terminated task for reaping, and wake the cleanup task
+pub fn queue_for_cleanup(id: TaskID) {
+    REAP_QUEUE.lock().push_back(id);
+    wake_cleanup_resident();
+}
+
+fn wake_cleanup_resident() {
     let id = *(CLEANUP_ID.read());
     send_message(id, Message::empty(), 0xffffffff);
 }
@@ -1,6 +1,10 @@
 use alloc::boxed::Box;
 
-use crate::{memory::address::VirtualAddress, task::switching::get_current_id};
+use crate::{
+    console::graphics::Region,
+    memory::address::VirtualAddress,
+    task::{actions::io::driver_io_complete, switching::get_current_id},
+};
 
 use super::textmode::{Color, ColorCode, TextBuffer, TextCell};
 use alloc::vec::Vec;
@@ -38,6 +42,17 @@ pub struct GraphicsBuffer {
     pub width: u16,
     pub height: u16,
     pub bits_per_pixel: usize,
+
+    /// Damage submitted with TGFXDAMAGE that has not been composited yet, in
+    /// surface coordinates.
+    pub pending_damage: Vec<Region>,
+    /// TGFXDAMAGE requests waiting for the next composite, stored as
+    /// (request id, fence value).
+    pub pending_fences: Vec<(u32, u32)>,
+    /// Set once the client has submitted damage explicitly. From then on the
+    /// compositor is woken by damage requests, and no longer needs to poll
+    /// the dirty rect header.
+    pub explicit_damage: bool,
 }
 
 impl GraphicsBuffer {
@@ -70,6 +85,73 @@ impl GraphicsBuffer {
         let buf = self.get_buffer();
         buf[0..8].fill(0);
     }
+
+    /// Clip a rect to the bounds of the surface. Returns None if nothing is
+    /// left after clipping.
+    fn clip(&self, x: u16, y: u16, width: u16, height: u16) -> Option<Region> {
+        if x >= self.width || y >= self.height {
+            return None;
+        }
+        let width = width.min(self.width - x);
+        let height = height.min(self.height - y);
+        if width == 0 || height == 0 {
+            return None;
+        }
+        Some(Region {
+            x,
+            y,
+            width,
+            height,
+        })
+    }
+
+    /// Queue up a damaged rect submitted by the client.
+    pub fn add_damage(&mut self, x: u16, y: u16, width: u16, height: u16) {
+        if let Some(rect) = self.clip(x, y, width, height) {
+            for existing in self.pending_damage.iter_mut() {
+                if existing.fully_contains(&rect) {
+                    return;
+                }
+                if rect.fully_contains(existing) {
+                    *existing = rect;
+                    return;
+                }
+            }
+            self.pending_damage.push(rect);
+        }
+    }
+
+    pub fn has_damage(&self) -> bool {
+        !self.pending_damage.is_empty() || self.read_dirty_rect().is_some()
+    }
+
+    /// Move all outstanding damage, both submitted rects and the legacy
+    /// dirty rect header, into `out`. Both sources are reset.
+    pub fn take_damage(&mut self, out: &mut Vec<Region>) {
+        out.extend(self.pending_damage.drain(..));
+        if let Some((x, y, w, h)) = self.read_dirty_rect() {
+            if let Some(rect) = self.clip(x, y, w, h) {
+                out.push(rect);
+            }
+            self.clear_dirty_rect();
+        }
+    }
+
+    /// Drop all outstanding damage, used when the whole surface is about to be
+    /// copied anyway.
+    pub fn discard_damage(&mut self) {
+        self.pending_damage.clear();
+        self.clear_dirty_rect();
+    }
+
+    /// Resolve every TGFXDAMAGE request waiting on this surface. Called once
+    /// the compositor has copied the surface contents out, so the client can
+    /// safely draw the next frame.
+    pub fn complete_fences(&mut self) {
+        for (request_id, fence) in self.pending_fences.drain(..) {
+            driver_io_complete(request_id, Ok(fence));
+        }
+    }
 }
 
 impl<const COLS: usize, const ROWS: usize> Terminal<COLS, ROWS> {
@@ -478,13 +560,20 @@ impl<const COLS: usize, const ROWS: usize> Terminal<COLS, ROWS> {
             width: graphics_struct.width,
             height: graphics_struct.height,
             bits_per_pixel,
+
+            pending_damage: Vec::new(),
+            pending_fences: Vec::new(),
+            explicit_damage: false,
         });
 
         graphics_struct.framebuffer = paddr.as_u32();
     }
 
     pub fn exit_graphics_mode(&mut self) {
-        if let Some(existing_buffer) = self.graphics_buffer.take() {
+        if let Some(mut existing_buffer) = self.graphics_buffer.take() {
+            // nothing will be composited from this surface again, so don't
+            // leave any client waiting on it
+            existing_buffer.complete_fences();
             crate::task::actions::memory::unmap_memory_for_task(
                 get_current_id(),
                 existing_buffer.vaddr,
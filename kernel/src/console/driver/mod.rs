@@ -100,7 +100,15 @@ impl ConsoleManager {
                 let arg = message.args[2];
                 let arg_len = message.args[3] as usize;
 
-                if arg_len != 0 {
+                if ioctl == termios::TGFXDAMAGE {
+                    // damage submissions stay pending until composited
+                    let result =
+                        self.submit_damage(message.unique_id, instance, arg as *const u8, arg_len);
+                    if arg_len != 0 {
+                        release_buffer(VirtualAddress::new(arg), arg_len);
+                    }
+                    result
+                } else if arg_len != 0 {
                     // attempt to interpret arg as pointer to struct
                     let result = self.ioctl_struct(instance, ioctl, arg as *mut u8, arg_len);
                     release_buffer(VirtualAddress::new(arg), arg_len);
@@ -207,6 +215,46 @@ impl ConsoleManager {
         }
     }
 
+    /// Queue up damaged rects on a console's graphics surface. The request is
+    /// not resolved here; it completes with the submitted fence value once
+    /// the compositor has copied the damaged pixels out of the surface.
+    pub fn submit_damage(
+        &mut self,
+        request_id: u32,
+        instance: u32,
+        arg_ptr: *const u8,
+        arg_len: usize,
+    ) -> Option<IoResult> {
+        let console_id = match self.open_io.get(instance as usize) {
+            Some((id, _)) => *id,
+            None => return Some(Err(IoError::FileHandleInvalid)),
+        };
+        if arg_len != core::mem::size_of::<termios::SurfaceDamage>() {
+            return Some(Err(IoError::InvalidArgument));
+        }
+
+        let console = self.consoles.get_mut(console_id).unwrap();
+        let graphics_buffer = match console.terminal.graphics_buffer.as_mut() {
+            Some(gb) => gb,
+            None => return Some(Err(IoError::UnsupportedOperation)),
+        };
+        let damage = unsafe { &*(arg_ptr as *const termios::SurfaceDamage) };
+        let rect_count = (damage.rect_count as usize).min(termios::MAX_DAMAGE_RECTS);
+        if rect_count == 0 {
+            graphics_buffer.add_damage(0, 0, graphics_buffer.width, graphics_buffer.height);
+        }
+        for i in 0..rect_count {
+            let rect = damage.rects[i];
+            graphics_buffer.add_damage(rect.x, rect.y, rect.width, rect.height);
+        }
+        graphics_buffer.explicit_damage = true;
+        // the top bit of a return value marks an error, keep it clear
+        graphics_buffer
+            .pending_fences
+            .push((request_id, damage.fence & 0x7fff_ffff));
+        None
+    }
+
     pub fn ioctl_struct(
         &mut self,
         instance: u32,
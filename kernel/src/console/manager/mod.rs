@@ -10,6 +10,7 @@ use crate::io::filesystem::install_task_dev;
 use crate::task::id::TaskID;
 use crate::task::switching::get_current_id;
 
+use super::console::term::GraphicsBuffer;
 use super::driver::PendingRead;
 use super::graphics::font::Font;
 use super::graphics::framebuffer::Framebuffer;
@@ -23,6 +24,58 @@ use alloc::{collections::VecDeque, vec::Vec};
 const COLS: usize = 80;
 const ROWS: usize = 25;
 
+/// Copy one rect of a console's graphics surface into the window content area
+/// of `buffer`, converting palette indices to colors if the surface is 8-bit.
+/// The rect is clipped to the visible content size; the part that was actually
+/// copied is returned, in surface coordinates.
+fn blit_surface_rect(
+    graphics_buffer: &GraphicsBuffer,
+    palette: &[u32; 256],
+    buffer: &mut [u8],
+    stride: usize,
+    content_x: usize,
+    content_y: usize,
+    bpp: usize,
+    rect: Region,
+    clip_w: usize,
+    clip_h: usize,
+) -> Option<Region> {
+    let x = rect.x as usize;
+    let y = rect.y as usize;
+    if x >= clip_w || y >= clip_h {
+        return None;
+    }
+    let copy_width = (rect.width as usize).min(clip_w - x);
+    let copy_height = (rect.height as usize).min(clip_h - y);
+
+    let raw_buffer = graphics_buffer.get_pixels();
+    let src_bpp = (graphics_buffer.bits_per_pixel + 7) / 8;
+    let src_stride = graphics_buffer.width as usize * src_bpp;
+
+    for row in y..(y + copy_height) {
+        let dest_offset = (content_y + row) * stride + (content_x + x) * bpp;
+        let src_offset = row * src_stride + x * src_bpp;
+
+        if src_bpp == bpp {
+            let byte_width = copy_width * bpp;
+            buffer[dest_offset..dest_offset + byte_width]
+                .copy_from_slice(&raw_buffer[src_offset..src_offset + byte_width]);
+        } else if src_bpp == 1 {
+            for px in 0..copy_width {
+                let color = palette[raw_buffer[src_offset + px] as usize];
+                crate::console::graphics::write_pixel(buffer, dest_offset + px * bpp, color, bpp);
+            }
+        }
+    }
+
+    Some(Region {
+        x: rect.x,
+        y: rect.y,
+        width: copy_width as u16,
+        height: copy_height as u16,
+    })
+}
+
 /// Information about scrollbar layout returned from draw_window,
 /// so the compositor can register hit zones.
 pub struct ScrollbarInfo {
@@ -151,6 +204,54 @@ impl ConsoleManager {
         let content_y = decor::CONTENT_Y as usize;
         let content_x = decor::CONTENT_X as usize;
 
+        // A graphics surface that only has new damage doesn't need the whole
+        // window rebuilt. The decorations and the rest of the content are
+        // still valid in the scratch buffer, so copy just the damaged rects.
+        if !force && !console.dirty {
+            if let Some(graphics_buffer) = console.terminal.graphics_buffer.as_mut() {
+                let mut damage = Vec::new();
+                graphics_buffer.take_damage(&mut damage);
+                if damage.is_empty() {
+                    return (avail_w, avail_h, None, None);
+                }
+                let palette = match &console.terminal.palette {
+                    Some(p) => &**p,
+                    None => &crate::console::graphics::palette::VGA_PALETTE,
+                };
+                let buffer = fb.get_buffer_mut();
+                let mut bounds: Option<Region> = None;
+                for rect in damage {
+                    let copied = blit_surface_rect(
+                        graphics_buffer,
+                        palette,
+                        buffer,
+                        fb.stride as usize,
+                        content_x,
+                        content_y,
+                        bpp,
+                        rect,
+                        avail_w as usize,
+                        avail_h as usize,
+                    );
+                    if let Some(copied) = copied {
+                        bounds = Some(match bounds {
+                            Some(b) => b.merge(&copied),
+                            None => copied,
+                        });
+                    }
+                }
+                graphics_buffer.complete_fences();
+
+                let dirty = bounds.map(|b| Region {
+                    x: window_pos.x + content_x as u16 + b.x,
+                    y: window_pos.y + content_y as u16 + b.y,
+                    width: b.width,
+                    height: b.height,
+                });
+                return (avail_w, avail_h, dirty, None);
+            }
+        }
+
         let inner_width = avail_w;
         self::decor::draw_window_bar(fb, window_pos, inner_width, font, &console.title, focused, bpp, hover_button);
 
@@ -169,36 +270,32 @@ impl ConsoleManager {
 
         let mut sb_info: Option<ScrollbarInfo> = None;
 
-        if let Some(graphics_buffer) = &console.terminal.graphics_buffer {
-            let gfx_w = (graphics_buffer.width as usize).min(outer_w);
-            let gfx_h = (graphics_buffer.height as usize).min(outer_h);
-
-            if !force && !console.dirty && graphics_buffer.read_dirty_rect().is_none() {
-                return (avail_w, avail_h, None, None);
-            }
-            graphics_buffer.clear_dirty_rect();
-
-            let copy_width = gfx_w.min(graphics_buffer.width as usize);
-            let copy_height = gfx_h.min(graphics_buffer.height as usize);
-            let raw_buffer = graphics_buffer.get_pixels();
-            let src_bpp = (graphics_buffer.bits_per_pixel + 7) / 8;
-
-            for row in 0..copy_height {
-                let dest_offset = (content_y + row) * fb.stride as usize + content_x * bpp;
-                let src_offset = row * graphics_buffer.width as usize * src_bpp;
-
-                if src_bpp == bpp {
-                    let byte_width = copy_width * bpp;
-                    buffer[dest_offset..dest_offset + byte_width]
-                        .copy_from_slice(&raw_buffer[src_offset..src_offset + byte_width]);
-                } else if src_bpp == 1 {
-                    let palette = console.terminal.get_palette();
-                    for px in 0..copy_width {
-                        let color = palette[raw_buffer[src_offset + px] as usize];
-                        crate::console::graphics::write_pixel(buffer, dest_offset + px * bpp, color, bpp);
-                    }
-                }
-            }
+        if let Some(graphics_buffer) = console.terminal.graphics_buffer.as_mut() {
+            // the whole surface gets copied, which covers any queued damage
+            graphics_buffer.discard_damage();
+            let palette = match &console.terminal.palette {
+                Some(p) => &**p,
+                None => &crate::console::graphics::palette::VGA_PALETTE,
+            };
+            let whole_surface = Region {
+                x: 0,
+                y: 0,
+                width: graphics_buffer.width,
+                height: graphics_buffer.height,
+            };
+            blit_surface_rect(
+                graphics_buffer,
+                palette,
+                buffer,
+                fb.stride as usize,
+                content_x,
+                content_y,
+                bpp,
+                whole_surface,
+                outer_w,
+                outer_h,
+            );
+            graphics_buffer.complete_fences();
         } else {
             let font_row_height = font.get_height() as usize;
             let char_width = font.get_glyph(b'A').map_or(8, |g| g.width as usize);
@@ -369,8 +369,14 @@ pub fn manager_task() -> ! {
             last_clock_update = now_ms;
         }
 
-        // Check if any console is in graphics mode
-        let any_graphics = conman.consoles.iter().any(|c| c.terminal.graphics_buffer.is_some());
+        // Surfaces that have never submitted explicit damage are only
+        // signalled through the dirty rect header, which has to be polled
+        let any_polled_graphics = conman.consoles.iter().any(|c| {
+            c.terminal
+                .graphics_buffer
+                .as_ref()
+                .map_or(false, |gb| !gb.explicit_damage)
+        });
 
         // Update topbar with the focused console's title
         if let Some(console) = conman.consoles.get(conman.current_console) {
@@ -385,12 +391,20 @@ pub fn manager_task() -> ! {
                 prev_mouse_x = mouse_x;
                 prev_mouse_y = mouse_y;
             }
+            // Surfaces aren't composited during a drag, and the redraw when
+            // it ends copies each one whole, so frame fences are released
+            // now instead of stalling their clients until the drag is over
+            for console in conman.consoles.iter_mut() {
+                if let Some(graphics_buffer) = console.terminal.graphics_buffer.as_mut() {
+                    graphics_buffer.complete_fences();
+                }
+            }
         } else {
             // Normal render path
             let mouse_moved = mouse_x != prev_mouse_x || mouse_y != prev_mouse_y;
             let any_gfx_dirty = conman.consoles.iter().any(|c| {
                 c.terminal.graphics_buffer.as_ref()
-                    .map_or(false, |gb| gb.read_dirty_rect().is_some())
+                    .map_or(false, |gb| gb.has_damage())
             });
             let any_dirty = mouse_moved || any_gfx_dirty || compositor.force_redraw || conman.consoles.iter().any(|c| c.dirty);
 
@@ -406,9 +420,10 @@ pub fn manager_task() -> ! {
             }
         }
 
-        // In graphics mode, poll at ~60fps so we notice dirty rects promptly.
-        // In text mode, block indefinitely until an event wakes us.
-        let timeout = if any_graphics {
+        // Legacy graphics surfaces are polled at ~60fps so we notice dirty
+        // rects promptly. Surfaces using TGFXDAMAGE wake us with a message,
+        // so with only those (or text mode) we block until an event arrives.
+        let timeout = if any_polled_graphics {
             let elapsed = crate::time::system::get_monotonic_ms() - frame_start;
             let remaining = 16u64.saturating_sub(elapsed);
             Some(remaining as u32)
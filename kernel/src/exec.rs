@@ -7,14 +7,22 @@
 //! 2. Map the appropriate loader binary into the target task
 //! 3. Set up a "load info" page with the executable path and arguments
 //! 4. Set up a stack and initial registers, then mark the task as runnable
+//!
+//! ELF programs are also kept in an image cache: the segment layout parsed
+//! on the first exec of a path is reused on later ones, and the kernel maps
+//! the segments itself, leaving the loader only the stack to set up.
 
 use alloc::{string::String, vec::Vec};
-use idos_api::io::driver::DriverMappingToken;
+use idos_api::io::{driver::DriverMappingToken, file::FileStatus};
+use idos_api::syscall::exec::{
+    SpawnAction, SPAWN_CLOSE, SPAWN_DUP, SPAWN_OPEN, SPAWN_TRANSFER,
+};
+use idos_api::syscall::memory::{PROT_EXEC, PROT_NONE, PROT_READ, PROT_WRITE};
 use spin::rwlock::RwLock;
 
 use crate::{
     io::{
-        filesystem::{driver::DriverID, driver_create_mapping},
+        filesystem::{driver::DriverID, driver_create_mapping, driver_remove_mapping},
         handle::Handle,
     },
     log::TaggedLogger,
@@ -24,13 +32,14 @@ use crate::{
     },
     task::{
         actions::{
-            handle::create_file_handle,
-            io::{close_sync, open_sync, read_struct_sync},
-            memory::map_memory_for_task,
+            handle::{create_file_handle, create_task, dup_handle, handle_exists},
+            io::{close_sync, open_sync, read_struct_sync, share_sync, stat_sync},
+            lifecycle::{add_args, terminate_task},
+            memory::{map_memory_for_task, unmap_memory_for_task},
         },
         id::TaskID,
-        map::get_task,
-        memory::MemoryBacking,
+        map::{for_each_task_mutfn, get_task},
+        memory::{pin_file_mapping, unpin_file_mapping, MemoryBacking},
         paging::{ExternalPageDirectory, PermissionFlags},
     },
 };
@@ -76,7 +85,9 @@ struct ProgramHeader {
 }
 
 const SEGMENT_TYPE_LOAD: u32 = 1;
+const SEGMENT_FLAG_EXEC: u32 = 1 << 0;
 const SEGMENT_FLAG_WRITE: u32 = 1 << 1;
+const SEGMENT_FLAG_READ: u32 = 1 << 2;
 
 const LOGGER: TaggedLogger = TaggedLogger::new("EXEC", 33);
 
@@ -136,16 +147,20 @@ pub enum ExecError {
     MappingFailed,
     /// The target task is not in the expected Uninitialized state
     InvalidTaskState,
+    /// A spawn named a handle the caller doesn't have, or one that couldn't
+    /// be given to the child
+    InvalidHandle,
     /// An internal error occurred
     InternalError,
 }
 
-/// Cached metadata about a loader binary, extracted from its ELF headers
+/// The loadable layout of an ELF binary, extracted from its headers, along
+/// with the driver mapping its pages are read through. This is what gets
+/// cached, so mapping the same binary again needs no parsing and no IO.
 /// When we support multiple executable formats, we'll need to extend this with
 /// an enum for format-specific metadata
-struct CachedLoader {
-    /// Path used to identify this loader in the cache
-    path: &'static str,
+#[derive(Clone)]
+struct ElfImage {
     driver_id: DriverID,
     mapping_token: DriverMappingToken,
     /// Entry point, relative to the base address of the first segment
@@ -155,8 +170,29 @@ struct CachedLoader {
     segments: Vec<CachedSegment>,
 }
 
-/// Metadata about a single loadable segment in the loader ELF. This is what we
+/// Cached metadata about a loader binary
+struct CachedLoader {
+    /// Path used to identify this loader in the cache
+    path: &'static str,
+    image: ElfImage,
+}
+
+/// Cached metadata about a program that has been executed before. Besides
+/// the path, the file's size and modification time identify it, so a binary
+/// that has been rebuilt is parsed again instead of mapped from stale data.
+/// FAT only keeps modification times to 2 seconds, so a binary rewritten at
+/// the same size within that window of its last write still looks current.
+struct CachedProgram {
+    /// The path, upper-cased since paths are case-insensitive
+    path: String,
+    byte_size: u32,
+    modification_time: u32,
+    image: ElfImage,
+}
+
+/// Metadata about a single loadable segment in an ELF. This is what we
 /// cache for each segment to avoid repeatedly parsing the ELF headers.
+#[derive(Clone)]
 struct CachedSegment {
     /// Virtual address offset relative to elf_base
     vaddr_offset: u32,
@@ -164,12 +200,28 @@ struct CachedSegment {
     file_offset: u32,
     /// Size in memory, rounded up to page boundary
     memory_size: u32,
-    /// Whether this segment is writable (private mapping)
-    writable: bool,
+    /// Bytes from the start of the segment that come from the file; the
+    /// rest is BSS
+    file_size: u32,
+    /// PROT_* bits from the segment's flags; writable segments are mapped
+    /// private
+    protection: u32,
 }
 
 static LOADER_CACHE: RwLock<Vec<CachedLoader>> = RwLock::new(Vec::new());
 
+/// Programs cached by earlier execs, least recently used first
+static PROGRAM_CACHE: RwLock<Vec<CachedProgram>> = RwLock::new(Vec::new());
+
+/// Images that have left the cache while tasks launched from them were still
+/// running. Those tasks page in through the image's driver mapping, so it is
+/// only removed once none of them has a region using it any more.
+static RETIRED_IMAGES: RwLock<Vec<ElfImage>> = RwLock::new(Vec::new());
+
+/// How many programs to keep cached. Each one holds on to its driver mapping
+/// and to every page of it that has been read so far.
+const PROGRAM_CACHE_SIZE: usize = 8;
+
 /// Header written at the start of the load info page. This struct is shared
 /// between the kernel and the userspace loader, so its layout must be stable.
 #[repr(C)]
@@ -186,6 +238,9 @@ struct LoadInfoHeader {
     argv_offset: u32,
     /// Total length of all argument strings combined (for bounds checking)
     argv_total_len: u32,
+    /// If nonzero, the kernel has already mapped the program from its image
+    /// cache, and this is its entry point
+    entry_point: u32,
 }
 
 const LOAD_INFO_DATA_START: usize = 0x100;
@@ -216,6 +271,9 @@ pub fn exec_program(task_id: TaskID, path: &str) -> Result<(), ExecError> {
     let mut magic: [u8; 4] = [0; 4];
     let _ = crate::task::actions::io::read_sync(exec_handle, &mut magic, 0)
         .map_err(|_| ExecError::FileNotFound)?;
+    // The file's size and modification time tell a cached image apart from
+    // a rebuilt one
+    let status = stat_sync(exec_handle).ok();
     let _ = close_sync(exec_handle);
 
     // 2. Pick the loader based on format
@@ -237,13 +295,20 @@ pub fn exec_program(task_id: TaskID, path: &str) -> Result<(), ExecError> {
     // 3. Map the loader into the target task
     let (entry_point, _loader_base) = map_loader_for_task(task_id, loader_path)?;
 
-    // 4. Set up stack (before load info, so auto-allocated pages land below it)
+    // 4. Map ELF programs directly from the image cache, so the loader only
+    //    has to set up the stack. If that fails, the loader maps it instead.
+    let program_entry = match status {
+        Some(ref status) if magic == ELF_MAGIC => map_program_image(task_id, path, status),
+        _ => None,
+    };
+
+    // 5. Set up stack (before load info, so auto-allocated pages land below it)
     setup_stack(task_id)?;
 
-    // 5. Set up the load info page
-    let load_info_addr = setup_load_info_page(task_id, path)?;
+    // 6. Set up the load info page
+    let load_info_addr = setup_load_info_page(task_id, path, program_entry)?;
 
-    // 6. Set registers and mark runnable
+    // 7. Set registers and mark runnable
     {
         let task_lock = get_task(task_id).ok_or(ExecError::InternalError)?;
         let mut task = task_lock.write();
@@ -280,6 +345,88 @@ pub fn exec_program(task_id: TaskID, path: &str) -> Result<(), ExecError> {
     Ok(())
 }
 
+/// Create a child of the current task and start the program at `path` in
+/// it, the way a shell launches a command: the child gets `args`, then the
+/// handles described by `actions`, in order, then the program. If any step
+/// fails the half-built child is torn down, and the calling task is left as
+/// it was, since transferred and closed handles are only released once the
+/// child is running.
+pub fn spawn_program<I, A>(
+    path: &str,
+    args: I,
+    actions: &[SpawnAction],
+) -> Result<(Handle, TaskID), ExecError>
+where
+    I: IntoIterator<Item = A>,
+    A: AsRef<[u8]>,
+{
+    // Check everything the caller passed in before creating anything
+    for action in actions {
+        match action.kind {
+            SPAWN_DUP | SPAWN_TRANSFER | SPAWN_CLOSE => {
+                if !handle_exists(Handle::new(action.handle as usize)) {
+                    return Err(ExecError::InvalidHandle);
+                }
+            }
+            SPAWN_OPEN => (),
+            _ => return Err(ExecError::InvalidHandle),
+        }
+    }
+
+    let (child_handle, child_id) = create_task();
+    add_args(child_id, args);
+    let result = give_handles(child_id, actions).and_then(|_| exec_program(child_id, path));
+    if let Err(err) = result {
+        LOGGER.log(format_args!("spawn {:?} failed: {:?}", child_id, err));
+        // The child never ran, and the cleanup task closes anything it had
+        // already been given
+        terminate_task(child_id, 0xff);
+        let _ = close_sync(child_handle);
+        return Err(err);
+    }
+
+    for action in actions {
+        if action.kind == SPAWN_TRANSFER || action.kind == SPAWN_CLOSE {
+            let _ = close_sync(Handle::new(action.handle as usize));
+        }
+    }
+    Ok((child_handle, child_id))
+}
+
+/// Hand a newly created child its handles. Handles the caller names are
+/// duplicated before being shared, so the originals stay put until the
+/// spawn is known to have worked.
+fn give_handles(child_id: TaskID, actions: &[SpawnAction]) -> Result<(), ExecError> {
+    for action in actions {
+        let handle = match action.kind {
+            SPAWN_DUP | SPAWN_TRANSFER => dup_handle(Handle::new(action.handle as usize))
+                .ok_or(ExecError::InvalidHandle)?,
+            SPAWN_OPEN => {
+                let path_bytes = unsafe {
+                    core::slice::from_raw_parts(
+                        action.path_ptr as *const u8,
+                        action.path_len as usize,
+                    )
+                };
+                let path =
+                    core::str::from_utf8(path_bytes).map_err(|_| ExecError::FileNotFound)?;
+                let handle = create_file_handle();
+                if open_sync(handle, path, action.flags).is_err() {
+                    let _ = close_sync(handle);
+                    return Err(ExecError::FileNotFound);
+                }
+                handle
+            }
+            _ => continue,
+        };
+        if share_sync(handle, child_id).is_err() {
+            let _ = close_sync(handle);
+            return Err(ExecError::InvalidHandle);
+        }
+    }
+    Ok(())
+}
+
 // === Loader Mapping ===
 
 /// Map the loader binary into the target task's address space. Returns the
@@ -291,62 +438,252 @@ fn map_loader_for_task(
     // Check cache first
     let cache = LOADER_CACHE.read();
     if let Some(cached) = cache.iter().find(|c| c.path == loader_path) {
-        let base = map_cached_loader(task_id, cached)?;
-        let entry = base.as_u32() + cached.entry_point_offset;
+        let base = map_image(task_id, &cached.image)?;
+        let entry = base.as_u32() + cached.image.entry_point_offset;
         return Ok((entry, base));
     }
     drop(cache);
 
     // Cold path: parse the loader ELF and cache it
-    let cached = parse_and_cache_loader(loader_path)?;
+    LOGGER.log(format_args!("Parsing loader: {}", loader_path));
+    let image = parse_elf_image(loader_path).map_err(|e| match e {
+        ExecError::FileNotFound => ExecError::LoaderNotFound,
+        other => other,
+    })?;
+    pin_file_mapping(image.driver_id, image.mapping_token);
 
-    let base = map_cached_loader(task_id, &cached)?;
-    let entry = base.as_u32() + cached.entry_point_offset;
+    let base = map_image(task_id, &image)?;
+    let entry = base.as_u32() + image.entry_point_offset;
 
-    LOADER_CACHE.write().push(cached);
+    LOADER_CACHE.write().push(CachedLoader {
+        path: loader_path,
+        image,
+    });
 
     Ok((entry, base))
 }
 
-/// Use cached loader metadata to map segments into the target task. Returns
-/// the base virtual address the loader was mapped at.
-fn map_cached_loader(task_id: TaskID, cached: &CachedLoader) -> Result<VirtualAddress, ExecError> {
+/// Use cached image metadata to map segments into the target task. Returns
+/// the base virtual address the image was mapped at.
+///
+/// Read-only segments share their frames with every other task running the
+/// same image. Writable ones, and read-only ones that end in BSS, get private
+/// pages that are copied from a shared frame instead of read through the
+/// driver again; since the cache pins its mappings, that frame stays
+/// resident from one exec to the next.
+fn map_image(task_id: TaskID, image: &ElfImage) -> Result<VirtualAddress, ExecError> {
     // For a PIE loader, we map at the ELF's own base address for now.
     // In the future we could relocate, but the loader controls its own layout.
-    let base = VirtualAddress::new(cached.elf_base);
+    let base = VirtualAddress::new(image.elf_base);
 
-    for segment in &cached.segments {
+    for (index, segment) in image.segments.iter().enumerate() {
         let vaddr = base + segment.vaddr_offset;
-        let shared = !segment.writable;
+        // A segment with BSS needs its own copy of the page where the file
+        // data ends, so that page can't be shared
+        let has_bss = segment.file_size < segment.memory_size;
+        let shared = segment.protection & PROT_WRITE == 0 && !has_bss;
+        let file_size = if has_bss {
+            segment.file_size
+        } else {
+            segment.memory_size
+        };
 
         let backing = MemoryBacking::FileBacked {
-            driver_id: cached.driver_id,
-            mapping_token: cached.mapping_token,
+            driver_id: image.driver_id,
+            mapping_token: image.mapping_token,
             offset_in_file: segment.file_offset,
             shared,
+            copy_from_shared: !shared,
+            file_size,
         };
 
-        map_memory_for_task(task_id, Some(vaddr), segment.memory_size, backing)
-            .map_err(|_| ExecError::MappingFailed)?;
+        let mapped = match get_task(task_id) {
+            Some(task_lock) => task_lock.write().memory_mapping.map_memory_with_protection(
+                Some(vaddr),
+                segment.memory_size,
+                backing,
+                segment.protection,
+            ),
+            None => return Err(ExecError::MappingFailed),
+        };
+        let landed = match mapped {
+            Ok(addr) if addr == vaddr => true,
+            // The range was taken and the mapping went somewhere else
+            Ok(elsewhere) => {
+                let _ = unmap_memory_for_task(task_id, elsewhere, segment.memory_size);
+                false
+            }
+            Err(_) => false,
+        };
+        if !landed {
+            for segment in &image.segments[..index] {
+                let _ = unmap_memory_for_task(
+                    task_id,
+                    base + segment.vaddr_offset,
+                    segment.memory_size,
+                );
+            }
+            return Err(ExecError::MappingFailed);
+        }
     }
 
     LOGGER.log(format_args!(
-        "Loader mapped at {:?} ({} segments)",
+        "Image mapped at {:?} ({} segments)",
         base,
-        cached.segments.len()
+        image.segments.len()
     ));
 
     Ok(base)
 }
 
-/// Parse the loader's ELF headers and create a driver mapping. This is the
-/// cold path — only runs once per loader binary.
-fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, ExecError> {
-    LOGGER.log(format_args!("Parsing loader: {}", loader_path));
+// === Program Image Cache ===
+
+/// Map an ELF program into the target task from the program cache, parsing
+/// and caching it first if this path hasn't been run before or the file has
+/// changed since. Returns the entry point, or None if the image couldn't be
+/// mapped, in which case the loader maps the program itself.
+fn map_program_image(task_id: TaskID, path: &str, status: &FileStatus) -> Option<u32> {
+    let key = path.to_ascii_uppercase();
+
+    let (cached, stale) = {
+        let mut cache = PROGRAM_CACHE.write();
+        match cache.iter().position(|c| c.path == key) {
+            Some(index) => {
+                let entry = cache.remove(index);
+                if entry.byte_size == status.byte_size
+                    && entry.modification_time == status.modification_time
+                {
+                    let image = entry.image.clone();
+                    // Most recently used goes to the back
+                    cache.push(entry);
+                    (Some(image), None)
+                } else {
+                    LOGGER.log(format_args!("Program changed on disk: {}", path));
+                    (None, Some(entry))
+                }
+            }
+            None => (None, None),
+        }
+    };
+    sweep_retired_images();
+    // The old mapping has to be gone before the path is mapped again, or the
+    // driver hands back the same token, still bound to the old file contents.
+    // While tasks running the old program still use it, the new one isn't
+    // cached and the loader maps it itself.
+    if let Some(entry) = stale {
+        if !release_cached_image(entry.image) {
+            return None;
+        }
+    }
+
+    let image = match cached {
+        Some(image) => image,
+        None => {
+            LOGGER.log(format_args!("Parsing program: {}", path));
+            let image = parse_elf_image(path).ok()?;
+            pin_file_mapping(image.driver_id, image.mapping_token);
+            let evicted = {
+                let mut cache = PROGRAM_CACHE.write();
+                let evicted = if cache.len() >= PROGRAM_CACHE_SIZE {
+                    Some(cache.remove(0))
+                } else {
+                    None
+                };
+                cache.push(CachedProgram {
+                    path: key,
+                    byte_size: status.byte_size,
+                    modification_time: status.modification_time,
+                    image: image.clone(),
+                });
+                evicted
+            };
+            if let Some(entry) = evicted {
+                release_cached_image(entry.image);
+            }
+            image
+        }
+    };
+
+    let base = map_image(task_id, &image).ok()?;
+    Some(base.as_u32() + image.entry_point_offset)
+}
+
+/// Drop everything an image held while it was cached: its pinned pages and,
+/// unless a running task still pages in through it, the driver mapping
+/// behind them. An image still in use is retired instead, and false is
+/// returned. Called without the cache lock held, since waiting on a driver
+/// task yields.
+fn release_cached_image(image: ElfImage) -> bool {
+    unpin_file_mapping(image.driver_id, image.mapping_token);
+    if image_in_use(&image) {
+        RETIRED_IMAGES.write().push(image);
+        return false;
+    }
+    remove_image_mapping(&image);
+    true
+}
+
+/// Remove the driver mappings of retired images that no task uses any more
+fn sweep_retired_images() {
+    let released: Vec<ElfImage> = {
+        let mut retired = RETIRED_IMAGES.write();
+        if retired.is_empty() {
+            return;
+        }
+        let (unused, in_use) = retired.drain(..).partition(|image| !image_in_use(image));
+        *retired = in_use;
+        unused
+    };
+    for image in released.iter() {
+        remove_image_mapping(image);
+    }
+}
+
+fn image_in_use(image: &ElfImage) -> bool {
+    let mut in_use = false;
+    for_each_task_mutfn(|task_lock| {
+        in_use = in_use
+            || task_lock
+                .read()
+                .memory_mapping
+                .uses_file_mapping(image.driver_id, image.mapping_token);
+    });
+    in_use
+}
+
+fn remove_image_mapping(image: &ElfImage) {
+    if driver_remove_mapping(image.driver_id, image.mapping_token).is_none() {
+        // Async driver — wait for it, so that a mapping created after this
+        // one can't pick up its completion instead
+        let task_lock = crate::task::switching::get_current_task();
+        task_lock.write().begin_file_mapping_request();
+        crate::task::actions::yield_coop();
+        task_lock.write().last_map_result.take();
+    }
+}
+
+/// Translate an ELF segment's permission flags into PROT_* bits
+fn segment_protection(flags: u32) -> u32 {
+    let mut protection = PROT_NONE;
+    if flags & SEGMENT_FLAG_READ != 0 {
+        protection |= PROT_READ;
+    }
+    if flags & SEGMENT_FLAG_WRITE != 0 {
+        protection |= PROT_WRITE;
+    }
+    if flags & SEGMENT_FLAG_EXEC != 0 {
+        protection |= PROT_EXEC;
+    }
+    protection
+}
 
+/// Read an ELF binary's headers and create a driver mapping for it (kept
+/// alive for the cache). This is the cold path, which only runs the first
+/// time a binary is mapped.
+fn parse_elf_image(path: &str) -> Result<ElfImage, ExecError> {
     // Open and read ELF headers
     let handle = create_file_handle();
-    let _ = open_sync(handle, loader_path, 0).map_err(|_| ExecError::LoaderNotFound)?;
+    let _ = open_sync(handle, path, 0).map_err(|_| ExecError::FileNotFound)?;
 
     let mut elf_header = ElfHeader::default();
     let _ = read_struct_sync(handle, &mut elf_header, 0).map_err(|_| ExecError::ParseError)?;
@@ -369,9 +706,9 @@ fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, Exe
 
     let _ = close_sync(handle);
 
-    // Create a driver mapping for the loader file (kept alive for the cache)
+    // Create a driver mapping for the file
     let (driver_id, relative_path) =
-        crate::io::prepare_file_path(loader_path).map_err(|_| ExecError::LoaderNotFound)?;
+        crate::io::prepare_file_path(path).map_err(|_| ExecError::FileNotFound)?;
 
     let result = match driver_create_mapping(driver_id, relative_path) {
         Some(immediate) => immediate,
@@ -383,13 +720,13 @@ fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, Exe
             let last_result = task_lock.write().last_map_result.take();
             match last_result {
                 Some(r) => r,
-                None => return Err(ExecError::LoaderNotFound),
+                None => return Err(ExecError::FileNotFound),
             }
         }
     };
     let mapping_token = match result {
         Ok(token) => DriverMappingToken::new(token),
-        Err(_) => return Err(ExecError::LoaderNotFound),
+        Err(_) => return Err(ExecError::FileNotFound),
     };
 
     // Build cached segment list from PT_LOAD headers, merging segments that
@@ -418,8 +755,9 @@ fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, Exe
         let file_offset_aligned = ph.offset & 0xfffff000;
         let memory_size_aligned =
             ((seg_vaddr + ph.memory_size + 0xfff) & 0xfffff000) - seg_vaddr_aligned;
+        let file_size = seg_vaddr - seg_vaddr_aligned + ph.file_size;
         let vaddr_offset = seg_vaddr_aligned - base;
-        let writable = ph.flags & SEGMENT_FLAG_WRITE != 0;
+        let protection = segment_protection(ph.flags);
 
         // Check if this segment overlaps with the previous one (common when
         // multiple segments share the same page). If so, extend the previous
@@ -432,9 +770,9 @@ fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, Exe
                 if new_end > prev_end {
                     prev.memory_size = new_end - prev.vaddr_offset;
                 }
-                if writable {
-                    prev.writable = true;
-                }
+                prev.file_size = prev.file_size.max(vaddr_offset - prev.vaddr_offset + file_size);
+                // The shared page needs whatever either segment allows
+                prev.protection |= protection;
                 true
             } else {
                 false
@@ -448,7 +786,8 @@ fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, Exe
                 vaddr_offset,
                 file_offset: file_offset_aligned,
                 memory_size: memory_size_aligned,
-                writable,
+                file_size,
+                protection,
             });
         }
     }
@@ -457,14 +796,13 @@ fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, Exe
     let entry_point_offset = elf_header.entry_point - elf_base;
 
     LOGGER.log(format_args!(
-        "Loader cached: base={:#X} entry_offset={:#X} segments={}",
+        "Image parsed: base={:#X} entry_offset={:#X} segments={}",
         elf_base,
         entry_point_offset,
         segments.len()
     ));
 
-    Ok(CachedLoader {
-        path: loader_path,
+    Ok(ElfImage {
         driver_id,
         mapping_token,
         entry_point_offset,
@@ -477,7 +815,11 @@ fn parse_and_cache_loader(loader_path: &'static str) -> Result<CachedLoader, Exe
 
 /// Allocate a page in the target task's address space and fill it with
 /// structured load information that the userspace loader will read.
-fn setup_load_info_page(task_id: TaskID, exec_path: &str) -> Result<VirtualAddress, ExecError> {
+fn setup_load_info_page(
+    task_id: TaskID,
+    exec_path: &str,
+    program_entry: Option<u32>,
+) -> Result<VirtualAddress, ExecError> {
     // Allocate a page of free memory in the target task
     let vaddr = map_memory_for_task(task_id, None, 0x1000, MemoryBacking::FreeMemory)
         .map_err(|_| ExecError::MappingFailed)?;
@@ -531,6 +873,7 @@ fn setup_load_info_page(task_id: TaskID, exec_path: &str) -> Result<VirtualAddre
         header.argc = argc;
         header.argv_offset = argv_offset as u32;
         header.argv_total_len = argv_len;
+        header.entry_point = program_entry.unwrap_or(0);
     }
 
     Ok(vaddr)
@@ -694,3 +1037,30 @@ pub fn exec_flat_binary(
 
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::{spawn_program, ExecError};
+    use crate::task::actions::handle::{create_file_handle, handle_exists};
+    use crate::task::actions::io::{close_sync, open_sync};
+    use idos_api::syscall::exec::SpawnAction;
+
+    #[test_case]
+    fn spawn_missing_program_keeps_handles() {
+        let handle = create_file_handle();
+        open_sync(handle, "TEST:\\MYFILE.TXT", 0).unwrap();
+        let actions = [SpawnAction::transfer(idos_api::io::Handle::new(*handle as u32))];
+        let result = spawn_program("TEST:\\NOTREAL.ELF", [b"NOTREAL"], &actions);
+        assert!(matches!(result, Err(ExecError::FileNotFound)));
+        // The transfer never happened
+        assert!(handle_exists(handle));
+        close_sync(handle).unwrap();
+    }
+
+    #[test_case]
+    fn spawn_rejects_unknown_handles() {
+        let actions = [SpawnAction::dup(idos_api::io::Handle::new(0x7fff))];
+        let result = spawn_program("TEST:\\MYFILE.TXT", [b"MYFILE"], &actions);
+        assert!(matches!(result, Err(ExecError::InvalidHandle)));
+    }
+}
@@ -1,9 +1,10 @@
 use core::arch::{asm, global_asm};
 
-use idos_api::compat::VMRegisters;
+use idos_api::compat::{VMRegisters, VM86_VIF};
 
 use crate::memory::address::VirtualAddress;
 use crate::task::actions::lifecycle::{exception, terminate};
+use crate::task::actions::vm::emulate_vm86_instruction;
 use crate::task::paging::page_on_demand;
 use crate::task::switching::get_current_id;
 
@@ -147,6 +148,8 @@ pub extern "x86-interrupt" fn page_fault(stack_frame: StackFrame, error: u32) {
         }
     } else {
         // User space
+        crate::stats::count_page_fault();
+        crate::task::accounting::with_current(|a| a.count_page_fault());
 
         if error & 1 == 0 {
             // Page was not present
@@ -203,6 +206,20 @@ gpf_exception:
     push ebx
 
     call _gpf_exception_inner
+
+    // The handler only returns after emulating a v86 instruction. IRETD to
+    // v86 mode reloads all segment registers from the stack, so the kernel
+    // selectors loaded above don't leak.
+    add esp, 12
+    pop edi
+    pop esi
+    pop ebp
+    pop ebx
+    pop edx
+    pop ecx
+    pop eax
+    add esp, 4
+    iretd
 "#
 );
 
@@ -233,10 +250,11 @@ debug_exception:
 /// the protected-mode context from before enter_vm86, returning to doslayer.
 /// This is used by both the GPF and debug trap handlers.
 fn exit_vm86(stack_frame: &StackFrame, registers: &SavedRegisters, exit_reason: u32) -> ! {
-    let stored_regs = crate::task::switching::get_current_task()
-        .write()
-        .vm86_registers
-        .take();
+    let (stored_regs, vif) = {
+        let task_lock = crate::task::switching::get_current_task();
+        let mut task = task_lock.write();
+        (task.vm86_registers.take(), task.vm86_vif)
+    };
     if let Some(mut prev_regs) = stored_regs {
         // Set the exit reason in eax so the caller of enter_8086 can read it
         prev_regs.eax = exit_reason;
@@ -253,7 +271,10 @@ fn exit_vm86(stack_frame: &StackFrame, registers: &SavedRegisters, exit_reason:
 
             vm_regs.eip = stack_frame.eip;
             vm_regs.cs = stack_frame.cs;
-            vm_regs.eflags = stack_frame.eflags;
+            vm_regs.eflags = stack_frame.eflags & !VM86_VIF;
+            if vif {
+                vm_regs.eflags |= VM86_VIF;
+            }
 
             let stack_frame_ptr = stack_frame as *const StackFrame as *const u32;
             vm_regs.esp = core::ptr::read_volatile(stack_frame_ptr.add(3));
@@ -353,11 +374,11 @@ pub extern "C" fn _gpf_exception_inner(
     stack_frame: &StackFrame,
     err_code: &u32,
     registers: &mut SavedRegisters,
-) -> ! {
-    crate::kprintln!("ERR: General Protection Fault, code {}", *err_code);
-    crate::kprintln!("{:?}", stack_frame);
-
+) {
     if stack_frame.eflags & 0x20000 != 0 {
+        if emulate_vm86_instruction(stack_frame) {
+            return;
+        }
         exit_vm86(stack_frame, registers, idos_api::compat::VM86_EXIT_GPF);
     }
 
@@ -410,6 +431,8 @@ pub extern "C" fn _gpf_exception_inner(
         }
     }
 
+    crate::kprintln!("ERR: General Protection Fault, code {}", *err_code);
+    crate::kprintln!("{:?}", stack_frame);
     if stack_frame.eip >= 0xc0000000 {
         crate::kprintln!("Kernel GPF");
     }
@@ -6,9 +6,11 @@ use super::stack::StackFrame;
 /// sends a secondary IPI to all of the other processors in the system. This
 /// allows them to respond to the timer the same way the BSP does.
 pub extern "x86-interrupt" fn pit_cascade(stack_frame: StackFrame) {
+    crate::stats::count_ipi();
     let scheduler = get_cpu_scheduler();
     let is_user = stack_frame.cs & 3 != 0 || stack_frame.eflags & 0x20000 != 0;
     scheduler.record_tick(is_user);
+    crate::profiler::sample(&stack_frame);
     scheduler.tick();
     get_lapic().eoi();
 }
@@ -112,7 +112,9 @@ pic_irq_core:
 /// Handle interrupts that come from the PIC
 #[no_mangle]
 pub extern "C" fn _handle_pic_interrupt(frame: &StackFrame, irq: u32, _registers: &SavedState) {
+    let start = crate::latency::now();
     let pic = PIC::new();
+    crate::stats::count_irq(irq);
 
     if irq == 0 {
         // IRQ 0 is not installable, and is hard-coded to the kernel's PIT
@@ -123,6 +125,7 @@ pub extern "C" fn _handle_pic_interrupt(frame: &StackFrame, irq: u32, _registers
         let is_user = frame.cs & 3 != 0 || frame.eflags & 0x20000 != 0;
         let scheduler = get_cpu_scheduler();
         scheduler.record_tick(is_user);
+        crate::profiler::sample(frame);
 
         if scheduler.has_lapic {
             get_lapic().broadcast_ipi(0xf0);
@@ -131,15 +134,18 @@ pub extern "C" fn _handle_pic_interrupt(frame: &StackFrame, irq: u32, _registers
         let should_preempt = scheduler.tick();
 
         // Virtual interrupt delivery to v86 tasks: if we interrupted a v86
-        // task that has the timer IRQ enabled, mark it pending and inject
-        // the trap flag so the next instruction triggers #DB, exiting to
-        // doslayer for delivery.
+        // task that has the timer IRQ enabled, mark it pending. If the task
+        // has virtual interrupts enabled, inject the trap flag so the next
+        // instruction triggers #DB, exiting to doslayer for delivery.
+        // Otherwise, the trap is raised once it executes STI.
         let is_vm86 = frame.eflags & 0x20000 != 0;
         if is_vm86 {
             let task_lock = crate::task::switching::get_current_task();
             let mut task = task_lock.write();
             if task.vm86_irq_mask & idos_api::compat::VM86_IRQ_TIMER != 0 {
                 task.vm86_pending_irqs |= idos_api::compat::VM86_IRQ_TIMER;
+            }
+            if task.vm86_pending_irqs != 0 && task.vm86_vif {
                 // Set TF (bit 8) in the real eflags on the interrupt frame.
                 // frame is now a reference to the actual stack, so this works.
                 frame.set_eflags(frame.eflags | 0x100);
@@ -147,6 +153,8 @@ pub extern "C" fn _handle_pic_interrupt(frame: &StackFrame, irq: u32, _registers
         }
 
         pic.end_of_interrupt(0);
+        // Time spent in the switch to another task isn't the handler's
+        crate::latency::record_irq(0, start);
 
         // Preempt if the time slice expired and we interrupted userspace
         // (ring 3 or VM86 mode).
@@ -186,6 +194,7 @@ pub extern "C" fn _handle_pic_interrupt(frame: &StackFrame, irq: u32, _registers
     }
 
     pic.end_of_interrupt(irq as u8);
+    crate::latency::record_irq(irq, start);
 }
 
 /// The PIT triggers at 100Hz, and is used to update the internal clock and the
@@ -10,12 +10,15 @@ use crate::{
         actions::{
             self,
             lifecycle::InMemoryArgsIterator,
-            memory::{map_file, map_memory, unmap_memory},
+            memory::{
+                advise_memory, collect_dirty_pages, map_file_for_task, map_file_segments_for_task,
+                map_memory, protect_memory, unmap_memory,
+            },
             send_message,
         },
         id::TaskID,
         map::get_task,
-        memory::MemoryBacking,
+        memory::{MemMapError, MemoryBacking},
     },
 };
 
@@ -128,6 +131,8 @@ fn log_syscall(registers: &FullSavedRegisters) {
         0x09 => "ldt modify",
         0x0a => "ldt free",
         0x0b => "enter protected mode",
+        0x0c => "set vm86 reflected ints",
+        0x0d => "spawn",
         0x10 => "submit async io op",
         0x11 => "send message",
         0x12 => "driver io complete",
@@ -147,6 +152,10 @@ fn log_syscall(registers: &FullSavedRegisters) {
         0x30 => "map memory",
         0x31 => "map file",
         0x32 => "unmap memory",
+        0x33 => "collect dirty pages",
+        0x34 => "advise memory",
+        0x35 => "map file segments",
+        0x36 => "protect memory",
         0x40 => "get monotonic ms",
         0x41 => "get system time",
         0x50 => "register filesystem",
@@ -169,8 +178,17 @@ fn log_syscall(registers: &FullSavedRegisters) {
 
 #[no_mangle]
 pub extern "C" fn _syscall_inner(registers: &mut FullSavedRegisters) {
+    let start = crate::latency::now();
+    // The result is written back to eax, so keep the number for the timing
+    let number = registers.eax;
+    dispatch_syscall(registers);
+    crate::latency::record_syscall(number, start);
+}
+
+fn dispatch_syscall(registers: &mut FullSavedRegisters) {
     log_syscall(registers);
     let eax = registers.eax;
+    crate::stats::count_syscall(eax);
     match eax {
         // task lifecycle and interop
         0x00 => {
@@ -289,6 +307,44 @@ pub extern "C" fn _syscall_inner(registers: &mut FullSavedRegisters) {
             crate::task::actions::vm::enter_protected_mode(registers, regs_ptr);
         }
 
+        0x0c => {
+            // set the interrupt vectors that are reflected into v86 code
+            // ebx = pointer to a 256-bit bitmap, one bit per vector
+            let reflected_ptr = registers.ebx as *const idos_api::compat::VM86ReflectedInts;
+            crate::task::actions::vm::set_vm86_reflected_ints(reflected_ptr);
+        }
+
+        0x0d => {
+            // spawn
+            // ebx = pointer to a SpawnRequest with the program path, an args
+            // buffer in the add_args format, and a list of handle actions
+            // Returns the child handle in eax and its task id in ebx
+            use idos_api::syscall::exec::{SpawnAction, SpawnRequest};
+            let request = unsafe { &*(registers.ebx as *const SpawnRequest) };
+            let path_slice = unsafe {
+                core::slice::from_raw_parts(request.path_ptr as *const u8, request.path_len as usize)
+            };
+            let actions = unsafe {
+                core::slice::from_raw_parts(
+                    request.actions_ptr as *const SpawnAction,
+                    request.action_count as usize,
+                )
+            };
+            let args =
+                InMemoryArgsIterator::new(request.args_ptr as *const u8, request.args_len as usize);
+            let result = match core::str::from_utf8(path_slice) {
+                Ok(path) => crate::exec::spawn_program(path, args, actions),
+                Err(_) => Err(crate::exec::ExecError::FileNotFound),
+            };
+            match result {
+                Ok((handle, task_id)) => {
+                    registers.eax = *handle as u32;
+                    registers.ebx = task_id.into();
+                }
+                Err(_) => registers.eax = 0xffff_ffff,
+            }
+        }
+
         // IO Actions
         0x10 => {
             // submit async io op
@@ -489,7 +545,17 @@ pub extern "C" fn _syscall_inner(registers: &mut FullSavedRegisters) {
             };
             let file_offset = mapping.file_offset;
             let shared = mapping.flags & idos_api::syscall::memory::MMAP_SHARED != 0;
-            match map_file(address, size, path, file_offset, shared) {
+            let current = crate::task::switching::get_current_id();
+            match map_file_for_task(
+                current,
+                address,
+                size,
+                path,
+                file_offset,
+                mapping.file_size,
+                shared,
+                mapping.protection,
+            ) {
                 Ok(vaddr) => {
                     registers.eax = vaddr.into();
                 }
@@ -513,6 +579,87 @@ pub extern "C" fn _syscall_inner(registers: &mut FullSavedRegisters) {
             }
         }
 
+        0x33 => {
+            // collect dirty pages
+            // ebx = region start, ecx = region size in bytes,
+            // edx = pointer to a bitmap with one bit per page of the region
+            // Returns the number of dirty pages in eax
+            let address = VirtualAddress::new(registers.ebx);
+            let size = registers.ecx;
+            let word_count = ((size as usize + 0xfff) / 0x1000 + 31) / 32;
+            let bitmap = unsafe {
+                core::slice::from_raw_parts_mut(registers.edx as *mut u32, word_count)
+            };
+            match collect_dirty_pages(address, size, bitmap) {
+                Ok(count) => {
+                    registers.eax = count;
+                }
+                Err(_e) => {
+                    registers.eax = 0xffff_ffff;
+                }
+            }
+        }
+
+        0x34 => {
+            // advise memory
+            // ebx = region start, ecx = region size in bytes, edx = advice
+            let address = VirtualAddress::new(registers.ebx);
+            let size = registers.ecx;
+            match advise_memory(address, size, registers.edx) {
+                Ok(()) => {
+                    registers.eax = 0;
+                }
+                Err(_e) => {
+                    registers.eax = 0xffff_ffff;
+                }
+            }
+        }
+
+        0x35 => {
+            // map file segments
+            // ebx = pointer to a SegmentMappings describing the file and an
+            // array of segments to map from it
+            use idos_api::syscall::memory::{SegmentMapping, SegmentMappings};
+            let mappings = unsafe { &*(registers.ebx as *const SegmentMappings) };
+            let path_slice = unsafe {
+                core::slice::from_raw_parts(
+                    mappings.path_ptr as *const u8,
+                    mappings.path_len as usize,
+                )
+            };
+            let segments = unsafe {
+                core::slice::from_raw_parts(
+                    mappings.segments_ptr as *const SegmentMapping,
+                    mappings.segment_count as usize,
+                )
+            };
+            let current = crate::task::switching::get_current_id();
+            let result = match core::str::from_utf8(path_slice) {
+                Ok(path) => map_file_segments_for_task(current, path, segments),
+                Err(_) => Err(MemMapError::FileUnavailable),
+            };
+            registers.eax = match result {
+                Ok(()) => 0,
+                Err(_) => 0xffff_ffff,
+            };
+        }
+
+        0x36 => {
+            // protect memory
+            // ebx = region start, ecx = region size in bytes,
+            // edx = PROT_* bits
+            let address = VirtualAddress::new(registers.ebx);
+            let size = registers.ecx;
+            match protect_memory(address, size, registers.edx) {
+                Ok(()) => {
+                    registers.eax = 0;
+                }
+                Err(_e) => {
+                    registers.eax = 0xffff_ffff;
+                }
+            }
+        }
+
         // time
         0x40 => {
             // get monotonic ms
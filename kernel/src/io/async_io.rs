@@ -72,6 +72,7 @@ pub const FILE_OP_MKDIR: u32 = 0x12;
 pub const FILE_OP_RMDIR: u32 = 0x13;
 pub const FILE_OP_UNLINK: u32 = 0x14;
 pub const FILE_OP_RENAME: u32 = 0x15;
+pub const FILE_OP_READDIR: u32 = 0x16;
 
 pub const SOCKET_OP_BROADCAST: u32 = 0x23;
 
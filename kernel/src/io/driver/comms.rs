@@ -37,6 +37,14 @@ pub enum DriverIoAction {
         buffer_len: usize,
         starting_offset: u32,
     },
+    /// List an open directory instance, providing the location and size of a
+    /// buffer to fill with entry records, and the index of the first entry.
+    ReadDir {
+        instance: u32,
+        buffer_ptr_vaddr: VirtualAddress,
+        buffer_len: usize,
+        first_index: u32,
+    },
     /// Stat an open file instance, providing the location and size of a
     /// writable stat object
     Stat {
@@ -152,6 +160,23 @@ impl DriverIoAction {
                     0,
                 ],
             },
+            Self::ReadDir {
+                instance,
+                buffer_ptr_vaddr,
+                buffer_len,
+                first_index,
+            } => Message {
+                message_type: DriverCommand::ReadDir as u32,
+                unique_id: request_id,
+                args: [
+                    *instance,
+                    buffer_ptr_vaddr.as_u32(),
+                    *buffer_len as u32,
+                    *first_index,
+                    0,
+                    0,
+                ],
+            },
             Self::Stat {
                 instance,
                 stat_ptr_vaddr,
@@ -34,6 +34,16 @@ pub trait KernelDriver {
         Some(Err(IoError::UnsupportedOperation))
     }
 
+    fn read_dir(
+        &self,
+        instance: u32,
+        buffer: &mut [u8],
+        first_index: u32,
+        io_callback: AsyncIOCallback,
+    ) -> Option<IoResult> {
+        Some(Err(IoError::UnsupportedOperation))
+    }
+
     fn stat(
         &self,
         instance: u32,
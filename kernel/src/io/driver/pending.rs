@@ -6,7 +6,7 @@ use spin::Mutex;
 use crate::{
     io::{
         async_io::{AsyncOpID, ASYNC_OP_CLOSE, ASYNC_OP_SHARE},
-        filesystem::driver::AsyncIOCallback,
+        filesystem::driver::{AsyncIOCallback, DriverID},
         handle::Handle,
     },
     task::{
@@ -29,6 +29,10 @@ struct IncomingRequest {
     pub source_io: u32,
     /// The individual async op
     pub source_op: AsyncOpID,
+    /// The installed driver the request went to, for latency accounting
+    pub driver: DriverID,
+    /// TSC reading when the request was sent
+    pub sent_at: u64,
 
     // the actual action data:
     /// The action to encode and send to the driver
@@ -38,12 +42,19 @@ struct IncomingRequest {
 static PENDING_REQUESTS: Mutex<BTreeMap<u32, IncomingRequest>> = Mutex::new(BTreeMap::new());
 static NEXT_REQUEST: AtomicU32 = AtomicU32::new(0);
 
-pub fn send_async_request(driver_id: TaskID, io_callback: AsyncIOCallback, action: DriverIoAction) {
+pub fn send_async_request(
+    driver: DriverID,
+    driver_id: TaskID,
+    io_callback: AsyncIOCallback,
+    action: DriverIoAction,
+) {
     let request = IncomingRequest {
         driver_id,
         source_task: io_callback.0,
         source_io: io_callback.1,
         source_op: io_callback.2,
+        driver,
+        sent_at: crate::latency::now(),
         action,
     };
     let request_id = NEXT_REQUEST.fetch_add(1, Ordering::SeqCst);
@@ -62,6 +73,7 @@ pub fn request_complete(request_id: u32, return_value: IoResult) {
         // TODO: shouldn't be a panic, should be an error
         panic!("Can't respond to a request for a different driver");
     }
+    crate::latency::record_driver_request(request.driver, request.sent_at);
     let Some(task_lock) = get_task(request.source_task) else {
         return;
     };
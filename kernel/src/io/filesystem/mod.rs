@@ -51,6 +51,11 @@ pub fn get_driver_id_by_name(name: &str) -> Option<DriverID> {
     None
 }
 
+pub fn get_driver_name(id: DriverID) -> Option<String> {
+    let drivers = INSTALLED_DRIVERS.read();
+    drivers.get(&*id).map(|(name, _)| name.clone())
+}
+
 pub fn get_all_drive_names() -> Vec<String> {
     let drivers = INSTALLED_DRIVERS.read();
     drivers
@@ -139,7 +144,7 @@ pub fn driver_open(
             }
             DriverType::TaskDevice(dev, sub) => {
                 let action = DriverIoAction::OpenRaw { driver_id: *sub };
-                send_async_request(*dev, io_callback, action);
+                send_async_request(driver_id, *dev, io_callback, action);
                 return None;
             }
             DriverType::TaskFilesystem(task) => {
@@ -183,7 +188,7 @@ pub fn driver_open(
                     }
                 };
 
-                send_async_request(*task, io_callback, action);
+                send_async_request(driver_id, *task, io_callback, action);
                 None
             }
         }
@@ -224,7 +229,7 @@ fn driver_path_op(
                 release_buffer(page_start, path_len);
                 let action = make_action(shared_vaddr, path_len);
 
-                send_async_request(*task, io_callback, action);
+                send_async_request(driver_id, *task, io_callback, action);
                 None
             }
         }
@@ -320,7 +325,7 @@ pub fn driver_rename(
                     dest_len: new_len,
                 };
 
-                send_async_request(*task, io_callback, action);
+                send_async_request(driver_id, *task, io_callback, action);
                 None
             }
         }
@@ -335,7 +340,7 @@ pub fn driver_close(id: DriverID, instance: u32, io_callback: AsyncIOCallback) -
 
         DriverType::TaskFilesystem(task_id) | DriverType::TaskDevice(task_id, _) => {
             let action = DriverIoAction::Close { instance };
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -348,6 +353,7 @@ pub fn driver_read(
     offset: u32,
     io_callback: AsyncIOCallback,
 ) -> Option<IoResult> {
+    crate::stats::count_driver_read(id, buffer.len());
     with_driver(id, |driver| match driver {
         DriverType::KernelFilesystem(d) | DriverType::KernelDevice(d) => {
             d.read(instance, buffer, offset, io_callback)
@@ -364,7 +370,7 @@ pub fn driver_read(
                 starting_offset: offset,
             };
 
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -377,6 +383,7 @@ pub fn driver_write(
     offset: u32,
     io_callback: AsyncIOCallback,
 ) -> Option<IoResult> {
+    crate::stats::count_driver_write(id, buffer.len());
     with_driver(id, |driver| match driver {
         DriverType::KernelFilesystem(d) | DriverType::KernelDevice(d) => {
             d.write(instance, buffer, offset, io_callback)
@@ -393,7 +400,36 @@ pub fn driver_write(
                 starting_offset: offset,
             };
 
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
+            None
+        }
+    })
+}
+
+pub fn driver_read_dir(
+    id: DriverID,
+    instance: u32,
+    buffer: &mut [u8],
+    first_index: u32,
+    io_callback: AsyncIOCallback,
+) -> Option<IoResult> {
+    with_driver(id, |driver| match driver {
+        DriverType::KernelFilesystem(d) | DriverType::KernelDevice(d) => {
+            d.read_dir(instance, buffer, first_index, io_callback)
+        }
+
+        DriverType::TaskFilesystem(task_id) | DriverType::TaskDevice(task_id, _) => {
+            let range_start = VirtualAddress::new(buffer.as_ptr() as u32);
+            let shared_vaddr = share_buffer(*task_id, range_start, buffer.len());
+
+            let action = DriverIoAction::ReadDir {
+                instance,
+                buffer_ptr_vaddr: shared_vaddr,
+                buffer_len: buffer.len(),
+                first_index,
+            };
+
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -421,7 +457,7 @@ pub fn driver_stat(
                 stat_len: core::mem::size_of::<FileStatus>(),
             };
 
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -445,7 +481,7 @@ pub fn driver_share(
                 dest_task_id: transfer_to,
                 is_move,
             };
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -484,7 +520,7 @@ pub fn driver_ioctl(
                     arg,
                 }
             };
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -510,7 +546,7 @@ pub fn driver_create_mapping(id: DriverID, path: Path) -> Option<IoResult> {
                 path_str_len: 0,
             };
             let io_callback: AsyncIOCallback = (get_current_id(), 0, AsyncOpID::new(0));
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
         DriverType::TaskFilesystem(task_id) => {
@@ -541,7 +577,7 @@ pub fn driver_create_mapping(id: DriverID, path: Path) -> Option<IoResult> {
                 }
             };
             let io_callback: AsyncIOCallback = (get_current_id(), 0, AsyncOpID::new(0));
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -564,7 +600,7 @@ pub fn driver_page_in_file(
                 frame_paddr,
             };
             let io_callback: AsyncIOCallback = (get_current_id(), 0, AsyncOpID::new(0));
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -578,7 +614,7 @@ pub fn driver_remove_mapping(id: DriverID, token: DriverMappingToken) -> Option<
                 mapping_token: *token,
             };
             let io_callback: AsyncIOCallback = (get_current_id(), 0, AsyncOpID::new(0));
-            send_async_request(*task_id, io_callback, action);
+            send_async_request(id, *task_id, io_callback, action);
             None
         }
     })
@@ -3,22 +3,37 @@ use crate::{
     memory::physical::with_allocator,
 };
 use alloc::string::String;
+use alloc::vec::Vec;
 use idos_api::io::error::{IoError, IoResult};
 use idos_api::io::file::FileStatus;
+use idos_api::stats::{
+    CpuEvents, EventsHeader, DRIVER_SLOTS, IRQ_LINES, LATENCY_IOCTL_RESET, PROFILE_IOCTL_START,
+    PROFILE_IOCTL_STOP, SYSCALL_BUCKETS,
+};
 use spin::RwLock;
 
 use super::{driver::AsyncIOCallback, get_all_drive_names};
 
+/// The contents of a file are rendered once when it is opened, so that reads
+/// at any offset see the same snapshot and don't pay to rebuild it.
+/// The profile is the exception: collecting it consumes the samples, so it
+/// waits for the first read. That way a handle opened only to send ioctls
+/// leaves the samples in place.
 struct OpenFile {
     listing: ListingType,
+    content: Option<Vec<u8>>,
 }
 
 enum ListingType {
     RootDir,
     CPU,
     Drives,
+    Events,
+    EventsBinary,
     KernInfo,
+    Latency,
     Memory,
+    Profile,
 }
 
 impl ListingType {
@@ -26,14 +41,19 @@ impl ListingType {
         match s.to_uppercase().as_str() {
             "CPU" => Some(Self::CPU),
             "DRIVES" => Some(Self::Drives),
+            "EVENTS" => Some(Self::Events),
+            "EVENTS.BIN" => Some(Self::EventsBinary),
             "KERNINFO" => Some(Self::KernInfo),
+            "LATENCY" => Some(Self::Latency),
             "MEMORY" => Some(Self::Memory),
+            "PROFILE" => Some(Self::Profile),
             _ => None,
         }
     }
 }
 
-const ROOT_LISTING: &str = "CPU\0DRIVES\0KERNINFO\0MEMORY\0";
+const ROOT_LISTING: &str =
+    "CPU\0DRIVES\0EVENTS\0EVENTS.BIN\0KERNINFO\0LATENCY\0MEMORY\0PROFILE\0";
 
 pub struct SysFS {
     open_files: RwLock<SlotList<OpenFile>>,
@@ -47,34 +67,45 @@ impl SysFS {
     }
 
     fn open_impl(&self, path: Path) -> IoResult {
-        let open_file = if path.is_empty() {
-            OpenFile {
-                listing: ListingType::RootDir,
-            }
+        let listing = if path.is_empty() {
+            ListingType::RootDir
         } else if let Some(listing_type) = ListingType::from_str(path.as_str()) {
-            OpenFile {
-                listing: listing_type,
-            }
+            listing_type
         } else {
             return Err(IoError::NotFound);
         };
-        let index = self.open_files.write().insert(open_file);
+        let content = match &listing {
+            ListingType::Profile => None,
+            other => Some(Self::generate_content(other)),
+        };
+        let index = self.open_files.write().insert(OpenFile { listing, content });
         Ok(index as u32)
     }
 
+    fn generate_content(listing: &ListingType) -> Vec<u8> {
+        match listing {
+            ListingType::RootDir => Vec::from(ROOT_LISTING.as_bytes()),
+            ListingType::CPU => Self::generate_cpu_content().into_bytes(),
+            ListingType::Drives => Self::generate_drives_content().into_bytes(),
+            ListingType::Events => Self::generate_events_content().into_bytes(),
+            ListingType::EventsBinary => Self::generate_events_binary(),
+            ListingType::KernInfo => Self::generate_kerninfo_content().into_bytes(),
+            ListingType::Latency => crate::latency::render().into_bytes(),
+            ListingType::Memory => Self::generate_memory_content().into_bytes(),
+            ListingType::Profile => crate::profiler::take_samples(),
+        }
+    }
+
     fn read_impl(&self, instance: u32, buffer: &mut [u8], offset: u32) -> IoResult {
         let mut open_files = self.open_files.write();
         let open_file = open_files
             .get_mut(instance as usize)
             .ok_or(IoError::FileHandleInvalid)?;
-        let content_string = match open_file.listing {
-            ListingType::RootDir => String::from(ROOT_LISTING),
-            ListingType::CPU => Self::generate_cpu_content(),
-            ListingType::Drives => Self::generate_drives_content(),
-            ListingType::KernInfo => Self::generate_kerninfo_content(),
-            ListingType::Memory => Self::generate_memory_content(),
-        };
-        let content_bytes = content_string.as_bytes();
+        let listing = &open_file.listing;
+        let content_bytes = open_file
+            .content
+            .get_or_insert_with(|| Self::generate_content(listing))
+            .as_slice();
         if offset >= content_bytes.len() as u32 {
             return Ok(0);
         }
@@ -119,6 +150,90 @@ impl SysFS {
         names.join("\n")
     }
 
+    fn generate_events_content() -> String {
+        use alloc::fmt::Write;
+        let (header, per_cpu) = crate::stats::snapshot();
+        let mut out = String::new();
+        for (cpu, events) in per_cpu.iter().enumerate() {
+            let _ = write!(
+                out,
+                "CPU {}:  switches {}  page faults {}  IPIs {}\n",
+                cpu, events.context_switches, events.page_faults, events.ipis,
+            );
+        }
+
+        // Everything else is summed across CPUs, leaving out idle entries
+        let total = |field: fn(&CpuEvents) -> &[u32], index: usize| -> u32 {
+            per_cpu
+                .iter()
+                .fold(0u32, |sum, events| sum.wrapping_add(field(events)[index]))
+        };
+        out.push_str("Syscalls:");
+        for number in 0..SYSCALL_BUCKETS {
+            let count = total(|e| &e.syscalls, number);
+            if count > 0 {
+                let _ = write!(out, "  {:#04x}={}", number, count);
+            }
+        }
+        out.push_str("\nIRQs:");
+        for line in 0..IRQ_LINES {
+            let count = total(|e| &e.irqs, line);
+            if count > 0 {
+                let _ = write!(out, "  {}={}", line, count);
+            }
+        }
+        out.push('\n');
+        for slot in 0..DRIVER_SLOTS {
+            let reads = total(|e| &e.driver_reads, slot);
+            let writes = total(|e| &e.driver_writes, slot);
+            if reads == 0 && writes == 0 {
+                continue;
+            }
+            let _ = write!(
+                out,
+                "Driver {}:  reads {} ({} bytes)  writes {} ({} bytes)\n",
+                slot,
+                reads,
+                total(|e| &e.driver_read_bytes, slot),
+                writes,
+                total(|e| &e.driver_write_bytes, slot),
+            );
+        }
+        let _ = write!(
+            out,
+            "Heap:  size {}  in use {}  allocations {}  frees {}\nScratch pages:  maps {}  contended {}",
+            header.heap_size,
+            header.heap_in_use,
+            header.heap_allocations,
+            header.heap_frees,
+            header.scratch_maps,
+            header.scratch_contended,
+        );
+        out
+    }
+
+    /// The same counters as `generate_events_content`, laid out as an
+    /// `EventsHeader` followed by one `CpuEvents` per CPU
+    fn generate_events_binary() -> Vec<u8> {
+        let (header, per_cpu) = crate::stats::snapshot();
+        let mut out = Vec::with_capacity(
+            core::mem::size_of::<EventsHeader>() + per_cpu.len() * header.cpu_record_size as usize,
+        );
+        out.extend_from_slice(Self::as_bytes(&header));
+        for events in per_cpu.iter() {
+            out.extend_from_slice(Self::as_bytes(events));
+        }
+        out
+    }
+
+    fn as_bytes<T: Copy>(value: &T) -> &[u8] {
+        // The stats records are repr(C) and made only of u32s, so they have no
+        // padding bytes
+        unsafe {
+            core::slice::from_raw_parts(value as *const T as *const u8, core::mem::size_of::<T>())
+        }
+    }
+
     fn generate_kerninfo_content() -> String {
         String::from("IDOS-NX Version 0.1\n")
     }
@@ -135,6 +250,28 @@ impl SysFS {
         )
     }
 
+    fn ioctl_impl(&self, instance: u32, ioctl: u32, arg: u32) -> IoResult {
+        let open_files = self.open_files.read();
+        let open_file = open_files
+            .get(instance as usize)
+            .ok_or(IoError::FileHandleInvalid)?;
+        match (&open_file.listing, ioctl) {
+            (ListingType::Profile, PROFILE_IOCTL_START) => {
+                crate::profiler::start(arg);
+                Ok(1)
+            }
+            (ListingType::Profile, PROFILE_IOCTL_STOP) => {
+                crate::profiler::stop();
+                Ok(1)
+            }
+            (ListingType::Latency, LATENCY_IOCTL_RESET) => {
+                crate::latency::reset();
+                Ok(1)
+            }
+            _ => Err(IoError::UnsupportedOperation),
+        }
+    }
+
     fn stat_impl(&self, instance: u32, file_status: &mut FileStatus) -> IoResult {
         let open_files = self.open_files.read();
         let _ = open_files
@@ -174,6 +311,17 @@ impl KernelDriver for SysFS {
         Some(self.stat_impl(instance, file_status))
     }
 
+    fn ioctl(
+        &self,
+        instance: u32,
+        ioctl: u32,
+        arg: u32,
+        _arg_len: usize,
+        _io_callback: AsyncIOCallback,
+    ) -> Option<IoResult> {
+        Some(self.ioctl_impl(instance, ioctl, arg))
+    }
+
     fn close(&self, instance: u32, _io_callback: AsyncIOCallback) -> Option<IoResult> {
         if self.open_files.write().remove(instance as usize).is_none() {
             Some(Err(IoError::FileHandleInvalid))
@@ -1,3 +1,5 @@
+use core::fmt::Write;
+
 use alloc::string::{String, ToString};
 use idos_api::io::file::FileStatus;
 use spin::RwLock;
@@ -9,6 +11,9 @@ use crate::io::filesystem::driver::AsyncIOCallback;
 use crate::task::id::TaskID;
 use crate::task::map::for_each_task_id;
 use crate::task::map::get_task;
+use crate::task::paging::ExternalPageDirectory;
+use crate::task::state::RunState;
+use crate::time::system::MS_PER_TICK;
 use idos_api::io::error::{IoError, IoResult};
 
 pub struct TaskFileSystem {
@@ -33,17 +38,41 @@ impl TaskFileSystem {
 
     pub fn generate_content_for_task(id: TaskID) -> Option<String> {
         let task_lock = get_task(id)?;
-        let task = task_lock.read();
         let mut content = String::new();
-        content.push_str("ID: ");
-        content.push_str(&id.to_string());
-        content.push_str("\nName: ");
-        content.push_str(&task.filename);
-        content.push_str("\nState: ");
-        content.push_str(&task.state.to_string());
-        content.push_str("\nParent: ");
-        content.push_str(&task.parent_id.to_string());
-        content.push('\n');
+        let (usage, resident_pages) = {
+            let task = task_lock.read();
+            content.push_str("ID: ");
+            content.push_str(&id.to_string());
+            content.push_str("\nName: ");
+            content.push_str(&task.filename);
+            content.push_str("\nState: ");
+            content.push_str(&task.state.to_string());
+            content.push_str("\nParent: ");
+            content.push_str(&task.parent_id.to_string());
+            content.push('\n');
+            // The read guard stays held while the page tables are walked, so
+            // the task can't be torn down underneath. The walk only uses
+            // scratch mappings and takes no task locks. A terminated task's
+            // page tables may already be on their way back to the allocator,
+            // so only live tasks are measured.
+            let is_live = !matches!(task.state, RunState::Terminated);
+            let resident_pages = if is_live && task.page_directory.as_u32() != 0 {
+                ExternalPageDirectory::at(id, task.page_directory).count_user_pages()
+            } else {
+                0
+            };
+            (task.accounting.snapshot(), resident_pages)
+        };
+
+        let _ = writeln!(content, "User Time: {} ms", usage.user_ticks * MS_PER_TICK);
+        let _ = writeln!(content, "Kernel Time: {} ms", usage.kernel_ticks * MS_PER_TICK);
+        let _ = writeln!(content, "Switches: {}", usage.context_switches);
+        let _ = writeln!(content, "Page Faults: {}", usage.page_faults);
+        let _ = writeln!(content, "Reads: {}", usage.reads);
+        let _ = writeln!(content, "Read Bytes: {}", usage.read_bytes);
+        let _ = writeln!(content, "Writes: {}", usage.writes);
+        let _ = writeln!(content, "Write Bytes: {}", usage.write_bytes);
+        let _ = writeln!(content, "Resident Pages: {}", resident_pages);
         Some(content)
     }
 
@@ -143,3 +172,45 @@ impl KernelDriver for TaskFileSystem {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::TaskFileSystem;
+    use crate::memory::address::{PhysicalAddress, VirtualAddress};
+    use crate::task::actions::memory::map_memory_for_task;
+    use crate::task::id::TaskID;
+    use crate::task::memory::MemoryBacking;
+
+    fn resident_pages(id: TaskID) -> u32 {
+        let content = TaskFileSystem::generate_content_for_task(id).unwrap();
+        let line = content
+            .lines()
+            .find_map(|line| line.strip_prefix("Resident Pages: "))
+            .unwrap();
+        line.parse().unwrap()
+    }
+
+    #[test_case]
+    fn resident_pages_counts_child_mappings() {
+        let child = crate::task::actions::lifecycle::create_task();
+        let before = resident_pages(child);
+        // Direct mappings are present as soon as they are made. The second
+        // one sits under a different page table.
+        let vga = PhysicalAddress::new(0xb8000);
+        map_memory_for_task(
+            child,
+            Some(VirtualAddress::new(0x2000_0000)),
+            0x3000,
+            MemoryBacking::Direct(vga),
+        )
+        .unwrap();
+        map_memory_for_task(
+            child,
+            Some(VirtualAddress::new(0x2040_0000)),
+            0x2000,
+            MemoryBacking::Direct(vga),
+        )
+        .unwrap();
+        assert_eq!(resident_pages(child), before + 5);
+    }
+}
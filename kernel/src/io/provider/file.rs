@@ -4,10 +4,13 @@ use super::{AsyncOpQueue, IOProvider, OpIdGenerator, UnmappedAsyncOp};
 use crate::{
     files::path::Path,
     io::{
-        async_io::{AsyncOpID, FILE_OP_IOCTL, FILE_OP_MKDIR, FILE_OP_RENAME, FILE_OP_RMDIR, FILE_OP_STAT, FILE_OP_UNLINK},
+        async_io::{
+            AsyncOpID, ASYNC_OP_READ, ASYNC_OP_WRITE, FILE_OP_IOCTL, FILE_OP_MKDIR,
+            FILE_OP_READDIR, FILE_OP_RENAME, FILE_OP_RMDIR, FILE_OP_STAT, FILE_OP_UNLINK,
+        },
         filesystem::{
             driver::DriverID, driver_close, driver_ioctl, driver_mkdir, driver_open, driver_read,
-            driver_rename, driver_rmdir, driver_share, driver_stat, driver_unlink, driver_write,
+            driver_read_dir, driver_rename, driver_rmdir, driver_share, driver_stat, driver_unlink, driver_write,
             get_driver_id_by_name,
         },
         handle::Handle,
@@ -61,6 +64,22 @@ impl FileIOProvider {
         }
     }
 
+    /// Charge a finished read or write to the task that owns this handle
+    fn account(&self, op_code: u32, result: &IoResult) {
+        let Ok(bytes) = result else {
+            return;
+        };
+        let Some(task_lock) = get_task(self.source_id.load(Ordering::SeqCst)) else {
+            return;
+        };
+        let accounting = task_lock.read().accounting.clone();
+        match op_code & 0xffff {
+            ASYNC_OP_READ => accounting.count_read(*bytes),
+            ASYNC_OP_WRITE => accounting.count_write(*bytes),
+            _ => (),
+        }
+    }
+
     pub fn is_bound(&self) -> bool {
         self.bound_instance.lock().is_some()
     }
@@ -113,6 +132,7 @@ impl IOProvider for FileIOProvider {
 
         match self.run_op(provider_index, id) {
             Some(result) => {
+                self.account(op.op_code, &result);
                 if let Some(completed_op) = self.remove_op(id) {
                     if let Ok(_) = result {
                         completed_op.maybe_close_handle(get_current_task(), provider_index);
@@ -132,6 +152,13 @@ impl IOProvider for FileIOProvider {
         self.pending_ops.read().get(&id).cloned()
     }
 
+    fn async_complete(&self, id: AsyncOpID, result: IoResult) -> Option<UnmappedAsyncOp> {
+        let found_op = self.remove_op(id)?;
+        self.account(found_op.op_code, &result);
+        found_op.complete(self.transform_result(found_op.op_code, result));
+        Some(found_op)
+    }
+
     fn remove_op(&self, id: AsyncOpID) -> Option<UnmappedAsyncOp> {
         self.pending_ops.write().remove(&id)
     }
@@ -326,6 +353,20 @@ impl IOProvider for FileIOProvider {
                         (self.source_id.load(Ordering::SeqCst), provider_index, id),
                     );
                 }
+                FILE_OP_READDIR => {
+                    let buffer_ptr = op.args[0] as *mut u8;
+                    let buffer_len = op.args[1] as usize;
+                    let buffer = unsafe { core::slice::from_raw_parts_mut(buffer_ptr, buffer_len) };
+                    let first_index = op.args[2];
+                    let driver_id: DriverID = self.driver_id.lock().unwrap();
+                    return driver_read_dir(
+                        driver_id,
+                        instance,
+                        buffer,
+                        first_index,
+                        (self.source_id.load(Ordering::SeqCst), provider_index, id),
+                    );
+                }
                 FILE_OP_IOCTL => {
                     let ioctl = op.args[0];
                     let arg = op.args[1];
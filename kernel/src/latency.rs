@@ -0,0 +1,208 @@
+//! Latency histograms.
+//!
+//! Syscalls, IRQ handlers and requests to driver tasks are timed with the TSC,
+//! and each duration lands in a bucket by its power of two. Recording one is
+//! two `rdtsc`s and a single relaxed atomic add, with no locks, so the
+//! histograms are always on and safe to update from interrupt context.
+//!
+//! A syscall is timed from entry to return, so one that blocks (sleeping,
+//! waiting on a futex) includes the time spent blocked, which is what its
+//! caller saw. A driver request is timed from when it is sent to the driver
+//! task until the driver completes it.
+//!
+//! A span that blocks can end on a different CPU than it started on, and
+//! the TSCs of different CPUs aren't guaranteed to agree. Such a span is off
+//! by the skew between them, and one that comes out negative is recorded as
+//! zero rather than wrapping, which hides the skew instead of reporting it.
+//!
+//! Drivers are timed by ID, and like the event counters, drivers with IDs
+//! past the end of the table share its last slot.
+//!
+//! Results are listed in `SYS:\LATENCY`, and the `LATENCY_IOCTL_RESET` ioctl
+//! on that file clears them.
+
+use core::fmt::Write;
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use alloc::format;
+use alloc::string::String;
+use idos_api::stats::{DRIVER_SLOTS, IRQ_LINES, LATENCY_BUCKETS, SYSCALL_BUCKETS};
+
+use crate::arch::rdtsc;
+use crate::io::filesystem::driver::DriverID;
+use crate::io::filesystem::get_driver_name;
+
+pub struct Histogram {
+    buckets: [AtomicU32; LATENCY_BUCKETS],
+}
+
+impl Histogram {
+    pub const fn new() -> Self {
+        Self {
+            buckets: [const { AtomicU32::new(0) }; LATENCY_BUCKETS],
+        }
+    }
+
+    pub fn record(&self, cycles: u64) {
+        self.buckets[bucket_for(cycles)].fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> [u32; LATENCY_BUCKETS] {
+        let mut counts = [0; LATENCY_BUCKETS];
+        for (count, bucket) in counts.iter_mut().zip(self.buckets.iter()) {
+            *count = bucket.load(Ordering::Relaxed);
+        }
+        counts
+    }
+
+    pub fn reset(&self) {
+        for bucket in self.buckets.iter() {
+            bucket.store(0, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Index of the highest set bit, so that 2^n..2^(n+1) all share bucket n
+fn bucket_for(cycles: u64) -> usize {
+    let log2 = 63 - (cycles | 1).leading_zeros() as usize;
+    log2.min(LATENCY_BUCKETS - 1)
+}
+
+static SYSCALLS: [Histogram; SYSCALL_BUCKETS] = [const { Histogram::new() }; SYSCALL_BUCKETS];
+static IRQS: [Histogram; IRQ_LINES] = [const { Histogram::new() }; IRQ_LINES];
+static DRIVERS: [Histogram; DRIVER_SLOTS] = [const { Histogram::new() }; DRIVER_SLOTS];
+
+/// Read the TSC, for use as the start of a timed span
+pub fn now() -> u64 {
+    let (high, low) = rdtsc();
+    (high as u64) << 32 | low as u64
+}
+
+fn since(start: u64) -> u64 {
+    now().saturating_sub(start)
+}
+
+pub fn record_syscall(number: u32, start: u64) {
+    let bucket = (number as usize).min(SYSCALL_BUCKETS - 1);
+    SYSCALLS[bucket].record(since(start));
+}
+
+pub fn record_irq(irq: u32, start: u64) {
+    if let Some(histogram) = IRQS.get(irq as usize) {
+        histogram.record(since(start));
+    }
+}
+
+pub fn record_driver_request(id: DriverID, start: u64) {
+    let slot = (*id as usize).min(DRIVER_SLOTS - 1);
+    DRIVERS[slot].record(since(start));
+}
+
+pub fn reset() {
+    for histogram in SYSCALLS.iter().chain(IRQS.iter()).chain(DRIVERS.iter()) {
+        histogram.reset();
+    }
+}
+
+/// Render every histogram that has recorded anything, as the contents of
+/// `SYS:\LATENCY`
+pub fn render() -> String {
+    let mut out = String::from(
+        "Latency in TSC cycles. Each n:count is how many events took 2^n to 2^(n+1)-1 cycles,\n\
+         and the last bucket also holds anything longer, so it only has a lower bound\n",
+    );
+    for (number, histogram) in SYSCALLS.iter().enumerate() {
+        render_histogram(&mut out, || format!("Syscall {:#04x}", number), histogram);
+    }
+    for (line, histogram) in IRQS.iter().enumerate() {
+        render_histogram(&mut out, || format!("IRQ {}", line), histogram);
+    }
+    for (slot, histogram) in DRIVERS.iter().enumerate() {
+        let label = || {
+            if slot == DRIVER_SLOTS - 1 {
+                return format!("Drivers {} and up", slot);
+            }
+            match get_driver_name(DriverID::new(slot as u32)) {
+                Some(name) => format!("Driver {} ({})", slot, name),
+                None => format!("Driver {}", slot),
+            }
+        };
+        render_histogram(&mut out, label, histogram);
+    }
+    out
+}
+
+fn render_histogram<L: FnOnce() -> String>(out: &mut String, label: L, histogram: &Histogram) {
+    let counts = histogram.snapshot();
+    let total: u64 = counts.iter().map(|&c| c as u64).sum();
+    if total == 0 {
+        return;
+    }
+    // Percentiles are reported as the bound of the bucket they fall in
+    let percentile = |p: u64| {
+        let target = (total * p).div_ceil(100);
+        let mut seen = 0;
+        for (n, &count) in counts.iter().enumerate() {
+            seen += count as u64;
+            if seen >= target {
+                return bucket_bound(n);
+            }
+        }
+        bucket_bound(LATENCY_BUCKETS - 1)
+    };
+    let highest = counts.iter().rposition(|&c| c > 0).unwrap_or(0);
+    let _ = write!(
+        out,
+        "{}:  count {}  p50 {}  p99 {}  max {}\n   ",
+        label(),
+        total,
+        percentile(50),
+        percentile(99),
+        bucket_bound(highest),
+    );
+    for (n, &count) in counts.iter().enumerate() {
+        if count > 0 {
+            let _ = write!(out, " {}:{}", n, count);
+        }
+    }
+    out.push('\n');
+}
+
+/// Bucket n holds everything under 2^(n+1), except the last, which is open
+/// ended and can only say how long its events took at least
+fn bucket_bound(n: usize) -> String {
+    if n >= LATENCY_BUCKETS - 1 {
+        format!(">= {}", 1u64 << (LATENCY_BUCKETS - 1))
+    } else {
+        format!("< {}", 1u64 << (n + 1))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test_case]
+    fn durations_land_in_power_of_two_buckets() {
+        assert_eq!(bucket_for(0), 0);
+        assert_eq!(bucket_for(1), 0);
+        assert_eq!(bucket_for(2), 1);
+        assert_eq!(bucket_for(3), 1);
+        assert_eq!(bucket_for(1024), 10);
+        assert_eq!(bucket_for(2047), 10);
+        assert_eq!(bucket_for(u64::MAX), LATENCY_BUCKETS - 1);
+
+        let histogram = Histogram::new();
+        histogram.record(5);
+        histogram.record(6);
+        histogram.record(1 << 20);
+        let counts = histogram.snapshot();
+        assert_eq!(counts[2], 2);
+        assert_eq!(counts[20], 1);
+        histogram.reset();
+        assert!(histogram.snapshot().iter().all(|&c| c == 0));
+
+        assert_eq!(bucket_bound(10), "< 2048");
+        assert_eq!(bucket_bound(LATENCY_BUCKETS - 1), ">= 2147483648");
+    }
+}
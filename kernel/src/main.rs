@@ -30,12 +30,15 @@ pub mod hardware;
 pub mod init;
 pub mod interrupts;
 pub mod io;
+pub mod latency;
 pub mod log;
 pub mod memory;
 pub mod net;
 pub mod panic;
 pub mod pipes;
+pub mod profiler;
 pub mod random;
+pub mod stats;
 pub mod sync;
 pub mod task;
 pub mod time;
@@ -140,6 +140,10 @@ impl ListAllocator {
         }
     }
 
+    pub fn get_size(&self) -> usize {
+        self.size
+    }
+
     pub fn find_last_node(&self) -> &mut AllocNode {
         let mut current = self.first_free;
         loop {
@@ -36,14 +36,16 @@ unsafe impl GlobalAlloc for Allocator {
                 let pages_needed = (space_needed / 0x1000) + 1;
                 allocator.expand(pages_needed);
             } else {
+                crate::stats::count_heap_alloc(layout.size());
                 return ptr;
             }
         }
     }
 
-    unsafe fn dealloc(&self, ptr: *mut u8, _layout: Layout) {
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
         let mut allocator = self.locked_allocator.lock();
         allocator.dealloc(ptr);
+        crate::stats::count_heap_free(layout.size());
     }
 }
 
@@ -81,6 +83,11 @@ pub fn init_allocator(location: VirtualAddress) {
     ));
 }
 
+/// Current size of the kernel heap in bytes, including free space
+pub fn heap_size() -> usize {
+    ALLOCATOR.locked_allocator.lock().get_size()
+}
+
 #[alloc_error_handler]
 fn alloc_error_handler(layout: Layout) -> ! {
     panic!("Alloc error: {:?}", layout);
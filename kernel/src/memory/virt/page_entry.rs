@@ -66,7 +66,23 @@ impl PageTableEntry {
         self.0 |= ENTRY_WRITE_ACCESS;
     }
 
+    pub fn clear_user_access(&mut self) {
+        self.0 &= !ENTRY_USER_ACCESS;
+    }
+
+    pub fn clear_write_access(&mut self) {
+        self.0 &= !ENTRY_WRITE_ACCESS;
+    }
+
     pub fn set_no_reclaim(&mut self) {
         self.0 |= ENTRY_NO_RECLAIM;
     }
+
+    pub fn is_dirty(&self) -> bool {
+        self.0 & ENTRY_DIRTY != 0
+    }
+
+    pub fn clear_dirty(&mut self) {
+        self.0 &= !ENTRY_DIRTY;
+    }
 }
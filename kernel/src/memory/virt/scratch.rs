@@ -26,6 +26,7 @@ impl UnmappedPage {
         for i in 0..SCRATCH_PAGE_COUNT {
             let prev = SCRATCH_PAGES.fetch_or(mask, Ordering::SeqCst);
             if prev & mask == 0 {
+                crate::stats::count_scratch_map(i as u32);
                 // Found an unused scratch table.
                 // Because the top pagedir entry is self-mapped:
                 //   - The top 0x1000 of memory will contain the pagedir
@@ -0,0 +1,192 @@
+//! Sampling profiler.
+//!
+//! While profiling is on, every CPU records what it interrupted on each timer
+//! tick: the task, the instruction pointer, and whether it was in the kernel,
+//! user space or VM86 mode. Samples go into a ring per CPU, so CPUs never wait
+//! on each other, and are collected by opening `SYS:\PROFILE`. The profiler is
+//! started and stopped with ioctls on that file.
+//!
+//! Samples are taken in interrupt context, so nothing there may block or
+//! allocate. The rings are allocated when profiling starts, and a sample that
+//! finds its ring locked by a reader is counted as dropped instead.
+
+use core::sync::atomic::{AtomicBool, AtomicU32, Ordering};
+
+use alloc::collections::{BTreeSet, VecDeque};
+use alloc::vec::Vec;
+use idos_api::stats::{
+    ProfileHeader, ProfileSample, ProfileTask, PROFILE_NAME_LEN, PROFILE_VERSION, SAMPLE_USER,
+    SAMPLE_VM86,
+};
+use spin::{Mutex, RwLock};
+
+use crate::interrupts::stack::StackFrame;
+use crate::task::id::TaskID;
+use crate::task::map::get_task;
+use crate::task::scheduling::get_cpu_scheduler;
+use crate::time::system::{get_system_ticks, MS_PER_TICK};
+
+/// Samples kept per CPU between reads. At one sample per 10ms tick, this is
+/// about forty seconds.
+const RING_CAPACITY: usize = 4096;
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static INTERVAL_TICKS: AtomicU32 = AtomicU32::new(1);
+static DROPPED: AtomicU32 = AtomicU32::new(0);
+
+/// One ring per CPU, indexed by CPU index
+static RINGS: RwLock<Vec<Mutex<VecDeque<ProfileSample>>>> = RwLock::new(Vec::new());
+
+/// Begin sampling every `interval_ticks` timer ticks, discarding anything
+/// collected so far
+pub fn start(interval_ticks: u32) {
+    ENABLED.store(false, Ordering::SeqCst);
+    {
+        let cpu_count = crate::hardware::cpu::CPU_COUNT.load(Ordering::SeqCst);
+        let mut rings = RINGS.write();
+        if rings.len() != cpu_count {
+            *rings = (0..cpu_count)
+                .map(|_| Mutex::new(VecDeque::with_capacity(RING_CAPACITY)))
+                .collect();
+        }
+        for ring in rings.iter() {
+            ring.lock().clear();
+        }
+    }
+    DROPPED.store(0, Ordering::SeqCst);
+    INTERVAL_TICKS.store(interval_ticks.max(1), Ordering::SeqCst);
+    ENABLED.store(true, Ordering::SeqCst);
+}
+
+pub fn stop() {
+    ENABLED.store(false, Ordering::SeqCst);
+}
+
+/// Called from the timer interrupt on each CPU, with the frame of whatever
+/// the interrupt stopped
+pub fn sample(frame: &StackFrame) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    if get_system_ticks() % INTERVAL_TICKS.load(Ordering::Relaxed) != 0 {
+        return;
+    }
+    let scheduler = get_cpu_scheduler();
+    let is_vm86 = frame.eflags & 0x20000 != 0;
+    let is_user = frame.cs & 3 != 0 || is_vm86;
+    let mut flags = 0;
+    if is_user {
+        flags |= SAMPLE_USER;
+    }
+    if is_vm86 {
+        flags |= SAMPLE_VM86;
+    }
+    let sample = ProfileSample {
+        eip: frame.eip,
+        task: scheduler.get_current_task().into(),
+        cs: frame.cs as u16,
+        cpu: scheduler.get_cpu_index() as u8,
+        flags,
+    };
+
+    let recorded = RINGS.try_read().and_then(|rings| {
+        let mut ring = rings.get(scheduler.get_cpu_index())?.try_lock()?;
+        if ring.len() == RING_CAPACITY {
+            ring.pop_front();
+            DROPPED.fetch_add(1, Ordering::Relaxed);
+        }
+        ring.push_back(sample);
+        Some(())
+    });
+    if recorded.is_none() {
+        DROPPED.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// Take every sample collected so far, laid out as the contents of
+/// `SYS:\PROFILE`
+pub fn take_samples() -> Vec<u8> {
+    let mut samples: Vec<ProfileSample> = Vec::new();
+    for ring in RINGS.read().iter() {
+        let mut ring = ring.lock();
+        samples.extend(ring.iter().copied());
+        ring.clear();
+    }
+
+    let task_ids: BTreeSet<u32> = samples.iter().map(|s| s.task).collect();
+    let tasks: Vec<ProfileTask> = task_ids
+        .into_iter()
+        .filter_map(|id| {
+            let task_lock = get_task(TaskID::new(id))?;
+            let task = task_lock.read();
+            let mut name = [0; PROFILE_NAME_LEN];
+            let len = task.filename.len().min(PROFILE_NAME_LEN);
+            name[..len].copy_from_slice(&task.filename.as_bytes()[..len]);
+            Some(ProfileTask { id, name })
+        })
+        .collect();
+
+    let header = ProfileHeader {
+        version: PROFILE_VERSION,
+        sample_count: samples.len() as u32,
+        task_count: tasks.len() as u32,
+        dropped: DROPPED.swap(0, Ordering::Relaxed),
+        interval_ms: INTERVAL_TICKS.load(Ordering::Relaxed) * MS_PER_TICK,
+    };
+
+    let mut out = Vec::with_capacity(
+        core::mem::size_of::<ProfileHeader>()
+            + samples.len() * core::mem::size_of::<ProfileSample>()
+            + tasks.len() * core::mem::size_of::<ProfileTask>(),
+    );
+    out.extend_from_slice(as_bytes(&header));
+    for sample in samples.iter() {
+        out.extend_from_slice(as_bytes(sample));
+    }
+    for task in tasks.iter() {
+        out.extend_from_slice(as_bytes(task));
+    }
+    out
+}
+
+fn as_bytes<T: Copy>(value: &T) -> &[u8] {
+    // The profile records are repr(C) with no padding bytes
+    unsafe { core::slice::from_raw_parts(value as *const T as *const u8, core::mem::size_of::<T>()) }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test_case]
+    fn samples_are_taken_once() {
+        start(1);
+        let frame = StackFrame {
+            eip: 0x1234,
+            cs: 0x1b,
+            eflags: 0x202,
+        };
+        sample(&frame);
+        sample(&frame);
+        stop();
+        sample(&frame);
+
+        let data = take_samples();
+        let header = unsafe { core::ptr::read_unaligned(data.as_ptr() as *const ProfileHeader) };
+        assert_eq!(header.version, PROFILE_VERSION);
+        // The timer may take kernel samples alongside the test's own
+        let ours = (0..header.sample_count as usize)
+            .map(|i| {
+                let offset = core::mem::size_of::<ProfileHeader>()
+                    + i * core::mem::size_of::<ProfileSample>();
+                unsafe { core::ptr::read_unaligned(data[offset..].as_ptr() as *const ProfileSample) }
+            })
+            .filter(|s| s.eip == 0x1234 && s.flags == SAMPLE_USER)
+            .count();
+        assert_eq!(ours, 2);
+
+        let again = take_samples();
+        let header = unsafe { core::ptr::read_unaligned(again.as_ptr() as *const ProfileHeader) };
+        assert_eq!(header.sample_count, 0);
+    }
+}
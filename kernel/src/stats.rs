@@ -0,0 +1,192 @@
+//! Event counters for tuning and diagnostics.
+//!
+//! Most events are counted per CPU, in an `EventCounters` that lives in that
+//! CPU's scheduler struct. Only the owning CPU ever increments them, so the
+//! counters never bounce between caches, and reading them from elsewhere is
+//! just a set of relaxed loads. The kernel heap and the scratch pages are
+//! shared by every CPU and may be used before any scheduler exists, so their
+//! counters are plain globals.
+//!
+//! Counters are exposed through sysfs, as text in `SYS:\EVENTS` and in the
+//! fixed binary layout from `idos_api::stats` in `SYS:\EVENTS.BIN`.
+
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use alloc::vec::Vec;
+use idos_api::stats::{
+    CpuEvents, EventsHeader, DRIVER_SLOTS, EVENTS_VERSION, IRQ_LINES, SYSCALL_BUCKETS,
+};
+
+use crate::io::filesystem::driver::DriverID;
+use crate::task::scheduling::{get_all_cpu_counters, get_cpu_scheduler};
+
+pub struct EventCounters {
+    context_switches: AtomicU32,
+    page_faults: AtomicU32,
+    ipis: AtomicU32,
+    syscalls: [AtomicU32; SYSCALL_BUCKETS],
+    irqs: [AtomicU32; IRQ_LINES],
+    driver_reads: [AtomicU32; DRIVER_SLOTS],
+    driver_writes: [AtomicU32; DRIVER_SLOTS],
+    driver_read_bytes: [AtomicU32; DRIVER_SLOTS],
+    driver_write_bytes: [AtomicU32; DRIVER_SLOTS],
+}
+
+impl EventCounters {
+    pub const fn new() -> Self {
+        Self {
+            context_switches: AtomicU32::new(0),
+            page_faults: AtomicU32::new(0),
+            ipis: AtomicU32::new(0),
+            syscalls: [const { AtomicU32::new(0) }; SYSCALL_BUCKETS],
+            irqs: [const { AtomicU32::new(0) }; IRQ_LINES],
+            driver_reads: [const { AtomicU32::new(0) }; DRIVER_SLOTS],
+            driver_writes: [const { AtomicU32::new(0) }; DRIVER_SLOTS],
+            driver_read_bytes: [const { AtomicU32::new(0) }; DRIVER_SLOTS],
+            driver_write_bytes: [const { AtomicU32::new(0) }; DRIVER_SLOTS],
+        }
+    }
+
+    pub fn snapshot(&self) -> CpuEvents {
+        let mut events = CpuEvents::empty();
+        events.context_switches = load(&self.context_switches);
+        events.page_faults = load(&self.page_faults);
+        events.ipis = load(&self.ipis);
+        load_all(&self.syscalls, &mut events.syscalls);
+        load_all(&self.irqs, &mut events.irqs);
+        load_all(&self.driver_reads, &mut events.driver_reads);
+        load_all(&self.driver_writes, &mut events.driver_writes);
+        load_all(&self.driver_read_bytes, &mut events.driver_read_bytes);
+        load_all(&self.driver_write_bytes, &mut events.driver_write_bytes);
+        events
+    }
+}
+
+fn load(counter: &AtomicU32) -> u32 {
+    counter.load(Ordering::Relaxed)
+}
+
+fn load_all(counters: &[AtomicU32], values: &mut [u32]) {
+    for (value, counter) in values.iter_mut().zip(counters) {
+        *value = load(counter);
+    }
+}
+
+fn bump(counter: &AtomicU32, amount: u32) {
+    counter.fetch_add(amount, Ordering::Relaxed);
+}
+
+fn local() -> &'static EventCounters {
+    &get_cpu_scheduler().counters
+}
+
+pub fn count_context_switch() {
+    bump(&local().context_switches, 1);
+}
+
+pub fn count_page_fault() {
+    bump(&local().page_faults, 1);
+}
+
+pub fn count_ipi() {
+    bump(&local().ipis, 1);
+}
+
+pub fn count_syscall(number: u32) {
+    let bucket = (number as usize).min(SYSCALL_BUCKETS - 1);
+    bump(&local().syscalls[bucket], 1);
+}
+
+pub fn count_irq(irq: u32) {
+    if let Some(counter) = local().irqs.get(irq as usize) {
+        bump(counter, 1);
+    }
+}
+
+fn driver_slot(id: DriverID) -> usize {
+    (*id as usize).min(DRIVER_SLOTS - 1)
+}
+
+pub fn count_driver_read(id: DriverID, bytes: usize) {
+    let counters = local();
+    let slot = driver_slot(id);
+    bump(&counters.driver_reads[slot], 1);
+    bump(&counters.driver_read_bytes[slot], bytes as u32);
+}
+
+pub fn count_driver_write(id: DriverID, bytes: usize) {
+    let counters = local();
+    let slot = driver_slot(id);
+    bump(&counters.driver_writes[slot], 1);
+    bump(&counters.driver_write_bytes[slot], bytes as u32);
+}
+
+static HEAP_IN_USE: AtomicU32 = AtomicU32::new(0);
+static HEAP_ALLOCATIONS: AtomicU32 = AtomicU32::new(0);
+static HEAP_FREES: AtomicU32 = AtomicU32::new(0);
+static SCRATCH_MAPS: AtomicU32 = AtomicU32::new(0);
+static SCRATCH_CONTENDED: AtomicU32 = AtomicU32::new(0);
+
+pub fn count_heap_alloc(bytes: usize) {
+    bump(&HEAP_ALLOCATIONS, 1);
+    bump(&HEAP_IN_USE, bytes as u32);
+}
+
+pub fn count_heap_free(bytes: usize) {
+    bump(&HEAP_FREES, 1);
+    HEAP_IN_USE.fetch_sub(bytes as u32, Ordering::Relaxed);
+}
+
+/// Record a scratch page mapping, and how many occupied slots were skipped
+/// before a free one was found
+pub fn count_scratch_map(contended: u32) {
+    bump(&SCRATCH_MAPS, 1);
+    if contended > 0 {
+        bump(&SCRATCH_CONTENDED, contended);
+    }
+}
+
+/// Read every counter, returning the global header and each CPU's record in
+/// order of CPU index
+pub fn snapshot() -> (EventsHeader, Vec<CpuEvents>) {
+    let mut per_cpu = get_all_cpu_counters();
+    per_cpu.sort_unstable_by_key(|(cpu, _)| *cpu);
+    let header = EventsHeader {
+        version: EVENTS_VERSION,
+        cpu_count: per_cpu.len() as u32,
+        cpu_record_size: core::mem::size_of::<CpuEvents>() as u32,
+        heap_size: crate::memory::heap::heap_size() as u32,
+        heap_in_use: load(&HEAP_IN_USE),
+        heap_allocations: load(&HEAP_ALLOCATIONS),
+        heap_frees: load(&HEAP_FREES),
+        scratch_maps: load(&SCRATCH_MAPS),
+        scratch_contended: load(&SCRATCH_CONTENDED),
+    };
+    (header, per_cpu.into_iter().map(|(_, events)| events).collect())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test_case]
+    fn counters_reach_the_snapshot() {
+        // Kernel tasks aren't preempted, so both reads see the same CPU
+        let before = local().snapshot();
+        count_syscall(0xffff);
+        count_irq(IRQ_LINES as u32);
+        count_driver_read(DriverID::new(0), 0x200);
+        let after = local().snapshot();
+        assert_eq!(
+            after.syscalls[SYSCALL_BUCKETS - 1],
+            before.syscalls[SYSCALL_BUCKETS - 1] + 1
+        );
+        assert!(after.irqs == before.irqs);
+        assert_eq!(after.driver_reads[0], before.driver_reads[0] + 1);
+        assert_eq!(after.driver_read_bytes[0], before.driver_read_bytes[0] + 0x200);
+
+        let (header, per_cpu) = snapshot();
+        assert_eq!(header.cpu_count as usize, per_cpu.len());
+        assert!(header.heap_in_use <= header.heap_size);
+    }
+}
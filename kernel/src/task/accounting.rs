@@ -0,0 +1,132 @@
+//! Per-task resource accounting.
+//!
+//! Every Task owns a `TaskAccounting`, shared through an Arc so that each CPU
+//! can keep a pointer to the one belonging to the task it is running. That
+//! pointer is swapped in by the context switch, which lets the timer tick and
+//! the page fault handler charge the current task without looking it up or
+//! taking any lock. Counters are relaxed atomics, since they only ever grow
+//! and readers just want a recent value.
+//!
+//! Resident pages aren't counted here; they are measured from the task's page
+//! tables when someone asks, which keeps the paging paths free of bookkeeping.
+
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use super::scheduling::get_cpu_scheduler;
+
+pub struct TaskAccounting {
+    user_ticks: AtomicU32,
+    kernel_ticks: AtomicU32,
+    context_switches: AtomicU32,
+    page_faults: AtomicU32,
+    reads: AtomicU32,
+    read_bytes: AtomicU32,
+    writes: AtomicU32,
+    write_bytes: AtomicU32,
+}
+
+/// A copy of a task's counters at one moment
+#[derive(Clone, Copy, Default)]
+pub struct TaskUsage {
+    pub user_ticks: u32,
+    pub kernel_ticks: u32,
+    pub context_switches: u32,
+    pub page_faults: u32,
+    pub reads: u32,
+    pub read_bytes: u32,
+    pub writes: u32,
+    pub write_bytes: u32,
+}
+
+impl TaskAccounting {
+    pub const fn new() -> Self {
+        Self {
+            user_ticks: AtomicU32::new(0),
+            kernel_ticks: AtomicU32::new(0),
+            context_switches: AtomicU32::new(0),
+            page_faults: AtomicU32::new(0),
+            reads: AtomicU32::new(0),
+            read_bytes: AtomicU32::new(0),
+            writes: AtomicU32::new(0),
+            write_bytes: AtomicU32::new(0),
+        }
+    }
+
+    pub fn record_tick(&self, is_user: bool) {
+        if is_user {
+            bump(&self.user_ticks, 1);
+        } else {
+            bump(&self.kernel_ticks, 1);
+        }
+    }
+
+    pub fn count_switch_in(&self) {
+        bump(&self.context_switches, 1);
+    }
+
+    pub fn count_page_fault(&self) {
+        bump(&self.page_faults, 1);
+    }
+
+    pub fn count_read(&self, bytes: u32) {
+        bump(&self.reads, 1);
+        bump(&self.read_bytes, bytes);
+    }
+
+    pub fn count_write(&self, bytes: u32) {
+        bump(&self.writes, 1);
+        bump(&self.write_bytes, bytes);
+    }
+
+    pub fn snapshot(&self) -> TaskUsage {
+        TaskUsage {
+            user_ticks: load(&self.user_ticks),
+            kernel_ticks: load(&self.kernel_ticks),
+            context_switches: load(&self.context_switches),
+            page_faults: load(&self.page_faults),
+            reads: load(&self.reads),
+            read_bytes: load(&self.read_bytes),
+            writes: load(&self.writes),
+            write_bytes: load(&self.write_bytes),
+        }
+    }
+}
+
+fn bump(counter: &AtomicU32, amount: u32) {
+    counter.fetch_add(amount, Ordering::Relaxed);
+}
+
+fn load(counter: &AtomicU32) -> u32 {
+    counter.load(Ordering::Relaxed)
+}
+
+/// Run `f` on the accounting of the task this CPU is running. Before the
+/// first context switch on a CPU there is no current task to charge, and
+/// `f` is skipped.
+pub fn with_current<F: FnOnce(&TaskAccounting)>(f: F) {
+    if let Some(accounting) = get_cpu_scheduler().get_current_accounting() {
+        f(accounting);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test_case]
+    fn current_task_is_charged() {
+        let task_lock = crate::task::switching::get_current_task();
+        let before = task_lock.read().accounting.snapshot();
+        with_current(|a| {
+            a.count_page_fault();
+            a.count_read(0x200);
+            a.count_write(3);
+        });
+        let after = task_lock.read().accounting.snapshot();
+        assert_eq!(after.page_faults, before.page_faults + 1);
+        assert_eq!(after.reads, before.reads + 1);
+        assert_eq!(after.read_bytes, before.read_bytes + 0x200);
+        assert_eq!(after.writes, before.writes + 1);
+        assert_eq!(after.write_bytes, before.write_bytes + 3);
+    }
+}
@@ -2,6 +2,7 @@ use core::sync::atomic::Ordering;
 
 use idos_api::io::{
     error::{IoError, IoResult},
+    file::FileStatus,
     AsyncOp,
 };
 
@@ -129,6 +130,16 @@ pub fn close_sync(handle: Handle) -> IoResult {
     io_sync(handle, ASYNC_OP_CLOSE, 0, 0, 0)
 }
 
+pub fn stat_sync(handle: Handle) -> Result<FileStatus, IoError> {
+    use idos_api::io::FILE_OP_STAT;
+
+    let mut status = FileStatus::new();
+    let ptr = &mut status as *mut FileStatus as u32;
+    let len = core::mem::size_of::<FileStatus>() as u32;
+    io_sync(handle, FILE_OP_STAT, ptr, len, 0)?;
+    Ok(status)
+}
+
 pub fn share_sync(handle: Handle, transfer_to: TaskID) -> IoResult {
     io_sync(handle, ASYNC_OP_SHARE, transfer_to.into(), 0, 0)
 }
@@ -1,7 +1,7 @@
 use alloc::boxed::Box;
 use alloc::string::String;
 
-use crate::cleanup::wake_cleanup_resident;
+use crate::cleanup::queue_for_cleanup;
 use crate::io::async_io::IOType;
 
 use super::super::id::TaskID;
@@ -99,6 +99,10 @@ pub fn terminate_id(id: TaskID, exit_code: u32) {
         match terminated_task {
             Some(task_lock) => {
                 let mut task = task_lock.write();
+                if task.is_terminated() {
+                    // Already reported and queued for cleanup
+                    return;
+                }
                 task.terminate();
                 task.parent_id
             }
@@ -116,8 +120,9 @@ pub fn terminate_id(id: TaskID, exit_code: u32) {
         }
     }
 
-    // notify the cleanup task
-    wake_cleanup_resident();
+    // The parent has its exit code already; reclaiming memory and handles is
+    // left to the cleanup task so that exiting stays cheap
+    queue_for_cleanup(id);
 }
 
 pub fn terminate_task(id: TaskID, exit_code: u32) {
@@ -1,19 +1,30 @@
+use alloc::{sync::Arc, vec::Vec};
 use idos_api::io::driver::DriverMappingToken;
+use spin::RwLock;
 
 use super::super::id::TaskID;
 use super::super::map::get_task;
-use super::super::memory::{MemMapError, MemoryBacking};
+use super::super::memory::{MemMapError, MemoryBacking, PROT_DEFAULT};
+use super::super::state::Task;
 use super::super::switching::get_current_id;
 use crate::io::async_io::AsyncOpID;
 use crate::io::driver::pending::send_async_request;
 use crate::io::filesystem::driver::DriverID;
 use crate::io::filesystem::driver_create_mapping;
 use crate::memory::address::{PhysicalAddress, VirtualAddress};
-use crate::memory::physical::{maybe_add_frame_reference, release_tracked_frame};
+use crate::memory::physical::{
+    maybe_add_frame_reference, release_tracked_frame, release_tracked_frames,
+};
 use crate::memory::shared::share_buffer;
 use crate::task::memory::{untrack_file_backed_page, UnmappedRegionKind};
 use crate::task::paging::{
-    current_pagedir_unmap, page_on_demand, ExternalPageDirectory, PermissionFlags,
+    current_pagedir_address, current_pagedir_set_permissions, current_pagedir_take_dirty,
+    current_pagedir_unmap, get_flags_for_region, maybe_get_current_physical_address,
+    page_on_demand, ExternalPageDirectory, PermissionFlags,
+};
+use idos_api::syscall::memory::{
+    SegmentMapping, MEM_ADVICE_DONTNEED, MEM_ADVICE_NORMAL, MEM_ADVICE_RANDOM,
+    MEM_ADVICE_SEQUENTIAL, MEM_ADVICE_WILLNEED, MMAP_SHARED, PROT_WRITE,
 };
 
 pub fn map_memory(
@@ -44,8 +55,8 @@ pub fn map_memory_for_task(
         // Make sure the page reference is tracked. We can't rely on page
         // faults to do this.
         let pagedir = ExternalPageDirectory::for_task(task_id);
-        // We haven't implemented flags for the userspace api yet, so just
-        // give it all the permissions
+        // New regions allow every access; protect_memory can narrow it
+        // down afterwards
         let flags =
             PermissionFlags::new(PermissionFlags::USER_ACCESS | PermissionFlags::WRITE_ACCESS);
 
@@ -95,6 +106,7 @@ pub fn unmap_memory_for_task(
             while offset < region.size {
                 let mapping = region.address + offset;
                 if let Some(frame) = current_pagedir_unmap(mapping) {
+                    let paddr = frame.peek_address();
                     let released =
                         release_tracked_frame(frame).map_err(|_| MemMapError::KernelError)?;
                     if released {
@@ -111,7 +123,12 @@ pub fn unmap_memory_for_task(
 
                                 // If we dropped the frame used for a file-backed
                                 // mapping, we also need to clear the re-use cache
-                                untrack_file_backed_page(driver_id, mapping_token, offset_in_file);
+                                untrack_file_backed_page(
+                                    driver_id,
+                                    mapping_token,
+                                    offset_in_file + offset,
+                                    paddr,
+                                );
                             }
                         }
                     }
@@ -120,36 +137,150 @@ pub fn unmap_memory_for_task(
             }
         }
     } else {
+        // Another task's memory is usually being unmapped because it has
+        // exited, often all of it at once. Walk each region's page tables in
+        // one pass and release its frames as a batch.
         let pagedir = ExternalPageDirectory::for_task(task_id);
         for region in unmapped_regions {
-            let mut offset = 0;
-            while offset < region.size {
-                let mapping = region.address + offset;
-                if let Some(frame) = pagedir.unmap(mapping) {
-                    let released =
-                        release_tracked_frame(frame).map_err(|_| MemMapError::KernelError)?;
-                    if released {
-                        if let UnmappedRegionKind::FileBacked {
-                            driver_id,
-                            mapping_token,
-                            offset_in_file,
-                            shared,
-                        } = region.kind
-                        {
-                            if shared {
-                                // If the frame was shared, we need to tell the driver that it's no longer mapped
-                                // TODO: send request to driver
-                                // If we dropped the frame used for a file-backed mapping, we also need to clear the re-use cache
-                                untrack_file_backed_page(driver_id, mapping_token, offset_in_file);
-                            }
-                        }
-                    }
+            let (offsets, frames): (Vec<u32>, Vec<_>) = pagedir
+                .unmap_range(region.address, region.size)
+                .into_iter()
+                .unzip();
+            release_tracked_frames(frames, |index, paddr| {
+                if let UnmappedRegionKind::FileBacked {
+                    driver_id,
+                    mapping_token,
+                    offset_in_file,
+                    shared: true,
+                } = region.kind
+                {
+                    // If we dropped the frame used for a file-backed mapping,
+                    // we also need to clear the re-use cache
+                    untrack_file_backed_page(
+                        driver_id,
+                        mapping_token,
+                        offset_in_file + offsets[index],
+                        paddr,
+                    );
                 }
-                offset += 4096;
-            }
+            })
+            .map_err(|_| MemMapError::KernelError)?;
+        }
+    }
+
+    Ok(())
+}
+
+/// Determine which pages in a region of the current task's memory have been
+/// written since the last time they were collected, and mark them clean
+/// again. Bit N of `bitmap` is set if the Nth page of the region is dirty.
+/// Returns the number of dirty pages found.
+pub fn collect_dirty_pages(
+    addr: VirtualAddress,
+    size: u32,
+    bitmap: &mut [u32],
+) -> Result<u32, MemMapError> {
+    if addr.as_u32() & 0xfff != 0 {
+        return Err(MemMapError::NotMapped);
+    }
+    let page_count = ((size + 0xfff) / 0x1000) as usize;
+    if bitmap.len() * 32 < page_count {
+        return Err(MemMapError::NotMapped);
+    }
+    {
+        let task_lock = get_task(get_current_id()).ok_or(MemMapError::NoTask)?;
+        let task = task_lock.read();
+        if task.memory_mapping.get_mapping_containing_address(&addr).is_none() {
+            return Err(MemMapError::NotMapped);
+        }
+        // Dirty bits are only flushed from this CPU's TLB, which is safe as
+        // long as the directory is the current task's own
+        assert!(task.page_directory == current_pagedir_address());
+    }
+
+    for word in bitmap.iter_mut().take((page_count + 31) / 32) {
+        *word = 0;
+    }
+    let mut dirty_count = 0;
+    for page in 0..page_count {
+        if current_pagedir_take_dirty(addr + (page as u32 * 0x1000)) {
+            bitmap[page / 32] |= 1 << (page % 32);
+            dirty_count += 1;
         }
     }
+    Ok(dirty_count)
+}
 
+/// Change the protection of a page-aligned range of the current task's
+/// memory. Every page of the range has to be mapped. Pages that are already
+/// present get their new permissions immediately; the rest pick them up
+/// when they are paged in.
+pub fn protect_memory(addr: VirtualAddress, size: u32, protection: u32) -> Result<(), MemMapError> {
+    let end = addr
+        .as_u32()
+        .checked_add(size)
+        .and_then(|end| end.checked_add(0xfff))
+        .ok_or(MemMapError::MapOutOfBounds)?
+        & 0xfffff000;
+    let range = addr..VirtualAddress::new(end);
+
+    let task_lock = get_task(get_current_id()).ok_or(MemMapError::NoTask)?;
+    let mut task = task_lock.write();
+    task.memory_mapping.set_protection(range.clone(), protection)?;
+    let mut page = range.start;
+    while page < range.end {
+        if let Some(region) = task.memory_mapping.get_mapping_containing_address(&page) {
+            current_pagedir_set_permissions(page, get_flags_for_region(region));
+        }
+        page = page + 0x1000;
+    }
+    Ok(())
+}
+
+/// How many pages past a fault are read in for regions advised as
+/// sequential
+const SEQUENTIAL_READAHEAD_PAGES: u32 = 8;
+
+/// Apply a usage hint to a region of the current task's memory. Sequential
+/// access widens the readahead window of the file-backed regions in the
+/// range, normal or random access closes it again, and will-need pages in
+/// everything in the range immediately. Don't-need is accepted and ignored.
+pub fn advise_memory(addr: VirtualAddress, size: u32, advice: u32) -> Result<(), MemMapError> {
+    if addr.as_u32() & 0xfff != 0 {
+        return Err(MemMapError::MappingWrongAlignment);
+    }
+    let end = addr
+        .as_u32()
+        .checked_add(size)
+        .ok_or(MemMapError::MapOutOfBounds)?;
+    let range = addr..VirtualAddress::new(end);
+
+    let readahead = match advice {
+        MEM_ADVICE_NORMAL | MEM_ADVICE_RANDOM => 0,
+        MEM_ADVICE_SEQUENTIAL => SEQUENTIAL_READAHEAD_PAGES,
+        MEM_ADVICE_WILLNEED => {
+            let mut page = addr;
+            while page < range.end {
+                if maybe_get_current_physical_address(page).is_none() {
+                    // Addresses outside any mapping, or pages that fail to
+                    // load, are left for the fault handler to report
+                    let _ = page_on_demand(page);
+                }
+                page = page + 0x1000;
+            }
+            return Ok(());
+        }
+        MEM_ADVICE_DONTNEED => return Ok(()),
+        _ => return Err(MemMapError::UnknownAdvice),
+    };
+    let task_lock = get_task(get_current_id()).ok_or(MemMapError::NoTask)?;
+    let updated = task_lock
+        .write()
+        .memory_mapping
+        .set_readahead(range, readahead);
+    if updated == 0 {
+        return Err(MemMapError::NotMapped);
+    }
     Ok(())
 }
 
@@ -195,23 +326,143 @@ pub fn map_file(
     offset_in_file: u32,
     shared: bool,
 ) -> Result<VirtualAddress, MemMapError> {
-    map_file_for_task(get_current_id(), vaddr, size, path, offset_in_file, shared)
+    let file_size = (size + 0xfff) & 0xfffff000;
+    let protection = if shared {
+        PROT_DEFAULT & !PROT_WRITE
+    } else {
+        PROT_DEFAULT
+    };
+    map_file_for_task(
+        get_current_id(),
+        vaddr,
+        size,
+        path,
+        offset_in_file,
+        file_size,
+        shared,
+        protection,
+    )
 }
 
+/// Map part of a file into a task. Only the first `file_size` bytes of the
+/// region are read from the file; the rest is zero-filled on demand, which
+/// is how the loader maps a segment together with its BSS.
 pub fn map_file_for_task(
     task_id: TaskID,
     vaddr: Option<VirtualAddress>,
     size: u32,
     path: &str,
     offset_in_file: u32,
+    file_size: u32,
     shared: bool,
+    protection: u32,
 ) -> Result<VirtualAddress, MemMapError> {
+    let file_size = clamp_file_size(size, file_size, shared)?;
+
+    let task_lock = get_task(task_id).ok_or(MemMapError::NoTask)?;
+    let (driver_id, mapping_token) = create_file_mapping(&task_lock, path)?;
+
+    let backing = MemoryBacking::FileBacked {
+        driver_id,
+        mapping_token,
+        offset_in_file,
+        shared,
+        copy_from_shared: false,
+        file_size,
+    };
+
+    let result = task_lock
+        .write()
+        .memory_mapping
+        .map_memory_with_protection(vaddr, size, backing, protection);
+
+    result
+}
+
+/// Map several regions of one file into a task at once, the way a loader
+/// maps an executable's segments. The path is resolved and the driver
+/// mapping created only once. Every segment has to land at exactly the
+/// address it asks for; if any of them can't, none are left mapped.
+pub fn map_file_segments_for_task(
+    task_id: TaskID,
+    path: &str,
+    segments: &[SegmentMapping],
+) -> Result<(), MemMapError> {
+    let mut file_sizes = Vec::with_capacity(segments.len());
+    for segment in segments {
+        if segment.virtual_address & 0xfff != 0 {
+            return Err(MemMapError::MappingWrongAlignment);
+        }
+        if segment.size == 0 {
+            return Err(MemMapError::InvalidSize);
+        }
+        let shared = segment.flags & MMAP_SHARED != 0;
+        file_sizes.push(clamp_file_size(segment.size, segment.file_size, shared)?);
+    }
+
+    let task_lock = get_task(task_id).ok_or(MemMapError::NoTask)?;
+    let (driver_id, mapping_token) = create_file_mapping(&task_lock, path)?;
+
+    // The lock is held throughout, so nothing can fault on a segment before
+    // a failure further on unmaps it again
+    let mut task = task_lock.write();
+    for (index, segment) in segments.iter().enumerate() {
+        let address = VirtualAddress::new(segment.virtual_address);
+        let backing = MemoryBacking::FileBacked {
+            driver_id,
+            mapping_token,
+            offset_in_file: segment.file_offset,
+            shared: segment.flags & MMAP_SHARED != 0,
+            copy_from_shared: false,
+            file_size: file_sizes[index],
+        };
+        let mapped = task.memory_mapping.map_memory_with_protection(
+            Some(address),
+            segment.size,
+            backing,
+            segment.protection,
+        );
+        let landed = match mapped {
+            Ok(mapped) if mapped == address => true,
+            // The range was taken, and the region went somewhere else
+            Ok(elsewhere) => {
+                let _ = task.memory_mapping.unmap_memory(elsewhere, segment.size);
+                false
+            }
+            Err(_) => false,
+        };
+        if !landed {
+            for earlier in &segments[..index] {
+                let address = VirtualAddress::new(earlier.virtual_address);
+                let _ = task.memory_mapping.unmap_memory(address, earlier.size);
+            }
+            return Err(MemMapError::MappingFailed);
+        }
+    }
+    Ok(())
+}
+
+/// Check how much of a file mapping comes from the file, capping it at the
+/// size of the mapping
+fn clamp_file_size(size: u32, file_size: u32, shared: bool) -> Result<u32, MemMapError> {
+    let file_size = file_size.min((size + 0xfff) & 0xfffff000);
+    // Shared frames are seen by every mapping of the file, so they can't
+    // have their tails cleared for one of them
+    if shared && file_size & 0xfff != 0 {
+        return Err(MemMapError::InvalidSize);
+    }
+    Ok(file_size)
+}
+
+/// Ask the driver behind `path` for a mapping token for the file.
+fn create_file_mapping(
+    task_lock: &Arc<RwLock<Task>>,
+    path: &str,
+) -> Result<(DriverID, DriverMappingToken), MemMapError> {
     // Mapping a file requires an async IO request to initialize the mapping
     // and get back a token. This requires the syscall to suspend the current
     // task until IO is complete. We don't want to be holding any locks when
     // we do that.
-    let task_lock = get_task(task_id).ok_or(MemMapError::NoTask)?;
-
     let (driver_id, relative_path) =
         crate::io::prepare_file_path(path).map_err(|_| MemMapError::FileUnavailable)?;
 
@@ -230,28 +481,20 @@ pub fn map_file_for_task(
             result
         }
     };
-    let mapping_token = match result {
-        Ok(token) => DriverMappingToken::new(token),
-        Err(_) => return Err(MemMapError::DriverError),
-    };
-
-    let backing = MemoryBacking::FileBacked {
-        driver_id,
-        mapping_token,
-        offset_in_file,
-        shared,
-    };
-
-    let result = task_lock
-        .write()
-        .memory_mapping
-        .map_memory(vaddr, size, backing);
-
-    result
+    match result {
+        Ok(token) => Ok((driver_id, DriverMappingToken::new(token))),
+        Err(_) => Err(MemMapError::DriverError),
+    }
 }
 
 #[cfg(test)]
 mod tests {
+    use idos_api::syscall::memory::{SegmentMapping, MMAP_SHARED, PROT_READ, PROT_WRITE};
+
+    use crate::memory::address::VirtualAddress;
+    use crate::task::map::get_task;
+    use crate::task::memory::MemoryBacking;
+
     #[test_case]
     fn test_mmap_file_async_driver() {
         // map a frame of memory to a file on the ATEST: drive
@@ -409,6 +652,145 @@ mod tests {
         assert_ne!(paddr1, paddr2);
     }
 
+    #[test_case]
+    fn test_mmap_file_zero_fills_past_file_size() {
+        // Only the first 0x1100 bytes come from the file: the second page
+        // keeps its first 0x100 bytes and the third is never read at all
+        let vaddr = super::map_file_for_task(
+            super::get_current_id(),
+            None,
+            0x3000,
+            "DEV:\\ASYNCDEV",
+            0,
+            0x1100,
+            false,
+            PROT_READ,
+        )
+        .unwrap();
+        let buffer = unsafe { core::slice::from_raw_parts(vaddr.as_ptr::<u8>(), 0x3000) };
+        assert!(buffer[..0x1000].iter().all(|&b| b == b'A'));
+        assert!(buffer[0x1000..0x1100].iter().all(|&b| b == b'B'));
+        assert!(buffer[0x1100..].iter().all(|&b| b == 0));
+    }
+
+    #[test_case]
+    fn test_mmap_file_shared_needs_whole_pages() {
+        let result = super::map_file_for_task(
+            super::get_current_id(),
+            None,
+            0x2000,
+            "ATEST:\\SHARED_TAIL",
+            0,
+            0x1100,
+            true,
+            PROT_READ,
+        );
+        assert!(result.is_err());
+    }
+
+    fn segment(address: u32, size: u32, offset: u32, shared: bool, protection: u32) -> SegmentMapping {
+        SegmentMapping {
+            virtual_address: address,
+            size,
+            file_offset: offset,
+            file_size: size,
+            flags: if shared { MMAP_SHARED } else { 0 },
+            protection,
+        }
+    }
+
+    fn region_at(address: u32) -> Option<(u32, u32)> {
+        let task_lock = get_task(super::get_current_id()).unwrap();
+        let task = task_lock.read();
+        let region = task
+            .memory_mapping
+            .get_mapping_containing_address(&VirtualAddress::new(address))?;
+        match region.backed_by {
+            MemoryBacking::FileBacked { offset_in_file, .. } => {
+                Some((offset_in_file, region.protection))
+            }
+            _ => None,
+        }
+    }
+
+    #[test_case]
+    fn test_map_file_segments_places_each_segment() {
+        // DEV:\ASYNCDEV reads as one letter per page, A, B, C, ...
+        let segments = [
+            segment(0x3000_0000, 0x1000, 0, true, PROT_READ),
+            segment(0x3000_2000, 0x2000, 0x2000, false, PROT_READ | PROT_WRITE),
+        ];
+        super::map_file_segments_for_task(super::get_current_id(), "DEV:\\ASYNCDEV", &segments)
+            .unwrap();
+
+        assert_eq!(region_at(0x3000_0000), Some((0, PROT_READ)));
+        assert_eq!(region_at(0x3000_1000), None);
+        assert_eq!(region_at(0x3000_2000), Some((0x2000, PROT_READ | PROT_WRITE)));
+        // Every page of a segment belongs to its one region
+        assert_eq!(region_at(0x3000_3000), Some((0x2000, PROT_READ | PROT_WRITE)));
+        let first = unsafe { core::slice::from_raw_parts(0x3000_0000 as *const u8, 0x1000) };
+        let second = unsafe { core::slice::from_raw_parts(0x3000_2000 as *const u8, 0x2000) };
+        assert!(first.iter().all(|&b| b == b'A'));
+        assert!(second[..0x1000].iter().all(|&b| b == b'C'));
+        assert!(second[0x1000..].iter().all(|&b| b == b'D'));
+
+        super::unmap_memory(VirtualAddress::new(0x3000_0000), 0x1000).unwrap();
+        super::unmap_memory(VirtualAddress::new(0x3000_2000), 0x2000).unwrap();
+    }
+
+    #[test_case]
+    fn test_map_file_segments_is_all_or_nothing() {
+        // Something already lives where the last segment wants to go
+        let occupied = super::map_file(
+            Some(VirtualAddress::new(0x3100_3000)), 0x1000, "ATEST:\\OCCUPIED", 0, true,
+        )
+        .unwrap();
+        assert_eq!(occupied, VirtualAddress::new(0x3100_3000));
+
+        let segments = [
+            segment(0x3100_0000, 0x1000, 0, true, PROT_READ),
+            segment(0x3100_1000, 0x1000, 0x1000, false, PROT_READ | PROT_WRITE),
+            segment(0x3100_3000, 0x1000, 0x2000, true, PROT_READ),
+        ];
+        let result =
+            super::map_file_segments_for_task(super::get_current_id(), "DEV:\\ASYNCDEV", &segments);
+        assert!(result.is_err());
+        assert_eq!(region_at(0x3100_0000), None);
+        assert_eq!(region_at(0x3100_1000), None);
+        // The region that was in the way is untouched
+        assert_eq!(region_at(0x3100_3000).map(|(offset, _)| offset), Some(0));
+
+        // Segments that overlap each other fail the same way
+        let segments = [
+            segment(0x3100_0000, 0x2000, 0, true, PROT_READ),
+            segment(0x3100_1000, 0x1000, 0x1000, true, PROT_READ),
+        ];
+        let result =
+            super::map_file_segments_for_task(super::get_current_id(), "DEV:\\ASYNCDEV", &segments);
+        assert!(result.is_err());
+        assert_eq!(region_at(0x3100_0000), None);
+
+        super::unmap_memory(occupied, 0x1000).unwrap();
+    }
+
+    #[test_case]
+    fn test_protect_memory_keeps_contents() {
+        let vaddr = super::map_file(None, 0x2000, "ATEST:\\PROTECT", 0, false).unwrap();
+        let buffer = unsafe { core::slice::from_raw_parts_mut(vaddr.as_ptr_mut::<u8>(), 0x2000) };
+        buffer[0] = b'X';
+        super::protect_memory(vaddr, 0x2000, PROT_READ).unwrap();
+        // Both the page already present and the one paged in afterwards
+        // are still readable
+        assert_eq!(buffer[0], b'X');
+        assert_eq!(&buffer[0x1000..0x1009], b"PAGE DATA");
+        super::protect_memory(vaddr, 0x1000, PROT_READ | PROT_WRITE).unwrap();
+        buffer[1] = b'Y';
+        assert_eq!(&buffer[0..2], b"XY");
+        super::unmap_memory(vaddr, 0x2000).unwrap();
+        // Only mapped memory can be protected
+        assert!(super::protect_memory(vaddr, 0x1000, PROT_READ).is_err());
+    }
+
     #[test_case]
     fn test_mmap_file_private_is_writable() {
         // Private file-backed mappings should be writable. Writing to the
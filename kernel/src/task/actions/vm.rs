@@ -1,34 +1,47 @@
-use idos_api::compat::VMRegisters;
+use idos_api::compat::{VM86ReflectedInts, VMRegisters, VM86_VIF};
 
-use crate::{interrupts::syscall::FullSavedRegisters, task::switching::get_current_task};
+use crate::{
+    interrupts::{stack::StackFrame, syscall::FullSavedRegisters},
+    task::switching::get_current_task,
+};
 
 use core::arch::asm;
 
+const EFLAGS_TF: u32 = 1 << 8;
+const EFLAGS_IF: u32 = 1 << 9;
+const EFLAGS_IOPL: u32 = 3 << 12;
+const EFLAGS_VM: u32 = 1 << 17;
+
 pub fn enter_vm86_mode(
     registers: &FullSavedRegisters,
     vm_regs_ptr: *mut VMRegisters,
     irq_mask: u32,
 ) {
     let task_lock = get_current_task();
+    let vm_regs = unsafe { &mut *vm_regs_ptr };
 
-    {
+    let pending_irqs = {
         let mut task = task_lock.write();
         task.vm86_registers = Some(registers.clone());
         task.vm86_irq_mask = irq_mask;
-    }
+        task.vm86_vif = vm_regs.eflags & VM86_VIF != 0;
+        if task.vm86_vif {
+            task.vm86_pending_irqs
+        } else {
+            0
+        }
+    };
 
-    let vm_regs = unsafe { &mut *vm_regs_ptr };
-    vm_regs.eflags |= 0x20200; // VM flag (bit 17) + IF (bit 9)
+    // The real IF always stays set, so that hardware interrupts still reach
+    // the kernel. The program's view of IF lives in the task's vif.
+    vm_regs.eflags = (vm_regs.eflags & !(VM86_VIF | EFLAGS_TF)) | EFLAGS_VM | EFLAGS_IF;
+    if pending_irqs != 0 {
+        // Trap immediately so that the pending IRQs are delivered
+        vm_regs.eflags |= EFLAGS_TF;
+    }
 
     let vm_regs_copy = vm_regs.clone();
 
-    crate::kprintln!(
-        "Enter 8086 Mode @ {:X}:{:X} IRQ({:X})",
-        vm_regs.cs,
-        vm_regs.eip,
-        irq_mask
-    );
-
     unsafe {
         asm!(
             "mov esp, eax",
@@ -45,6 +58,177 @@ pub fn enter_vm86_mode(
     }
 }
 
+pub fn set_vm86_reflected_ints(reflected_ptr: *const VM86ReflectedInts) {
+    let reflected = unsafe { *reflected_ptr };
+    get_current_task().write().vm86_reflected_ints = reflected;
+}
+
+/// v86 code runs with IOPL 0, so CLI, STI, PUSHF, POPF, IRET and INT all
+/// trigger a GPF. Rather than returning to the userspace VM monitor for
+/// each of them, the common cases are emulated here and v86 execution resumes
+/// immediately. CLI and STI act on a virtual interrupt flag, and INTs are
+/// dispatched through the real-mode IVT if the vector has been marked as
+/// reflected.
+/// Returns false if the instruction needs to be handled by the monitor.
+pub fn emulate_vm86_instruction(stack_frame: &StackFrame) -> bool {
+    let (mut vif, reflected, pending_irqs) = {
+        let task_lock = get_current_task();
+        let task = task_lock.read();
+        (
+            task.vm86_vif,
+            task.vm86_reflected_ints,
+            task.vm86_pending_irqs & task.vm86_irq_mask,
+        )
+    };
+
+    // ESP and SS are pushed by the CPU just beyond the StackFrame
+    let frame_ptr = stack_frame as *const StackFrame as *mut u32;
+    let (esp, ss) = unsafe {
+        (
+            core::ptr::read_volatile(frame_ptr.add(3)),
+            core::ptr::read_volatile(frame_ptr.add(4)) & 0xffff,
+        )
+    };
+    let mut sp = esp & 0xffff;
+    let mut cs = stack_frame.cs & 0xffff;
+    let mut ip = stack_frame.eip & 0xffff;
+    let mut eflags = stack_frame.eflags;
+
+    // Memory accesses below may page fault, so no task lock can be held here
+    let mut push = |value: u16| {
+        sp = sp.wrapping_sub(2) & 0xffff;
+        unsafe { write_linear_u16((ss << 4) + sp, value) };
+    };
+    let flags_image = |eflags: u32, vif: bool| -> u16 {
+        let mut flags = eflags & !(EFLAGS_IF | EFLAGS_TF);
+        if vif {
+            flags |= EFLAGS_IF;
+        }
+        flags as u16
+    };
+
+    let opcode = unsafe { read_linear_u8((cs << 4) + ip) };
+    match opcode {
+        0xfa => {
+            // CLI
+            vif = false;
+            ip += 1;
+        }
+        0xfb => {
+            // STI
+            vif = true;
+            ip += 1;
+        }
+        0x9c => {
+            // PUSHF
+            push(flags_image(eflags, vif));
+            ip += 1;
+        }
+        0x9d => {
+            // POPF
+            let flags = unsafe { read_linear_u16((ss << 4) + sp) } as u32;
+            sp = (sp + 2) & 0xffff;
+            vif = flags & EFLAGS_IF != 0;
+            eflags = merge_popped_flags(eflags, flags);
+            ip += 1;
+        }
+        0xcf => {
+            // IRET
+            let stack_base = ss << 4;
+            let (new_ip, new_cs, flags) = unsafe {
+                (
+                    read_linear_u16(stack_base + sp) as u32,
+                    read_linear_u16(stack_base + ((sp + 2) & 0xffff)) as u32,
+                    read_linear_u16(stack_base + ((sp + 4) & 0xffff)) as u32,
+                )
+            };
+            sp = (sp + 6) & 0xffff;
+            vif = flags & EFLAGS_IF != 0;
+            eflags = merge_popped_flags(eflags, flags);
+            cs = new_cs;
+            ip = new_ip;
+        }
+        0xcd => {
+            // INT nn
+            let int_num = unsafe { read_linear_u8((cs << 4) + ((ip + 1) & 0xffff)) };
+            if !reflected.is_set(int_num) {
+                return false;
+            }
+            push(flags_image(eflags, vif));
+            push(cs as u16);
+            push(((ip + 2) & 0xffff) as u16);
+            vif = false;
+            let vector = int_num as u32 * 4;
+            unsafe {
+                ip = read_linear_u16(vector) as u32;
+                cs = read_linear_u16(vector + 2) as u32;
+            }
+        }
+        _ => return false,
+    }
+
+    // Like PVI, a pending virtual interrupt is raised as soon as the
+    // program re-enables interrupts. The trap flag forces an exit on the
+    // next instruction.
+    if vif && pending_irqs != 0 {
+        eflags |= EFLAGS_TF;
+    } else {
+        eflags &= !EFLAGS_TF;
+    }
+
+    get_current_task().write().vm86_vif = vif;
+    stack_frame.set_eip(ip & 0xffff);
+    stack_frame.set_cs(cs);
+    stack_frame.set_eflags(eflags);
+    unsafe {
+        core::ptr::write_volatile(frame_ptr.add(3), (esp & 0xffff_0000) | sp);
+    }
+    true
+}
+
+/// Combine flags popped by v86 code with the real eflags. The program can't
+/// modify IOPL or the real IF, and the trap flag is managed by the kernel.
+fn merge_popped_flags(eflags: u32, popped: u32) -> u32 {
+    let preserved = eflags & (0xffff_0000 | EFLAGS_IOPL);
+    let popped = popped & 0xffff & !(EFLAGS_IOPL | EFLAGS_IF | EFLAGS_TF);
+    preserved | popped | EFLAGS_IF
+}
+
+// v86 code uses linear addresses, and segment 0 (which holds the IVT) is
+// perfectly valid. Access them with plain moves so that address 0 isn't
+// treated as a null pointer.
+
+unsafe fn read_linear_u8(addr: u32) -> u8 {
+    let value: u8;
+    asm!(
+        "mov {0}, byte ptr [{1:e}]",
+        out(reg_byte) value,
+        in(reg) addr,
+        options(nostack, readonly, preserves_flags),
+    );
+    value
+}
+
+unsafe fn read_linear_u16(addr: u32) -> u16 {
+    let value: u16;
+    asm!(
+        "mov {0:x}, word ptr [{1:e}]",
+        out(reg) value,
+        in(reg) addr,
+        options(nostack, readonly, preserves_flags),
+    );
+    value
+}
+
+unsafe fn write_linear_u16(addr: u32, value: u16) {
+    asm!(
+        "mov word ptr [{1:e}], {0:x}",
+        in(reg) value,
+        in(reg) addr,
+        options(nostack, preserves_flags),
+    );
+}
+
 /// Enter DPMI protected mode. The caller's registers are saved so that when
 /// the DPMI code faults (INT instruction, GPF, etc.), we can restore the
 /// caller's context and return the exit reason.
@@ -1,10 +1,19 @@
 use crate::{
     io::filesystem::driver::DriverID,
-    memory::address::{PhysicalAddress, VirtualAddress},
+    memory::{
+        address::{PhysicalAddress, VirtualAddress},
+        physical::{
+            allocated_frame::AllocatedFrame, maybe_add_frame_reference, release_tracked_frame,
+        },
+    },
+};
+use alloc::{
+    collections::{BTreeMap, BTreeSet},
+    vec::Vec,
 };
-use alloc::{collections::BTreeMap, vec::Vec};
 use core::ops::Range;
 use idos_api::io::driver::DriverMappingToken;
+use idos_api::syscall::memory::{PROT_EXEC, PROT_READ, PROT_WRITE};
 use spin::rwlock::RwLock;
 
 /// Global lookup for which physical memory pages are currently being used
@@ -33,15 +42,59 @@ pub fn track_file_backed_page(
 ) {
     let mut tracker = FILE_BACKED_PAGE_TRACKER.write();
     tracker.insert((driver_id, mapping_token, offset_in_file), paddr);
+    if PINNED_FILE_MAPPINGS.read().contains(&(driver_id, mapping_token)) {
+        maybe_add_frame_reference(paddr);
+    }
 }
 
+/// Forget the frame tracked for a page of a file, if it is still `paddr`.
+/// A private copy of the page may be released while the shared frame lives
+/// on, so the address has to match.
 pub fn untrack_file_backed_page(
     driver_id: DriverID,
     mapping_token: DriverMappingToken,
     offset_in_file: u32,
+    paddr: PhysicalAddress,
 ) {
     let mut tracker = FILE_BACKED_PAGE_TRACKER.write();
-    tracker.remove(&(driver_id, mapping_token, offset_in_file));
+    let key = (driver_id, mapping_token, offset_in_file);
+    if tracker.get(&key) == Some(&paddr) {
+        tracker.remove(&key);
+    }
+}
+
+/// File mappings whose shared pages stay resident after the last task using
+/// them lets go. Each tracked page of a pinned mapping holds one extra frame
+/// reference on behalf of the pin.
+static PINNED_FILE_MAPPINGS: RwLock<BTreeSet<(DriverID, DriverMappingToken)>> =
+    RwLock::new(BTreeSet::new());
+
+/// Keep the shared pages of a file mapping resident, for caches that expect
+/// to map the same file again soon (like executable images)
+pub fn pin_file_mapping(driver_id: DriverID, mapping_token: DriverMappingToken) {
+    PINNED_FILE_MAPPINGS
+        .write()
+        .insert((driver_id, mapping_token));
+}
+
+/// Drop a pin, releasing the pages that only the pin was keeping alive
+pub fn unpin_file_mapping(driver_id: DriverID, mapping_token: DriverMappingToken) {
+    if !PINNED_FILE_MAPPINGS
+        .write()
+        .remove(&(driver_id, mapping_token))
+    {
+        return;
+    }
+    let mut tracker = FILE_BACKED_PAGE_TRACKER.write();
+    let pages: Vec<(u32, PhysicalAddress)> = tracker
+        .range((driver_id, mapping_token, 0)..=(driver_id, mapping_token, u32::MAX))
+        .map(|(&(_, _, offset), &paddr)| (offset, paddr))
+        .collect();
+    for (offset, paddr) in pages {
+        if let Ok(true) = release_tracked_frame(AllocatedFrame::new(paddr)) {
+            tracker.remove(&(driver_id, mapping_token, offset));
+        }
+    }
 }
 
 /// MemMappedRegion represents a section of memory that has been mapped to a
@@ -57,8 +110,17 @@ pub struct MemMappedRegion {
     /// The backing type of this memory region, used to determine how to handle
     /// page faults.
     pub backed_by: MemoryBacking,
+    /// Number of pages past a faulting page to read in along with it, for
+    /// file-backed regions the task has said it will scan sequentially
+    pub readahead: u32,
+    /// PROT_* bits for what the task may do with the region. Pages are
+    /// mapped with the matching permissions when they are paged in.
+    pub protection: u32,
 }
 
+/// Protection given to regions mapped without asking for any in particular
+pub const PROT_DEFAULT: u32 = PROT_READ | PROT_WRITE | PROT_EXEC;
+
 impl MemMappedRegion {
     pub fn get_address_range(&self) -> Range<VirtualAddress> {
         let start = self.address;
@@ -77,6 +139,21 @@ impl MemMappedRegion {
     pub fn page_count(&self) -> usize {
         (self.size as usize + 0xfff) / 0x1000
     }
+
+    /// Split the region at a page boundary inside it, keeping the part
+    /// before `at` and returning the part after it
+    fn split_off(&mut self, at: VirtualAddress) -> MemMappedRegion {
+        let front_size = at - self.address;
+        let after = MemMappedRegion {
+            address: at,
+            size: self.size - front_size,
+            backed_by: self.backed_by.offset_by(front_size),
+            readahead: self.readahead,
+            protection: self.protection,
+        };
+        self.size = front_size;
+        after
+    }
 }
 
 /// The backing type of a mem-mapped region determines how it behaves when a
@@ -106,9 +183,48 @@ pub enum MemoryBacking {
         /// If true, physical frames are shared across tasks via the tracker.
         /// If false, each mapping gets its own writable copy.
         shared: bool,
+        /// For private mappings: fill each page by copying the frame kept in
+        /// the tracker, reading it from the file (and tracking it) first if
+        /// nobody has yet. Only whole pages of file data are kept this way.
+        copy_from_shared: bool,
+        /// How many bytes of the region, from its start, come from the file.
+        /// The rest reads as zero: the page holding the boundary has its
+        /// tail cleared when it is paged in, and pages past it are handed
+        /// out zeroed without reading the file at all. Only private mappings
+        /// may end their file data early.
+        file_size: u32,
     },
 }
 
+impl MemoryBacking {
+    /// The backing for the part of a region that starts `offset` bytes in
+    fn offset_by(&self, offset: u32) -> MemoryBacking {
+        match *self {
+            MemoryBacking::Direct(paddr) => MemoryBacking::Direct(paddr + offset),
+            MemoryBacking::FileBacked {
+                driver_id,
+                mapping_token,
+                offset_in_file,
+                shared,
+                copy_from_shared,
+                file_size,
+            } => MemoryBacking::FileBacked {
+                driver_id,
+                mapping_token,
+                offset_in_file: offset_in_file + offset,
+                shared,
+                copy_from_shared,
+                file_size: file_size.saturating_sub(offset),
+            },
+            ref other => other.clone(),
+        }
+    }
+
+    fn is_shared(&self) -> bool {
+        matches!(self, MemoryBacking::FileBacked { shared: true, .. })
+    }
+}
+
 pub struct UnmappedRegion {
     pub address: VirtualAddress,
     pub size: u32,
@@ -182,10 +298,29 @@ impl<const U: u32> MappedMemory<U> {
         addr: Option<VirtualAddress>,
         requested_size: u32,
         backing: MemoryBacking,
+    ) -> Result<VirtualAddress, MemMapError> {
+        let protection = if backing.is_shared() {
+            PROT_DEFAULT & !PROT_WRITE
+        } else {
+            PROT_DEFAULT
+        };
+        self.map_memory_with_protection(addr, requested_size, backing, protection)
+    }
+
+    /// Same as map_memory, but with PROT_* bits for the region. Shared
+    /// file-backed regions can't be writable, since their frames belong to
+    /// every task mapping the file.
+    pub fn map_memory_with_protection(
+        &mut self,
+        addr: Option<VirtualAddress>,
+        requested_size: u32,
+        backing: MemoryBacking,
+        protection: u32,
     ) -> Result<VirtualAddress, MemMapError> {
         if requested_size == 0 {
             return Err(MemMapError::InvalidSize);
         }
+        check_protection(&backing, protection)?;
         let rounded_size = (requested_size + 0xfff) & 0xfffff000;
 
         let location: Option<VirtualAddress> = match addr {
@@ -209,6 +344,8 @@ impl<const U: u32> MappedMemory<U> {
             address: free_space,
             size: requested_size,
             backed_by: backing,
+            readahead: 0,
+            protection,
         };
         self.regions.insert(free_space, mapping);
         Ok(free_space)
@@ -288,6 +425,7 @@ impl<const U: u32> MappedMemory<U> {
                             mapping_token,
                             offset_in_file,
                             shared,
+                            ..
                         } => UnmappedRegionKind::FileBacked {
                             driver_id,
                             mapping_token,
@@ -297,22 +435,17 @@ impl<const U: u32> MappedMemory<U> {
                     },
                 });
             }
-            if region_range.start < addr {
-                let before = MemMappedRegion {
-                    address: region_range.start,
-                    size: addr - region_range.start,
-                    backed_by: region.backed_by.clone(),
-                };
-                self.regions.insert(before.address, before);
-            }
+            let mut region = region;
             if region_range.end > unmap_end {
-                let after = MemMappedRegion {
-                    address: unmap_end,
-                    size: region_range.end - unmap_end,
-                    backed_by: region.backed_by.clone(),
-                };
+                // The remainder starts further into the file than the
+                // original region did
+                let after = region.split_off(unmap_end);
                 self.regions.insert(after.address, after);
             }
+            if region_range.start < addr {
+                region.split_off(addr);
+                self.regions.insert(region.address, region);
+            }
         }
 
         Ok(unmapped)
@@ -320,6 +453,18 @@ impl<const U: u32> MappedMemory<U> {
 
     /// Returns a reference to a mmap region if it contains the requested
     /// virtual address. This is useful for handling a page fault.
+    /// Whether any region is still paged in through this driver mapping
+    pub fn uses_file_mapping(&self, driver: DriverID, token: DriverMappingToken) -> bool {
+        self.regions.values().any(|region| match region.backed_by {
+            MemoryBacking::FileBacked {
+                driver_id,
+                mapping_token,
+                ..
+            } => driver_id == driver && mapping_token == token,
+            _ => false,
+        })
+    }
+
     pub fn get_mapping_containing_address(
         &self,
         addr: &VirtualAddress,
@@ -346,6 +491,69 @@ impl<const U: u32> MappedMemory<U> {
         None
     }
 
+    /// Set the readahead window of every region overlapping `range`. Regions
+    /// aren't split for this: a hint covering part of a region applies to
+    /// all of it. Returns the number of regions updated.
+    pub fn set_readahead(&mut self, range: Range<VirtualAddress>, pages: u32) -> usize {
+        let mut updated = 0;
+        for (_, region) in self.regions.iter_mut() {
+            if ranges_overlap(&region.get_address_range(), &range) {
+                region.readahead = pages;
+                updated += 1;
+            }
+        }
+        updated
+    }
+
+    /// Change the protection of every page in `range`, which must start on a
+    /// page boundary and be mapped throughout. Regions that straddle either
+    /// end are split so only the pages in the range change. Nothing is
+    /// modified if any part of the range can't take the new protection.
+    pub fn set_protection(
+        &mut self,
+        range: Range<VirtualAddress>,
+        protection: u32,
+    ) -> Result<(), MemMapError> {
+        if !range.start.is_page_aligned() {
+            return Err(MemMapError::MappingWrongAlignment);
+        }
+        let mut keys: Vec<VirtualAddress> = Vec::new();
+        let mut covered_to = range.start;
+        for (key, region) in self.regions.range(..range.end) {
+            let region_end = (region.address + region.size).next_page_barrier();
+            if region_end <= range.start {
+                continue;
+            }
+            if region.address > covered_to {
+                return Err(MemMapError::NotMapped);
+            }
+            check_protection(&region.backed_by, protection)?;
+            covered_to = region_end;
+            keys.push(*key);
+        }
+        if covered_to < range.end {
+            return Err(MemMapError::NotMapped);
+        }
+
+        for key in keys {
+            let mut region = self.regions.remove(&key).unwrap();
+            let region_end = (region.address + region.size).next_page_barrier();
+            if region_end > range.end {
+                let after = region.split_off(range.end);
+                self.regions.insert(after.address, after);
+            }
+            if region.address < range.start {
+                let mut middle = region.split_off(range.start);
+                middle.protection = protection;
+                self.regions.insert(middle.address, middle);
+            } else {
+                region.protection = protection;
+            }
+            self.regions.insert(region.address, region);
+        }
+        Ok(())
+    }
+
     /// Checks if the specified range can fit without overlapping any currently
     /// mapped regions.
     fn can_fit_range(&self, range: Range<VirtualAddress>) -> bool {
@@ -467,6 +675,17 @@ impl<const U: u32> MappedMemory<U> {
     }
 }
 
+/// Make sure a region with this backing can be given this protection
+fn check_protection(backing: &MemoryBacking, protection: u32) -> Result<(), MemMapError> {
+    if protection & !PROT_DEFAULT != 0 {
+        return Err(MemMapError::InvalidProtection);
+    }
+    if backing.is_shared() && protection & PROT_WRITE != 0 {
+        return Err(MemMapError::InvalidProtection);
+    }
+    Ok(())
+}
+
 pub fn ranges_overlap(a: &Range<VirtualAddress>, b: &Range<VirtualAddress>) -> bool {
     let min = a.start.min(b.start);
     let max = a.end.max(b.end);
@@ -499,11 +718,19 @@ pub enum MemMapError {
     DriverError,
     /// An error occurred in the kernel while managing memory
     KernelError,
+    /// The usage hint passed to advise_memory is not one the kernel knows
+    UnknownAdvice,
+    /// Unknown PROT_* bits, or write access to a shared file mapping
+    InvalidProtection,
 }
 
 #[cfg(test)]
 mod tests {
-    use super::{ranges_overlap, MappedMemory, MemoryBacking, VirtualAddress};
+    use super::{
+        ranges_overlap, DriverID, DriverMappingToken, MappedMemory, MemMapError, MemoryBacking,
+        UnmappedRegionKind, VirtualAddress, PROT_DEFAULT,
+    };
+    use idos_api::syscall::memory::{PROT_READ, PROT_WRITE};
 
     #[test_case]
     fn overlapping_ranges() {
@@ -616,4 +843,108 @@ mod tests {
         assert_eq!(second.address, VirtualAddress::new(0x6000));
         assert_eq!(second.size, 0x1000);
     }
+
+    #[test_case]
+    fn unmapping_file_backed_keeps_offsets() {
+        let mut regions = MappedMemory::<0xc000_0000>::new();
+        regions
+            .map_memory(
+                Some(VirtualAddress::new(0x4000)),
+                0x3000,
+                MemoryBacking::FileBacked {
+                    driver_id: DriverID::new(1),
+                    mapping_token: DriverMappingToken::new(1),
+                    offset_in_file: 0x10000,
+                    shared: false,
+                    copy_from_shared: false,
+                    file_size: 0x2800,
+                },
+            )
+            .unwrap();
+        let unmapped = regions
+            .unmap_memory(VirtualAddress::new(0x5000), 0x1000)
+            .unwrap();
+        match unmapped[0].kind {
+            UnmappedRegionKind::FileBacked { offset_in_file, .. } => {
+                assert_eq!(offset_in_file, 0x11000)
+            }
+            _ => panic!("unmapped region lost its backing"),
+        }
+        let second = regions
+            .get_mapping_containing_address(&VirtualAddress::new(0x6000))
+            .unwrap();
+        match second.backed_by {
+            MemoryBacking::FileBacked {
+                offset_in_file,
+                file_size,
+                ..
+            } => {
+                assert_eq!(offset_in_file, 0x12000);
+                assert_eq!(file_size, 0x800);
+            }
+            _ => panic!("remaining region lost its backing"),
+        }
+    }
+
+    #[test_case]
+    fn protecting_part_of_a_region() {
+        let mut regions = MappedMemory::<0xc000_0000>::new();
+        regions
+            .map_memory(
+                Some(VirtualAddress::new(0x4000)),
+                0x3000,
+                MemoryBacking::FreeMemory,
+            )
+            .unwrap();
+        regions
+            .set_protection(
+                VirtualAddress::new(0x5000)..VirtualAddress::new(0x6000),
+                PROT_READ,
+            )
+            .unwrap();
+        assert_eq!(regions.len(), 3);
+        let protection_at = |addr| {
+            regions
+                .get_mapping_containing_address(&VirtualAddress::new(addr))
+                .unwrap()
+                .protection
+        };
+        assert_eq!(protection_at(0x4000), PROT_DEFAULT);
+        assert_eq!(protection_at(0x5000), PROT_READ);
+        assert_eq!(protection_at(0x6fff), PROT_DEFAULT);
+
+        // A range running past the end of the mapping changes nothing
+        assert!(matches!(
+            regions.set_protection(
+                VirtualAddress::new(0x6000)..VirtualAddress::new(0x8000),
+                PROT_READ
+            ),
+            Err(MemMapError::NotMapped),
+        ));
+        assert_eq!(regions.len(), 3);
+    }
+
+    #[test_case]
+    fn shared_file_mappings_stay_read_only() {
+        let mut regions = MappedMemory::<0xc000_0000>::new();
+        let backing = MemoryBacking::FileBacked {
+            driver_id: DriverID::new(1),
+            mapping_token: DriverMappingToken::new(1),
+            offset_in_file: 0,
+            shared: true,
+            copy_from_shared: false,
+            file_size: 0x2000,
+        };
+        assert!(regions
+            .map_memory_with_protection(None, 0x2000, backing.clone(), PROT_READ | PROT_WRITE)
+            .is_err());
+        let addr = regions.map_memory(None, 0x2000, backing).unwrap();
+        assert_eq!(PROT_DEFAULT & !PROT_WRITE, {
+            regions.get_mapping_containing_address(&addr).unwrap().protection
+        });
+        assert!(matches!(
+            regions.set_protection(addr..addr + 0x1000, PROT_READ | PROT_WRITE),
+            Err(MemMapError::InvalidProtection),
+        ));
+    }
 }
@@ -1,5 +1,6 @@
 use crate::log::TaggedLogger;
 
+pub mod accounting;
 pub mod actions;
 pub mod args;
 pub mod id;
@@ -1,9 +1,16 @@
+use alloc::sync::Arc;
+use alloc::vec::Vec;
 use idos_api::io::error::IoError;
-use spin::Mutex;
+use idos_api::syscall::memory::{PROT_NONE, PROT_WRITE};
+use spin::{Mutex, RwLock};
 
 use super::id::TaskID;
 use super::map::get_task;
-use super::memory::{get_file_backed_page, track_file_backed_page, MemMappedRegion, MemoryBacking};
+use super::memory::{
+    get_file_backed_page, track_file_backed_page, untrack_file_backed_page, MemMappedRegion,
+    MemoryBacking,
+};
+use super::state::Task;
 use super::switching::get_current_task;
 use crate::io::filesystem::driver_page_in_file;
 use crate::memory::address::{PhysicalAddress, VirtualAddress};
@@ -63,12 +70,63 @@ pub fn page_on_demand(address: VirtualAddress) -> Option<PhysicalAddress> {
         .memory_mapping
         .get_mapping_containing_address(&address)
         .cloned()?;
+    // A region the task isn't allowed to touch is never paged in, so the
+    // access faults like one outside any mapping
+    if mem_mapping.protection == PROT_NONE {
+        return None;
+    }
+
+    let (paddr, file_ended) = page_in(&task_lock, &mem_mapping, address)?;
+    if mem_mapping.readahead > 0 && !file_ended {
+        if let MemoryBacking::FileBacked { .. } = mem_mapping.backed_by {
+            read_ahead(&task_lock, &mem_mapping, address);
+        }
+    }
+    Some(paddr)
+}
 
+/// After a fault in a file-backed region, page in the next few pages of the
+/// region too, so a sequential scan takes one fault per window instead of
+/// one per page. Each page is a round trip to the driver, made while the
+/// fault waits, so the window ends as soon as it stops paying off: at the
+/// first page that is already present (the scan has been here before), at
+/// the end of the file, or at the first failure.
+fn read_ahead(task_lock: &Arc<RwLock<Task>>, mem_mapping: &MemMappedRegion, address: VirtualAddress) {
+    let mut region_end = mem_mapping.get_address_range().end;
+    // Zero-filled pages past the file data aren't worth faulting in early
+    if let MemoryBacking::FileBacked { file_size, .. } = mem_mapping.backed_by {
+        region_end = region_end.min(mem_mapping.address + file_size);
+    }
+    let mut next = address.prev_page_barrier();
+    for _ in 0..mem_mapping.readahead {
+        next = next + 0x1000;
+        if next >= region_end {
+            break;
+        }
+        if maybe_get_current_physical_address(next).is_some() {
+            break;
+        }
+        match page_in(task_lock, mem_mapping, next) {
+            Some((_, false)) => (),
+            _ => break,
+        }
+    }
+}
+
+/// Back a single page of `mem_mapping` with a frame, according to the
+/// region's backing type. Along with the address, reports whether the page
+/// reaches the end of the file data, so read-ahead knows to stop.
+fn page_in(
+    task_lock: &Arc<RwLock<Task>>,
+    mem_mapping: &MemMappedRegion,
+    address: VirtualAddress,
+) -> Option<(PhysicalAddress, bool)> {
     // offset of the page within the mapping
     let page_offset = address.prev_page_barrier() - mem_mapping.address;
     // offset of the address within the page
     let local_offset = address.as_u32() & 0xfff;
     let flags = get_flags_for_region(&mem_mapping);
+    let mut file_ended = false;
 
     let frame_start = match &mem_mapping.backed_by {
         MemoryBacking::IsaDma => {
@@ -97,13 +155,7 @@ pub fn page_on_demand(address: VirtualAddress) -> Option<PhysicalAddress> {
             // Zero the frame before mapping it. This is critical for BSS
             // sections and any anonymous memory that expects zero-initialized
             // pages.
-            {
-                let scratch = UnmappedPage::map(allocated_frame.peek_address());
-                let page_ptr = scratch.virtual_address().as_u32() as *mut u8;
-                unsafe {
-                    core::ptr::write_bytes(page_ptr, 0, 0x1000);
-                }
-            }
+            zero_frame_from(allocated_frame.peek_address(), 0);
             current_pagedir_map(allocated_frame, address.prev_page_barrier(), flags)
         }
         MemoryBacking::FileBacked {
@@ -111,13 +163,33 @@ pub fn page_on_demand(address: VirtualAddress) -> Option<PhysicalAddress> {
             mapping_token,
             offset_in_file,
             shared,
+            copy_from_shared,
+            file_size,
         } => {
             let total_offset = offset_in_file + page_offset;
 
+            // Past the end of the file data the region is plain zero-filled
+            // memory, like the BSS that follows an ELF segment
+            if page_offset >= *file_size {
+                let allocated_frame =
+                    allocate_frame_with_tracking().expect("Failed to allocate memory for page");
+                zero_frame_from(allocated_frame.peek_address(), 0);
+                let paddr = current_pagedir_map(allocated_frame, address.prev_page_barrier(), flags);
+                return Some((paddr + local_offset, true));
+            }
+
             // Shared mappings reuse physical frames across tasks via the
-            // tracker. Private mappings always get a fresh frame.
-            if *shared {
-                if let Some(paddr) = get_file_backed_page(*driver_id, *mapping_token, total_offset) {
+            // tracker. Private mappings always get a fresh frame, but with
+            // copy_from_shared it is filled from the tracked frame, which
+            // is paged in once and kept for the next task.
+            let from_shared = *copy_from_shared && page_offset + 0x1000 <= *file_size;
+            let tracked = if *shared || from_shared {
+                get_file_backed_page(*driver_id, *mapping_token, total_offset)
+            } else {
+                None
+            };
+            if let Some(paddr) = tracked {
+                if *shared {
                     super::LOGGER.log(format_args!("File-backed Mapping: re-use {:?}", paddr));
                     maybe_add_frame_reference(paddr);
                     current_pagedir_map(
@@ -125,8 +197,20 @@ pub fn page_on_demand(address: VirtualAddress) -> Option<PhysicalAddress> {
                         address.prev_page_barrier(),
                         flags,
                     );
-                    return Some(paddr);
+                    return Some((paddr + local_offset, false));
+                }
+                // Hold a reference while copying, in case the last other
+                // user of the frame lets go of it meanwhile
+                maybe_add_frame_reference(paddr);
+                let allocated_frame =
+                    allocate_frame_with_tracking().expect("Failed to allocate memory");
+                copy_frame(paddr, allocated_frame.peek_address());
+                if let Ok(true) = release_tracked_frame(AllocatedFrame::new(paddr)) {
+                    untrack_file_backed_page(*driver_id, *mapping_token, total_offset, paddr);
                 }
+                let frame_paddr =
+                    current_pagedir_map(allocated_frame, address.prev_page_barrier(), flags);
+                return Some((frame_paddr + local_offset, false));
             }
 
             let allocated_frame =
@@ -148,9 +232,32 @@ pub fn page_on_demand(address: VirtualAddress) -> Option<PhysicalAddress> {
                 };
 
             match result {
-                Ok(_) => {
+                Ok(bytes_read) => {
+                    // A short read means the file itself ends in this page
+                    file_ended = bytes_read < 0x1000;
+                    let valid = *file_size - page_offset;
+                    if valid < 0x1000 {
+                        zero_frame_from(frame_paddr, valid as usize);
+                    }
                     if *shared {
                         track_file_backed_page(*driver_id, *mapping_token, total_offset, frame_paddr);
+                    } else if from_shared {
+                        // Keep the page as read from the file for later
+                        // tasks, and give this one a copy
+                        track_file_backed_page(*driver_id, *mapping_token, total_offset, frame_paddr);
+                        let copy =
+                            allocate_frame_with_tracking().expect("Failed to allocate memory");
+                        copy_frame(frame_paddr, copy.peek_address());
+                        let paddr = current_pagedir_map(copy, address.prev_page_barrier(), flags);
+                        if let Ok(true) = release_tracked_frame(allocated_frame) {
+                            untrack_file_backed_page(
+                                *driver_id,
+                                *mapping_token,
+                                total_offset,
+                                frame_paddr,
+                            );
+                        }
+                        return Some((paddr + local_offset, file_ended));
                     }
                     current_pagedir_map(allocated_frame, address.prev_page_barrier(), flags)
                 }
@@ -162,7 +269,29 @@ pub fn page_on_demand(address: VirtualAddress) -> Option<PhysicalAddress> {
         }
     };
 
-    Some(frame_start + local_offset)
+    Some((frame_start + local_offset, file_ended))
+}
+
+/// Copy the contents of one frame into another
+fn copy_frame(from: PhysicalAddress, to: PhysicalAddress) {
+    let source = UnmappedPage::map(from);
+    let dest = UnmappedPage::map(to);
+    unsafe {
+        core::ptr::copy_nonoverlapping(
+            source.virtual_address().as_ptr::<u8>(),
+            dest.virtual_address().as_ptr_mut::<u8>(),
+            0x1000,
+        );
+    }
+}
+
+/// Clear a frame from byte `start` to the end of the page
+fn zero_frame_from(paddr: PhysicalAddress, start: usize) {
+    let scratch = UnmappedPage::map(paddr);
+    let page_ptr = scratch.virtual_address().as_u32() as *mut u8;
+    unsafe {
+        core::ptr::write_bytes(page_ptr.add(start), 0, 0x1000 - start);
+    }
 }
 
 /// Create a new page directory, copying the kernel-space entries from the
@@ -245,6 +374,9 @@ pub fn current_pagedir_map_explicit(
     }
 
     let table = PageTable::at_address(table_address);
+    // Start from a clean entry, so permissions left over from whatever was
+    // mapped here before don't carry over
+    table.get_mut(table_index).zero();
     table.get_mut(table_index).set_address(paddr);
     table.get_mut(table_index).set_present();
     if flags.has_flag(PermissionFlags::USER_ACCESS) {
@@ -289,6 +421,73 @@ pub fn current_pagedir_unmap(vaddr: VirtualAddress) -> Option<AllocatedFrame> {
     Some(AllocatedFrame::new(paddr))
 }
 
+/// Physical address of the page directory this CPU is running on
+pub fn current_pagedir_address() -> PhysicalAddress {
+    let cr3: u32;
+    unsafe {
+        core::arch::asm!("mov {0:e}, cr3", out(reg) cr3);
+    }
+    PhysicalAddress::new(cr3 & 0xfffff000)
+}
+
+/// Check whether the page containing `vaddr` has been written since the last
+/// check, and reset its dirty bit so the CPU will set it again on the next
+/// write. Pages that are not present have never been written, and are
+/// reported as clean.
+///
+/// Only this CPU's TLB is flushed, with no shootdown. That relies on no two
+/// CPUs ever running on the same page directory: every task gets its own
+/// from `create_page_directory`, a task only runs on one CPU at a time, and
+/// moving it to another CPU reloads CR3, which drops the stale entries.
+/// If tasks ever come to share an address space, other CPUs running it will
+/// need to be sent an invalidation too.
+pub fn current_pagedir_take_dirty(vaddr: VirtualAddress) -> bool {
+    let dir_index = vaddr.get_page_directory_index();
+    let current_dir = PageTable::current_directory();
+    if !current_dir.get(dir_index).is_present() {
+        return false;
+    }
+    let table_address = VirtualAddress::new(0xffc00000 + (dir_index as u32 * 0x1000));
+    let table = PageTable::at_address(table_address);
+    let entry = table.get_mut(vaddr.get_page_table_index());
+    if !entry.is_present() || !entry.is_dirty() {
+        return false;
+    }
+    entry.clear_dirty();
+    // the cached translation still has the dirty bit set; without flushing
+    // it, the CPU would skip updating the entry on the next write
+    invalidate_page(vaddr.prev_page_barrier());
+    true
+}
+
+/// Apply new permissions to the page containing `vaddr`, if it is present
+/// in the current page directory. Returns whether it was.
+pub fn current_pagedir_set_permissions(vaddr: VirtualAddress, flags: PermissionFlags) -> bool {
+    let dir_index = vaddr.get_page_directory_index();
+    let current_dir = PageTable::current_directory();
+    if !current_dir.get(dir_index).is_present() {
+        return false;
+    }
+    let table_address = VirtualAddress::new(0xffc00000 + (dir_index as u32 * 0x1000));
+    let table = PageTable::at_address(table_address);
+    let entry = table.get_mut(vaddr.get_page_table_index());
+    if !entry.is_present() {
+        return false;
+    }
+    if flags.has_flag(PermissionFlags::USER_ACCESS) {
+        entry.set_user_access();
+    } else {
+        entry.clear_user_access();
+    }
+    if flags.has_flag(PermissionFlags::WRITE_ACCESS) {
+        entry.set_write_access();
+    } else {
+        entry.clear_write_access();
+    }
+    invalidate_page(vaddr.prev_page_barrier());
+    true
+}
+
 /// Get the physical address backing a virtual address in the current page
 /// directory. If there is a valid mapping but the page has not been assigned
 /// yet, it will be allocated and placed in the page table.
@@ -322,7 +521,15 @@ pub fn maybe_get_current_physical_address(vaddr: VirtualAddress) -> Option<Physi
 }
 
 pub fn get_flags_for_region(region: &MemMappedRegion) -> PermissionFlags {
-    let mut flags = PermissionFlags::USER_ACCESS | PermissionFlags::WRITE_ACCESS;
+    let mut flags = 0;
+    // Any access at all means the page has to be readable from user mode.
+    // Pages of a region with no access left are kept for the kernel only.
+    if region.protection != PROT_NONE {
+        flags |= PermissionFlags::USER_ACCESS;
+    }
+    if region.protection & PROT_WRITE != 0 {
+        flags |= PermissionFlags::WRITE_ACCESS;
+    }
 
     // Physical memory explicitly backing a region should not be freed when a
     // page is cleaned up
@@ -350,6 +557,12 @@ impl ExternalPageDirectory {
         let task_lock = get_task(id).unwrap();
         let page_directory_location = task_lock.read().page_directory;
 
+        Self::at(id, page_directory_location)
+    }
+
+    /// Use a page directory already read from the task, for callers that
+    /// can't rely on the task still being in the task map
+    pub fn at(id: TaskID, page_directory_location: PhysicalAddress) -> Self {
         Self {
             id,
             page_directory_location,
@@ -387,6 +600,7 @@ impl ExternalPageDirectory {
                 page_table.zero();
             }
             let table_entry = page_table.get_mut(table_index);
+            table_entry.zero();
             table_entry.set_address(paddr);
             table_entry.set_present();
             if flags.has_flag(PermissionFlags::USER_ACCESS) {
@@ -423,4 +637,65 @@ impl ExternalPageDirectory {
         page_table.get_mut(table_index).clear_present();
         Some(backing_frame)
     }
+
+    /// Count the pages present in the user half of the address space. Each
+    /// page table is mapped into scratch space once, so this costs one scratch
+    /// mapping per 4MiB in use rather than one per page.
+    pub fn count_user_pages(&self) -> u32 {
+        let unmapped_for_dir = UnmappedPage::map(self.page_directory_location);
+        let page_dir = PageTable::at_address(unmapped_for_dir.virtual_address());
+        let mut count = 0;
+        // Directory entries from 768 up cover the shared kernel space
+        for dir_index in 0..768 {
+            let dir_entry = page_dir.get(dir_index);
+            if !dir_entry.is_present() {
+                continue;
+            }
+            let unmapped_for_table = UnmappedPage::map(dir_entry.get_address());
+            let page_table = PageTable::at_address(unmapped_for_table.virtual_address());
+            count += (0..1024).filter(|&i| page_table.get(i).is_present()).count() as u32;
+        }
+        count
+    }
+
+    /// Unmap every present page in `size` bytes starting at `address`,
+    /// returning each page's offset from `address` alongside its backing frame.
+    /// Unlike calling `unmap` page by page, the directory and each page table
+    /// are only mapped into scratch space once, which makes this the cheap way
+    /// to tear down whole regions.
+    pub fn unmap_range(&self, address: VirtualAddress, size: u32) -> Vec<(u32, AllocatedFrame)> {
+        super::LOGGER.log(format_args!(
+            "Unmapping {:#X} bytes at {:?} for {:?}",
+            size, address, self.id
+        ));
+        let start = address.as_u32() & 0xfffff000;
+        let end = address.as_u32().saturating_add(size);
+        let mut unmapped = Vec::new();
+
+        let unmapped_for_dir = UnmappedPage::map(self.page_directory_location);
+        let page_dir = PageTable::at_address(unmapped_for_dir.virtual_address());
+        let mut page = start;
+        while page < end {
+            // Each page table covers 4MiB
+            let table_end = (page | 0x3fffff).saturating_add(1).min(end);
+            let dir_entry = page_dir.get(VirtualAddress::new(page).get_page_directory_index());
+            if dir_entry.is_present() {
+                let unmapped_for_table = UnmappedPage::map(dir_entry.get_address());
+                let page_table = PageTable::at_address(unmapped_for_table.virtual_address());
+                while page < table_end {
+                    let entry = page_table.get_mut(VirtualAddress::new(page).get_page_table_index());
+                    if entry.is_present() {
+                        unmapped.push((page - start, AllocatedFrame::new(entry.get_address())));
+                        entry.clear_present();
+                    }
+                    page += 0x1000;
+                }
+            }
+            if table_end == end {
+                break;
+            }
+            page = table_end;
+        }
+        unmapped
+    }
 }
@@ -3,11 +3,14 @@
 //! LAPIC, tick counting), but all runnable tasks live in one global queue.
 
 use core::arch::asm;
-use core::sync::atomic::{AtomicU8, AtomicU32, Ordering};
+use core::sync::atomic::{AtomicPtr, AtomicU8, AtomicU32, Ordering};
 
 use alloc::collections::VecDeque;
+use alloc::sync::Arc;
 use spin::Mutex;
 
+use idos_api::stats::CpuEvents;
+
 use crate::{
     arch::gdt::{GdtEntry, TssWithBitmap},
     hardware::lapic::LocalAPIC,
@@ -15,9 +18,11 @@ use crate::{
         address::{PhysicalAddress, VirtualAddress},
         physical::allocate_frame,
     },
+    stats::EventCounters,
 };
 
 use super::{
+    accounting::TaskAccounting,
     id::{AtomicTaskID, TaskID},
     map::get_task,
     paging::{current_pagedir_map, current_pagedir_map_explicit, PermissionFlags},
@@ -67,8 +72,27 @@ pub struct CPUScheduler {
     user_ticks: AtomicU32,
     kernel_ticks: AtomicU32,
     idle_ticks: AtomicU32,
+
+    /// Accounting of the current task, holding one reference from its Arc.
+    /// Only this CPU swaps it, during the context switch, so the timer and
+    /// fault handlers can charge the running task without a lookup. Null
+    /// until the first switch.
+    current_accounting: AtomicPtr<TaskAccounting>,
+
+    /// Reference on the outgoing task's accounting, put aside by the context
+    /// switch and released once it has completed. A task that has already
+    /// been reaped may hold the last reference, and freeing it mid-switch
+    /// would run the allocator on the way between two stacks.
+    retired_accounting: AtomicPtr<TaskAccounting>,
+
+    /// Per-CPU event counters, only ever incremented by this CPU
+    pub counters: EventCounters,
 }
 
+// The scheduler and its counters share a single page, with the LAPIC mapped
+// directly above it
+const _: () = assert!(core::mem::size_of::<CPUScheduler>() <= 0x1000);
+
 impl CPUScheduler {
     pub fn new(cpu_index: usize, idle_task: TaskID, linear_address: VirtualAddress) -> Self {
         let mut gdt = unsafe { crate::arch::gdt::GDT.clone() };
@@ -89,6 +113,11 @@ impl CPUScheduler {
             user_ticks: AtomicU32::new(0),
             kernel_ticks: AtomicU32::new(0),
             idle_ticks: AtomicU32::new(0),
+
+            current_accounting: AtomicPtr::new(core::ptr::null_mut()),
+            retired_accounting: AtomicPtr::new(core::ptr::null_mut()),
+
+            counters: EventCounters::new(),
         }
     }
 
@@ -116,8 +145,40 @@ impl CPUScheduler {
         self.current_task.swap(id, Ordering::SeqCst)
     }
 
-    /// Record one tick of CPU time in the appropriate per-CPU bucket.
+    /// Make `accounting` the one charged for work on this CPU. The reference
+    /// held on the previous task's is put aside until
+    /// `release_retired_accounting` runs after the switch.
+    pub fn set_current_accounting(&self, accounting: Arc<TaskAccounting>) {
+        let next = Arc::into_raw(accounting) as *mut TaskAccounting;
+        let prev = self.current_accounting.swap(next, Ordering::SeqCst);
+        let older = self.retired_accounting.swap(prev, Ordering::SeqCst);
+        // switch() releases the retired reference before each switch, so
+        // there is never an older one waiting here
+        assert!(older.is_null());
+    }
+
+    /// Drop the reference put aside by the last context switch
+    pub fn release_retired_accounting(&self) {
+        let prev = self
+            .retired_accounting
+            .swap(core::ptr::null_mut(), Ordering::SeqCst);
+        if !prev.is_null() {
+            drop(unsafe { Arc::from_raw(prev) });
+        }
+    }
+
+    pub fn get_current_accounting(&self) -> Option<&TaskAccounting> {
+        // The pointer holds its own reference, and is only replaced by this
+        // CPU's context switch, so it outlives any borrow taken on this CPU
+        unsafe { self.current_accounting.load(Ordering::Relaxed).as_ref() }
+    }
+
+    /// Record one tick of CPU time in the appropriate per-CPU bucket, and
+    /// charge it to the current task.
     pub fn record_tick(&self, is_user: bool) {
+        if let Some(accounting) = self.get_current_accounting() {
+            accounting.record_tick(is_user);
+        }
         let is_idle = self.get_current_task() == self.idle_task;
         if is_user {
             self.user_ticks.fetch_add(1, Ordering::Relaxed);
@@ -255,6 +316,18 @@ pub fn get_all_cpu_ticks() -> alloc::vec::Vec<(usize, u32, u32, u32)> {
         .collect()
 }
 
+/// Collect a snapshot of each CPU's event counters, paired with its index
+pub fn get_all_cpu_counters() -> alloc::vec::Vec<(usize, CpuEvents)> {
+    let schedulers = CPU_SCHEDULERS.lock();
+    schedulers
+        .iter()
+        .map(|sp| unsafe {
+            let s = &*sp.0;
+            (s.get_cpu_index(), s.counters.snapshot())
+        })
+        .collect()
+}
+
 /// Put a task on the global work queue, making it eligible for execution again.
 pub fn reenqueue_task(id: TaskID) {
     GLOBAL_WORK_QUEUE.lock().push_back(WorkItem::Task(id));
@@ -276,6 +349,7 @@ pub fn switch() {
     if stale != 0xFFFFFFFF {
         reenqueue_task(TaskID::new(stale));
     }
+    scheduler.release_retired_accounting();
 
     let current_id = scheduler.current_task.load(Ordering::SeqCst);
 
@@ -323,6 +397,7 @@ pub fn switch() {
             .store(current_id.into(), Ordering::SeqCst);
     }
 
+    crate::stats::count_context_switch();
     switch_to(switch_to_id);
 
     // We're now on the resumed task's stack. The outgoing task's state has
@@ -334,4 +409,5 @@ pub fn switch() {
     if prev != 0xFFFFFFFF {
         reenqueue_task(TaskID::new(prev));
     }
+    scheduler.release_retired_accounting();
 }
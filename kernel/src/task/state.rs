@@ -8,9 +8,11 @@ use crate::time::system::{get_system_time, Timestamp};
 use alloc::boxed::Box;
 use alloc::string::String;
 use alloc::sync::Arc;
+use idos_api::compat::VM86ReflectedInts;
 use idos_api::io::error::IoResult;
 use idos_api::ipc::Message;
 
+use super::accounting::TaskAccounting;
 use super::args::ExecArgs;
 use super::id::TaskID;
 use super::memory::MappedMemory;
@@ -65,6 +67,8 @@ pub struct Task {
     pub state: RunState,
     /// Timestamp when the Task was created
     pub created_at: Timestamp,
+    /// CPU time, scheduling, fault and I/O counters charged to this task
+    pub accounting: Arc<TaskAccounting>,
 
     /// A Box pointing to the kernel stack for this task. This stack will be
     /// used when the task is executing kernel-mode code.
@@ -107,6 +111,10 @@ pub struct Task {
     pub vm86_irq_mask: u32,
     /// Bitmask of IRQs pending delivery to the v86 task
     pub vm86_pending_irqs: u32,
+    /// Virtual interrupt flag of the v86 task, toggled by emulated CLI/STI
+    pub vm86_vif: bool,
+    /// Software interrupts reflected into the v86 task's own IVT handlers
+    pub vm86_reflected_ints: VM86ReflectedInts,
 
     /// Storage for the task's registers when it enters DPMI protected mode.
     /// When Some, GPF handler knows to exit back to the caller instead of terminating.
@@ -129,6 +137,7 @@ impl Task {
             parent_id,
             state: RunState::Uninitialized,
             created_at: get_system_time().to_timestamp(),
+            accounting: Arc::new(TaskAccounting::new()),
             kernel_stack: Some(stack),
             stack_pointer,
             page_directory: PhysicalAddress::new(0),
@@ -143,6 +152,8 @@ impl Task {
             vm86_registers: None,
             vm86_irq_mask: 0,
             vm86_pending_irqs: 0,
+            vm86_vif: true,
+            vm86_reflected_ints: VM86ReflectedInts::none(),
             dpmi_registers: None,
             fpu_state: FxState::new(),
             ldt: None,
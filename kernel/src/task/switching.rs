@@ -233,6 +233,11 @@ pub fn switch_to(id: TaskID) {
     }
 
     super::scheduling::get_cpu_scheduler().set_current_task(id);
+    {
+        let accounting = next_task_lock.read().accounting.clone();
+        accounting.count_switch_in();
+        super::scheduling::get_cpu_scheduler().set_current_accounting(accounting);
+    }
 
     // Save outgoing task's FPU state, restore incoming task's
     unsafe {
@@ -0,0 +1,228 @@
+//! Stress test and benchmark for the libc heap, run on the host with
+//! `make libcbench`.
+//!
+//! A fixed pseudo-random sequence of malloc, free and realloc calls is
+//! replayed against the libc heap and against the host's system allocator.
+//! Every block is filled with a pattern when it's allocated, and checked
+//! before it's resized or freed, so overlapping blocks or corrupted
+//! metadata show up as failures. Once everything has been freed, the heap
+//! must have handed its memory back.
+
+#[path = "../src/heap.rs"]
+#[allow(dead_code)]
+mod heap;
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::time::{Duration, Instant};
+
+use heap::{Heap, PageSource, PAGE_SIZE};
+
+const SLOTS: usize = 4096;
+const OPERATIONS: usize = 4_000_000;
+
+/// Page source backed by the host allocator, which keeps count of the
+/// memory the heap is holding
+#[derive(Default)]
+struct HostPages {
+    mapped: usize,
+    peak: usize,
+    maps: usize,
+}
+
+impl PageSource for HostPages {
+    fn map(&mut self, size: usize) -> Option<usize> {
+        let layout = Layout::from_size_align(size, PAGE_SIZE).ok()?;
+        let address = unsafe { std::alloc::alloc(layout) };
+        if address.is_null() {
+            return None;
+        }
+        self.mapped += size;
+        self.peak = self.peak.max(self.mapped);
+        self.maps += 1;
+        Some(address as usize)
+    }
+
+    fn unmap(&mut self, address: usize, size: usize) {
+        let layout = Layout::from_size_align(size, PAGE_SIZE).unwrap();
+        unsafe { std::alloc::dealloc(address as *mut u8, layout) };
+        self.mapped -= size;
+    }
+}
+
+/// The allocator operations under test
+trait Allocator {
+    unsafe fn malloc(&mut self, size: usize) -> *mut u8;
+    unsafe fn free(&mut self, p: *mut u8, size: usize);
+    unsafe fn realloc(&mut self, p: *mut u8, old_size: usize, new_size: usize) -> *mut u8;
+}
+
+impl Allocator for Heap<HostPages> {
+    unsafe fn malloc(&mut self, size: usize) -> *mut u8 {
+        self.alloc(size)
+    }
+
+    unsafe fn free(&mut self, p: *mut u8, _size: usize) {
+        Heap::free(self, p)
+    }
+
+    unsafe fn realloc(&mut self, p: *mut u8, _old_size: usize, new_size: usize) -> *mut u8 {
+        Heap::realloc(self, p, new_size)
+    }
+}
+
+struct SystemAllocator;
+
+impl Allocator for SystemAllocator {
+    unsafe fn malloc(&mut self, size: usize) -> *mut u8 {
+        System.alloc(Layout::from_size_align_unchecked(size, 16))
+    }
+
+    unsafe fn free(&mut self, p: *mut u8, size: usize) {
+        System.dealloc(p, Layout::from_size_align_unchecked(size, 16))
+    }
+
+    unsafe fn realloc(&mut self, p: *mut u8, old_size: usize, new_size: usize) -> *mut u8 {
+        System.realloc(p, Layout::from_size_align_unchecked(old_size, 16), new_size)
+    }
+}
+
+/// xorshift32, so that both allocators see the same sequence
+struct Rng(u32);
+
+impl Rng {
+    fn next(&mut self) -> u32 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 17;
+        self.0 ^= self.0 << 5;
+        self.0
+    }
+
+    fn below(&mut self, n: u32) -> u32 {
+        self.next() % n
+    }
+}
+
+/// Mostly small requests, some medium, and the occasional large one, which
+/// is roughly what C programs do
+fn random_size(rng: &mut Rng) -> usize {
+    match rng.below(100) {
+        0..=79 => 1 + rng.below(128) as usize,
+        80..=94 => 129 + rng.below(1024 - 128) as usize,
+        95..=98 => 1025 + rng.below(64 * 1024) as usize,
+        _ => 256 * 1024 + rng.below(512 * 1024) as usize,
+    }
+}
+
+#[derive(Clone, Copy)]
+struct Block {
+    p: *mut u8,
+    size: usize,
+    tag: u8,
+}
+
+const EMPTY: Block = Block {
+    p: std::ptr::null_mut(),
+    size: 0,
+    tag: 0,
+};
+
+/// Only the ends of large blocks are written and checked, to keep the
+/// benchmark measuring the allocator rather than memset
+unsafe fn fill(block: &Block) {
+    let n = block.size.min(64);
+    std::ptr::write_bytes(block.p, block.tag, n);
+    std::ptr::write_bytes(block.p.add(block.size - n), block.tag, n);
+}
+
+unsafe fn check(block: &Block) {
+    let n = block.size.min(64);
+    check_range(block, 0, n);
+    check_range(block, block.size - n, block.size);
+}
+
+unsafe fn check_range(block: &Block, start: usize, end: usize) {
+    for i in start..end {
+        let byte = *block.p.add(i);
+        assert_eq!(byte, block.tag, "block {:p} size {} corrupted at {}", block.p, block.size, i);
+    }
+}
+
+/// Replay the operation sequence, returning how long it took. The
+/// bookkeeping around each call is the same for every allocator, so the
+/// difference between runs is down to the allocator.
+unsafe fn run(allocator: &mut impl Allocator, verify: bool) -> Duration {
+    let mut rng = Rng(0x1234_5678);
+    let mut blocks = vec![EMPTY; SLOTS];
+    let start = Instant::now();
+
+    for op in 0..OPERATIONS {
+        let slot = rng.below(SLOTS as u32) as usize;
+        let block = &mut blocks[slot];
+        let action = rng.below(8);
+
+        if block.p.is_null() {
+            let size = random_size(&mut rng);
+            let p = allocator.malloc(size);
+            assert!(!p.is_null(), "malloc({}) failed", size);
+            assert_eq!(p as usize % 16, 0, "malloc({}) misaligned", size);
+            *block = Block { p, size, tag: op as u8 };
+            if verify {
+                fill(block);
+            }
+        } else if action == 0 {
+            let size = random_size(&mut rng);
+            if verify {
+                check(block);
+            }
+            let p = allocator.realloc(block.p, block.size, size);
+            assert!(!p.is_null(), "realloc({}) failed", size);
+            block.p = p;
+            if verify {
+                // The start of the block must have moved with it
+                check_range(block, 0, block.size.min(size).min(64));
+            }
+            block.size = size;
+            if verify {
+                fill(block);
+            }
+        } else {
+            if verify {
+                check(block);
+            }
+            allocator.free(block.p, block.size);
+            *block = EMPTY;
+        }
+    }
+
+    for block in blocks.iter().filter(|b| !b.p.is_null()) {
+        if verify {
+            check(block);
+        }
+        allocator.free(block.p, block.size);
+    }
+    start.elapsed()
+}
+
+fn per_op(elapsed: Duration) -> f64 {
+    elapsed.as_nanos() as f64 / OPERATIONS as f64
+}
+
+fn main() {
+    let mut heap = Heap::new(HostPages::default());
+    unsafe { run(&mut heap, true) };
+    let pages = heap.source();
+    println!(
+        "verified {} operations: peak {} KB mapped in {} mappings",
+        OPERATIONS,
+        pages.peak / 1024,
+        pages.maps,
+    );
+    // Everything has been freed, so at most the spare arena should remain
+    assert!(pages.mapped <= 1024 * 1024, "{} bytes still mapped", pages.mapped);
+
+    let mut heap = Heap::new(HostPages::default());
+    let libc_time = unsafe { run(&mut heap, false) };
+    let system_time = unsafe { run(&mut SystemAllocator, false) };
+    println!("libc heap:        {:6.1} ns/op", per_op(libc_time));
+    println!("system allocator: {:6.1} ns/op", per_op(system_time));
+}
@@ -1,42 +1,80 @@
 //! Directory reading via kernel file I/O.
 //!
-//! The kernel treats directories as readable files where entries
-//! are null-byte separated filenames.
+//! Directories are listed with FILE_OP_READDIR, which returns a batch of
+//! records carrying each entry's name, type, size and modification time, so
+//! a full listing costs one round trip per buffer rather than a stat per
+//! entry. Filesystems that don't support it are read as plain files instead,
+//! where entries are null-byte separated filenames; `readdir_plus` then
+//! falls back to a stat per entry.
 
 use core::ffi::{c_char, c_int};
 use core::ptr;
 use core::sync::atomic::Ordering;
 
-use idos_api::io::{AsyncOp, Handle, ASYNC_OP_CLOSE, ASYNC_OP_OPEN, ASYNC_OP_READ};
+use idos_api::io::file::{DirEntryHeader, DirEntryRecords, FileStatus, FileType};
+use idos_api::io::{AsyncOp, Handle, ASYNC_OP_CLOSE, ASYNC_OP_OPEN, ASYNC_OP_READ, FILE_OP_READDIR};
 use idos_api::syscall::exec::futex_wait_u32;
 use idos_api::syscall::io::{append_io_op, create_file_handle};
 
-const DIR_BUF_SIZE: usize = 512;
+use crate::stat::{fill_stat, stat_translated, Stat};
+
+const DIR_BUF_SIZE: usize = 1024;
 const MAX_OPEN_DIRS: usize = 8;
+const PATH_MAX: usize = 256;
+
+/// d_type values
+pub const DT_UNKNOWN: u8 = 0;
+pub const DT_DIR: u8 = 4;
+pub const DT_REG: u8 = 8;
+
+#[derive(Clone, Copy, PartialEq)]
+enum ListMode {
+    /// Nothing has been read yet
+    Unknown,
+    /// The buffer holds FILE_OP_READDIR records
+    Records,
+    /// The filesystem only supports plain reads of entry names
+    Names,
+}
 
 pub struct DIR {
     handle: Handle,
+    mode: ListMode,
     /// Read buffer
     buf: [u8; DIR_BUF_SIZE],
     /// Number of valid bytes in buf
     buf_len: usize,
     /// Current position within buf
     buf_pos: usize,
-    /// File read offset
+    /// File read offset for names, or index of the next entry to request
+    /// for records
     read_offset: u32,
     /// Reached end of directory
     eof: bool,
+    /// Translated path of the directory, used to stat entries when the
+    /// filesystem can't list their attributes
+    path: [u8; PATH_MAX],
+    path_len: usize,
     /// Is this slot in use
     in_use: bool,
 }
 
 #[repr(C)]
 pub struct dirent {
+    pub d_type: u8,
     pub d_name: [c_char; 256],
 }
 
+/// IDOS extension: a directory entry along with its attributes, as returned
+/// by `readdir_plus`
+#[repr(C)]
+pub struct dirent_plus {
+    pub d_ent: dirent,
+    pub d_stat: Stat,
+}
+
 static mut DIR_TABLE: [DIR; MAX_OPEN_DIRS] = unsafe { core::mem::zeroed() };
-static mut DIRENT_BUF: dirent = dirent { d_name: [0; 256] };
+static mut DIRENT_PLUS_BUF: dirent_plus = unsafe { core::mem::zeroed() };
 
 fn io_sync_raw(handle: Handle, op_code: u32, arg0: u32, arg1: u32, arg2: u32) -> Result<u32, u32> {
     let op = AsyncOp::new(op_code, arg0, arg1, arg2);
@@ -72,7 +110,7 @@ pub unsafe extern "C" fn opendir(name: *const c_char) -> *mut DIR {
     };
 
     // Translate path
-    let mut path_buf = [0u8; 256];
+    let mut path_buf = [0u8; PATH_MAX];
     let path_len = crate::stdio::translate_path_raw(name, &mut path_buf);
 
     let handle = create_file_handle();
@@ -91,11 +129,14 @@ pub unsafe extern "C" fn opendir(name: *const c_char) -> *mut DIR {
 
     DIR_TABLE[idx] = DIR {
         handle,
+        mode: ListMode::Unknown,
         buf: [0; DIR_BUF_SIZE],
         buf_len: 0,
         buf_pos: 0,
         read_offset: 0,
         eof: false,
+        path: path_buf,
+        path_len,
         in_use: true,
     };
 
@@ -104,80 +145,206 @@ pub unsafe extern "C" fn opendir(name: *const c_char) -> *mut DIR {
 
 #[no_mangle]
 pub unsafe extern "C" fn readdir(dirp: *mut DIR) -> *mut dirent {
+    match next_entry(dirp) {
+        Some(_) => &raw mut DIRENT_PLUS_BUF.d_ent,
+        None => ptr::null_mut(),
+    }
+}
+
+/// Like readdir, but also fills in the entry's size, type and timestamps.
+/// On filesystems that list attributes along with names this costs nothing
+/// extra; elsewhere it stats each entry.
+#[no_mangle]
+pub unsafe extern "C" fn readdir_plus(dirp: *mut DIR) -> *mut dirent_plus {
+    let status = match next_entry(dirp) {
+        Some(status) => status,
+        None => return ptr::null_mut(),
+    };
+    let plus = &raw mut DIRENT_PLUS_BUF;
+    match status {
+        Some(status) => fill_stat(&raw mut (*plus).d_stat, &status),
+        None => {
+            if stat_entry(dirp, &raw mut (*plus).d_stat) < 0 {
+                ptr::write_bytes(&raw mut (*plus).d_stat, 0, 1);
+            } else if (*plus).d_stat.st_mode & 0o040000 != 0 {
+                (*plus).d_ent.d_type = DT_DIR;
+            } else {
+                (*plus).d_ent.d_type = DT_REG;
+            }
+        }
+    }
+    plus
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn closedir(dirp: *mut DIR) -> c_int {
     if dirp.is_null() || !(*dirp).in_use {
-        return ptr::null_mut();
+        return -1;
+    }
+    io_sync_raw((*dirp).handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
+    (*dirp).in_use = false;
+    0
+}
+
+/// Advance to the next entry, copying its name and type into the shared
+/// dirent. Returns None at the end of the directory; otherwise the entry's
+/// attributes, if the filesystem provided them.
+unsafe fn next_entry(dirp: *mut DIR) -> Option<Option<FileStatus>> {
+    if dirp.is_null() || !(*dirp).in_use {
+        return None;
+    }
+    let dir = &mut *dirp;
+    if dir.mode == ListMode::Unknown {
+        if fill_records(dir) {
+            dir.mode = ListMode::Records;
+        } else {
+            dir.mode = ListMode::Names;
+            dir.eof = false;
+        }
+    }
+    match dir.mode {
+        ListMode::Records => next_record(dir).map(Some),
+        _ => next_name(dir).map(|_| None),
+    }
+}
+
+fn set_name(name: &[u8], d_type: u8) {
+    unsafe {
+        let entry = &mut *(&raw mut DIRENT_PLUS_BUF.d_ent);
+        let len = name.len().min(entry.d_name.len() - 1);
+        for (dest, &byte) in entry.d_name.iter_mut().zip(&name[..len]) {
+            *dest = byte as c_char;
+        }
+        entry.d_name[len] = 0;
+        entry.d_type = d_type;
+    }
+}
+
+/// Request the next batch of records. Returns false if the filesystem
+/// doesn't support FILE_OP_READDIR, or the request otherwise failed.
+fn fill_records(dir: &mut DIR) -> bool {
+    let result = io_sync_raw(
+        dir.handle,
+        FILE_OP_READDIR,
+        dir.buf.as_mut_ptr() as u32,
+        dir.buf.len() as u32,
+        dir.read_offset,
+    );
+    dir.buf_pos = 0;
+    match result {
+        Ok(n) => {
+            dir.buf_len = n as usize;
+            if n == 0 {
+                dir.eof = true;
+            }
+            true
+        }
+        Err(_) => {
+            dir.buf_len = 0;
+            dir.eof = true;
+            false
+        }
+    }
+}
+
+fn next_record(dir: &mut DIR) -> Option<FileStatus> {
+    loop {
+        let mut records = DirEntryRecords::new(&dir.buf[dir.buf_pos..dir.buf_len]);
+        if let Some((header, name)) = records.next() {
+            dir.buf_pos += header.record_len as usize;
+            dir.read_offset += 1;
+            if name.is_empty() {
+                continue;
+            }
+            set_name(name, d_type_for(&header));
+            let mut status = FileStatus::new();
+            status.byte_size = header.byte_size;
+            status.file_type = header.file_type;
+            status.modification_time = header.modification_time;
+            return Some(status);
+        }
+        if dir.eof || !fill_records(dir) || dir.buf_len == 0 {
+            return None;
+        }
     }
+}
+
+fn d_type_for(header: &DirEntryHeader) -> u8 {
+    if header.file_type & FileType::Dir as u32 != 0 {
+        DT_DIR
+    } else if header.file_type & FileType::File as u32 != 0 {
+        DT_REG
+    } else {
+        DT_UNKNOWN
+    }
+}
 
+fn next_name(dir: &mut DIR) -> Option<()> {
     loop {
         // Try to find a null-terminated entry in the current buffer
-        let start = (*dirp).buf_pos;
-        for i in start..(*dirp).buf_len {
-            if (*dirp).buf[i] == 0 {
-                // Found entry from start..i
-                let name_len = i - start;
-                if name_len == 0 {
-                    (*dirp).buf_pos = i + 1;
-                    continue;
-                }
-                // Copy to dirent
-                for j in 0..name_len {
-                    DIRENT_BUF.d_name[j] = (*dirp).buf[start + j] as c_char;
-                }
-                DIRENT_BUF.d_name[name_len] = 0;
-                (*dirp).buf_pos = i + 1;
-                return &raw mut DIRENT_BUF;
+        let start = dir.buf_pos;
+        if let Some(len) = dir.buf[start..dir.buf_len].iter().position(|&b| b == 0) {
+            dir.buf_pos = start + len + 1;
+            if len == 0 {
+                continue;
             }
+            set_name(&dir.buf[start..start + len], DT_UNKNOWN);
+            return Some(());
         }
 
         // No complete entry found; need to read more
-        if (*dirp).eof {
-            return ptr::null_mut();
+        if dir.eof {
+            return None;
         }
 
         // Move any partial entry to beginning of buffer
-        let remaining = (*dirp).buf_len - (*dirp).buf_pos;
-        if remaining > 0 && (*dirp).buf_pos > 0 {
-            ptr::copy(
-                (*dirp).buf.as_ptr().add((*dirp).buf_pos),
-                (*dirp).buf.as_mut_ptr(),
-                remaining,
-            );
-        }
-        (*dirp).buf_len = remaining;
-        (*dirp).buf_pos = 0;
+        let remaining = dir.buf_len - dir.buf_pos;
+        dir.buf.copy_within(dir.buf_pos..dir.buf_len, 0);
+        dir.buf_len = remaining;
+        dir.buf_pos = 0;
 
         // Read more data
-        let read_buf = &mut (*dirp).buf[remaining..];
+        let read_buf = &mut dir.buf[remaining..];
         let result = io_sync_raw(
-            (*dirp).handle,
+            dir.handle,
             ASYNC_OP_READ,
-            read_buf.as_ptr() as u32,
+            read_buf.as_mut_ptr() as u32,
             read_buf.len() as u32,
-            (*dirp).read_offset,
+            dir.read_offset,
         );
 
         match result {
             Ok(n) if n > 0 => {
-                (*dirp).buf_len += n as usize;
-                (*dirp).read_offset += n;
+                dir.buf_len += n as usize;
+                dir.read_offset += n;
             }
             _ => {
-                (*dirp).eof = true;
+                dir.eof = true;
                 if remaining == 0 {
-                    return ptr::null_mut();
+                    return None;
                 }
-                // Process any remaining partial entry
             }
         }
     }
 }
 
-#[no_mangle]
-pub unsafe extern "C" fn closedir(dirp: *mut DIR) -> c_int {
-    if dirp.is_null() || !(*dirp).in_use {
-        return -1;
+/// Stat the entry most recently returned from `dirp`, by path
+unsafe fn stat_entry(dirp: *mut DIR, statbuf: *mut Stat) -> c_int {
+    let dir = &*dirp;
+    let entry = &*(&raw const DIRENT_PLUS_BUF.d_ent);
+    let mut path = [0u8; PATH_MAX];
+    let mut len = dir.path_len;
+    path[..len].copy_from_slice(&dir.path[..len]);
+    if len > 0 && path[len - 1] != b'\\' {
+        path[len] = b'\\';
+        len += 1;
     }
-    io_sync_raw((*dirp).handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
-    (*dirp).in_use = false;
-    0
+    for &c in entry.d_name.iter().take_while(|&&c| c != 0) {
+        if len == PATH_MAX {
+            return -1;
+        }
+        path[len] = c as u8;
+        len += 1;
+    }
+    stat_translated(&path[..len], statbuf)
 }
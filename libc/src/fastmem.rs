@@ -0,0 +1,364 @@
+//! Word-at-a-time and bulk-copy implementations of the hot string and memory
+//! routines. The `string` module exports the C symbols and calls into these.
+//!
+//! This module doesn't depend on anything else in libc, so the host test
+//! suite (`libc/tests/fastmem.rs`, run with `make libctest`) includes it
+//! directly.
+//!
+//! The scanning loops load whole aligned words, and may read past the end of
+//! a string or buffer. An aligned load never straddles a page boundary, so
+//! those reads can't fault.
+//!
+//! memcpy, memmove and memset must not be written as plain byte loops, since
+//! the compiler may turn those back into calls to the same functions. They
+//! use `rep movs` / `rep stos` instead.
+//!
+//! SSE2 versions of strlen and memchr are compiled in when the target
+//! enables SSE2. The IDOS target builds without SSE, so it uses the word
+//! loops.
+
+use core::arch::asm;
+use core::mem::size_of;
+use core::ptr;
+
+const WORD: usize = size_of::<usize>();
+/// 0x01 in every byte
+const LO: usize = usize::MAX / 0xff;
+/// 0x80 in every byte
+const HI: usize = LO << 7;
+
+/// Copies shorter than this skip the alignment and dword setup
+const BULK_THRESHOLD: usize = 16;
+
+/// Flags the zero bytes in `w`. The lowest flagged byte is always a real
+/// zero; bytes above it may be flagged spuriously.
+#[inline(always)]
+fn zero_mask(w: usize) -> usize {
+    w.wrapping_sub(LO) & !w & HI
+}
+
+/// Index of the lowest flagged byte in a nonzero mask
+#[inline(always)]
+fn first_flagged(mask: usize) -> usize {
+    (mask.trailing_zeros() / 8) as usize
+}
+
+#[inline(always)]
+fn is_aligned(p: *const u8) -> bool {
+    (p as usize) % WORD == 0
+}
+
+// ---- Scanning ----
+
+pub unsafe fn strlen(s: *const u8) -> usize {
+    #[cfg(target_feature = "sse2")]
+    return strlen_sse2(s);
+    #[cfg(not(target_feature = "sse2"))]
+    return strlen_words(s);
+}
+
+pub unsafe fn strlen_words(s: *const u8) -> usize {
+    let mut p = s;
+    while !is_aligned(p) {
+        if *p == 0 {
+            return p as usize - s as usize;
+        }
+        p = p.add(1);
+    }
+    loop {
+        let mask = zero_mask(*(p as *const usize));
+        if mask != 0 {
+            return p as usize - s as usize + first_flagged(mask);
+        }
+        p = p.add(WORD);
+    }
+}
+
+/// Search `n` bytes at `s` for `c`, returning null if it isn't found
+pub unsafe fn memchr(s: *const u8, c: u8, n: usize) -> *const u8 {
+    #[cfg(target_feature = "sse2")]
+    return memchr_sse2(s, c, n);
+    #[cfg(not(target_feature = "sse2"))]
+    return memchr_words(s, c, n);
+}
+
+pub unsafe fn memchr_words(s: *const u8, c: u8, n: usize) -> *const u8 {
+    let mut i = 0;
+    while i < n && !is_aligned(s.add(i)) {
+        if *s.add(i) == c {
+            return s.add(i);
+        }
+        i += 1;
+    }
+    let pattern = LO * c as usize;
+    while n - i >= WORD {
+        let mask = zero_mask(*(s.add(i) as *const usize) ^ pattern);
+        if mask != 0 {
+            return s.add(i + first_flagged(mask));
+        }
+        i += WORD;
+    }
+    while i < n {
+        if *s.add(i) == c {
+            return s.add(i);
+        }
+        i += 1;
+    }
+    ptr::null()
+}
+
+/// Find the first `c` in a string, or its terminator when `c` is zero
+pub unsafe fn strchr(s: *const u8, c: u8) -> *const u8 {
+    let mut p = s;
+    while !is_aligned(p) {
+        if *p == c {
+            return p;
+        }
+        if *p == 0 {
+            return ptr::null();
+        }
+        p = p.add(1);
+    }
+    let pattern = LO * c as usize;
+    loop {
+        let w = *(p as *const usize);
+        if zero_mask(w) | zero_mask(w ^ pattern) != 0 {
+            // This word holds a match or the terminator; settle which
+            loop {
+                if *p == c {
+                    return p;
+                }
+                if *p == 0 {
+                    return ptr::null();
+                }
+                p = p.add(1);
+            }
+        }
+        p = p.add(WORD);
+    }
+}
+
+pub unsafe fn strrchr(s: *const u8, c: u8) -> *const u8 {
+    if c == 0 {
+        return s.add(strlen(s));
+    }
+    let mut last = ptr::null();
+    let mut p = s;
+    loop {
+        let found = strchr(p, c);
+        if found.is_null() {
+            return last;
+        }
+        last = found;
+        p = found.add(1);
+    }
+}
+
+// ---- Comparison ----
+
+pub unsafe fn strcmp(a: *const u8, b: *const u8) -> i32 {
+    strncmp(a, b, usize::MAX)
+}
+
+pub unsafe fn strncmp(a: *const u8, b: *const u8, n: usize) -> i32 {
+    let mut i = 0;
+    // Words can only be compared when both strings share an alignment, since
+    // reading a misaligned word of the shorter string could fault
+    if (a as usize) % WORD == (b as usize) % WORD {
+        while i < n && !is_aligned(a.add(i)) {
+            let (x, y) = (*a.add(i), *b.add(i));
+            if x != y || x == 0 {
+                return x as i32 - y as i32;
+            }
+            i += 1;
+        }
+        while n - i >= WORD {
+            let x = *(a.add(i) as *const usize);
+            let y = *(b.add(i) as *const usize);
+            if x != y || zero_mask(x) != 0 {
+                break;
+            }
+            i += WORD;
+        }
+    }
+    while i < n {
+        let (x, y) = (*a.add(i), *b.add(i));
+        if x != y || x == 0 {
+            return x as i32 - y as i32;
+        }
+        i += 1;
+    }
+    0
+}
+
+pub unsafe fn memcmp(a: *const u8, b: *const u8, n: usize) -> i32 {
+    let mut i = 0;
+    while n - i >= WORD {
+        let x = ptr::read_unaligned(a.add(i) as *const usize);
+        let y = ptr::read_unaligned(b.add(i) as *const usize);
+        if x != y {
+            break;
+        }
+        i += WORD;
+    }
+    while i < n {
+        let (x, y) = (*a.add(i), *b.add(i));
+        if x != y {
+            return x as i32 - y as i32;
+        }
+        i += 1;
+    }
+    0
+}
+
+// ---- Copying and filling ----
+
+pub unsafe fn memcpy(dest: *mut u8, src: *const u8, n: usize) {
+    if n < BULK_THRESHOLD {
+        movsb(dest, src, n);
+        return;
+    }
+    // Align the destination, move dwords, then finish the tail
+    let head = (dest as usize).wrapping_neg() % 4;
+    movsb(dest, src, head);
+    let dwords = (n - head) / 4;
+    movsd(dest.add(head), src.add(head), dwords);
+    let done = head + dwords * 4;
+    movsb(dest.add(done), src.add(done), n - done);
+}
+
+pub unsafe fn memmove(dest: *mut u8, src: *const u8, n: usize) {
+    // Copying forwards is safe unless dest starts inside the source range
+    if (dest as usize).wrapping_sub(src as usize) >= n {
+        memcpy(dest, src, n);
+        return;
+    }
+    // Copy backwards: the odd trailing bytes first, then whole dwords
+    let dwords = n / 4;
+    let tail = n % 4;
+    asm!(
+        "std",
+        "rep movsb",
+        "cld",
+        inout("ecx") tail => _,
+        inout("edi") dest.wrapping_add(n - 1) => _,
+        inout("esi") src.wrapping_add(n - 1) => _,
+        options(nostack),
+    );
+    asm!(
+        "std",
+        "rep movsd",
+        "cld",
+        inout("ecx") dwords => _,
+        inout("edi") dest.wrapping_add(dwords * 4).wrapping_sub(4) => _,
+        inout("esi") src.wrapping_add(dwords * 4).wrapping_sub(4) => _,
+        options(nostack),
+    );
+}
+
+pub unsafe fn memset(dest: *mut u8, c: u8, n: usize) {
+    if n < BULK_THRESHOLD {
+        stosb(dest, c, n);
+        return;
+    }
+    let head = (dest as usize).wrapping_neg() % 4;
+    stosb(dest, c, head);
+    let dwords = (n - head) / 4;
+    asm!(
+        "rep stosd",
+        inout("ecx") dwords => _,
+        inout("edi") dest.add(head) => _,
+        in("eax") 0x0101_0101u32 * c as u32,
+        options(nostack, preserves_flags),
+    );
+    let done = head + dwords * 4;
+    stosb(dest.add(done), c, n - done);
+}
+
+#[inline(always)]
+unsafe fn movsb(dest: *mut u8, src: *const u8, count: usize) {
+    asm!(
+        "rep movsb",
+        inout("ecx") count => _,
+        inout("edi") dest => _,
+        inout("esi") src => _,
+        options(nostack, preserves_flags),
+    );
+}
+
+#[inline(always)]
+unsafe fn movsd(dest: *mut u8, src: *const u8, count: usize) {
+    asm!(
+        "rep movsd",
+        inout("ecx") count => _,
+        inout("edi") dest => _,
+        inout("esi") src => _,
+        options(nostack, preserves_flags),
+    );
+}
+
+#[inline(always)]
+unsafe fn stosb(dest: *mut u8, c: u8, count: usize) {
+    asm!(
+        "rep stosb",
+        inout("ecx") count => _,
+        inout("edi") dest => _,
+        in("al") c,
+        options(nostack, preserves_flags),
+    );
+}
+
+// ---- SSE2 ----
+
+#[cfg(all(target_feature = "sse2", target_arch = "x86"))]
+use core::arch::x86 as simd;
+#[cfg(all(target_feature = "sse2", target_arch = "x86_64"))]
+use core::arch::x86_64 as simd;
+
+/// Bitmask of the bytes equal to `needle` in the aligned 16 bytes at `p`
+#[cfg(target_feature = "sse2")]
+#[inline(always)]
+unsafe fn match_mask16(p: *const u8, needle: simd::__m128i) -> u32 {
+    let chunk = simd::_mm_load_si128(p as *const simd::__m128i);
+    simd::_mm_movemask_epi8(simd::_mm_cmpeq_epi8(chunk, needle)) as u32
+}
+
+#[cfg(target_feature = "sse2")]
+pub unsafe fn strlen_sse2(s: *const u8) -> usize {
+    let zero = simd::_mm_setzero_si128();
+    let offset = s as usize % 16;
+    let mut block = s.wrapping_sub(offset);
+    // Ignore matches before the start of the string
+    let mut mask = match_mask16(block, zero) >> offset << offset;
+    while mask == 0 {
+        block = block.wrapping_add(16);
+        mask = match_mask16(block, zero);
+    }
+    block as usize + mask.trailing_zeros() as usize - s as usize
+}
+
+#[cfg(target_feature = "sse2")]
+pub unsafe fn memchr_sse2(s: *const u8, c: u8, n: usize) -> *const u8 {
+    if n == 0 {
+        return ptr::null();
+    }
+    let needle = simd::_mm_set1_epi8(c as i8);
+    let end = (s as usize).saturating_add(n);
+    let offset = s as usize % 16;
+    let mut block = s.wrapping_sub(offset);
+    let mut mask = match_mask16(block, needle) >> offset << offset;
+    loop {
+        if mask != 0 {
+            let found = block as usize + mask.trailing_zeros() as usize;
+            if found >= end {
+                return ptr::null();
+            }
+            return s.add(found - s as usize);
+        }
+        block = block.wrapping_add(16);
+        if block as usize >= end {
+            return ptr::null();
+        }
+        mask = match_mask16(block, needle);
+    }
+}
@@ -0,0 +1,1185 @@
+//! Kernels for the math library, generic over f64 and f32. The `math`
+//! module exports the C symbols and calls into these.
+//!
+//! The IDOS target is soft-float (it builds with SSE disabled), so plain
+//! Rust float arithmetic in libc turns into library calls. The x87 does the
+//! arithmetic instead, in 64-bit extended precision, and the Rust code here
+//! only looks at bit patterns: special values are sorted out with integer
+//! tests before any FPU instruction runs. The f32 functions load and store
+//! single precision directly rather than converting through f64.
+//!
+//! fsin, fcos and fptan are slow microcoded instructions that reduce their
+//! argument with a 66-bit value of pi, so near multiples of pi/2 they lose
+//! most of their digits, and beyond 2^63 they return the argument
+//! unchanged. They aren't used. Arguments beyond pi/4 are reduced exactly
+//! instead, by multiplying with the bits of 2/pi in integer arithmetic
+//! (Payne-Hanek), and the reduced argument goes to the FPU in extended
+//! precision, where polynomials for sin and cos take over; tan is their
+//! quotient. Evaluated in extended precision, the double-precision
+//! coefficients leave results well under an ulp out.
+//!
+//! pow is 2^(y * log2(x)) without leaving the FPU, so the exponent keeps
+//! extended precision; rounded to a double in between, large results could
+//! be off by hundreds of ulps.
+//!
+//! Like `fastmem`, this module is self-contained so the host test suite in
+//! `libc/tests/math.rs` can include it directly.
+
+use core::arch::asm;
+
+/// The bits of 2/pi after the binary point, most significant first. Enough
+/// to reduce the largest double.
+static TWO_OVER_PI: [u32; 40] = [
+    0xa2f9836e, 0x4e441529, 0xfc2757d1, 0xf534ddc0, 0xdb629599, 0x3c439041,
+    0xfe5163ab, 0xdebbc561, 0xb7246e3a, 0x424dd2e0, 0x06492eea, 0x09d1921c,
+    0xfe1deb1c, 0xb129a73e, 0xe88235f5, 0x2ebb4484, 0xe99c7026, 0xb45f7e41,
+    0x3991d639, 0x835339f4, 0x9c845f8b, 0xbdf9283b, 0x1ff897ff, 0xde05980f,
+    0xef2f118b, 0x5a0a6d1f, 0x6d367ecf, 0x27cb09b7, 0x4f463f66, 0x9e5fea2d,
+    0x7527bac7, 0xebe5f17b, 0x3d0739f7, 0x8a5292ea, 0x6bfb5fb1, 0x1f8d5d08,
+    0x56033046, 0xfc7b6bab, 0xf0cfbc20, 0x9af4361d,
+];
+
+/// The trig kernels
+#[derive(Clone, Copy)]
+pub enum Trig {
+    Sin,
+    Cos,
+    Tan,
+    /// -1/tan, for tan in the odd quadrants
+    NegCot,
+}
+
+/// An argument for a trig kernel
+pub enum Angle<F> {
+    /// Small enough to use as it is
+    Direct(F),
+    Reduced(Reduced),
+}
+
+/// A positive x reduced by multiples of pi/2: x = (4k + quadrant) * pi/2 + r,
+/// where r = fraction * 2^scale * pi and |r| <= pi/4
+pub struct Reduced {
+    pub quadrant: u32,
+    pub fraction: i64,
+    pub scale: i32,
+}
+
+/// Which log the log kernel produces
+#[derive(Clone, Copy)]
+pub enum LogBase {
+    E,
+    Two,
+    Ten,
+}
+
+/// An exponent t for the exp2 kernel, as n = round(32t) and the remaining
+/// u = (t - n/32) * ln(2), which is small enough that a double holds it
+/// closely enough. t itself is kept, rounded, for when it's out of range.
+/// `scale` is for 2^(n/32 rounded down), as two factors that are both
+/// normal doubles. The kernels address the fields by offset, and for pow
+/// n carries k on the way in.
+#[repr(C)]
+pub struct Exp2Arg {
+    pub u: f64,
+    pub t: f64,
+    pub scale: [f64; 2],
+    pub n: i32,
+}
+
+/// The float types, with their bit layout and the x87 sequences that have
+/// to know the operand width
+pub trait Float: Copy {
+    const MANT_BITS: u32;
+    const EXP_BITS: u32;
+    /// Bits of the largest value the trig kernels take unreduced
+    const PI_4: u64;
+    /// Precision control bits that make fsqrt round straight to this type,
+    /// where rounding to 64 bits first could be off by one
+    const SQRT_PRECISION: Option<u16>;
+
+    const SIGN: u64 = 1 << (Self::MANT_BITS + Self::EXP_BITS);
+    const INF: u64 = ((1 << Self::EXP_BITS) - 1) << Self::MANT_BITS;
+    const NAN: u64 = Self::INF | (1 << (Self::MANT_BITS - 1));
+    const BIAS: i32 = (1 << (Self::EXP_BITS - 1)) - 1;
+    const ONE: u64 = (Self::BIAS as u64) << Self::MANT_BITS;
+
+    fn to_bits64(self) -> u64;
+    fn from_bits64(bits: u64) -> Self;
+
+    fn x87_trig(angle: Angle<Self>, op: Trig) -> Self;
+    /// log of 2^k * m, for m from `log_split`
+    fn x87_log(m: Self, k: i32, entry: &[f64; 3], base: LogBase) -> Self;
+    /// The exponent for e^x: x * log2(e)
+    fn x87_exp_arg(self) -> Exp2Arg;
+    /// The exponent for x^y: y * log2(2^k * m), for m from `log_split`
+    fn x87_pow_arg(m: Self, k: i32, entry: &[f64; 3], y: Self) -> Exp2Arg;
+    /// 2^t, given the table entry for n mod 32
+    fn x87_exp2(arg: &Exp2Arg, entry: &[f64; 2]) -> Self;
+    fn x87_atan(self) -> Self;
+    fn x87_atan2(self, x: Self) -> Self;
+    fn x87_asin(self) -> Self;
+    fn x87_acos(self) -> Self;
+    fn x87_sqrt(self) -> Self;
+    fn x87_fmod(self, y: Self) -> Self;
+    fn x87_ldexp(self, n: i32) -> Self;
+}
+
+/// Load `$x` onto the FPU, run the instructions, and return st(0)
+macro_rules! x87_unary {
+    ($t:ty, $size:literal, $x:expr, [$($op:literal),*]) => {{
+        let x: $t = $x;
+        let mut out: $t = 0.0;
+        unsafe {
+            asm!(
+                concat!("fld ", $size, " ptr [{x}]"),
+                $($op,)*
+                concat!("fstp ", $size, " ptr [{out}]"),
+                x = in(reg) &x as *const $t,
+                out = in(reg) &mut out as *mut $t,
+            );
+        }
+        out
+    }};
+}
+
+/// As `x87_unary`, loading `$a` and then `$b`, so `$b` starts in st(0) and
+/// `$a` in st(1)
+macro_rules! x87_binary {
+    ($t:ty, $size:literal, $a:expr, $b:expr, [$($op:literal),*]) => {{
+        let a: $t = $a;
+        let b: $t = $b;
+        let mut out: $t = 0.0;
+        unsafe {
+            asm!(
+                concat!("fld ", $size, " ptr [{a}]"),
+                concat!("fld ", $size, " ptr [{b}]"),
+                $($op,)*
+                concat!("fstp ", $size, " ptr [{out}]"),
+                a = in(reg) &a as *const $t,
+                b = in(reg) &b as *const $t,
+                out = in(reg) &mut out as *mut $t,
+            );
+        }
+        out
+    }};
+}
+
+/// Coefficients of the sin and cos polynomials on [-pi/4, pi/4] (minimax
+/// fits, from fdlibm): S1..S6, C1..C6, then -1/2
+static TRIG_COEFFS: [f64; 13] = [
+    -1.66666666666666324348e-01,
+    8.33333333332248946124e-03,
+    -1.98412698298579493134e-04,
+    2.75573137070700676789e-06,
+    -2.50507602534068634195e-08,
+    1.58969099521155010221e-10,
+    4.16666666666666019037e-02,
+    -1.38888888888741095749e-03,
+    2.48015872894767294178e-05,
+    -2.75573143513906633035e-07,
+    2.08757232129817482790e-09,
+    -1.13596475577881948265e-11,
+    -0.5,
+];
+
+/// sin(r) = r + r z S(z), with z = r^2, replacing r in st(0)
+macro_rules! sin_poly {
+    () => {
+        concat!(
+            "fld st(0)\n",
+            "fmul st(0), st(0)\n",          // z, r
+            "fld qword ptr [{k} + 40]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 32]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 24]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 16]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 8]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k}]\n",       // S(z), z, r
+            "fmulp\n",
+            "fmul st(0), st(1)\n",          // r z S(z), r
+            "faddp",
+        )
+    };
+}
+
+/// cos(r) = 1 - z/2 + z^2 C(z), with z = r^2, replacing r in st(0)
+macro_rules! cos_poly {
+    () => {
+        concat!(
+            "fmul st(0), st(0)\n",          // z
+            "fld qword ptr [{k} + 88]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 80]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 72]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 64]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 56]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{k} + 48]\n",  // C(z), z
+            "fmul st(0), st(1)\n",
+            "fmul st(0), st(1)\n",          // z^2 C(z), z
+            "fxch\n",
+            "fmul qword ptr [{k} + 96]\n",  // -z/2, z^2 C(z)
+            "faddp\n",
+            "fld1\n",
+            "faddp",
+        )
+    };
+}
+
+/// Run the `$load` instructions, which leave an angle of at most pi/4 in
+/// st(0), then the kernel for `$op`, storing the result through `$out`.
+/// tan is the quotient of the sin and cos polynomials.
+macro_rules! trig_asm {
+    ($op:expr, $size:literal, $out:expr, [$($load:expr),*], $($operands:tt)*) => {
+        match $op {
+            Trig::Sin => asm!(
+                $($load,)*
+                sin_poly!(),
+                concat!("fstp ", $size, " ptr [{out}]"),
+                out = in(reg) $out,
+                k = in(reg) TRIG_COEFFS.as_ptr(),
+                $($operands)*
+            ),
+            Trig::Cos => asm!(
+                $($load,)*
+                cos_poly!(),
+                concat!("fstp ", $size, " ptr [{out}]"),
+                out = in(reg) $out,
+                k = in(reg) TRIG_COEFFS.as_ptr(),
+                $($operands)*
+            ),
+            Trig::Tan => asm!(
+                $($load,)*
+                "fld st(0)",
+                cos_poly!(),
+                "fxch",
+                sin_poly!(),                // sin, cos
+                "fdiv st(0), st(1)",
+                "fstp st(1)",
+                concat!("fstp ", $size, " ptr [{out}]"),
+                out = in(reg) $out,
+                k = in(reg) TRIG_COEFFS.as_ptr(),
+                $($operands)*
+            ),
+            Trig::NegCot => asm!(
+                $($load,)*
+                "fld st(0)",
+                cos_poly!(),
+                "fxch",
+                sin_poly!(),
+                "fdivr st(0), st(1)",
+                "fstp st(1)",
+                "fchs",
+                concat!("fstp ", $size, " ptr [{out}]"),
+                out = in(reg) $out,
+                k = in(reg) TRIG_COEFFS.as_ptr(),
+                $($operands)*
+            ),
+        }
+    };
+}
+
+/// Constants for the exp and log kernels: 1, 32 and 1/32, then the
+/// coefficients of e^u = 1 + u + u^2 (1/2 + u/6 + ... + u^5/7!) and of
+/// log1p(r) = r + r^2 (-1/2 + r/3 - ... - r^8/10). Taylor series are
+/// enough over the small intervals the tables leave.
+static EXP_LOG_COEFFS: [f64; 18] = [
+    1.0,
+    32.0,
+    1.0 / 32.0,
+    1.0 / 2.0,
+    1.0 / 6.0,
+    1.0 / 24.0,
+    1.0 / 120.0,
+    1.0 / 720.0,
+    1.0 / 5040.0,
+    -1.0 / 2.0,
+    1.0 / 3.0,
+    -1.0 / 4.0,
+    1.0 / 5.0,
+    -1.0 / 6.0,
+    1.0 / 7.0,
+    -1.0 / 8.0,
+    1.0 / 9.0,
+    -1.0 / 10.0,
+];
+
+/// 2^(j/32) for j in 0..32, split into a double and the remainder
+static EXP2_TABLE: [[f64; 2]; 32] = [
+    [1.0, 0.0],
+    [1.0218971486541166, 5.109225028973444e-17],
+    [1.0442737824274138, 8.551889705537965e-17],
+    [1.0671404006768237, -7.899853966841582e-17],
+    [1.0905077326652577, -3.046782079812471e-17],
+    [1.1143867425958924, 1.0410278456845571e-16],
+    [1.1387886347566916, 8.912812676025408e-17],
+    [1.1637248587775775, 3.8292048369240935e-17],
+    [1.189207115002721, 3.982015231465646e-17],
+    [1.215247359980469, -7.712630692681488e-17],
+    [1.241857812073484, 4.658027591836937e-17],
+    [1.2690509571917332, 2.667932131342186e-18],
+    [1.2968395546510096, 2.5382502794888315e-17],
+    [1.3252366431597413, -2.8587312100388614e-17],
+    [1.3542555469368927, 7.70094837980299e-17],
+    [1.383909881963832, -6.770511658794786e-17],
+    [1.4142135623730951, -9.667293313452913e-17],
+    [1.4451808069770467, -3.0237581349939873e-17],
+    [1.4768261459394993, -3.483994556892796e-17],
+    [1.5091644275934228, -1.016455327754295e-16],
+    [1.5422108254079407, 7.949834809697621e-17],
+    [1.5759808451078865, -1.0136916471278304e-17],
+    [1.6104903319492543, 2.4707192569797888e-17],
+    [1.645755478153965, -1.0125679913674773e-16],
+    [1.681792830507429, 8.199010020581497e-17],
+    [1.718619298122478, -1.851380418263111e-17],
+    [1.7562521603732995, 2.960140695448873e-17],
+    [1.7947090750031072, 1.8227458427912087e-17],
+    [1.8340080864093424, 3.283107224245627e-17],
+    [1.8741676341103, -6.122763413004143e-17],
+    [1.9152065613971474, -1.0619946056195963e-16],
+    [1.9571441241754002, 8.960767791036668e-17],
+];
+
+/// For 128 intervals of the mantissa: a reciprocal of the interval's
+/// midpoint, rounded to 11 bits so that m * inv is exact in extended
+/// precision, and -log2(inv), split into a double and the remainder. The
+/// intervals next to 1 use 1 itself, so log1p gets r = m - 1 unrounded and
+/// logs of values close to 1 keep their precision. Intervals 53 and up
+/// hold mantissas halved, so that 2^k * m has k = 0 from 0.7 to 1.4.
+static LOG_TABLE: [[f64; 3]; 128] = [
+    [1.0, 0.0, 0.0],
+    [0.98828125, 0.01700642530568987, 1.5972941926192318e-19],
+    [0.98095703125, 0.027738151266708092, -2.46243565733366e-19],
+    [0.97314453125, 0.039274005160942, -1.7278193861280767e-18],
+    [0.9658203125, 0.050173289240889186, 2.3639709580926717e-18],
+    [0.958984375, 0.060420785685306934, 2.6350344473023893e-18],
+    [0.95166015625, 0.07148162474211002, 6.546960856034292e-18],
+    [0.94482421875, 0.08188214896822735, 2.9971186407588894e-18],
+    [0.9375, 0.09310940439148147, 5.596192057804377e-18],
+    [0.93115234375, 0.10291087168724379, 2.9137072561334826e-18],
+    [0.92431640625, 0.11354130429629482, -4.5871534057870394e-18],
+    [0.91748046875, 0.12425064857994447, 6.853874849863998e-18],
+    [0.9111328125, 0.13426672914824128, -4.296507112505036e-18],
+    [0.90478515625, 0.14435283397273424, -6.952745667412445e-18],
+    [0.8984375, 0.1545099490556248, -1.0257445278779149e-17],
+    [0.89208984375, 0.16473908137251142, -1.1100877355568565e-17],
+    [0.8857421875, 0.17504125947147756, 9.187367213953157e-19],
+    [0.8798828125, 0.18461670418646142, -9.756143273834308e-18],
+    [0.87353515625, 0.19506232794809178, 7.066401504146592e-18],
+    [0.86767578125, 0.20477203397132182, 1.38243173531359e-17],
+    [0.86181640625, 0.21454753184145736, 1.2158130598490866e-19],
+    [0.85595703125, 0.22438971924046194, -5.35263519051155e-18],
+    [0.8505859375, 0.2334710914011354, 1.2290806365525887e-17],
+    [0.8447265625, 0.24344367747591303, -9.01018344668743e-18],
+    [0.83935546875, 0.25264617052193894, 8.076765896511638e-18],
+    [0.833984375, 0.2619077403795096, 2.5674284264406596e-17],
+    [0.82861328125, 0.27122915045733664, -9.701204383359725e-18],
+    [0.8232421875, 0.2806111790579177, 5.310192486504759e-18],
+    [0.81787109375, 0.29005461976750285, 1.8751439653399727e-17],
+    [0.8125, 0.2995602818589078, 2.2038346320583612e-17],
+    [0.8076171875, 0.3082564808287253, -3.537176700590459e-18],
+    [0.802734375, 0.3170054163183171, 2.3523324741511304e-17],
+    [0.79736328125, 0.32669092443830505, 1.3730695172209248e-17],
+    [0.79248046875, 0.3355527154520286, -2.2774944794094357e-17],
+    [0.78759765625, 0.34446927684435735, -1.6847893029913242e-17],
+    [0.78271484375, 0.353441289845452, -2.4170128218623407e-17],
+    [0.7783203125, 0.3615640860095282, 4.611097173512508e-18],
+    [0.7734375, 0.37064337992039037, 1.0829515961374715e-17],
+    [0.7685546875, 0.3797801744925136, -1.6096277288783958e-18],
+    [0.76416015625, 0.38805305818001934, -2.1098576195314388e-17],
+    [0.759765625, 0.39637365501380806, 1.022404781071449e-17],
+    [0.75537109375, 0.4047425185509643, -1.3785383750739252e-18],
+    [0.7509765625, 0.4131602120381735, -1.5588034771992556e-17],
+    [0.74658203125, 0.4216273086391953, 2.6578055682351393e-17],
+    [0.7421875, 0.43014439166905216, -3.494516357745965e-18],
+    [0.73779296875, 0.4387120548351709, 9.333910506746754e-18],
+    [0.7333984375, 0.4473309024857282, 1.4739102717124542e-17],
+    [0.7294921875, 0.4550355672107629, -5.410276510682121e-19],
+    [0.72509765625, 0.46375278431187184, 1.6425708019179094e-17],
+    [0.72119140625, 0.47154588923521074, 2.2775280838886553e-17],
+    [0.71728515625, 0.47938131944372014, -1.2862038920370005e-17],
+    [0.712890625, 0.48824734623262045, -2.7147611907429378e-17],
+    [0.708984375, 0.4961742620042493, 5.9855617385791034e-18],
+    [1.41015625, -0.495855026887171, -7.732436708320467e-18],
+    [1.40234375, -0.48784003382305136, 1.0193009782798152e-17],
+    [1.3955078125, -0.4807902010958165, 2.6333862619610112e-17],
+    [1.3876953125, -0.4726908392427803, -1.044584533138613e-17],
+    [1.3798828125, -0.46454575033393936, -1.363680619203139e-17],
+    [1.373046875, -0.4573808790725353, -2.118416815043639e-18],
+    [1.365234375, -0.4491486453754364, -1.2680099850781333e-18],
+    [1.3583984375, -0.4419067045422391, 1.7737592801637073e-17],
+    [1.3505859375, -0.43358544115049413, -2.5496880180069352e-17],
+    [1.34375, -0.42626475470209796, 1.9932012137193316e-17],
+    [1.3369140625, -0.41890673125789957, 3.495603078233188e-18],
+    [1.330078125, -0.41151098801207114, -2.1375800441180017e-17],
+    [1.3232421875, -0.4040771362412339, 1.6583314156510952e-17],
+    [1.31640625, -0.3966047811818585, 2.4945446272221624e-17],
+    [1.3095703125, -0.38909352190447394, 3.414190184299973e-18],
+    [1.302734375, -0.381542951184585, -1.5527441284875936e-17],
+    [1.2958984375, -0.37395265537019334, -1.16185011989222e-17],
+    [1.2900390625, -0.36741475124682765, 1.9832690831642982e-17],
+    [1.283203125, -0.3597495603223296, -1.707033378106343e-17],
+    [1.2763671875, -0.35204342579543324, 2.7237550876984884e-17],
+    [1.2705078125, -0.3454052467177954, -1.569294402166512e-17],
+    [1.2646484375, -0.33873638257391625, 1.3223515682493515e-17],
+    [1.2578125, -0.33091687811461695, -2.7280710743859677e-17],
+    [1.251953125, -0.324180546618741, -1.1096003063866165e-17],
+    [1.24609375, -0.3174126137648694, 2.323781744454089e-17],
+    [1.2392578125, -0.3094763538411059, -2.7567691895457813e-17],
+    [1.2333984375, -0.30263892378755225, -1.1485676327919665e-17],
+    [1.2275390625, -0.2957689344205078, 2.1911015305441225e-19],
+    [1.2216796875, -0.2888660741658198, -1.8864651264720715e-17],
+    [1.2158203125, -0.2819300269554433, -5.393815716044053e-18],
+    [1.2099609375, -0.27496047214060154, -5.968020877812403e-18],
+    [1.205078125, -0.2691266791494179, 1.4396338620164906e-17],
+    [1.19921875, -0.2620948453701794, 1.9736610012705414e-17],
+    [1.193359375, -0.2550285698187295, -2.120281575904453e-17],
+    [1.1875, -0.2479275134435855, -3.8662183541602335e-18],
+    [1.1826171875, -0.24198314969432874, 1.7221267038609542e-18],
+    [1.1767578125, -0.23481743111732398, 1.0142705626281356e-17],
+    [1.171875, -0.22881869049588088, 5.967894054218645e-18],
+    [1.166015625, -0.221587121264805, -1.0753938632316746e-17],
+    [1.1611328125, -0.21553299974565582, 3.8724606982413356e-18],
+    [1.1552734375, -0.20823435833978843, -3.3044644312795267e-19],
+    [1.150390625, -0.2021238238304607, 5.617772777398998e-18],
+    [1.1455078125, -0.19598729802850845, -1.2169978440794582e-17],
+    [1.140625, -0.18982455888001723, 2.362617117852667e-19],
+    [1.1357421875, -0.18363538147321837, -4.496493429227619e-18],
+    [1.1298828125, -0.1761731491074899, -8.388447200870944e-18],
+    [1.125, -0.16992500144231237, 1.0448980122780218e-17],
+    [1.1201171875, -0.163649676015825, 1.1231792670675826e-17],
+    [1.115234375, -0.15734693536284278, -8.592357733591447e-18],
+    [1.1103515625, -0.1510165388922479, 1.1592562003890375e-17],
+    [1.10546875, -0.14465824283188233, 1.2418120622178973e-17],
+    [1.1015625, -0.13955135239879354, -1.0261096402609116e-17],
+    [1.0966796875, -0.13314221240060117, 6.368596063066329e-18],
+    [1.091796875, -0.12670447284319009, -1.3540792773480899e-17],
+    [1.0869140625, -0.12023787734195947, -5.401076463047287e-19],
+    [1.08203125, -0.11374216604918833, -4.176554812415606e-18],
+    [1.078125, -0.10852445677816905, -5.4046572138033075e-18],
+    [1.0732421875, -0.10197567094923111, 8.960136399655002e-19],
+    [1.0693359375, -0.09671515448853577, 5.8324537695896444e-18],
+    [1.064453125, -0.0901124196642887, 1.8427755599309794e-19],
+    [1.0595703125, -0.08347932733184166, -6.795870340692762e-18],
+    [1.0556640625, -0.07815080773465025, 1.640841876436271e-18],
+    [1.0517578125, -0.07280253454420753, 1.539712036373804e-18],
+    [1.046875, -0.06608919045777244, 4.130247852756734e-18],
+    [1.04296875, -0.06069593168755394, 2.5532721555644674e-18],
+    [1.0380859375, -0.053925881531104676, -1.9721780084906356e-18],
+    [1.0341796875, -0.04848687399233647, -1.964524532946479e-18],
+    [1.0302734375, -0.04302728359454748, -1.834817119476286e-18],
+    [1.0263671875, -0.03754695396217841, -1.3991628834759544e-18],
+    [1.021484375, -0.030667136246941375, 7.653494469163576e-19],
+    [1.017578125, -0.025139562278508228, -1.1252820114576252e-18],
+    [1.013671875, -0.019590728357880813, -6.879484297579749e-19],
+    [1.009765625, -0.014020470314934629, 5.074606583865348e-19],
+    [1.005859375, -0.008428622070580729, 2.762959380730282e-20],
+    [1.0, 0.0, 0.0],
+];
+
+/// Where the top bits of the mantissa switch to the halved intervals,
+/// near sqrt(2)
+const LOG_HALVED: usize = 53;
+
+/// log2(2^k * m) from m in st(0): k - log2(inv) + log1p(r) * log2(e), with
+/// r = m * inv - 1, for the log table entry at {e}
+macro_rules! log2_poly {
+    () => {
+        concat!(
+            "fmul qword ptr [{e}]\n",
+            "fsub qword ptr [{c}]\n",        // r
+            "fld qword ptr [{c} + 136]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 128]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 120]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 112]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 104]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 96]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 88]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 80]\n",
+            "fmul st(0), st(1)\n",
+            "fadd qword ptr [{c} + 72]\n",   // P(r), r
+            "fmul st(0), st(1)\n",
+            "fmul st(0), st(1)\n",
+            "faddp\n",                       // log1p(r)
+            "fldl2e\n",
+            "fmulp\n",
+            "fadd qword ptr [{e} + 16]\n",
+            "fadd qword ptr [{e} + 8]\n",
+        )
+    };
+}
+
+/// Split the exponent t in st(0) into the `Exp2Arg` at {arg}
+macro_rules! exp2_split {
+    () => {
+        concat!(
+            "fst qword ptr [{arg} + 8]\n",
+            "fld st(0)\n",
+            "fmul qword ptr [{c} + 8]\n",
+            "fistp dword ptr [{arg} + 32]\n",
+            "fild dword ptr [{arg} + 32]\n",
+            "fmul qword ptr [{c} + 16]\n",   // n/32, t
+            "fsub st(0), st(1)\n",
+            "fstp st(1)\n",
+            "fldln2\n",
+            "fmulp\n",
+            "fchs\n",
+            "fstp qword ptr [{arg}]",
+        )
+    };
+}
+
+/// The log kernel, storing to and loading m from the same place, followed
+/// by `$base` to turn log2 into the log wanted
+macro_rules! log_asm {
+    ($size:literal, $io:expr, $k:expr, $entry:expr, [$($base:literal),*]) => {
+        asm!(
+            concat!("fld ", $size, " ptr [{io}]"),
+            log2_poly!(),
+            "fild dword ptr [{k}]",
+            "faddp",
+            $($base,)*
+            concat!("fstp ", $size, " ptr [{io}]"),
+            io = in(reg) $io,
+            k = in(reg) $k,
+            e = in(reg) $entry,
+            c = in(reg) EXP_LOG_COEFFS.as_ptr(),
+        )
+    };
+}
+
+macro_rules! impl_float {
+    ($t:ty, $size:literal, $bytes:literal, mant = $mant:expr, exp = $exp:expr,
+     pi_4 = $pi_4:expr, sqrt_precision = $sqrt_precision:expr) => {
+        impl Float for $t {
+            const MANT_BITS: u32 = $mant;
+            const EXP_BITS: u32 = $exp;
+            const PI_4: u64 = $pi_4;
+            const SQRT_PRECISION: Option<u16> = $sqrt_precision;
+
+            fn to_bits64(self) -> u64 {
+                self.to_bits() as u64
+            }
+
+            fn from_bits64(bits: u64) -> Self {
+                <$t>::from_bits(bits as _)
+            }
+
+            fn x87_trig(angle: Angle<Self>, op: Trig) -> Self {
+                let mut out: $t = 0.0;
+                let out_ptr = &mut out as *mut $t;
+                unsafe {
+                    match angle {
+                        Angle::Direct(x) => trig_asm!(
+                            op, $size, out_ptr,
+                            [concat!("fld ", $size, " ptr [{x}]")],
+                            x = in(reg) &x as *const $t,
+                        ),
+                        Angle::Reduced(r) => {
+                            // The fraction, then 2^scale as a double (the
+                            // scale is always between -253 and -65)
+                            let parts = [r.fraction as u64, ((r.scale + 1023) as u64) << 52];
+                            trig_asm!(
+                                op, $size, out_ptr,
+                                [
+                                    "fild qword ptr [{r}]",
+                                    "fldpi",
+                                    "fmulp",
+                                    "fmul qword ptr [{r} + 8]"
+                                ],
+                                r = in(reg) parts.as_ptr(),
+                            )
+                        }
+                    }
+                }
+                out
+            }
+
+            fn x87_log(m: Self, k: i32, entry: &[f64; 3], base: LogBase) -> Self {
+                let mut io = m;
+                let io_ptr = &mut io as *mut $t;
+                let k = &k as *const i32;
+                unsafe {
+                    match base {
+                        LogBase::E => log_asm!($size, io_ptr, k, entry.as_ptr(), ["fldln2", "fmulp"]),
+                        LogBase::Two => log_asm!($size, io_ptr, k, entry.as_ptr(), []),
+                        LogBase::Ten => log_asm!($size, io_ptr, k, entry.as_ptr(), ["fldlg2", "fmulp"]),
+                    }
+                }
+                io
+            }
+
+            fn x87_exp_arg(self) -> Exp2Arg {
+                let mut arg = Exp2Arg { u: 0.0, t: 0.0, scale: [0.0; 2], n: 0 };
+                unsafe {
+                    asm!(
+                        concat!("fld ", $size, " ptr [{x}]"),
+                        "fldl2e",
+                        "fmulp",
+                        exp2_split!(),
+                        x = in(reg) &self as *const $t,
+                        c = in(reg) EXP_LOG_COEFFS.as_ptr(),
+                        arg = in(reg) &mut arg as *mut Exp2Arg,
+                    );
+                }
+                arg
+            }
+
+            fn x87_pow_arg(m: Self, k: i32, entry: &[f64; 3], y: Self) -> Exp2Arg {
+                let mut arg = Exp2Arg { u: 0.0, t: 0.0, scale: [0.0; 2], n: k };
+                let xy = [m, y];
+                unsafe {
+                    asm!(
+                        concat!("fld ", $size, " ptr [{xy}]"),
+                        log2_poly!(),
+                        "fild dword ptr [{arg} + 32]",
+                        "faddp",                            // log2(x)
+                        concat!("fmul ", $size, " ptr [{xy} + ", $bytes, "]"),
+                        exp2_split!(),
+                        xy = in(reg) xy.as_ptr(),
+                        e = in(reg) entry.as_ptr(),
+                        c = in(reg) EXP_LOG_COEFFS.as_ptr(),
+                        arg = in(reg) &mut arg as *mut Exp2Arg,
+                    );
+                }
+                arg
+            }
+
+            fn x87_exp2(arg: &Exp2Arg, entry: &[f64; 2]) -> Self {
+                // 2^t = 2^(n/32) * e^u, with |u| at most ln(2)/64
+                let mut out: $t = 0.0;
+                unsafe {
+                    asm!(
+                        "fld qword ptr [{arg}]",
+                        "fld qword ptr [{c} + 64]",
+                        "fmul st(0), st(1)",
+                        "fadd qword ptr [{c} + 56]",
+                        "fmul st(0), st(1)",
+                        "fadd qword ptr [{c} + 48]",
+                        "fmul st(0), st(1)",
+                        "fadd qword ptr [{c} + 40]",
+                        "fmul st(0), st(1)",
+                        "fadd qword ptr [{c} + 32]",
+                        "fmul st(0), st(1)",
+                        "fadd qword ptr [{c} + 24]",
+                        "fmul st(0), st(1)",
+                        "fmul st(0), st(1)",
+                        "faddp",                            // w = e^u - 1
+                        "fld qword ptr [{e}]",
+                        "fadd qword ptr [{e} + 8]",         // 2^(j/32), w
+                        "fld st(0)",
+                        "fmul st(0), st(2)",
+                        "faddp",
+                        "fstp st(1)",                       // 2^(j/32) (1 + w)
+                        "fmul qword ptr [{arg} + 16]",
+                        "fmul qword ptr [{arg} + 24]",
+                        concat!("fstp ", $size, " ptr [{out}]"),
+                        arg = in(reg) arg as *const Exp2Arg,
+                        e = in(reg) entry.as_ptr(),
+                        c = in(reg) EXP_LOG_COEFFS.as_ptr(),
+                        out = in(reg) &mut out as *mut $t,
+                    );
+                }
+                out
+            }
+
+            fn x87_atan(self) -> Self {
+                x87_unary!($t, $size, self, ["fld1", "fpatan"])
+            }
+
+            fn x87_atan2(self, x: Self) -> Self {
+                x87_binary!($t, $size, self, x, ["fpatan"])
+            }
+
+            fn x87_asin(self) -> Self {
+                // atan2(x, sqrt((1 - x)(1 + x))), which unlike 1 - x*x
+                // doesn't cancel as |x| approaches 1
+                x87_unary!($t, $size, self, [
+                    "fld1",
+                    "fsub st(0), st(1)",
+                    "fld1",
+                    "fadd st(0), st(2)",
+                    "fmulp",
+                    "fsqrt",
+                    "fpatan"
+                ])
+            }
+
+            fn x87_acos(self) -> Self {
+                x87_unary!($t, $size, self, [
+                    "fld1",
+                    "fsub st(0), st(1)",
+                    "fld1",
+                    "fadd st(0), st(2)",
+                    "fmulp",
+                    "fsqrt",
+                    "fxch",
+                    "fpatan"
+                ])
+            }
+
+            fn x87_sqrt(self) -> Self {
+                let precision = match Self::SQRT_PRECISION {
+                    Some(precision) => precision,
+                    None => return x87_unary!($t, $size, self, ["fsqrt"]),
+                };
+                let mut cw: u16 = 0;
+                let mut out: $t = 0.0;
+                unsafe {
+                    asm!("fnstcw [{cw}]", cw = in(reg) &mut cw as *mut u16);
+                    let sqrt_cw = (cw & !0x0300) | precision;
+                    asm!(
+                        "fldcw [{sqrt_cw}]",
+                        concat!("fld ", $size, " ptr [{x}]"),
+                        "fsqrt",
+                        concat!("fstp ", $size, " ptr [{out}]"),
+                        "fldcw [{cw}]",
+                        sqrt_cw = in(reg) &sqrt_cw as *const u16,
+                        x = in(reg) &self as *const $t,
+                        out = in(reg) &mut out as *mut $t,
+                        cw = in(reg) &cw as *const u16,
+                    );
+                }
+                out
+            }
+
+            fn x87_fmod(self, y: Self) -> Self {
+                let mut out: $t = 0.0;
+                unsafe {
+                    asm!(
+                        concat!("fld ", $size, " ptr [{y}]"),
+                        concat!("fld ", $size, " ptr [{x}]"),
+                        "2:",
+                        "fprem",
+                        "fnstsw ax",
+                        "test ah, 4",  // check C2 flag (incomplete reduction)
+                        "jnz 2b",
+                        concat!("fstp ", $size, " ptr [{out}]"),
+                        "fstp st(0)",
+                        x = in(reg) &self as *const $t,
+                        y = in(reg) &y as *const $t,
+                        out = in(reg) &mut out as *mut $t,
+                        out("ax") _,
+                    );
+                }
+                out
+            }
+
+            fn x87_ldexp(self, n: i32) -> Self {
+                let mut out: $t = 0.0;
+                unsafe {
+                    asm!(
+                        "fild dword ptr [{n}]",
+                        concat!("fld ", $size, " ptr [{x}]"),
+                        "fscale",
+                        "fstp st(1)",
+                        concat!("fstp ", $size, " ptr [{out}]"),
+                        x = in(reg) &self as *const $t,
+                        n = in(reg) &n as *const i32,
+                        out = in(reg) &mut out as *mut $t,
+                    );
+                }
+                out
+            }
+        }
+    };
+}
+
+impl_float!(f64, "qword", "8", mant = 52, exp = 11, pi_4 = 0x3fe9_21fb_5444_2d18,
+            sqrt_precision = Some(0x0200));
+impl_float!(f32, "dword", "4", mant = 23, exp = 8, pi_4 = 0x3f49_0fdb,
+            sqrt_precision = None);
+
+fn with_sign<F: Float>(x: F, negative: bool) -> F {
+    if negative {
+        F::from_bits64(x.to_bits64() ^ F::SIGN)
+    } else {
+        x
+    }
+}
+
+/// A finite nonzero magnitude, given as bits, as m * 2^e with m an integer
+fn split<F: Float>(abs: u64) -> (u64, i32) {
+    let biased = (abs >> F::MANT_BITS) as i32;
+    let fraction = abs & ((1 << F::MANT_BITS) - 1);
+    if biased == 0 {
+        (fraction, 1 - F::BIAS - F::MANT_BITS as i32)
+    } else {
+        (fraction | (1 << F::MANT_BITS), biased - F::BIAS - F::MANT_BITS as i32)
+    }
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum Parity {
+    NotInteger,
+    Odd,
+    Even,
+}
+
+/// Whether a finite magnitude, given as bits, is an odd or even integer
+fn parity<F: Float>(abs: u64) -> Parity {
+    if abs == 0 {
+        return Parity::Even;
+    }
+    let (m, e) = split::<F>(abs);
+    if e > 0 {
+        return Parity::Even;
+    }
+    let shift = (-e) as u32;
+    if shift >= 64 || m & ((1 << shift) - 1) != 0 {
+        Parity::NotInteger
+    } else if (m >> shift) & 1 == 1 {
+        Parity::Odd
+    } else {
+        Parity::Even
+    }
+}
+
+/// 32 bits of 2/pi, starting from bit `first` after the binary point
+/// (counting from 1). Bits before the point are zero.
+fn two_over_pi_bits(first: i32) -> u32 {
+    let index = first - 1;
+    if index <= -32 {
+        return 0;
+    }
+    if index < 0 {
+        return TWO_OVER_PI[0] >> -index;
+    }
+    let word = (index / 32) as usize;
+    let shift = index % 32;
+    if shift == 0 {
+        TWO_OVER_PI[word]
+    } else {
+        (TWO_OVER_PI[word] << shift) | (TWO_OVER_PI[word + 1] >> (32 - shift))
+    }
+}
+
+/// Reduce m * 2^e, which must be positive, by multiples of pi/2
+pub fn reduce(m: u64, e: i32) -> Reduced {
+    // x * 2/pi mod 4. Bits of 2/pi before bit e - 1 only add multiples of
+    // four, so take 192 bits from there: m is under 2^53 and no double
+    // comes within 2^-62 of a multiple of pi/2, which leaves over 64 good
+    // bits in the fraction of the product
+    let mut window = [0u32; 6];
+    for (i, word) in window.iter_mut().rev().enumerate() {
+        *word = two_over_pi_bits(e - 1 + 32 * i as i32);
+    }
+    let mut p = [0u32; 8];
+    for (i, part) in [m as u32, (m >> 32) as u32].into_iter().enumerate() {
+        let mut carry = 0u64;
+        for (j, &word) in window.iter().enumerate() {
+            let t = part as u64 * word as u64 + p[i + j] as u64 + carry;
+            p[i + j] = t as u32;
+            carry = t >> 32;
+        }
+        p[i + 6] = carry as u32;
+    }
+
+    // The product is scaled by 2^190: two bits of quadrant, then the fraction
+    let mut quadrant = p[5] >> 30;
+    let mut frac = [p[0], p[1], p[2], p[3], p[4], p[5] & 0x3fff_ffff];
+    let negative = frac[5] & 0x2000_0000 != 0;
+    if negative {
+        // Past the halfway point: round up to the next quadrant and take
+        // the distance back to it
+        quadrant += 1;
+        let mut carry = 1u64;
+        for limb in frac.iter_mut() {
+            let t = (!*limb) as u64 + carry;
+            *limb = t as u32;
+            carry = t >> 32;
+        }
+        frac[5] &= 0x3fff_ffff;
+    }
+
+    let top_limb = match frac.iter().rposition(|&limb| limb != 0) {
+        Some(limb) => limb,
+        None => {
+            return Reduced {
+                quadrant: quadrant & 3,
+                fraction: 0,
+                scale: 0,
+            }
+        }
+    };
+    let top = (top_limb * 32) as i32 + 31 - frac[top_limb].leading_zeros() as i32;
+    // The 63 bits from the top one down
+    let low = top - 62;
+    let limb_at = |i: i32| -> u128 {
+        if i < 0 || i >= 6 {
+            0
+        } else {
+            frac[i as usize] as u128
+        }
+    };
+    let base = low.div_euclid(32);
+    let wide = limb_at(base) | (limb_at(base + 1) << 32) | (limb_at(base + 2) << 64);
+    let fraction = (wide >> low.rem_euclid(32)) as u64 as i64;
+    Reduced {
+        quadrant: quadrant & 3,
+        fraction: if negative { -fraction } else { fraction },
+        // fraction * 2^(low - 190) quarter turns, times pi/2
+        scale: low - 191,
+    }
+}
+
+/// The trig argument for a finite magnitude, given as bits, past pi/4
+fn reduce_abs<F: Float>(abs: u64) -> Reduced {
+    let (m, e) = split::<F>(abs);
+    reduce(m, e)
+}
+
+pub fn sin<F: Float>(x: F) -> F {
+    let bits = x.to_bits64();
+    let abs = bits & !F::SIGN;
+    if abs >= F::INF {
+        return F::from_bits64(F::NAN);
+    }
+    if abs <= F::PI_4 {
+        return F::x87_trig(Angle::Direct(x), Trig::Sin);
+    }
+    let r = reduce_abs::<F>(abs);
+    let op = if r.quadrant & 1 == 0 { Trig::Sin } else { Trig::Cos };
+    let negative = (r.quadrant & 2 != 0) != (bits & F::SIGN != 0);
+    with_sign(F::x87_trig(Angle::Reduced(r), op), negative)
+}
+
+pub fn cos<F: Float>(x: F) -> F {
+    let abs = x.to_bits64() & !F::SIGN;
+    if abs >= F::INF {
+        return F::from_bits64(F::NAN);
+    }
+    if abs <= F::PI_4 {
+        return F::x87_trig(Angle::Direct(x), Trig::Cos);
+    }
+    // cos(x) = sin(x + pi/2)
+    let r = reduce_abs::<F>(abs);
+    let quadrant = r.quadrant + 1;
+    let op = if quadrant & 1 == 0 { Trig::Sin } else { Trig::Cos };
+    with_sign(F::x87_trig(Angle::Reduced(r), op), quadrant & 2 != 0)
+}
+
+pub fn tan<F: Float>(x: F) -> F {
+    let bits = x.to_bits64();
+    let abs = bits & !F::SIGN;
+    if abs >= F::INF {
+        return F::from_bits64(F::NAN);
+    }
+    if abs <= F::PI_4 {
+        return F::x87_trig(Angle::Direct(x), Trig::Tan);
+    }
+    let r = reduce_abs::<F>(abs);
+    let op = if r.quadrant & 1 == 0 { Trig::Tan } else { Trig::NegCot };
+    with_sign(F::x87_trig(Angle::Reduced(r), op), bits & F::SIGN != 0)
+}
+
+pub fn asin<F: Float>(x: F) -> F {
+    F::x87_asin(x)
+}
+
+pub fn acos<F: Float>(x: F) -> F {
+    F::x87_acos(x)
+}
+
+pub fn atan<F: Float>(x: F) -> F {
+    F::x87_atan(x)
+}
+
+pub fn atan2<F: Float>(y: F, x: F) -> F {
+    F::x87_atan2(y, x)
+}
+
+/// A positive finite magnitude, given as bits, as 2^k * m with m between
+/// 0.7 and 1.4, and the log table entry for m
+fn log_split<F: Float>(abs: u64) -> (F, i32, &'static [f64; 3]) {
+    let (m, e) = split::<F>(abs);
+    // Normalize subnormals so the leading one sits at the implicit bit
+    let shift = m.leading_zeros() - (63 - F::MANT_BITS);
+    let fraction = (m << shift) & ((1 << F::MANT_BITS) - 1);
+    let mut k = e - shift as i32 + F::MANT_BITS as i32;
+    let index = (fraction >> (F::MANT_BITS - 7)) as usize;
+    let mut biased = F::BIAS as u64;
+    if index >= LOG_HALVED {
+        biased -= 1;
+        k += 1;
+    }
+    (F::from_bits64((biased << F::MANT_BITS) | fraction), k, &LOG_TABLE[index])
+}
+
+/// 2^t for the exponent from `x87_exp_arg` or `x87_pow_arg`
+fn exp2<F: Float>(mut arg: Exp2Arg) -> F {
+    // Past 2^1100 either way the result is certainly infinite or zero. n
+    // is i32::MIN if t was too big to convert at all.
+    if arg.n.unsigned_abs() > 32 * 1100 {
+        let negative = arg.t.to_bits() >> 63 != 0;
+        return F::from_bits64(if negative { 0 } else { F::INF });
+    }
+    // 2^(n/32) is 2^(j/32) from the table times a power of two, applied in
+    // two halves so that each is a normal double
+    let k = arg.n >> 5;
+    let half = k >> 1;
+    arg.scale = [
+        f64::from_bits(((half + 1023) as u64) << 52),
+        f64::from_bits(((k - half + 1023) as u64) << 52),
+    ];
+    let entry = &EXP2_TABLE[(arg.n & 31) as usize];
+    F::x87_exp2(&arg, entry)
+}
+
+pub fn exp<F: Float>(x: F) -> F {
+    let bits = x.to_bits64();
+    if bits & !F::SIGN < F::INF {
+        exp2(F::x87_exp_arg(x))
+    } else if bits == F::SIGN | F::INF {
+        F::from_bits64(0)
+    } else {
+        // +inf, or NaN
+        x
+    }
+}
+
+fn log_base<F: Float>(x: F, base: LogBase) -> F {
+    let bits = x.to_bits64();
+    if bits & !F::SIGN == 0 {
+        return F::from_bits64(F::SIGN | F::INF);
+    }
+    if bits & F::SIGN != 0 {
+        return F::from_bits64(F::NAN);
+    }
+    if bits >= F::INF {
+        return x;
+    }
+    let (m, k, entry) = log_split::<F>(bits);
+    F::x87_log(m, k, entry, base)
+}
+
+pub fn log<F: Float>(x: F) -> F {
+    log_base(x, LogBase::E)
+}
+
+pub fn log10<F: Float>(x: F) -> F {
+    log_base(x, LogBase::Ten)
+}
+
+pub fn log2<F: Float>(x: F) -> F {
+    log_base(x, LogBase::Two)
+}
+
+/// x^y, with the special cases from C99 Annex F
+pub fn pow<F: Float>(x: F, y: F) -> F {
+    let (x_bits, y_bits) = (x.to_bits64(), y.to_bits64());
+    let (x_abs, y_abs) = (x_bits & !F::SIGN, y_bits & !F::SIGN);
+    if y_abs == 0 || x_bits == F::ONE {
+        return F::from_bits64(F::ONE);
+    }
+    if x_abs > F::INF || y_abs > F::INF {
+        return F::from_bits64(F::NAN);
+    }
+    let y_negative = y_bits & F::SIGN != 0;
+    if y_abs == F::INF {
+        if x_abs == F::ONE {
+            return F::from_bits64(F::ONE);
+        }
+        // Infinite for |x| < 1 and y = -inf, or |x| > 1 and y = +inf
+        let infinite = (x_abs < F::ONE) == y_negative;
+        return F::from_bits64(if infinite { F::INF } else { 0 });
+    }
+
+    let parity = parity::<F>(y_abs);
+    let x_negative = x_bits & F::SIGN != 0;
+    let negative = x_negative && parity == Parity::Odd;
+    if x_abs == 0 || x_abs == F::INF {
+        // Zero or infinity, depending on which way y points
+        let infinite = (x_abs == F::INF) != y_negative;
+        return with_sign(F::from_bits64(if infinite { F::INF } else { 0 }), negative);
+    }
+    if x_negative && parity == Parity::NotInteger {
+        return F::from_bits64(F::NAN);
+    }
+    let (m, k, entry) = log_split::<F>(x_abs);
+    with_sign(exp2::<F>(F::x87_pow_arg(m, k, entry, y)), negative)
+}
+
+pub fn sqrt<F: Float>(x: F) -> F {
+    F::x87_sqrt(x)
+}
+
+pub fn fabs<F: Float>(x: F) -> F {
+    F::from_bits64(x.to_bits64() & !F::SIGN)
+}
+
+pub fn floor<F: Float>(x: F) -> F {
+    round_toward(x, true)
+}
+
+pub fn ceil<F: Float>(x: F) -> F {
+    round_toward(x, false)
+}
+
+/// Round to an integer toward -inf (`down`) or +inf, by clearing the
+/// fraction bits and, when that moves the wrong way, carrying one into the
+/// integer part
+fn round_toward<F: Float>(x: F, down: bool) -> F {
+    let bits = x.to_bits64();
+    let abs = bits & !F::SIGN;
+    let sign = bits & F::SIGN;
+    let exp = (abs >> F::MANT_BITS) as i32 - F::BIAS;
+    if exp >= F::MANT_BITS as i32 {
+        // Already an integer, or infinite or NaN
+        return x;
+    }
+    // Rounding moves away from zero for floor of a negative value, or ceil
+    // of a positive one
+    let away = (sign != 0) == down;
+    if exp < 0 {
+        if abs == 0 {
+            return x;
+        }
+        return F::from_bits64(if away { sign | F::ONE } else { sign });
+    }
+    let mask = (1u64 << (F::MANT_BITS as i32 - exp)) - 1;
+    if abs & mask == 0 {
+        return x;
+    }
+    let bits = if away { bits + mask } else { bits };
+    F::from_bits64(bits & !mask)
+}
+
+pub fn fmod<F: Float>(x: F, y: F) -> F {
+    F::x87_fmod(x, y)
+}
+
+pub fn ldexp<F: Float>(x: F, n: i32) -> F {
+    F::x87_ldexp(x, n)
+}
+
+/// Split x into a fraction in [0.5, 1) and a power of two
+pub fn frexp<F: Float>(x: F, exp: &mut i32) -> F {
+    let bits = x.to_bits64();
+    let abs = bits & !F::SIGN;
+    if abs == 0 || abs >= F::INF {
+        *exp = 0;
+        return x;
+    }
+    // Normalize subnormals so the leading one sits at the implicit bit
+    let (m, e) = split::<F>(abs);
+    let shift = m.leading_zeros() - (63 - F::MANT_BITS);
+    let m = m << shift;
+    *exp = e - shift as i32 + F::MANT_BITS as i32 + 1;
+    let fraction = m & ((1 << F::MANT_BITS) - 1);
+    F::from_bits64((bits & F::SIGN) | ((F::BIAS as u64 - 1) << F::MANT_BITS) | fraction)
+}
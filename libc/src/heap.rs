@@ -0,0 +1,440 @@
+//! Size-class heap behind malloc and free.
+//!
+//! Memory is managed in three tiers:
+//!
+//! - Small requests (up to 512 bytes) are rounded up to one of 16 size
+//!   classes, and served from single-page slabs. Each class keeps a list of
+//!   slabs with free slots, so allocating and freeing are a handful of
+//!   pointer operations.
+//! - Medium requests get a run of whole pages carved out of a 1MB arena.
+//!   Free runs are kept in bins by length, and merge with their neighbours
+//!   when freed. An arena that becomes completely free is unmapped, except
+//!   for one that is kept as a spare.
+//! - Large requests get a mapping of their own, which is unmapped on free.
+//!
+//! Every span (slab, run or large mapping) starts with a `Span` header on a
+//! page boundary, and every pointer handed out lies within the first page of
+//! its span. free() finds the header by rounding down to the page.
+//!
+//! libc programs are single threaded, so there is no locking: every call
+//! takes the path a threaded allocator would reserve for the owning thread.
+//!
+//! The heap gets its pages from a `PageSource`, so the host stress benchmark
+//! in `libc/bench/malloc_stress.rs` can run it without the kernel.
+
+use core::mem::size_of;
+use core::ptr;
+
+pub const PAGE_SIZE: usize = 4096;
+
+/// Supplies page-aligned memory to the heap
+pub trait PageSource {
+    fn map(&mut self, size: usize) -> Option<usize>;
+    fn unmap(&mut self, address: usize, size: usize);
+}
+
+/// Pages in each arena that medium runs are carved from
+const ARENA_PAGES: usize = 256;
+/// Requests needing longer runs than this get their own mapping
+const MAX_RUN_PAGES: usize = 64;
+/// Free runs shorter than this are binned by exact length. Longer ones share
+/// the last bin.
+const RUN_BINS: usize = 32;
+
+const SMALL_MAX: usize = 512;
+const CLASS_SIZES: [u16; 16] = [
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512,
+];
+const CLASS_COUNT: usize = CLASS_SIZES.len();
+
+/// Smallest class that fits a size, indexed by the size in 16-byte units
+const CLASS_LOOKUP: [u8; SMALL_MAX / 16 + 1] = build_class_lookup();
+
+const fn build_class_lookup() -> [u8; SMALL_MAX / 16 + 1] {
+    let mut table = [0; SMALL_MAX / 16 + 1];
+    let mut units = 0;
+    let mut class = 0;
+    while units < table.len() {
+        while (CLASS_SIZES[class] as usize) < units * 16 {
+            class += 1;
+        }
+        table[units] = class as u8;
+        units += 1;
+    }
+    table
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+enum SpanKind {
+    Slab,
+    Run,
+    FreeRun,
+    Large,
+}
+
+#[repr(C, align(16))]
+struct Span {
+    kind: SpanKind,
+    class: u8,
+    /// Set on the last span in an arena
+    last: bool,
+    /// Length of this span in pages
+    pages: u32,
+    /// Length of the span just before this one in its arena, or 0 if this is
+    /// the first
+    prev_pages: u32,
+    /// Slabs: number of objects handed out
+    in_use: u16,
+    /// Slabs: objects at or past this index have never been handed out
+    carved: u16,
+    /// Slabs: objects that have been freed
+    free: *mut FreeObject,
+    /// Links in the class's slab list, or in a free run bin
+    next: *mut Span,
+    prev: *mut Span,
+}
+
+/// Size of the span header; also the offset of the first object or block
+const HEADER: usize = size_of::<Span>();
+
+struct FreeObject {
+    next: *mut FreeObject,
+}
+
+pub struct Heap<P: PageSource> {
+    source: P,
+    /// Slabs with at least one free slot, for each size class
+    slabs: [*mut Span; CLASS_COUNT],
+    /// Free runs, indexed by length. Index 0 is unused.
+    runs: [*mut Span; RUN_BINS + 1],
+    /// Number of completely free arenas in the run bins
+    empty_arenas: usize,
+}
+
+impl<P: PageSource> Heap<P> {
+    pub const fn new(source: P) -> Self {
+        Self {
+            source,
+            slabs: [ptr::null_mut(); CLASS_COUNT],
+            runs: [ptr::null_mut(); RUN_BINS + 1],
+            empty_arenas: 0,
+        }
+    }
+
+    /// Used by the host benchmark to inspect how much memory is mapped
+    #[allow(dead_code)]
+    pub fn source(&self) -> &P {
+        &self.source
+    }
+
+    pub unsafe fn alloc(&mut self, size: usize) -> *mut u8 {
+        if size <= SMALL_MAX {
+            return self.alloc_small(CLASS_LOOKUP[(size + 15) / 16] as usize);
+        }
+        let Some(pages) = pages_for(size) else {
+            return ptr::null_mut();
+        };
+        let span = if pages <= MAX_RUN_PAGES {
+            self.alloc_run(pages)
+        } else {
+            self.alloc_large(pages)
+        };
+        if span.is_null() {
+            return ptr::null_mut();
+        }
+        (span as *mut u8).add(HEADER)
+    }
+
+    pub unsafe fn free(&mut self, p: *mut u8) {
+        let span = span_of(p);
+        match (*span).kind {
+            SpanKind::Slab => self.free_small(span, p),
+            SpanKind::Run => self.free_run(span),
+            SpanKind::Large => {
+                let size = (*span).pages as usize * PAGE_SIZE;
+                self.source.unmap(span as usize, size);
+            }
+            SpanKind::FreeRun => (),
+        }
+    }
+
+    /// Number of bytes that can be stored at `p`, which may exceed the size
+    /// originally requested
+    pub unsafe fn usable_size(&self, p: *mut u8) -> usize {
+        let span = span_of(p);
+        match (*span).kind {
+            SpanKind::Slab => CLASS_SIZES[(*span).class as usize] as usize,
+            _ => (*span).pages as usize * PAGE_SIZE - HEADER,
+        }
+    }
+
+    pub unsafe fn realloc(&mut self, p: *mut u8, size: usize) -> *mut u8 {
+        let usable = self.usable_size(p);
+        if size <= usable {
+            return p;
+        }
+        let span = span_of(p);
+        if (*span).kind == SpanKind::Run {
+            // Grow in place when the following run is free and long enough
+            if let Some(pages) = pages_for(size) {
+                if pages <= MAX_RUN_PAGES && self.extend_run(span, pages) {
+                    return p;
+                }
+            }
+        }
+        let moved = self.alloc(size);
+        if !moved.is_null() {
+            ptr::copy_nonoverlapping(p, moved, usable);
+            self.free(p);
+        }
+        moved
+    }
+
+    // ---- Small objects ----
+
+    unsafe fn alloc_small(&mut self, class: usize) -> *mut u8 {
+        let mut slab = self.slabs[class];
+        if slab.is_null() {
+            slab = self.alloc_run(1);
+            if slab.is_null() {
+                return ptr::null_mut();
+            }
+            (*slab).kind = SpanKind::Slab;
+            (*slab).class = class as u8;
+            (*slab).in_use = 0;
+            (*slab).carved = 0;
+            (*slab).free = ptr::null_mut();
+            push(&mut self.slabs[class], slab);
+        }
+
+        let object = if !(*slab).free.is_null() {
+            let object = (*slab).free;
+            (*slab).free = (*object).next;
+            object as *mut u8
+        } else {
+            let index = (*slab).carved as usize;
+            (*slab).carved += 1;
+            (slab as *mut u8).add(HEADER + index * CLASS_SIZES[class] as usize)
+        };
+        (*slab).in_use += 1;
+        if (*slab).in_use as usize == slab_capacity(class) {
+            unlink(&mut self.slabs[class], slab);
+        }
+        object
+    }
+
+    unsafe fn free_small(&mut self, slab: *mut Span, p: *mut u8) {
+        let class = (*slab).class as usize;
+        let object = p as *mut FreeObject;
+        (*object).next = (*slab).free;
+        (*slab).free = object;
+        if (*slab).in_use as usize == slab_capacity(class) {
+            // The slab was full, so it isn't on the list
+            push(&mut self.slabs[class], slab);
+        }
+        (*slab).in_use -= 1;
+        // Hand empty slabs back to the run allocator, so that they don't pin
+        // otherwise empty arenas. Getting the page back is cheap while the
+        // arena is still mapped.
+        if (*slab).in_use == 0 {
+            unlink(&mut self.slabs[class], slab);
+            self.free_run(slab);
+        }
+    }
+
+    // ---- Page runs ----
+
+    unsafe fn alloc_run(&mut self, pages: usize) -> *mut Span {
+        let mut run = ptr::null_mut();
+        for bin in pages..RUN_BINS {
+            if !self.runs[bin].is_null() {
+                run = self.runs[bin];
+                break;
+            }
+        }
+        if run.is_null() {
+            // First fit among the long runs
+            let mut candidate = self.runs[RUN_BINS];
+            while !candidate.is_null() && ((*candidate).pages as usize) < pages {
+                candidate = (*candidate).next;
+            }
+            run = candidate;
+        }
+        if run.is_null() {
+            run = self.new_arena();
+            if run.is_null() {
+                return ptr::null_mut();
+            }
+        } else {
+            self.remove_free_run(run);
+        }
+        self.split_run(run, pages);
+        (*run).kind = SpanKind::Run;
+        run
+    }
+
+    unsafe fn new_arena(&mut self) -> *mut Span {
+        let Some(address) = self.source.map(ARENA_PAGES * PAGE_SIZE) else {
+            return ptr::null_mut();
+        };
+        let run = address as *mut Span;
+        (*run).kind = SpanKind::FreeRun;
+        (*run).pages = ARENA_PAGES as u32;
+        (*run).prev_pages = 0;
+        (*run).last = true;
+        run
+    }
+
+    /// Trim a run to `pages`, returning the rest to the bins
+    unsafe fn split_run(&mut self, run: *mut Span, pages: usize) {
+        let excess = (*run).pages as usize - pages;
+        if excess == 0 {
+            return;
+        }
+        let rest = (run as *mut u8).add(pages * PAGE_SIZE) as *mut Span;
+        (*rest).kind = SpanKind::FreeRun;
+        (*rest).pages = excess as u32;
+        (*rest).prev_pages = pages as u32;
+        (*rest).last = (*run).last;
+        (*run).pages = pages as u32;
+        (*run).last = false;
+        self.fix_next_link(rest);
+        self.insert_free_run(rest);
+    }
+
+    unsafe fn free_run(&mut self, run: *mut Span) {
+        let mut run = run;
+        (*run).kind = SpanKind::FreeRun;
+        if !(*run).last {
+            let next = next_span(run);
+            if (*next).kind == SpanKind::FreeRun {
+                self.remove_free_run(next);
+                (*run).pages += (*next).pages;
+                (*run).last = (*next).last;
+            }
+        }
+        if (*run).prev_pages != 0 {
+            let prev = prev_span(run);
+            if (*prev).kind == SpanKind::FreeRun {
+                self.remove_free_run(prev);
+                (*prev).pages += (*run).pages;
+                (*prev).last = (*run).last;
+                run = prev;
+            }
+        }
+        self.fix_next_link(run);
+        if is_whole_arena(run) && self.empty_arenas > 0 {
+            self.source.unmap(run as usize, ARENA_PAGES * PAGE_SIZE);
+            return;
+        }
+        self.insert_free_run(run);
+    }
+
+    /// Grow a run in place into the free run that follows it
+    unsafe fn extend_run(&mut self, run: *mut Span, pages: usize) -> bool {
+        if (*run).last {
+            return false;
+        }
+        let next = next_span(run);
+        if (*next).kind != SpanKind::FreeRun || pages > ((*run).pages + (*next).pages) as usize {
+            return false;
+        }
+        self.remove_free_run(next);
+        (*run).pages += (*next).pages;
+        (*run).last = (*next).last;
+        self.fix_next_link(run);
+        self.split_run(run, pages);
+        true
+    }
+
+    /// Point the span after `span` back at it
+    unsafe fn fix_next_link(&mut self, span: *mut Span) {
+        if !(*span).last {
+            (*next_span(span)).prev_pages = (*span).pages;
+        }
+    }
+
+    unsafe fn insert_free_run(&mut self, run: *mut Span) {
+        if is_whole_arena(run) {
+            self.empty_arenas += 1;
+        }
+        push(&mut self.runs[run_bin(run)], run);
+    }
+
+    unsafe fn remove_free_run(&mut self, run: *mut Span) {
+        if is_whole_arena(run) {
+            self.empty_arenas -= 1;
+        }
+        unlink(&mut self.runs[run_bin(run)], run);
+    }
+
+    // ---- Large blocks ----
+
+    unsafe fn alloc_large(&mut self, pages: usize) -> *mut Span {
+        let Some(address) = self.source.map(pages * PAGE_SIZE) else {
+            return ptr::null_mut();
+        };
+        let span = address as *mut Span;
+        (*span).kind = SpanKind::Large;
+        (*span).pages = pages as u32;
+        span
+    }
+}
+
+/// Pages needed to hold a header and `size` bytes
+fn pages_for(size: usize) -> Option<usize> {
+    let total = size.checked_add(HEADER + PAGE_SIZE - 1)?;
+    let pages = total / PAGE_SIZE;
+    // Span lengths are stored as u32
+    if pages > u32::MAX as usize {
+        return None;
+    }
+    Some(pages)
+}
+
+fn slab_capacity(class: usize) -> usize {
+    (PAGE_SIZE - HEADER) / CLASS_SIZES[class] as usize
+}
+
+fn span_of(p: *mut u8) -> *mut Span {
+    (p as usize & !(PAGE_SIZE - 1)) as *mut Span
+}
+
+unsafe fn next_span(span: *mut Span) -> *mut Span {
+    (span as *mut u8).add((*span).pages as usize * PAGE_SIZE) as *mut Span
+}
+
+unsafe fn prev_span(span: *mut Span) -> *mut Span {
+    (span as *mut u8).sub((*span).prev_pages as usize * PAGE_SIZE) as *mut Span
+}
+
+unsafe fn is_whole_arena(run: *mut Span) -> bool {
+    (*run).prev_pages == 0 && (*run).last
+}
+
+unsafe fn run_bin(run: *mut Span) -> usize {
+    ((*run).pages as usize).min(RUN_BINS)
+}
+
+unsafe fn push(head: &mut *mut Span, span: *mut Span) {
+    (*span).prev = ptr::null_mut();
+    (*span).next = *head;
+    if !head.is_null() {
+        (**head).prev = span;
+    }
+    *head = span;
+}
+
+unsafe fn unlink(head: &mut *mut Span, span: *mut Span) {
+    if (*span).prev.is_null() {
+        *head = (*span).next;
+    } else {
+        (*(*span).prev).next = (*span).next;
+    }
+    if !(*span).next.is_null() {
+        (*(*span).next).prev = (*span).prev;
+    }
+    (*span).next = ptr::null_mut();
+    (*span).prev = ptr::null_mut();
+}
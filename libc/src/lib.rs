@@ -6,11 +6,17 @@ mod allocator;
 mod ctype;
 mod dirent;
 mod errno;
+mod fastmem;
+mod fpmath;
+mod heap;
 mod locale;
 mod math;
 mod mman;
+mod numfmt;
+mod printf;
 mod setjmp;
 mod signal;
+mod sort;
 mod stat;
 mod stdio;
 mod stdlib;
@@ -1,39 +1,363 @@
-//! mmap/munmap wrappers.
+//! mmap/munmap/msync/madvise wrappers.
+//!
+//! Anonymous mappings are on-demand memory. File mappings are made by path
+//! through the kernel's file-backed regions, so the descriptor passed to
+//! mmap only identifies the file, and the mapping outlives it.
+//!
+//! The kernel shares the frames of a MAP_SHARED mapping between tasks, but
+//! only read-only. A writable MAP_SHARED mapping is made private instead and
+//! recorded here, so msync, munmap and exit can write its dirty pages back
+//! to the file. Other tasks see those writes once they reach the file rather
+//! than as they happen.
+//!
+//! Protection is enforced by the page tables, except for PROT_EXEC: without
+//! PAE there is no no-execute bit, so anything readable can be executed.
 
 use core::ffi::{c_int, c_void};
+use core::ptr;
 
-use idos_api::syscall::memory::map_memory;
+use idos_api::io::file::FileStatus;
+use idos_api::io::{Handle, ASYNC_OP_CLOSE, ASYNC_OP_OPEN, ASYNC_OP_WRITE, FILE_OP_STAT};
+use idos_api::syscall::io::create_file_handle;
+use idos_api::syscall::memory::{
+    advise_memory, collect_dirty_pages, map_file, map_memory, protect_memory, unmap_memory,
+    MMAP_SHARED,
+};
 
+use crate::stdio::io_sync;
+
+pub const PROT_NONE: c_int = 0;
 pub const PROT_READ: c_int = 1;
 pub const PROT_WRITE: c_int = 2;
 pub const PROT_EXEC: c_int = 4;
+pub const MAP_SHARED: c_int = 0x01;
 pub const MAP_PRIVATE: c_int = 0x02;
 pub const MAP_ANONYMOUS: c_int = 0x20;
 pub const MAP_FAILED: *mut c_void = !0usize as *mut c_void;
 
+pub const MS_ASYNC: c_int = 1;
+pub const MS_INVALIDATE: c_int = 2;
+pub const MS_SYNC: c_int = 4;
+
+/// madvise hints, numbered as the kernel expects them
+pub const MADV_NORMAL: c_int = 0;
+pub const MADV_RANDOM: c_int = 1;
+pub const MADV_SEQUENTIAL: c_int = 2;
+pub const MADV_WILLNEED: c_int = 3;
+pub const MADV_DONTNEED: c_int = 4;
+
+const PAGE_SIZE: u32 = 0x1000;
+
+/// Pages examined per collect_dirty_pages call, one bit each
+const DIRTY_BATCH_PAGES: u32 = 32 * 32;
+
+/// A writable shared file mapping, whose dirty pages belong in the file
+#[derive(Clone, Copy)]
+struct WriteBack {
+    addr: u32,
+    /// Length in bytes, rounded up to whole pages
+    length: u32,
+    /// File offset of the first page
+    offset: u32,
+    /// Translated path of the file, malloc'd
+    path: *mut u8,
+    path_len: usize,
+}
+
+const MAX_WRITE_BACK: usize = 16;
+
+static mut WRITE_BACK: [Option<WriteBack>; MAX_WRITE_BACK] = [None; MAX_WRITE_BACK];
+
+fn page_round_up(length: usize) -> Option<u32> {
+    let length = u32::try_from(length).ok()?;
+    Some(length.checked_add(PAGE_SIZE - 1)? & !(PAGE_SIZE - 1))
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn mmap(
     addr: *mut c_void,
     length: usize,
-    _prot: c_int,
-    _flags: c_int,
-    _fd: c_int,
-    _offset: i32,
+    prot: c_int,
+    flags: c_int,
+    fd: c_int,
+    offset: i32,
 ) -> *mut c_void {
+    let rounded = match page_round_up(length) {
+        Some(rounded) if rounded > 0 => rounded,
+        _ => return MAP_FAILED,
+    };
     let vaddr = if addr.is_null() {
         None
     } else {
         Some(addr as u32)
     };
+    if prot & !(PROT_READ | PROT_WRITE | PROT_EXEC) != 0 {
+        return MAP_FAILED;
+    }
+    let protection = prot as u32;
+
+    if flags & MAP_ANONYMOUS != 0 {
+        let mapped = match map_memory(vaddr, rounded, None) {
+            Ok(mapped) => mapped,
+            Err(()) => return MAP_FAILED,
+        };
+        // Anonymous memory comes back with every access allowed
+        if prot != PROT_READ | PROT_WRITE | PROT_EXEC
+            && protect_memory(mapped, rounded, protection).is_err()
+        {
+            unmap_memory(mapped, rounded).ok();
+            return MAP_FAILED;
+        }
+        return mapped as *mut c_void;
+    }
+
+    let shared = match flags & (MAP_SHARED | MAP_PRIVATE) {
+        MAP_SHARED => true,
+        MAP_PRIVATE => false,
+        _ => return MAP_FAILED,
+    };
+    if offset < 0 || offset as u32 & (PAGE_SIZE - 1) != 0 {
+        return MAP_FAILED;
+    }
+    let offset = offset as u32;
+    if offset.checked_add(rounded).is_none() {
+        return MAP_FAILED;
+    }
+    let path = match crate::unistd::fd_path(fd).map(core::str::from_utf8) {
+        Some(Ok(path)) => path,
+        _ => return MAP_FAILED,
+    };
+
+    let write_back = shared && prot & PROT_WRITE != 0;
+    let slot = if write_back {
+        match (*ptr::addr_of!(WRITE_BACK)).iter().position(|entry| entry.is_none()) {
+            Some(slot) => Some(slot),
+            None => return MAP_FAILED,
+        }
+    } else {
+        None
+    };
+    let map_flags = if shared && !write_back { MMAP_SHARED } else { 0 };
 
-    match map_memory(vaddr, length as u32, None) {
-        Ok(mapped) => mapped as *mut c_void,
-        Err(()) => MAP_FAILED,
+    let mapped = match map_file(vaddr, rounded, path, offset, map_flags, protection) {
+        Ok(mapped) => mapped,
+        Err(()) => return MAP_FAILED,
+    };
+
+    if let Some(slot) = slot {
+        let path_copy = crate::allocator::malloc(path.len());
+        if path_copy.is_null() {
+            unmap_memory(mapped, rounded).ok();
+            return MAP_FAILED;
+        }
+        ptr::copy_nonoverlapping(path.as_ptr(), path_copy, path.len());
+        WRITE_BACK[slot] = Some(WriteBack {
+            addr: mapped,
+            length: rounded,
+            offset,
+            path: path_copy,
+            path_len: path.len(),
+        });
+    }
+    mapped as *mut c_void
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn munmap(addr: *mut c_void, length: usize) -> c_int {
+    let start = addr as u32;
+    let length = match page_round_up(length) {
+        Some(length) if length > 0 => length,
+        _ => return -1,
+    };
+    if start & (PAGE_SIZE - 1) != 0 || start.checked_add(length).is_none() {
+        return -1;
+    }
+    // Unmapping is not allowed to fail just because write-back did, or the
+    // pages would be stuck mapped
+    sync_range(start, length);
+    forget_range(start, length);
+    match unmap_memory(start, length) {
+        Ok(()) => 0,
+        Err(()) => -1,
     }
 }
 
+/// Change the access allowed to whole pages of mapped memory. A read-only
+/// MAP_SHARED mapping can't be made writable, since its frames are the ones
+/// every other task mapping the file sees.
 #[no_mangle]
-pub unsafe extern "C" fn munmap(_addr: *mut c_void, _length: usize) -> c_int {
-    // Kernel doesn't support unmapping yet
-    0 // pretend success
+pub unsafe extern "C" fn mprotect(addr: *mut c_void, length: usize, prot: c_int) -> c_int {
+    let start = addr as u32;
+    let length = match page_round_up(length) {
+        Some(length) => length,
+        None => return -1,
+    };
+    if start & (PAGE_SIZE - 1) != 0 || prot & !(PROT_READ | PROT_WRITE | PROT_EXEC) != 0 {
+        return -1;
+    }
+    match protect_memory(start, length, prot as u32) {
+        Ok(()) => 0,
+        Err(()) => -1,
+    }
+}
+
+/// Write the dirty pages of writable shared mappings in the range back to
+/// their files. Writes are always synchronous, so MS_ASYNC behaves like
+/// MS_SYNC. Other mappings have nothing to write back.
+#[no_mangle]
+pub unsafe extern "C" fn msync(addr: *mut c_void, length: usize, flags: c_int) -> c_int {
+    let start = addr as u32;
+    if flags & MS_SYNC != 0 && flags & MS_ASYNC != 0 {
+        return -1;
+    }
+    let length = match page_round_up(length) {
+        Some(length) => length,
+        None => return -1,
+    };
+    if start & (PAGE_SIZE - 1) != 0 || start.checked_add(length).is_none() {
+        return -1;
+    }
+    if sync_range(start, length) { 0 } else { -1 }
+}
+
+/// Pass a usage hint on to the kernel. MADV_SEQUENTIAL makes faults in a
+/// file mapping read ahead, and MADV_WILLNEED pages the range in now.
+#[no_mangle]
+pub unsafe extern "C" fn madvise(addr: *mut c_void, length: usize, advice: c_int) -> c_int {
+    let length = match page_round_up(length) {
+        Some(length) => length,
+        None => return -1,
+    };
+    if advice < 0 {
+        return -1;
+    }
+    match advise_memory(addr as u32, length, advice as u32) {
+        Ok(()) => 0,
+        Err(()) => -1,
+    }
+}
+
+/// Write back every writable shared mapping, for exit
+pub unsafe fn sync_all() {
+    for slot in 0..MAX_WRITE_BACK {
+        if let Some(entry) = WRITE_BACK[slot] {
+            write_back(&entry, entry.addr, entry.addr + entry.length);
+        }
+    }
+}
+
+/// Write back the parts of writable shared mappings within `start..start+length`.
+/// Returns false if any page failed to reach its file.
+unsafe fn sync_range(start: u32, length: u32) -> bool {
+    let end = start + length;
+    let mut ok = true;
+    for slot in 0..MAX_WRITE_BACK {
+        if let Some(entry) = WRITE_BACK[slot] {
+            let lo = start.max(entry.addr);
+            let hi = end.min(entry.addr + entry.length);
+            if lo < hi {
+                ok &= write_back(&entry, lo, hi);
+            }
+        }
+    }
+    ok
+}
+
+/// Drop the unmapped range from the write-back table. A mapping unmapped
+/// from either end shrinks; one with a hole punched in the middle keeps its
+/// full extent, since the hole has no dirty pages left to find.
+unsafe fn forget_range(start: u32, length: u32) {
+    let end = start + length;
+    for slot in 0..MAX_WRITE_BACK {
+        let entry = match WRITE_BACK[slot].as_mut() {
+            Some(entry) => entry,
+            None => continue,
+        };
+        let entry_end = entry.addr + entry.length;
+        if end <= entry.addr || start >= entry_end {
+            continue;
+        }
+        if start <= entry.addr && end >= entry_end {
+            crate::allocator::free(entry.path);
+            WRITE_BACK[slot] = None;
+        } else if start <= entry.addr {
+            entry.offset += end - entry.addr;
+            entry.length = entry_end - end;
+            entry.addr = end;
+        } else if end >= entry_end {
+            entry.length = start - entry.addr;
+        }
+    }
+}
+
+/// Write the dirty pages of `entry` within `lo..hi` to its file. Runs of
+/// adjacent dirty pages go out as a single write, and nothing is written
+/// past the current end of the file. The file is only opened once a dirty
+/// page turns up.
+unsafe fn write_back(entry: &WriteBack, lo: u32, hi: u32) -> bool {
+    let mut file: Option<(Handle, u32)> = None;
+    let mut ok = true;
+    let mut bitmap = [0u32; (DIRTY_BATCH_PAGES / 32) as usize];
+    let mut batch = lo;
+    while batch < hi {
+        let batch_len = (hi - batch).min(DIRTY_BATCH_PAGES * PAGE_SIZE);
+        let pages = batch_len / PAGE_SIZE;
+        match collect_dirty_pages(batch, batch_len, &mut bitmap) {
+            Ok(0) => {}
+            Ok(_) => {
+                if file.is_none() {
+                    file = open_for_write_back(entry);
+                }
+                let (handle, file_size) = match file {
+                    Some(file) => file,
+                    None => return false,
+                };
+                let mut page = 0;
+                while page < pages {
+                    if bitmap[page as usize / 32] & (1 << (page % 32)) == 0 {
+                        page += 1;
+                        continue;
+                    }
+                    let run_start = page;
+                    while page < pages && bitmap[page as usize / 32] & (1 << (page % 32)) != 0 {
+                        page += 1;
+                    }
+                    let run_addr = batch + run_start * PAGE_SIZE;
+                    let file_pos = entry.offset + (run_addr - entry.addr);
+                    if file_pos >= file_size {
+                        break;
+                    }
+                    let len = ((page - run_start) * PAGE_SIZE).min(file_size - file_pos);
+                    ok &= io_sync(handle, ASYNC_OP_WRITE, run_addr, len, file_pos) == Ok(len);
+                }
+            }
+            Err(()) => ok = false,
+        }
+        batch += batch_len;
+    }
+    if let Some((handle, _)) = file {
+        io_sync(handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
+    }
+    ok
+}
+
+/// Open the file behind a write-back mapping, returning it with its size
+unsafe fn open_for_write_back(entry: &WriteBack) -> Option<(Handle, u32)> {
+    let handle = create_file_handle();
+    let opened = io_sync(handle, ASYNC_OP_OPEN, entry.path as u32, entry.path_len as u32, 0);
+    let mut status = FileStatus::new();
+    let stat = opened.and_then(|_| {
+        io_sync(
+            handle,
+            FILE_OP_STAT,
+            &mut status as *mut FileStatus as u32,
+            core::mem::size_of::<FileStatus>() as u32,
+            0,
+        )
+    });
+    if stat.is_err() {
+        io_sync(handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
+        return None;
+    }
+    Some((handle, status.byte_size))
 }
@@ -0,0 +1,358 @@
+//! Digit generation for printf.
+//!
+//! Integers are written backwards into a caller's buffer, two decimal
+//! digits at a time from a pair table. 64-bit values are split into 32-bit
+//! pieces first, since a u64 division is a library call on i386.
+//!
+//! A finite double is exactly m * 2^e, so its decimal expansion is finite
+//! too, and printf's fixed-precision conversions can be rounded correctly
+//! from it (ties go to even, as with glibc). The expansion is produced a
+//! digit at a time: the integer part goes through a u64 when it fits, and
+//! fraction digits come from multiplying the fraction by ten and taking
+//! what overflows. Fractions of up to 60 bits, which covers everything from
+//! 1/256 upwards, live in a single u64; smaller values and integer parts
+//! beyond 2^64 fall back to multi-word arithmetic on the stack. Nothing is
+//! allocated.
+//!
+//! Like `fastmem`, this module is self-contained so the host test suite in
+//! `libc/tests/printf.rs` can include it directly.
+
+const DIGIT_PAIRS: &[u8; 200] = b"\
+    0001020304050607080910111213141516171819\
+    2021222324252627282930313233343536373839\
+    4041424344454647484950515253545556575859\
+    6061626364656667686970717273747576777879\
+    8081828384858687888990919293949596979899";
+
+/// Longest integer conversion, 64-bit octal
+pub const INT_BUF_LEN: usize = 22;
+
+/// Write `val` in decimal so that it ends at `buf[end]`, returning the
+/// index of the first digit
+pub fn write_dec(val: u64, buf: &mut [u8], end: usize) -> usize {
+    let mut pos = end;
+    let mut val = val;
+    // Peel off eight digits at a time until the rest fits in 32 bits
+    while val > u32::MAX as u64 {
+        let low = (val % 100_000_000) as u32;
+        val /= 100_000_000;
+        let start = pos - 8;
+        let written = write_dec_u32(low, buf, pos);
+        buf[start..written].fill(b'0');
+        pos = start;
+    }
+    write_dec_u32(val as u32, buf, pos)
+}
+
+fn write_dec_u32(mut val: u32, buf: &mut [u8], end: usize) -> usize {
+    let mut pos = end;
+    while val >= 100 {
+        let pair = (val % 100) as usize * 2;
+        val /= 100;
+        pos -= 2;
+        buf[pos] = DIGIT_PAIRS[pair];
+        buf[pos + 1] = DIGIT_PAIRS[pair + 1];
+    }
+    if val >= 10 {
+        let pair = val as usize * 2;
+        pos -= 2;
+        buf[pos] = DIGIT_PAIRS[pair];
+        buf[pos + 1] = DIGIT_PAIRS[pair + 1];
+    } else {
+        pos -= 1;
+        buf[pos] = b'0' + val as u8;
+    }
+    pos
+}
+
+/// Write `val` in a power-of-two base (8 or 16) so that it ends at
+/// `buf[end]`, returning the index of the first digit
+pub fn write_pow2(val: u64, shift: u32, upper: bool, buf: &mut [u8], end: usize) -> usize {
+    let digits = if upper {
+        b"0123456789ABCDEF"
+    } else {
+        b"0123456789abcdef"
+    };
+    let mask = (1u64 << shift) - 1;
+    let mut pos = end;
+    let mut val = val;
+    loop {
+        pos -= 1;
+        buf[pos] = digits[(val & mask) as usize];
+        val >>= shift;
+        if val == 0 {
+            return pos;
+        }
+    }
+}
+
+/// Most digits a float conversion produces. Precision asked for beyond this
+/// is padded with zeros by the caller rather than computed.
+pub const MAX_DIGITS: usize = 512;
+
+/// Rounded decimal digits of a non-negative finite double, as ASCII
+pub struct Digits {
+    pub buf: [u8; MAX_DIGITS],
+    pub len: usize,
+    /// For `fixed`, how many of the digits come before the decimal point
+    /// (zero if the value is below one). For `scientific`, the decimal
+    /// exponent of the first digit.
+    pub point: i32,
+}
+
+impl Digits {
+    /// The value rounded to `frac_digits` places after the decimal point
+    pub fn fixed(val: f64, frac_digits: usize) -> Digits {
+        let mut x = Expansion::new(val);
+        let mut d = Digits::empty();
+        d.point = x.int_len as i32;
+        let wanted = x.int_len + frac_digits;
+        let count = wanted.min(MAX_DIGITS);
+        for _ in 0..count {
+            d.push(x.next_digit());
+        }
+        if count == wanted && d.round(&mut x) {
+            // 9.99 became 10.0: one more integer digit
+            if d.len < MAX_DIGITS {
+                d.len += 1;
+            }
+            d.buf.copy_within(0..d.len - 1, 1);
+            d.buf[0] = b'1';
+            d.point += 1;
+        }
+        d
+    }
+
+    /// The value rounded to `sig_digits` significant digits (at least one)
+    pub fn scientific(val: f64, sig_digits: usize) -> Digits {
+        let count = sig_digits.clamp(1, MAX_DIGITS);
+        let mut d = Digits::empty();
+        if val == 0.0 {
+            d.buf[..count].fill(b'0');
+            d.len = count;
+            return d;
+        }
+        let mut x = Expansion::new(val);
+        if x.int_len > 0 {
+            d.point = x.int_len as i32 - 1;
+        } else {
+            // Skip the zeros between the point and the first digit
+            let mut first = x.next_digit();
+            d.point = -1;
+            while first == 0 {
+                first = x.next_digit();
+                d.point -= 1;
+            }
+            d.push(first);
+        }
+        while d.len < count {
+            d.push(x.next_digit());
+        }
+        if count == sig_digits && d.round(&mut x) {
+            // 9.99 became 10.0: still the same number of digits
+            d.buf[0] = b'1';
+            d.point += 1;
+        }
+        d
+    }
+
+    fn empty() -> Digits {
+        Digits {
+            buf: [b'0'; MAX_DIGITS],
+            len: 0,
+            point: 0,
+        }
+    }
+
+    fn push(&mut self, digit: u8) {
+        self.buf[self.len] = b'0' + digit;
+        self.len += 1;
+    }
+
+    /// Round the digits so far according to the rest of the expansion.
+    /// Returns true if the carry ran off the front, leaving all zeros.
+    fn round(&mut self, x: &mut Expansion) -> bool {
+        let next = x.next_digit();
+        let last_odd = self.len > 0 && (self.buf[self.len - 1] - b'0') & 1 == 1;
+        let round_up = next > 5 || (next == 5 && (last_odd || !x.rest_is_zero()));
+        if !round_up {
+            return false;
+        }
+        for digit in self.buf[..self.len].iter_mut().rev() {
+            if *digit == b'9' {
+                *digit = b'0';
+            } else {
+                *digit += 1;
+                return false;
+            }
+        }
+        true
+    }
+}
+
+/// Integer digits of a double need at most 309 places
+const INT_DIGITS: usize = 310;
+/// Limbs for the largest integer part (2^1024) or longest fraction (2^-1074)
+const LIMBS: usize = 35;
+
+/// The exact decimal expansion of a non-negative finite double, read off one
+/// digit at a time. Digits past the end of the expansion are zero.
+struct Expansion {
+    int: [u8; INT_DIGITS],
+    int_len: usize,
+    int_pos: usize,
+    frac: Fraction,
+}
+
+enum Fraction {
+    /// `bits / 2^shift`, for shifts of up to 60
+    Word { bits: u64, shift: u32 },
+    /// `limbs[..len] / 2^(32 * len)`, least significant limb first
+    Limbs { limbs: [u32; LIMBS], len: usize },
+}
+
+impl Expansion {
+    fn new(val: f64) -> Expansion {
+        let bits = val.to_bits();
+        let biased = ((bits >> 52) & 0x7ff) as i32;
+        let fraction = bits & ((1 << 52) - 1);
+        let (m, e) = if biased == 0 {
+            (fraction, -1074)
+        } else {
+            (fraction | (1 << 52), biased - 1075)
+        };
+
+        let mut x = Expansion {
+            int: [0; INT_DIGITS],
+            int_len: 0,
+            int_pos: 0,
+            frac: Fraction::Word { bits: 0, shift: 0 },
+        };
+        if e >= 0 {
+            if e <= 11 {
+                x.set_int(m << e);
+            } else {
+                x.set_big_int(m, e as u32);
+            }
+            return x;
+        }
+
+        let shift = (-e) as u32;
+        if shift < 64 {
+            x.set_int(m >> shift);
+        }
+        let frac_bits = if shift < 64 { m & ((1 << shift) - 1) } else { m };
+        x.frac = if shift <= 60 {
+            Fraction::Word { bits: frac_bits, shift }
+        } else {
+            // Align the fraction so its denominator is a whole number of
+            // limbs; the fraction is under 2^53, so the shifted value spans
+            // at most three limbs
+            let len = ((shift + 31) / 32) as usize;
+            let wide = (frac_bits as u128) << (len as u32 * 32 - shift);
+            let mut limbs = [0; LIMBS];
+            limbs[0] = wide as u32;
+            limbs[1] = (wide >> 32) as u32;
+            if len > 2 {
+                limbs[2] = (wide >> 64) as u32;
+            }
+            Fraction::Limbs { limbs, len }
+        };
+        x
+    }
+
+    fn set_int(&mut self, val: u64) {
+        if val == 0 {
+            return;
+        }
+        let mut buf = [0u8; 20];
+        let start = write_dec(val, &mut buf, 20);
+        for (dest, &digit) in self.int.iter_mut().zip(&buf[start..]) {
+            *dest = digit - b'0';
+        }
+        self.int_len = 20 - start;
+    }
+
+    /// Integer parts beyond 2^64 are divided down nine digits at a time
+    fn set_big_int(&mut self, m: u64, e: u32) {
+        let mut limbs = [0u32; LIMBS];
+        let wide = (m as u128) << (e % 32);
+        let base = (e / 32) as usize;
+        let mut len = base;
+        for i in 0..3 {
+            let limb = (wide >> (32 * i)) as u32;
+            limbs[base + i] = limb;
+            if limb != 0 {
+                len = base + i + 1;
+            }
+        }
+
+        // Nine-digit chunks, least significant first
+        let mut chunks = [0u32; INT_DIGITS / 9 + 1];
+        let mut chunk_count = 0;
+        while len > 0 {
+            let mut rem = 0u64;
+            for limb in limbs[..len].iter_mut().rev() {
+                let cur = (rem << 32) | *limb as u64;
+                *limb = (cur / 1_000_000_000) as u32;
+                rem = cur % 1_000_000_000;
+            }
+            chunks[chunk_count] = rem as u32;
+            chunk_count += 1;
+            while len > 0 && limbs[len - 1] == 0 {
+                len -= 1;
+            }
+        }
+
+        let mut buf = [0u8; 10];
+        for (i, &chunk) in chunks[..chunk_count].iter().rev().enumerate() {
+            let mut start = write_dec_u32(chunk, &mut buf, 10);
+            if i > 0 {
+                buf[1..start].fill(b'0');
+                start = 1;
+            }
+            for &digit in &buf[start..] {
+                self.int[self.int_len] = digit - b'0';
+                self.int_len += 1;
+            }
+        }
+    }
+
+    fn next_digit(&mut self) -> u8 {
+        if self.int_pos < self.int_len {
+            self.int_pos += 1;
+            return self.int[self.int_pos - 1];
+        }
+        match &mut self.frac {
+            Fraction::Word { bits, shift } => {
+                if *shift == 0 {
+                    return 0;
+                }
+                *bits *= 10;
+                let digit = (*bits >> *shift) as u8;
+                *bits &= (1 << *shift) - 1;
+                digit
+            }
+            Fraction::Limbs { limbs, len } => {
+                let mut carry = 0u64;
+                for limb in limbs[..*len].iter_mut() {
+                    let cur = *limb as u64 * 10 + carry;
+                    *limb = cur as u32;
+                    carry = cur >> 32;
+                }
+                carry as u8
+            }
+        }
+    }
+
+    /// True if every digit after those already read is zero
+    fn rest_is_zero(&self) -> bool {
+        if self.int[self.int_pos..self.int_len].iter().any(|&d| d != 0) {
+            return false;
+        }
+        match &self.frac {
+            Fraction::Word { bits, .. } => *bits == 0,
+            Fraction::Limbs { limbs, len } => limbs[..*len].iter().all(|&l| l == 0),
+        }
+    }
+}
@@ -0,0 +1,550 @@
+//! The printf engine.
+//!
+//! `format` walks a format string, pulling arguments from an `Args` source
+//! and handing output to a `Sink` in runs: literal text between conversions
+//! goes out in one piece, each conversion is laid out in a small stack
+//! buffer, and padding is written by count. The stream sink copies these
+//! runs straight into the FILE buffer and the string sink straight into the
+//! caller's array, so no conversion builds a temporary string or allocates.
+//! An unbuffered stream has no FILE buffer to speak of, so its output is
+//! staged on the stack by a `StagingSink` instead.
+//!
+//! Like `fastmem`, this module depends only on `numfmt`, so the host test
+//! suite in `libc/tests/printf.rs` can include both directly.
+
+use crate::numfmt::{write_dec, write_pow2, Digits, INT_BUF_LEN, MAX_DIGITS};
+
+/// Where formatted output goes
+pub trait Sink {
+    fn write(&mut self, bytes: &[u8]);
+
+    fn fill(&mut self, byte: u8, count: usize) {
+        let chunk = [byte; 32];
+        let mut left = count;
+        while left > 0 {
+            let n = left.min(chunk.len());
+            self.write(&chunk[..n]);
+            left -= n;
+        }
+    }
+}
+
+/// Output staged in a caller's buffer and passed to `emit` only when the
+/// buffer fills and once more at the end, for streams that have no buffer of
+/// their own to collect it in. `emit` returns false if the write failed.
+pub struct StagingSink<'a, W: FnMut(&[u8]) -> bool> {
+    buf: &'a mut [u8],
+    len: usize,
+    emit: W,
+    pub failed: bool,
+}
+
+impl<'a, W: FnMut(&[u8]) -> bool> StagingSink<'a, W> {
+    pub fn new(buf: &'a mut [u8], emit: W) -> Self {
+        Self {
+            buf,
+            len: 0,
+            emit,
+            failed: false,
+        }
+    }
+
+    /// Pass on whatever is staged
+    pub fn flush(&mut self) {
+        if self.len > 0 {
+            self.failed |= !(self.emit)(&self.buf[..self.len]);
+            self.len = 0;
+        }
+    }
+}
+
+impl<W: FnMut(&[u8]) -> bool> Sink for StagingSink<'_, W> {
+    fn write(&mut self, bytes: &[u8]) {
+        let mut rest = bytes;
+        while !rest.is_empty() {
+            let n = rest.len().min(self.buf.len() - self.len);
+            self.buf[self.len..self.len + n].copy_from_slice(&rest[..n]);
+            self.len += n;
+            rest = &rest[n..];
+            if self.len == self.buf.len() {
+                self.flush();
+            }
+        }
+    }
+}
+
+/// Where conversion arguments come from. Anything narrower than an int
+/// arrives promoted to one, and long is the same size as int.
+pub trait Args {
+    fn int(&mut self) -> i32;
+    fn long_long(&mut self) -> i64;
+    fn double(&mut self) -> f64;
+    fn pointer(&mut self) -> usize;
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum Length {
+    Default,
+    Char,
+    Short,
+    LongLong,
+}
+
+struct Spec {
+    left: bool,
+    zero: bool,
+    plus: bool,
+    space: bool,
+    alt: bool,
+    width: usize,
+    precision: Option<usize>,
+    length: Length,
+}
+
+/// Counts what passes through to the sink
+struct Out<'a, S: Sink> {
+    sink: &'a mut S,
+    count: usize,
+}
+
+impl<S: Sink> Out<'_, S> {
+    fn write(&mut self, bytes: &[u8]) {
+        if !bytes.is_empty() {
+            self.sink.write(bytes);
+            self.count += bytes.len();
+        }
+    }
+
+    fn fill(&mut self, byte: u8, count: usize) {
+        if count > 0 {
+            self.sink.fill(byte, count);
+            self.count += count;
+        }
+    }
+
+    /// Write a conversion padded out to the field width. `zeros` go between
+    /// the prefix and the body, and `trailing` zeros between the body and
+    /// the suffix. Zero padding, where allowed, widens `zeros`.
+    fn padded(&mut self, spec: &Spec, pad_zero: bool, field: Field) {
+        let len = field.prefix.len() + field.zeros + field.body.len() + field.trailing + field.suffix.len();
+        let pad = spec.width.saturating_sub(len);
+        let zero_pad = spec.zero && pad_zero && !spec.left;
+        if !spec.left && !zero_pad {
+            self.fill(b' ', pad);
+        }
+        self.write(field.prefix);
+        self.fill(b'0', field.zeros + if zero_pad { pad } else { 0 });
+        self.write(field.body);
+        self.fill(b'0', field.trailing);
+        self.write(field.suffix);
+        if spec.left {
+            self.fill(b' ', pad);
+        }
+    }
+}
+
+struct Field<'a> {
+    prefix: &'a [u8],
+    zeros: usize,
+    body: &'a [u8],
+    trailing: usize,
+    suffix: &'a [u8],
+}
+
+impl<'a> Field<'a> {
+    fn plain(body: &'a [u8]) -> Self {
+        Field {
+            prefix: &[],
+            zeros: 0,
+            body,
+            trailing: 0,
+            suffix: &[],
+        }
+    }
+}
+
+/// Format `fmt` into `sink`, returning the number of bytes produced
+pub unsafe fn format<A: Args, S: Sink>(fmt: *const u8, args: &mut A, sink: &mut S) -> usize {
+    let mut out = Out { sink, count: 0 };
+    let mut i = 0;
+    loop {
+        let start = i;
+        while *fmt.add(i) != 0 && *fmt.add(i) != b'%' {
+            i += 1;
+        }
+        out.write(core::slice::from_raw_parts(fmt.add(start), i - start));
+        if *fmt.add(i) == 0 {
+            break;
+        }
+        i += 1;
+
+        let mut spec = Spec {
+            left: false,
+            zero: false,
+            plus: false,
+            space: false,
+            alt: false,
+            width: 0,
+            precision: None,
+            length: Length::Default,
+        };
+        loop {
+            match *fmt.add(i) {
+                b'-' => spec.left = true,
+                b'0' => spec.zero = true,
+                b'+' => spec.plus = true,
+                b' ' => spec.space = true,
+                b'#' => spec.alt = true,
+                _ => break,
+            }
+            i += 1;
+        }
+
+        if *fmt.add(i) == b'*' {
+            let width = args.int();
+            if width < 0 {
+                spec.left = true;
+            }
+            spec.width = width.unsigned_abs() as usize;
+            i += 1;
+        } else {
+            while (*fmt.add(i)).is_ascii_digit() {
+                spec.width = spec.width * 10 + (*fmt.add(i) - b'0') as usize;
+                i += 1;
+            }
+        }
+
+        if *fmt.add(i) == b'.' {
+            i += 1;
+            if *fmt.add(i) == b'*' {
+                let precision = args.int();
+                // A negative precision is taken as if none was given
+                spec.precision = if precision < 0 { None } else { Some(precision as usize) };
+                i += 1;
+            } else {
+                let mut precision = 0;
+                while (*fmt.add(i)).is_ascii_digit() {
+                    precision = precision * 10 + (*fmt.add(i) - b'0') as usize;
+                    i += 1;
+                }
+                spec.precision = Some(precision);
+            }
+        }
+
+        // long, size_t and ptrdiff_t are all the size of an int; intmax_t
+        // is long long
+        match *fmt.add(i) {
+            b'h' => {
+                i += 1;
+                spec.length = Length::Short;
+                if *fmt.add(i) == b'h' {
+                    i += 1;
+                    spec.length = Length::Char;
+                }
+            }
+            b'l' => {
+                i += 1;
+                if *fmt.add(i) == b'l' {
+                    i += 1;
+                    spec.length = Length::LongLong;
+                }
+            }
+            b'j' | b'q' => {
+                i += 1;
+                spec.length = Length::LongLong;
+            }
+            b'z' | b't' | b'L' => i += 1,
+            _ => {}
+        }
+
+        let conv = *fmt.add(i);
+        if conv == 0 {
+            break;
+        }
+        i += 1;
+
+        match conv {
+            b'd' | b'i' | b'u' | b'o' | b'x' | b'X' => format_integer(&mut out, &spec, conv, args),
+            b'p' => format_pointer(&mut out, &spec, args.pointer()),
+            b'f' | b'F' | b'e' | b'E' | b'g' | b'G' => {
+                format_float(&mut out, &spec, conv, args.double())
+            }
+            b's' => format_string(&mut out, &spec, args.pointer() as *const u8),
+            b'c' => {
+                let c = [args.int() as u8];
+                out.padded(&spec, false, Field::plain(&c));
+            }
+            b'%' => out.write(b"%"),
+            b'n' => {
+                let p = args.pointer();
+                if p != 0 {
+                    match spec.length {
+                        Length::Char => *(p as *mut i8) = out.count as i8,
+                        Length::Short => *(p as *mut i16) = out.count as i16,
+                        Length::LongLong => *(p as *mut i64) = out.count as i64,
+                        Length::Default => *(p as *mut i32) = out.count as i32,
+                    }
+                }
+            }
+            _ => {
+                // Unknown conversion, output it as written
+                out.write(&[b'%', conv]);
+            }
+        }
+    }
+    out.count
+}
+
+fn format_integer<A: Args, S: Sink>(out: &mut Out<S>, spec: &Spec, conv: u8, args: &mut A) {
+    let signed = conv == b'd' || conv == b'i';
+    let (magnitude, negative) = if signed {
+        let val = match spec.length {
+            Length::LongLong => args.long_long(),
+            Length::Char => args.int() as i8 as i64,
+            Length::Short => args.int() as i16 as i64,
+            Length::Default => args.int() as i64,
+        };
+        (val.unsigned_abs(), val < 0)
+    } else {
+        let val = match spec.length {
+            Length::LongLong => args.long_long() as u64,
+            Length::Char => args.int() as u8 as u64,
+            Length::Short => args.int() as u16 as u64,
+            Length::Default => args.int() as u32 as u64,
+        };
+        (val, false)
+    };
+
+    let mut buf = [0u8; INT_BUF_LEN];
+    // An explicit zero precision prints no digits for zero
+    let start = if magnitude == 0 && spec.precision == Some(0) {
+        INT_BUF_LEN
+    } else {
+        match conv {
+            b'o' => write_pow2(magnitude, 3, false, &mut buf, INT_BUF_LEN),
+            b'x' => write_pow2(magnitude, 4, false, &mut buf, INT_BUF_LEN),
+            b'X' => write_pow2(magnitude, 4, true, &mut buf, INT_BUF_LEN),
+            _ => write_dec(magnitude, &mut buf, INT_BUF_LEN),
+        }
+    };
+    let digits = &buf[start..];
+
+    let prefix: &[u8] = if negative {
+        b"-"
+    } else if signed && spec.plus {
+        b"+"
+    } else if signed && spec.space {
+        b" "
+    } else if spec.alt && magnitude != 0 && conv == b'x' {
+        b"0x"
+    } else if spec.alt && magnitude != 0 && conv == b'X' {
+        b"0X"
+    } else {
+        b""
+    };
+    let mut zeros = spec.precision.map_or(0, |p| p.saturating_sub(digits.len()));
+    // The alternate octal form always starts with a zero
+    if conv == b'o' && spec.alt && zeros == 0 && digits.first() != Some(&b'0') {
+        zeros = 1;
+    }
+    out.padded(
+        spec,
+        spec.precision.is_none(),
+        Field {
+            prefix,
+            zeros,
+            body: digits,
+            trailing: 0,
+            suffix: &[],
+        },
+    );
+}
+
+fn format_pointer<S: Sink>(out: &mut Out<S>, spec: &Spec, val: usize) {
+    let mut buf = [0u8; INT_BUF_LEN];
+    let start = write_pow2(val as u64, 4, false, &mut buf, INT_BUF_LEN);
+    out.padded(
+        spec,
+        false,
+        Field {
+            prefix: b"0x",
+            zeros: 0,
+            body: &buf[start..],
+            trailing: 0,
+            suffix: &[],
+        },
+    );
+}
+
+unsafe fn format_string<S: Sink>(out: &mut Out<S>, spec: &Spec, s: *const u8) {
+    if s.is_null() {
+        out.padded(spec, false, Field::plain(b"(null)"));
+        return;
+    }
+    let max = spec.precision.unwrap_or(usize::MAX);
+    let mut len = 0;
+    while len < max && *s.add(len) != 0 {
+        len += 1;
+    }
+    out.padded(spec, false, Field::plain(core::slice::from_raw_parts(s, len)));
+}
+
+/// The mantissa of a float conversion, built up left to right
+struct Body {
+    buf: [u8; MAX_DIGITS + 8],
+    len: usize,
+    /// Zeros owed past the digits that were computed
+    trailing: usize,
+}
+
+impl Body {
+    fn push(&mut self, bytes: &[u8]) {
+        self.buf[self.len..self.len + bytes.len()].copy_from_slice(bytes);
+        self.len += bytes.len();
+    }
+
+    fn push_zeros(&mut self, count: usize) {
+        self.buf[self.len..self.len + count].fill(b'0');
+        self.len += count;
+    }
+
+    /// %g drops trailing zeros from the fraction, and the point with them
+    fn strip_fraction_zeros(&mut self) {
+        if !self.buf[..self.len].contains(&b'.') {
+            return;
+        }
+        self.trailing = 0;
+        while self.buf[self.len - 1] == b'0' {
+            self.len -= 1;
+        }
+        if self.buf[self.len - 1] == b'.' {
+            self.len -= 1;
+        }
+    }
+}
+
+fn format_float<S: Sink>(out: &mut Out<S>, spec: &Spec, conv: u8, val: f64) {
+    let upper = conv.is_ascii_uppercase();
+    let prefix: &[u8] = if val.is_sign_negative() {
+        b"-"
+    } else if spec.plus {
+        b"+"
+    } else if spec.space {
+        b" "
+    } else {
+        b""
+    };
+
+    if !val.is_finite() {
+        let body: &[u8] = match (val.is_nan(), upper) {
+            (true, false) => b"nan",
+            (true, true) => b"NAN",
+            (false, false) => b"inf",
+            (false, true) => b"INF",
+        };
+        let field = Field {
+            prefix,
+            ..Field::plain(body)
+        };
+        out.padded(spec, false, field);
+        return;
+    }
+
+    let val = val.abs();
+    let precision = spec.precision.unwrap_or(6);
+    let mut body = Body {
+        buf: [0; MAX_DIGITS + 8],
+        len: 0,
+        trailing: 0,
+    };
+    let mut suffix = [0u8; 6];
+    let mut suffix_len = 0;
+
+    match conv.to_ascii_lowercase() {
+        b'f' => {
+            let digits = Digits::fixed(val, precision);
+            let point = digits.point as usize;
+            if point == 0 {
+                body.push(b"0");
+            } else {
+                body.push(&digits.buf[..point]);
+            }
+            if precision > 0 || spec.alt {
+                body.push(b".");
+            }
+            body.push(&digits.buf[point..digits.len]);
+            body.trailing = precision - (digits.len - point);
+        }
+        b'e' => {
+            let digits = Digits::scientific(val, precision + 1);
+            layout_exponent(&mut body, &digits, precision, spec.alt);
+            suffix_len = write_exponent(&mut suffix, digits.point, upper);
+        }
+        _ => {
+            // %g: P significant digits, in whichever style C picks by
+            // the exponent those digits end up with
+            let significant = precision.max(1);
+            let digits = Digits::scientific(val, significant);
+            let exp = digits.point;
+            if exp >= -4 && (exp as i64) < significant as i64 {
+                if exp >= 0 {
+                    let int_len = exp as usize + 1;
+                    body.push(&digits.buf[..int_len]);
+                    body.push(b".");
+                    body.push(&digits.buf[int_len..digits.len]);
+                } else {
+                    body.push(b"0.");
+                    body.push_zeros((-exp - 1) as usize);
+                    body.push(&digits.buf[..digits.len]);
+                }
+                body.trailing = significant - digits.len;
+            } else {
+                layout_exponent(&mut body, &digits, significant - 1, true);
+                suffix_len = write_exponent(&mut suffix, exp, upper);
+            }
+            if !spec.alt {
+                body.strip_fraction_zeros();
+            }
+        }
+    }
+
+    out.padded(
+        spec,
+        true,
+        Field {
+            prefix,
+            zeros: 0,
+            body: &body.buf[..body.len],
+            trailing: body.trailing,
+            suffix: &suffix[..suffix_len],
+        },
+    );
+}
+
+/// d.ddd mantissa for the exponent styles
+fn layout_exponent(body: &mut Body, digits: &Digits, precision: usize, point: bool) {
+    body.push(&digits.buf[..1]);
+    if precision > 0 || point {
+        body.push(b".");
+    }
+    body.push(&digits.buf[1..digits.len]);
+    body.trailing = precision + 1 - digits.len;
+}
+
+/// e+XX, with at least two exponent digits
+fn write_exponent(buf: &mut [u8; 6], exp: i32, upper: bool) -> usize {
+    buf[0] = if upper { b'E' } else { b'e' };
+    buf[1] = if exp < 0 { b'-' } else { b'+' };
+    let mut digits = [0u8; 4];
+    let start = write_dec(exp.unsigned_abs() as u64, &mut digits, 4);
+    let mut len = 2;
+    if 4 - start < 2 {
+        buf[len] = b'0';
+        len += 1;
+    }
+    for &d in &digits[start..] {
+        buf[len] = d;
+        len += 1;
+    }
+    len
+}
@@ -0,0 +1,213 @@
+//! Introsort behind qsort.
+//!
+//! Quicksort with a median-of-three pivot does the bulk of the work. Ranges
+//! of 16 elements or fewer are finished with insertion sort, and when the
+//! recursion gets deeper than 2*log2(n) the range is heapsorted instead, so
+//! the worst case stays O(n log n). The smaller partition is recursed into
+//! and the larger one looped on, which bounds the stack to O(log n). Nothing
+//! is allocated: elements only ever move by swapping.
+//!
+//! Swaps are specialised for 4- and 8-byte elements, which covers arrays of
+//! ints and pointers; other sizes are swapped in 4-byte chunks.
+//!
+//! Like `fastmem`, this module is self-contained so the host test suite in
+//! `libc/tests/sort.rs` can include it directly.
+
+use core::ffi::{c_int, c_void};
+use core::ptr;
+
+pub type Comparator = unsafe extern "C" fn(*const c_void, *const c_void) -> c_int;
+
+/// Ranges this short are insertion sorted
+const INSERTION_CUTOFF: usize = 16;
+
+pub unsafe fn sort(base: *mut u8, count: usize, size: usize, compare: Comparator) {
+    if count < 2 || size == 0 {
+        return;
+    }
+    match size {
+        4 => Sorter::<Swap4>::new(base, size, compare).sort(count),
+        8 => Sorter::<Swap8>::new(base, size, compare).sort(count),
+        _ => Sorter::<SwapChunked>::new(base, size, compare).sort(count),
+    }
+}
+
+trait Swap {
+    unsafe fn swap(a: *mut u8, b: *mut u8, size: usize);
+}
+
+struct Swap4;
+struct Swap8;
+struct SwapChunked;
+
+impl Swap for Swap4 {
+    #[inline(always)]
+    unsafe fn swap(a: *mut u8, b: *mut u8, _size: usize) {
+        let x = ptr::read_unaligned(a as *const u32);
+        ptr::write_unaligned(a as *mut u32, ptr::read_unaligned(b as *const u32));
+        ptr::write_unaligned(b as *mut u32, x);
+    }
+}
+
+impl Swap for Swap8 {
+    #[inline(always)]
+    unsafe fn swap(a: *mut u8, b: *mut u8, _size: usize) {
+        let x = ptr::read_unaligned(a as *const u64);
+        ptr::write_unaligned(a as *mut u64, ptr::read_unaligned(b as *const u64));
+        ptr::write_unaligned(b as *mut u64, x);
+    }
+}
+
+impl Swap for SwapChunked {
+    unsafe fn swap(a: *mut u8, b: *mut u8, size: usize) {
+        let mut i = 0;
+        while size - i >= 4 {
+            Swap4::swap(a.add(i), b.add(i), 4);
+            i += 4;
+        }
+        while i < size {
+            let x = *a.add(i);
+            *a.add(i) = *b.add(i);
+            *b.add(i) = x;
+            i += 1;
+        }
+    }
+}
+
+struct Sorter<S: Swap> {
+    base: *mut u8,
+    size: usize,
+    compare: Comparator,
+    _swap: core::marker::PhantomData<S>,
+}
+
+impl<S: Swap> Sorter<S> {
+    fn new(base: *mut u8, size: usize, compare: Comparator) -> Self {
+        Self {
+            base,
+            size,
+            compare,
+            _swap: core::marker::PhantomData,
+        }
+    }
+
+    #[inline(always)]
+    unsafe fn at(&self, i: usize) -> *mut u8 {
+        self.base.add(i * self.size)
+    }
+
+    /// True if element `a` sorts strictly before element `b`
+    #[inline(always)]
+    unsafe fn less(&self, a: usize, b: usize) -> bool {
+        (self.compare)(self.at(a) as *const c_void, self.at(b) as *const c_void) < 0
+    }
+
+    #[inline(always)]
+    unsafe fn swap(&self, a: usize, b: usize) {
+        S::swap(self.at(a), self.at(b), self.size);
+    }
+
+    unsafe fn sort(&self, count: usize) {
+        let depth_limit = 2 * (usize::BITS - count.leading_zeros()) as usize;
+        self.introsort(0, count, depth_limit);
+    }
+
+    /// Sort the elements in `lo..hi`
+    unsafe fn introsort(&self, mut lo: usize, mut hi: usize, mut depth: usize) {
+        while hi - lo > INSERTION_CUTOFF {
+            if depth == 0 {
+                self.heapsort(lo, hi);
+                return;
+            }
+            depth -= 1;
+            let pivot = self.partition(lo, hi);
+            if pivot - lo < hi - pivot {
+                self.introsort(lo, pivot, depth);
+                lo = pivot + 1;
+            } else {
+                self.introsort(pivot + 1, hi, depth);
+                hi = pivot;
+            }
+        }
+        self.insertion_sort(lo, hi);
+    }
+
+    /// Partition `lo..hi` around the median of its first, middle and last
+    /// elements, returning the pivot's final position
+    unsafe fn partition(&self, lo: usize, hi: usize) -> usize {
+        let mid = lo + (hi - lo) / 2;
+        let last = hi - 1;
+        if self.less(mid, lo) {
+            self.swap(mid, lo);
+        }
+        if self.less(last, mid) {
+            self.swap(last, mid);
+            if self.less(mid, lo) {
+                self.swap(mid, lo);
+            }
+        }
+        // The pivot waits at lo while the rest is partitioned. Both scans
+        // stop on elements equal to it, which keeps runs of duplicates
+        // evenly split. Both scans are bounded as well, so a comparator
+        // that isn't a consistent ordering can't walk them off the range.
+        self.swap(lo, mid);
+        let mut i = lo + 1;
+        let mut j = last;
+        loop {
+            while i <= j && self.less(i, lo) {
+                i += 1;
+            }
+            while j > lo && self.less(lo, j) {
+                j -= 1;
+            }
+            if i >= j {
+                break;
+            }
+            self.swap(i, j);
+            i += 1;
+            j -= 1;
+        }
+        self.swap(lo, j);
+        j
+    }
+
+    unsafe fn insertion_sort(&self, lo: usize, hi: usize) {
+        for i in lo + 1..hi {
+            let mut j = i;
+            while j > lo && self.less(j, j - 1) {
+                self.swap(j, j - 1);
+                j -= 1;
+            }
+        }
+    }
+
+    unsafe fn heapsort(&self, lo: usize, hi: usize) {
+        let count = hi - lo;
+        for root in (0..count / 2).rev() {
+            self.sift_down(lo, root, count);
+        }
+        for end in (1..count).rev() {
+            self.swap(lo, lo + end);
+            self.sift_down(lo, 0, end);
+        }
+    }
+
+    /// Restore the max-heap property below `root` in the heap of `count`
+    /// elements starting at `lo`
+    unsafe fn sift_down(&self, lo: usize, mut root: usize, count: usize) {
+        loop {
+            let mut child = 2 * root + 1;
+            if child >= count {
+                return;
+            }
+            if child + 1 < count && self.less(lo + child, lo + child + 1) {
+                child += 1;
+            }
+            if !self.less(lo + root, lo + child) {
+                return;
+            }
+            self.swap(lo + root, lo + child);
+            root = child;
+        }
+    }
+}
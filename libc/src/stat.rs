@@ -3,7 +3,7 @@
 use core::ffi::{c_char, c_int};
 
 use idos_api::io::file::FileStatus;
-use idos_api::io::{ASYNC_OP_CLOSE, ASYNC_OP_OPEN, FILE_OP_MKDIR, FILE_OP_STAT};
+use idos_api::io::{Handle, ASYNC_OP_CLOSE, ASYNC_OP_OPEN, FILE_OP_MKDIR, FILE_OP_STAT};
 use idos_api::syscall::io::create_file_handle;
 
 use crate::stdio::{io_sync, translate_path_raw};
@@ -35,18 +35,24 @@ pub unsafe extern "C" fn stat(pathname: *const c_char, statbuf: *mut Stat) -> c_
         return -1;
     }
 
-    let handle = create_file_handle();
-
     // Translate the path for the kernel
     let mut path_buf = [0u8; 256];
     let path_len = translate_path_raw(pathname, &mut path_buf);
 
+    stat_translated(&path_buf[..path_len], statbuf)
+}
+
+/// stat() for a path that has already been translated for the kernel.
+/// Used by dirent.rs when a filesystem can't list attributes itself.
+pub unsafe fn stat_translated(path: &[u8], statbuf: *mut Stat) -> c_int {
+    let handle = create_file_handle();
+
     // Open the file
     let open_result = io_sync(
         handle,
         ASYNC_OP_OPEN,
-        path_buf.as_ptr() as u32,
-        path_len as u32,
+        path.as_ptr() as u32,
+        path.len() as u32,
         0,
     );
 
@@ -72,7 +78,12 @@ pub unsafe extern "C" fn stat(pathname: *const c_char, statbuf: *mut Stat) -> c_
         return -1;
     }
 
-    // Map kernel FileStatus to POSIX struct stat
+    fill_stat(statbuf, &fs);
+    0
+}
+
+/// Map kernel FileStatus to POSIX struct stat
+pub unsafe fn fill_stat(statbuf: *mut Stat, fs: &FileStatus) {
     let mode = if fs.file_type == 2 {
         S_IFDIR | 0o755
     } else {
@@ -89,18 +100,26 @@ pub unsafe extern "C" fn stat(pathname: *const c_char, statbuf: *mut Stat) -> c_
     (*statbuf).st_mtime = fs.modification_time as i32;
     (*statbuf).st_atime = fs.modification_time as i32;
     (*statbuf).st_ctime = fs.modification_time as i32;
-
-    0
 }
 
 #[no_mangle]
-pub unsafe extern "C" fn fstat(_fd: c_int, statbuf: *mut Stat) -> c_int {
-    // fstat on an open fd would need access to the kernel handle, which
-    // we don't track by raw fd today. Zero-fill for now.
-    if !statbuf.is_null() {
-        core::ptr::write_bytes(statbuf as *mut u8, 0, core::mem::size_of::<Stat>());
-        (*statbuf).st_mode = S_IFREG | 0o644;
+pub unsafe extern "C" fn fstat(fd: c_int, statbuf: *mut Stat) -> c_int {
+    // Descriptors are kernel handles, so the handle can be stat'd directly
+    if fd < 0 || statbuf.is_null() {
+        return -1;
+    }
+    let mut fs = FileStatus::new();
+    let stat_result = io_sync(
+        Handle::new(fd as u32),
+        FILE_OP_STAT,
+        &mut fs as *mut FileStatus as u32,
+        core::mem::size_of::<FileStatus>() as u32,
+        0,
+    );
+    if stat_result.is_err() {
+        return -1;
     }
+    fill_stat(statbuf, &fs);
     0
 }
 
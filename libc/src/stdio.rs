@@ -5,12 +5,24 @@ use core::ptr;
 use core::sync::atomic::{AtomicU32, Ordering};
 
 use idos_api::io::{AsyncOp, Handle, ASYNC_OP_CLOSE, ASYNC_OP_OPEN, ASYNC_OP_READ, ASYNC_OP_WRITE, FILE_OP_STAT, FILE_OP_IOCTL, FILE_OP_RENAME, OPEN_FLAG_CREATE, OPEN_FLAG_EXCLUSIVE};
+use idos_api::io::sync::ioctl_sync;
+use idos_api::io::termios::{Termios, TCGETS};
 use idos_api::syscall::exec::futex_wait_u32;
 use idos_api::syscall::io::{append_io_op, create_file_handle};
 
+use crate::printf;
+
 // ---- FILE structure ----
 
+/// Size of the buffer embedded in every FILE, used for console streams and
+/// whenever a larger buffer can't be allocated
 const FILE_BUF_SIZE: usize = 1024;
+/// Default buffer size for regular files and pipes, allocated on first use
+const FILE_BUF_SIZE_LARGE: usize = 4096;
+
+pub const _IOFBF: c_int = 0;
+pub const _IOLBF: c_int = 1;
+pub const _IONBF: c_int = 2;
 
 pub const SEEK_SET: c_int = 0;
 pub const SEEK_CUR: c_int = 1;
@@ -33,10 +45,21 @@ pub struct FILE {
     is_console: bool,
     /// Unget buffer (-1 if empty)
     unget: c_int,
-    /// Write buffer — accumulates bytes to reduce syscalls
-    wbuf: [u8; FILE_BUF_SIZE],
-    /// Number of valid bytes in wbuf
+    /// Buffering mode: _IOFBF, _IOLBF or _IONBF
+    buf_mode: c_int,
+    /// Active buffer, used for either reading or writing at any one time.
+    /// Null until the first I/O operation or setvbuf call picks one.
+    buf: *mut u8,
+    buf_size: usize,
+    /// Set when `buf` came from malloc and must be freed
+    buf_owned: bool,
+    /// Bytes read ahead but not yet consumed are buf[rpos..rend]
+    rpos: usize,
+    rend: usize,
+    /// Number of bytes waiting to be written, at the start of buf
     wbuf_pos: usize,
+    /// Embedded storage, used when no other buffer has been chosen
+    sbuf: [u8; FILE_BUF_SIZE],
 }
 
 // Fixed file table
@@ -63,44 +86,124 @@ pub fn init() {
     unsafe {
         FILES_INITIALIZED = true;
         // stdin = file table entry 0, uses kernel handle for console read
-        FILE_TABLE[0] = FILE {
-            handle: Handle::new(0),
-            pos: 0,
-            error: 0,
-            eof: 0,
-            is_open: true,
-            is_console: true,
-            unget: -1,
-            wbuf: [0; FILE_BUF_SIZE],
-            wbuf_pos: 0,
-        };
+        open_stream(&raw mut FILE_TABLE[0], Handle::new(0), true);
         // stdout = file table entry 1
-        FILE_TABLE[1] = FILE {
-            handle: Handle::new(1),
-            pos: 0,
-            error: 0,
-            eof: 0,
-            is_open: true,
-            is_console: true,
-            unget: -1,
-            wbuf: [0; FILE_BUF_SIZE],
-            wbuf_pos: 0,
-        };
-        // stderr = same as stdout for now
-        FILE_TABLE[2] = FILE {
-            handle: Handle::new(1),
-            pos: 0,
-            error: 0,
-            eof: 0,
-            is_open: true,
-            is_console: true,
-            unget: -1,
-            wbuf: [0; FILE_BUF_SIZE],
-            wbuf_pos: 0,
-        };
+        open_stream(&raw mut FILE_TABLE[1], Handle::new(1), true);
+        // stderr = same as stdout for now, and unbuffered as C requires, so
+        // diagnostics are never held back even when redirected
+        open_stream(&raw mut FILE_TABLE[2], Handle::new(1), true);
+        FILE_TABLE[2].buf_mode = _IONBF;
     }
 }
 
+/// Reset a FILE to a freshly opened state. The buffer is chosen lazily.
+unsafe fn open_stream(f: *mut FILE, handle: Handle, is_console: bool) {
+    (*f).handle = handle;
+    (*f).pos = 0;
+    (*f).error = 0;
+    (*f).eof = 0;
+    (*f).is_open = true;
+    (*f).is_console = is_console;
+    (*f).unget = -1;
+    (*f).buf_mode = _IOFBF;
+    (*f).buf = ptr::null_mut();
+    (*f).buf_size = 0;
+    (*f).buf_owned = false;
+    (*f).rpos = 0;
+    (*f).rend = 0;
+    (*f).wbuf_pos = 0;
+}
+
+/// Release a malloc'd buffer, if any.
+unsafe fn release_buffer(f: *mut FILE) {
+    if (*f).buf_owned {
+        crate::allocator::free((*f).buf);
+    }
+    (*f).buf = ptr::null_mut();
+    (*f).buf_size = 0;
+    (*f).buf_owned = false;
+}
+
+/// Pick the default buffer for a stream on its first use. Interactive
+/// consoles are line buffered and use the small embedded buffer, since
+/// reads return at most a line anyway. Files and pipes get a larger
+/// buffer so that bulk transfers take fewer round trips.
+unsafe fn ensure_buffer(f: *mut FILE) {
+    if !(*f).buf.is_null() {
+        return;
+    }
+    if (*f).buf_mode == _IONBF {
+        (*f).buf = (*f).sbuf.as_mut_ptr();
+        (*f).buf_size = 1;
+        return;
+    }
+    let interactive = (*f).is_console && is_terminal((*f).handle);
+    if interactive {
+        (*f).buf_mode = _IOLBF;
+    } else {
+        let large = crate::allocator::malloc(FILE_BUF_SIZE_LARGE);
+        if !large.is_null() {
+            (*f).buf = large;
+            (*f).buf_size = FILE_BUF_SIZE_LARGE;
+            (*f).buf_owned = true;
+            return;
+        }
+    }
+    (*f).buf = (*f).sbuf.as_mut_ptr();
+    (*f).buf_size = FILE_BUF_SIZE;
+}
+
+/// Standard streams may have been redirected to a pipe or file. Only a real
+/// console answers terminal ioctls.
+unsafe fn is_terminal(handle: Handle) -> bool {
+    let mut termios = Termios::default();
+    let len = core::mem::size_of::<Termios>() as u32;
+    ioctl_sync(handle, TCGETS, &raw mut termios as u32, len).is_ok()
+}
+
+/// Refill the read buffer from the current position. Returns the number of
+/// bytes now available, or 0 on EOF or error (with the matching flag set).
+unsafe fn fill_rbuf(f: *mut FILE) -> usize {
+    ensure_buffer(f);
+    if (*f).wbuf_pos > 0 && flush_wbuf(f) == EOF {
+        return 0;
+    }
+    // Make sure any prompt is visible before blocking on console input
+    if (*f).is_console && !stdout.is_null() && (*stdout).wbuf_pos > 0 {
+        flush_wbuf(stdout);
+    }
+    (*f).rpos = 0;
+    (*f).rend = 0;
+    let result = io_sync(
+        (*f).handle,
+        ASYNC_OP_READ,
+        (*f).buf as u32,
+        (*f).buf_size as u32,
+        (*f).pos,
+    );
+    match result {
+        Ok(0) => {
+            (*f).eof = 1;
+            0
+        }
+        Ok(n) => {
+            (*f).rend = n as usize;
+            n as usize
+        }
+        Err(_) => {
+            (*f).error = 1;
+            0
+        }
+    }
+}
+
+/// Throw away read-ahead data, e.g. before writing or seeking. Since `pos`
+/// tracks the logical position, nothing else needs adjusting.
+unsafe fn discard_rbuf(f: *mut FILE) {
+    (*f).rpos = 0;
+    (*f).rend = 0;
+}
+
 // Public pointers to stdin/stdout/stderr
 #[no_mangle]
 pub static mut stdin: *mut FILE = ptr::null_mut();
@@ -231,14 +334,8 @@ pub unsafe extern "C" fn fopen(path: *const c_char, mode: *const c_char) -> *mut
         return ptr::null_mut();
     }
 
-    (*f).handle = handle;
-    (*f).pos = 0;
-    (*f).error = 0;
-    (*f).eof = 0;
-    (*f).is_open = true;
-    (*f).is_console = false;
-    (*f).unget = -1;
-    (*f).wbuf_pos = 0;
+    open_stream(f, handle, false);
+    crate::unistd::set_fd_path(handle.as_u32() as c_int, &path_buf[..path_len]);
 
     // If mode contains 'a' (append), seek to end
     let mut m = mode;
@@ -281,8 +378,13 @@ pub unsafe extern "C" fn freopen(
         return ptr::null_mut();
     }
     // Close the existing stream
-    if (*stream).is_open && !(*stream).is_console {
-        io_sync((*stream).handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
+    if (*stream).is_open {
+        flush_wbuf(stream);
+        release_buffer(stream);
+        if !(*stream).is_console {
+            io_sync((*stream).handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
+            crate::unistd::forget_fd_path((*stream).handle.as_u32() as c_int);
+        }
     }
     if path.is_null() {
         // NULL path means just change mode on the same fd — not meaningful for us
@@ -303,14 +405,8 @@ pub unsafe extern "C" fn freopen(
         (*stream).is_open = false;
         return ptr::null_mut();
     }
-    (*stream).handle = handle;
-    (*stream).pos = 0;
-    (*stream).error = 0;
-    (*stream).eof = 0;
-    (*stream).is_open = true;
-    (*stream).is_console = false;
-    (*stream).unget = -1;
-    (*stream).wbuf_pos = 0;
+    open_stream(stream, handle, false);
+    crate::unistd::set_fd_path(handle.as_u32() as c_int, &path_buf[..path_len]);
     stream
 }
 
@@ -320,12 +416,14 @@ pub unsafe extern "C" fn fclose(f: *mut FILE) -> c_int {
         return EOF;
     }
     // Flush any buffered writes
-    flush_wbuf(f);
+    let result = flush_wbuf(f);
+    release_buffer(f);
     if !(*f).is_console {
         io_sync((*f).handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
+        crate::unistd::forget_fd_path((*f).handle.as_u32() as c_int);
     }
     (*f).is_open = false;
-    0
+    result
 }
 
 #[no_mangle]
@@ -340,34 +438,60 @@ pub unsafe extern "C" fn fread(
     }
 
     // Flush buffered writes so position is correct
-    if (*f).wbuf_pos > 0 {
-        flush_wbuf(f);
+    if (*f).wbuf_pos > 0 && flush_wbuf(f) == EOF {
+        return 0;
     }
 
     let total = size * nmemb;
-    let result = io_sync(
-        (*f).handle,
-        ASYNC_OP_READ,
-        ptr as u32,
-        total as u32,
-        (*f).pos,
-    );
+    let dest = ptr as *mut u8;
+    let mut done = 0;
 
-    match result {
-        Ok(bytes_read) => {
-            if bytes_read == 0 {
-                (*f).eof = 1;
-                0
-            } else {
-                (*f).pos += bytes_read;
-                (bytes_read as usize) / size
+    if (*f).unget >= 0 {
+        *dest = (*f).unget as u8;
+        (*f).unget = -1;
+        (*f).pos += 1;
+        done = 1;
+    }
+
+    // Serve what we can from data already read ahead
+    let buffered = ((*f).rend - (*f).rpos).min(total - done);
+    if buffered > 0 {
+        ptr::copy_nonoverlapping((*f).buf.add((*f).rpos), dest.add(done), buffered);
+        (*f).rpos += buffered;
+        (*f).pos += buffered as u32;
+        done += buffered;
+    }
+
+    if done < total {
+        ensure_buffer(f);
+        let remaining = total - done;
+        if remaining >= (*f).buf_size {
+            // Large reads go straight into the caller's memory
+            let result = io_sync(
+                (*f).handle,
+                ASYNC_OP_READ,
+                dest.add(done) as u32,
+                remaining as u32,
+                (*f).pos,
+            );
+            match result {
+                Ok(0) => (*f).eof = 1,
+                Ok(bytes_read) => {
+                    (*f).pos += bytes_read;
+                    done += bytes_read as usize;
+                }
+                Err(_) => (*f).error = 1,
             }
-        }
-        Err(_) => {
-            (*f).error = 1;
-            0
+        } else {
+            let available = fill_rbuf(f).min(remaining);
+            ptr::copy_nonoverlapping((*f).buf, dest.add(done), available);
+            (*f).rpos = available;
+            (*f).pos += available as u32;
+            done += available;
         }
     }
+
+    done / size
 }
 
 #[no_mangle]
@@ -381,6 +505,27 @@ pub unsafe extern "C" fn fwrite(
         return 0;
     }
 
+    let total = size * nmemb;
+    let src = ptr as *const u8;
+    discard_rbuf(f);
+    (*f).unget = -1;
+    ensure_buffer(f);
+
+    // Small writes are collected in the buffer
+    if (*f).buf_mode != _IONBF && total <= (*f).buf_size - (*f).wbuf_pos {
+        ptr::copy_nonoverlapping(src, (*f).buf.add((*f).wbuf_pos), total);
+        (*f).wbuf_pos += total;
+        (*f).pos += total as u32;
+        let data = core::slice::from_raw_parts(src, total);
+        let full = (*f).wbuf_pos == (*f).buf_size;
+        if full || ((*f).buf_mode == _IOLBF && data.contains(&b'\n')) {
+            if flush_wbuf(f) == EOF {
+                return 0;
+            }
+        }
+        return nmemb;
+    }
+
     // Flush any buffered data first so ordering is preserved
     if (*f).wbuf_pos > 0 {
         if flush_wbuf(f) == EOF {
@@ -388,11 +533,10 @@ pub unsafe extern "C" fn fwrite(
         }
     }
 
-    let total = size * nmemb;
     let result = io_sync(
         (*f).handle,
         ASYNC_OP_WRITE,
-        ptr as u32,
+        src as u32,
         total as u32,
         (*f).pos,
     );
@@ -422,6 +566,7 @@ pub unsafe extern "C" fn fseek(f: *mut FILE, offset: c_int, whence: c_int) -> c_
 
     (*f).eof = 0;
     (*f).unget = -1;
+    discard_rbuf(f);
 
     match whence {
         0 => {
@@ -474,15 +619,34 @@ pub unsafe extern "C" fn clearerr(f: *mut FILE) {
     }
 }
 
+/// A null stream flushes every open stream
 #[no_mangle]
 pub unsafe extern "C" fn fflush(f: *mut FILE) -> c_int {
-    if f.is_null() || !(*f).is_open {
+    if f.is_null() {
+        return flush_all();
+    }
+    if !(*f).is_open {
         return 0;
     }
     flush_wbuf(f)
 }
 
+/// Write out whatever every open stream still has buffered. Called by
+/// `exit`, since fully buffered streams would otherwise lose their tail.
+pub(crate) unsafe fn flush_all() -> c_int {
+    let mut result = 0;
+    for i in 0..MAX_FILES {
+        let f = &raw mut FILE_TABLE[i];
+        if (*f).is_open && (*f).wbuf_pos > 0 && flush_wbuf(f) == EOF {
+            result = EOF;
+        }
+    }
+    result
+}
+
 /// Flush the write buffer for a FILE. Returns 0 on success, EOF on error.
+/// `pos` already accounts for the buffered bytes, which start at
+/// `pos - wbuf_pos` in the file.
 unsafe fn flush_wbuf(f: *mut FILE) -> c_int {
     let n = (*f).wbuf_pos;
     if n == 0 {
@@ -491,13 +655,12 @@ unsafe fn flush_wbuf(f: *mut FILE) -> c_int {
     let result = io_sync(
         (*f).handle,
         ASYNC_OP_WRITE,
-        (*f).wbuf.as_ptr() as u32,
+        (*f).buf as u32,
         n as u32,
-        (*f).pos,
+        (*f).pos - n as u32,
     );
     match result {
-        Ok(bytes_written) => {
-            (*f).pos += bytes_written;
+        Ok(_) => {
             (*f).wbuf_pos = 0;
             0
         }
@@ -509,6 +672,28 @@ unsafe fn flush_wbuf(f: *mut FILE) -> c_int {
     }
 }
 
+/// Write straight to the stream at its position, bypassing the buffer.
+/// Returns false on error.
+unsafe fn write_direct(f: *mut FILE, bytes: &[u8]) -> bool {
+    let result = io_sync(
+        (*f).handle,
+        ASYNC_OP_WRITE,
+        bytes.as_ptr() as u32,
+        bytes.len() as u32,
+        (*f).pos,
+    );
+    match result {
+        Ok(bytes_written) => {
+            (*f).pos += bytes_written;
+            true
+        }
+        Err(_) => {
+            (*f).error = 1;
+            false
+        }
+    }
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn fgetc(f: *mut FILE) -> c_int {
     if f.is_null() || !(*f).is_open {
@@ -519,27 +704,17 @@ pub unsafe extern "C" fn fgetc(f: *mut FILE) -> c_int {
     if (*f).unget >= 0 {
         let c = (*f).unget;
         (*f).unget = -1;
+        (*f).pos += 1;
         return c;
     }
 
-    let mut byte: u8 = 0;
-    let result = io_sync(
-        (*f).handle,
-        ASYNC_OP_READ,
-        &raw mut byte as u32,
-        1,
-        (*f).pos,
-    );
-    match result {
-        Ok(n) if n > 0 => {
-            (*f).pos += 1;
-            byte as c_int
-        }
-        _ => {
-            (*f).eof = 1;
-            EOF
-        }
+    if (*f).rpos == (*f).rend && fill_rbuf(f) == 0 {
+        return EOF;
     }
+    let byte = *(*f).buf.add((*f).rpos);
+    (*f).rpos += 1;
+    (*f).pos += 1;
+    byte as c_int
 }
 
 #[no_mangle]
@@ -549,12 +724,25 @@ pub unsafe extern "C" fn getc(f: *mut FILE) -> c_int {
 
 #[no_mangle]
 pub unsafe extern "C" fn ungetc(c: c_int, f: *mut FILE) -> c_int {
-    if f.is_null() || c == EOF {
+    if f.is_null() || c == EOF || (*f).unget >= 0 {
+        return EOF;
+    }
+    // Nothing has been read yet, so there is no position to step back to
+    if (*f).pos == 0 {
         return EOF;
     }
-    (*f).unget = c;
+    let byte = c as u8;
+    // Step back into the read buffer when possible, so the pushed-back byte
+    // is consumed in order with the rest of the buffered data
+    if (*f).rpos > 0 && (*f).wbuf_pos == 0 {
+        (*f).rpos -= 1;
+        *(*f).buf.add((*f).rpos) = byte;
+    } else {
+        (*f).unget = byte as c_int;
+    }
+    (*f).pos -= 1;
     (*f).eof = 0;
-    c
+    byte as c_int
 }
 
 #[no_mangle]
@@ -588,13 +776,25 @@ pub unsafe extern "C" fn fputc(c: c_int, f: *mut FILE) -> c_int {
         return EOF;
     }
     let byte = c as u8;
+    if (*f).rend > 0 {
+        discard_rbuf(f);
+    }
+    (*f).unget = -1;
+    ensure_buffer(f);
 
     // Append to write buffer
-    (*f).wbuf[(*f).wbuf_pos] = byte;
+    *(*f).buf.add((*f).wbuf_pos) = byte;
     (*f).wbuf_pos += 1;
-
-    // Flush when buffer is full, or on newline for console streams
-    if (*f).wbuf_pos >= FILE_BUF_SIZE || ((*f).is_console && byte == b'\n') {
+    (*f).pos += 1;
+
+    // Flush when buffer is full, on newline for line-buffered streams, and
+    // immediately for unbuffered ones
+    let flush = match (*f).buf_mode {
+        _IONBF => true,
+        _IOLBF => byte == b'\n',
+        _ => false,
+    };
+    if flush || (*f).wbuf_pos >= (*f).buf_size {
         if flush_wbuf(f) == EOF {
             return EOF;
         }
@@ -637,406 +837,124 @@ pub unsafe extern "C" fn puts(s: *const c_char) -> c_int {
 
 // ---- printf family ----
 
-/// Internal printf engine that writes to a callback.
-unsafe fn format_to(
-    mut write_fn: impl FnMut(u8),
-    fmt: *const c_char,
-    mut args: VaList,
-) -> c_int {
-    let mut count: c_int = 0;
-    let mut i = 0;
-
-    let emit = |write_fn: &mut dyn FnMut(u8), count: &mut c_int, c: u8| {
-        write_fn(c);
-        *count += 1;
-    };
-
-    loop {
-        let c = *fmt.add(i) as u8;
-        if c == 0 {
-            break;
-        }
+impl printf::Args for VaList<'_, '_> {
+    fn int(&mut self) -> i32 {
+        unsafe { self.arg::<i32>() }
+    }
 
-        if c != b'%' {
-            emit(&mut write_fn, &mut count, c);
-            i += 1;
-            continue;
-        }
+    fn long_long(&mut self) -> i64 {
+        unsafe { self.arg::<i64>() }
+    }
 
-        i += 1;
-        let c = *fmt.add(i) as u8;
-        if c == 0 {
-            break;
-        }
+    fn double(&mut self) -> f64 {
+        unsafe { self.arg::<f64>() }
+    }
 
-        // Parse flags
-        let mut left_justify = false;
-        let mut zero_pad = false;
-        let mut plus_sign = false;
-        let mut space_sign = false;
-        let mut hash_flag = false;
-        loop {
-            let fc = *fmt.add(i) as u8;
-            match fc {
-                b'-' => {
-                    left_justify = true;
-                    i += 1;
-                }
-                b'0' => {
-                    zero_pad = true;
-                    i += 1;
-                }
-                b'+' => {
-                    plus_sign = true;
-                    i += 1;
-                }
-                b' ' => {
-                    space_sign = true;
-                    i += 1;
-                }
-                b'#' => {
-                    hash_flag = true;
-                    i += 1;
-                }
-                _ => break,
-            }
-        }
+    fn pointer(&mut self) -> usize {
+        unsafe { self.arg::<usize>() }
+    }
+}
 
-        // Parse width
-        let mut width: usize = 0;
-        if *fmt.add(i) as u8 == b'*' {
-            width = args.arg::<c_int>() as usize;
-            i += 1;
-        } else {
-            while (*fmt.add(i) as u8) >= b'0' && (*fmt.add(i) as u8) <= b'9' {
-                width = width * 10 + (*fmt.add(i) as u8 - b'0') as usize;
-                i += 1;
-            }
-        }
+/// printf output to a stream, copied into its buffer a run at a time.
+/// Flushing for line-buffered streams is left to the end of the call, so a
+/// printf that fits in the buffer costs at most one write. Unbuffered
+/// streams don't come through here, since their one-byte buffer would cost
+/// a write per byte.
+struct StreamSink {
+    f: *mut FILE,
+    newline: bool,
+    failed: bool,
+}
 
-        // Parse precision
-        let mut precision: Option<usize> = None;
-        if *fmt.add(i) as u8 == b'.' {
-            i += 1;
-            let mut prec = 0usize;
-            if *fmt.add(i) as u8 == b'*' {
-                prec = args.arg::<c_int>() as usize;
-                i += 1;
-            } else {
-                while (*fmt.add(i) as u8) >= b'0' && (*fmt.add(i) as u8) <= b'9' {
-                    prec = prec * 10 + (*fmt.add(i) as u8 - b'0') as usize;
-                    i += 1;
+impl printf::Sink for StreamSink {
+    fn write(&mut self, bytes: &[u8]) {
+        let f = self.f;
+        unsafe {
+            let mut rest = bytes;
+            while !rest.is_empty() {
+                let room = (*f).buf_size - (*f).wbuf_pos;
+                let n = rest.len().min(room);
+                ptr::copy_nonoverlapping(rest.as_ptr(), (*f).buf.add((*f).wbuf_pos), n);
+                (*f).wbuf_pos += n;
+                (*f).pos += n as u32;
+                rest = &rest[n..];
+                if (*f).wbuf_pos == (*f).buf_size && flush_wbuf(f) == EOF {
+                    self.failed = true;
                 }
             }
-            precision = Some(prec);
-        }
-
-        // Parse length modifier
-        let mut long_flag = false;
-        let c = *fmt.add(i) as u8;
-        if c == b'l' {
-            long_flag = true;
-            i += 1;
-            if *fmt.add(i) as u8 == b'l' {
-                i += 1; // ll treated same as l on 32-bit
-            }
-        } else if c == b'h' {
-            i += 1;
-            if *fmt.add(i) as u8 == b'h' {
-                i += 1;
-            }
-        } else if c == b'z' || c == b'j' || c == b't' {
-            i += 1;
-            long_flag = true; // size_t is 32-bit
-        }
-
-        // Parse conversion
-        let conv = *fmt.add(i) as u8;
-        i += 1;
-
-        match conv {
-            b'd' | b'i' => {
-                let val = if long_flag {
-                    args.arg::<i32>()
-                } else {
-                    args.arg::<c_int>() as i32
-                };
-                let mut buf = [0u8; 12];
-                let s = format_int(val as i64, 10, false, &mut buf);
-                let prefix = if val < 0 {
-                    b'-'
-                } else if plus_sign {
-                    b'+'
-                } else if space_sign {
-                    b' '
-                } else {
-                    0
-                };
-                // Precision for integers = minimum number of digits
-                let prec_pad = match precision {
-                    Some(p) if p > s.len() => p - s.len(),
-                    _ => 0,
-                };
-                let slen = s.len() + prec_pad + if prefix != 0 { 1 } else { 0 };
-                let pad = if width > slen { width - slen } else { 0 };
-                let pad_char = if zero_pad && !left_justify && precision.is_none() { b'0' } else { b' ' };
-
-                if !left_justify && pad_char == b' ' {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b' ');
-                    }
-                }
-                if prefix != 0 {
-                    emit(&mut write_fn, &mut count, prefix);
-                }
-                if !left_justify && pad_char == b'0' {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b'0');
-                    }
-                }
-                for _ in 0..prec_pad {
-                    emit(&mut write_fn, &mut count, b'0');
-                }
-                for &b in s {
-                    emit(&mut write_fn, &mut count, b);
-                }
-                if left_justify {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b' ');
-                    }
-                }
-            }
-            b'u' => {
-                let val = args.arg::<u32>();
-                let mut buf = [0u8; 12];
-                let s = format_uint(val as u64, 10, false, &mut buf);
-                let pad = if width > s.len() { width - s.len() } else { 0 };
-                if !left_justify {
-                    let pc = if zero_pad { b'0' } else { b' ' };
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, pc);
-                    }
-                }
-                for &b in s {
-                    emit(&mut write_fn, &mut count, b);
-                }
-                if left_justify {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b' ');
-                    }
-                }
-            }
-            b'x' | b'X' => {
-                let val = args.arg::<u32>();
-                let upper = conv == b'X';
-                let mut buf = [0u8; 12];
-                let s = format_uint(val as u64, 16, upper, &mut buf);
-                let prefix_len = if hash_flag && val != 0 { 2 } else { 0 };
-                let slen = s.len() + prefix_len;
-                let pad = if width > slen { width - slen } else { 0 };
-
-                if !left_justify && !zero_pad {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b' ');
-                    }
-                }
-                if hash_flag && val != 0 {
-                    emit(&mut write_fn, &mut count, b'0');
-                    emit(&mut write_fn, &mut count, if upper { b'X' } else { b'x' });
-                }
-                if !left_justify && zero_pad {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b'0');
-                    }
-                }
-                for &b in s {
-                    emit(&mut write_fn, &mut count, b);
-                }
-                if left_justify {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b' ');
-                    }
-                }
-            }
-            b'o' => {
-                let val = args.arg::<u32>();
-                let mut buf = [0u8; 16];
-                let s = format_uint(val as u64, 8, false, &mut buf);
-                for &b in s {
-                    emit(&mut write_fn, &mut count, b);
-                }
-            }
-            b'p' => {
-                let val = args.arg::<u32>();
-                emit(&mut write_fn, &mut count, b'0');
-                emit(&mut write_fn, &mut count, b'x');
-                let mut buf = [0u8; 12];
-                let s = format_uint(val as u64, 16, false, &mut buf);
-                for &b in s {
-                    emit(&mut write_fn, &mut count, b);
-                }
-            }
-            b's' => {
-                let s = args.arg::<*const c_char>();
-                if s.is_null() {
-                    let null_str = b"(null)";
-                    for &b in null_str {
-                        emit(&mut write_fn, &mut count, b);
-                    }
-                } else {
-                    let max_len = precision.unwrap_or(usize::MAX);
-                    let slen = crate::string::strnlen(s, max_len);
-                    let pad = if width > slen { width - slen } else { 0 };
-                    if !left_justify {
-                        for _ in 0..pad {
-                            emit(&mut write_fn, &mut count, b' ');
-                        }
-                    }
-                    for j in 0..slen {
-                        emit(&mut write_fn, &mut count, *s.add(j) as u8);
-                    }
-                    if left_justify {
-                        for _ in 0..pad {
-                            emit(&mut write_fn, &mut count, b' ');
-                        }
-                    }
-                }
-            }
-            b'c' => {
-                let c = args.arg::<c_int>() as u8;
-                emit(&mut write_fn, &mut count, c);
-            }
-            b'f' | b'F' | b'g' | b'G' | b'e' | b'E' => {
-                let val = args.arg::<f64>();
-                let prec = precision.unwrap_or(6);
-                let mut buf = [0u8; 64];
-                let len = format_float(val, prec, &mut buf);
-                let s = &buf[..len];
-                let pad = if width > s.len() { width - s.len() } else { 0 };
-                if !left_justify {
-                    let pc = if zero_pad { b'0' } else { b' ' };
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, pc);
-                    }
-                }
-                for &b in s {
-                    emit(&mut write_fn, &mut count, b);
-                }
-                if left_justify {
-                    for _ in 0..pad {
-                        emit(&mut write_fn, &mut count, b' ');
-                    }
-                }
-            }
-            b'%' => {
-                emit(&mut write_fn, &mut count, b'%');
-            }
-            b'n' => {
-                let p = args.arg::<*mut c_int>();
-                if !p.is_null() {
-                    *p = count;
-                }
-            }
-            _ => {
-                // Unknown format, just output it
-                emit(&mut write_fn, &mut count, b'%');
-                emit(&mut write_fn, &mut count, conv);
-            }
         }
+        self.newline |= bytes.contains(&b'\n');
     }
-
-    count
 }
 
-fn format_int<'a>(mut val: i64, base: u64, upper: bool, buf: &'a mut [u8]) -> &'a [u8] {
-    let negative = val < 0;
-    let mut uval = if negative {
-        (-(val as i64)) as u64
-    } else {
-        val as u64
-    };
-    let s = format_uint(uval, base, upper, buf);
-    s
-}
-
-fn format_uint<'a>(mut val: u64, base: u64, upper: bool, buf: &'a mut [u8]) -> &'a [u8] {
-    if val == 0 {
-        buf[0] = b'0';
-        return &buf[..1];
-    }
-    let digits = if upper {
-        b"0123456789ABCDEF"
-    } else {
-        b"0123456789abcdef"
-    };
-    let mut pos = buf.len();
-    while val > 0 && pos > 0 {
-        pos -= 1;
-        buf[pos] = digits[(val % base) as usize];
-        val /= base;
-    }
-    &buf[pos..]
+/// printf output to a caller's array, truncated to `capacity` bytes
+struct BufferSink {
+    buf: *mut u8,
+    capacity: usize,
+    len: usize,
 }
 
-fn format_float(val: f64, precision: usize, buf: &mut [u8]) -> usize {
-    let mut pos = 0;
-
-    if val < 0.0 {
-        buf[pos] = b'-';
-        pos += 1;
-    }
-
-    let val = if val < 0.0 { -val } else { val };
-
-    // Integer part
-    let int_part = val as u64;
-    let mut int_buf = [0u8; 20];
-    let int_str = format_uint(int_part, 10, false, &mut int_buf);
-    for &b in int_str {
-        if pos < buf.len() {
-            buf[pos] = b;
-            pos += 1;
+impl printf::Sink for BufferSink {
+    fn write(&mut self, bytes: &[u8]) {
+        let n = bytes.len().min(self.capacity - self.len);
+        if n > 0 {
+            unsafe {
+                ptr::copy_nonoverlapping(bytes.as_ptr(), self.buf.add(self.len), n);
+            }
+            self.len += n;
         }
     }
 
-    if precision > 0 {
-        if pos < buf.len() {
-            buf[pos] = b'.';
-            pos += 1;
-        }
-
-        let mut frac = val - int_part as f64;
-        for _ in 0..precision {
-            frac *= 10.0;
-            let digit = frac as u8;
-            if pos < buf.len() {
-                buf[pos] = b'0' + digit;
-                pos += 1;
+    fn fill(&mut self, byte: u8, count: usize) {
+        let n = count.min(self.capacity - self.len);
+        if n > 0 {
+            unsafe {
+                ptr::write_bytes(self.buf.add(self.len), byte, n);
             }
-            frac -= digit as f64;
+            self.len += n;
         }
     }
-
-    pos
 }
 
 // ---- printf / fprintf / sprintf / snprintf ----
 
 #[no_mangle]
-pub unsafe extern "C" fn vfprintf(f: *mut FILE, fmt: *const c_char, args: VaList) -> c_int {
-    let mut f_ptr = f;
-    let result = format_to(
-        |b| {
-            fputc(b as c_int, f_ptr);
-        },
-        fmt,
-        args,
-    );
-    // Flush after printf for console streams so output appears immediately
-    if !f.is_null() && (*f).is_console && (*f).wbuf_pos > 0 {
-        flush_wbuf(f);
+pub unsafe extern "C" fn vfprintf(f: *mut FILE, fmt: *const c_char, mut args: VaList) -> c_int {
+    if f.is_null() || !(*f).is_open || fmt.is_null() {
+        return EOF;
+    }
+    if (*f).rend > 0 {
+        discard_rbuf(f);
+    }
+    (*f).unget = -1;
+    ensure_buffer(f);
+
+    if (*f).buf_mode == _IONBF {
+        // Staged on the stack so that the whole printf is usually one write
+        let mut staging = [0u8; FILE_BUF_SIZE];
+        let mut sink = printf::StagingSink::new(&mut staging, |bytes| write_direct(f, bytes));
+        let count = printf::format(fmt as *const u8, &mut args, &mut sink);
+        sink.flush();
+        return if sink.failed { EOF } else { count as c_int };
+    }
+
+    let mut sink = StreamSink {
+        f,
+        newline: false,
+        failed: false,
+    };
+    let count = printf::format(fmt as *const u8, &mut args, &mut sink);
+    // Console streams are flushed after every printf so output appears
+    // immediately
+    let flush = (*f).is_console || ((*f).buf_mode == _IOLBF && sink.newline);
+    if flush && flush_wbuf(f) == EOF {
+        sink.failed = true;
+    }
+    if sink.failed {
+        EOF
+    } else {
+        count as c_int
     }
-    result
 }
 
 #[no_mangle]
@@ -1049,34 +967,25 @@ pub unsafe extern "C" fn fprintf(f: *mut FILE, fmt: *const c_char, mut args: ...
     vfprintf(f, fmt, args.as_va_list())
 }
 
+/// Formats into `buf`, truncating to `size` bytes including the terminator
+/// but returning the untruncated length. Never allocates.
 #[no_mangle]
 pub unsafe extern "C" fn vsnprintf(
     buf: *mut c_char,
     size: usize,
     fmt: *const c_char,
-    args: VaList,
+    mut args: VaList,
 ) -> c_int {
-    if size == 0 {
-        // Still need to count
-        let mut count = 0i32;
-        format_to(|_| { count += 1; }, fmt, args);
-        return count;
-    }
-
-    let mut pos = 0usize;
-    let max = size - 1;
-    let result = format_to(
-        |b| {
-            if pos < max {
-                *buf.add(pos) = b as c_char;
-                pos += 1;
-            }
-        },
-        fmt,
-        args,
-    );
-    *buf.add(pos) = 0;
-    result
+    let mut sink = BufferSink {
+        buf: buf as *mut u8,
+        capacity: size.saturating_sub(1),
+        len: 0,
+    };
+    let count = printf::format(fmt as *const u8, &mut args, &mut sink);
+    if size > 0 {
+        *buf.add(sink.len) = 0;
+    }
+    count as c_int
 }
 
 #[no_mangle]
@@ -1355,13 +1264,66 @@ pub unsafe extern "C" fn fileno(f: *mut FILE) -> c_int {
 // ---- setbuf / setvbuf ----
 
 #[no_mangle]
-pub unsafe extern "C" fn setbuf(_f: *mut FILE, _buf: *mut c_char) {
-    // no-op
+pub unsafe extern "C" fn setbuf(f: *mut FILE, buf: *mut c_char) {
+    if buf.is_null() {
+        setvbuf(f, buf, _IONBF, 0);
+    } else {
+        setvbuf(f, buf, _IOFBF, FILE_BUF_SIZE);
+    }
 }
 
+/// Choose the buffering mode and buffer for a stream. A null `buf` with a
+/// nonzero `size` allocates a buffer of that size; a zero `size` keeps the
+/// default size for the stream. Unbuffered streams still hold one byte, so
+/// that reads and ungetc work the same way in every mode.
 #[no_mangle]
-pub unsafe extern "C" fn setvbuf(_f: *mut FILE, _buf: *mut c_char, _mode: c_int, _size: usize) -> c_int {
-    0 // success, no-op
+pub unsafe extern "C" fn setvbuf(f: *mut FILE, buf: *mut c_char, mode: c_int, size: usize) -> c_int {
+    if f.is_null() || !(*f).is_open || !matches!(mode, _IOFBF | _IOLBF | _IONBF) {
+        return -1;
+    }
+    if flush_wbuf(f) == EOF {
+        return -1;
+    }
+
+    let (new_buf, new_size, owned) = if mode == _IONBF {
+        ((*f).sbuf.as_mut_ptr(), 1, false)
+    } else if !buf.is_null() && size > 0 {
+        (buf as *mut u8, size, false)
+    } else if size > 0 {
+        let allocated = crate::allocator::malloc(size);
+        if allocated.is_null() {
+            return -1;
+        }
+        (allocated, size, true)
+    } else {
+        // Keep the default buffer, but honor the requested mode
+        ensure_buffer(f);
+        (*f).buf_mode = mode;
+        return 0;
+    };
+
+    // Carry over read-ahead data so that switching buffers mid-stream
+    // doesn't lose input
+    let unread = (*f).rend - (*f).rpos;
+    if unread > new_size {
+        if owned {
+            crate::allocator::free(new_buf);
+        }
+        return -1;
+    }
+    if unread > 0 {
+        ptr::copy((*f).buf.add((*f).rpos), new_buf, unread);
+    }
+    if (*f).buf != new_buf {
+        release_buffer(f);
+    }
+    (*f).buf = new_buf;
+    (*f).buf_size = new_size;
+    (*f).buf_owned = owned;
+    (*f).buf_mode = mode;
+    (*f).rpos = 0;
+    (*f).rend = unread;
+    0
 }
 
 // ---- rewind / fgetpos / fsetpos ----
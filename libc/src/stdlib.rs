@@ -28,6 +28,10 @@ pub unsafe extern "C" fn exit(status: c_int) -> ! {
             func();
         }
     }
+    // Output still sitting in stdio buffers
+    crate::stdio::flush_all();
+    // Shared file mappings still holding unwritten changes
+    crate::mman::sync_all();
     idos_api::syscall::exec::terminate(status as u32)
 }
 
@@ -262,38 +266,7 @@ pub unsafe extern "C" fn qsort(
     size: usize,
     compar: unsafe extern "C" fn(*const c_void, *const c_void) -> c_int,
 ) {
-    // Simple insertion sort (good enough for small arrays, correct for all)
-    if nmemb <= 1 {
-        return;
-    }
-    let base = base as *mut u8;
-    // Allocate temp buffer on stack for elements up to 256 bytes, heap otherwise
-    let mut tmp_buf = [0u8; 256];
-    let tmp: *mut u8 = if size <= 256 {
-        tmp_buf.as_mut_ptr()
-    } else {
-        crate::allocator::malloc(size)
-    };
-
-    for i in 1..nmemb {
-        let elem = base.add(i * size);
-        // Copy current element to tmp
-        ptr::copy_nonoverlapping(elem, tmp, size);
-        let mut j = i;
-        while j > 0 {
-            let prev = base.add((j - 1) * size);
-            if compar(prev as *const c_void, tmp as *const c_void) <= 0 {
-                break;
-            }
-            ptr::copy_nonoverlapping(prev, base.add(j * size), size);
-            j -= 1;
-        }
-        ptr::copy_nonoverlapping(tmp, base.add(j * size), size);
-    }
-
-    if size > 256 {
-        crate::allocator::free(tmp);
-    }
+    crate::sort::sort(base as *mut u8, nmemb, size, compar);
 }
 
 #[no_mangle]
@@ -1,18 +1,40 @@
 //! C string and memory functions.
 //!
-//! Note: memcpy, memset, memcmp, memmove are provided by compiler-builtins-mem
-//! so we don't redefine them here to avoid duplicate symbols.
+//! The hot paths live in `fastmem`. Our memcpy, memmove, memset and memcmp
+//! replace the generic byte-loop versions from compiler-builtins-mem, which
+//! are weak symbols.
 
 use core::ffi::{c_char, c_int, c_void};
 use core::ptr;
 
+use crate::fastmem;
+
+#[no_mangle]
+pub unsafe extern "C" fn memcpy(dest: *mut c_void, src: *const c_void, n: usize) -> *mut c_void {
+    fastmem::memcpy(dest as *mut u8, src as *const u8, n);
+    dest
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memmove(dest: *mut c_void, src: *const c_void, n: usize) -> *mut c_void {
+    fastmem::memmove(dest as *mut u8, src as *const u8, n);
+    dest
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memset(s: *mut c_void, c: c_int, n: usize) -> *mut c_void {
+    fastmem::memset(s as *mut u8, c as u8, n);
+    s
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memcmp(s1: *const c_void, s2: *const c_void, n: usize) -> c_int {
+    fastmem::memcmp(s1 as *const u8, s2 as *const u8, n)
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn strlen(s: *const c_char) -> usize {
-    let mut len = 0;
-    while *s.add(len) != 0 {
-        len += 1;
-    }
-    len
+    fastmem::strlen(s as *const u8)
 }
 
 #[no_mangle]
@@ -23,46 +45,18 @@ pub unsafe extern "C" fn strcmp(s1: *const c_char, s2: *const c_char) -> c_int {
 /// In the "C" locale, strcoll is identical to strcmp.
 #[no_mangle]
 pub unsafe extern "C" fn strcoll(s1: *const c_char, s2: *const c_char) -> c_int {
-    let mut i = 0;
-    loop {
-        let a = *s1.add(i) as u8;
-        let b = *s2.add(i) as u8;
-        if a != b {
-            return a as c_int - b as c_int;
-        }
-        if a == 0 {
-            return 0;
-        }
-        i += 1;
-    }
+    fastmem::strcmp(s1 as *const u8, s2 as *const u8)
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn strncmp(s1: *const c_char, s2: *const c_char, n: usize) -> c_int {
-    for i in 0..n {
-        let a = *s1.add(i) as u8;
-        let b = *s2.add(i) as u8;
-        if a != b {
-            return a as c_int - b as c_int;
-        }
-        if a == 0 {
-            return 0;
-        }
-    }
-    0
+    fastmem::strncmp(s1 as *const u8, s2 as *const u8, n)
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn strcpy(dest: *mut c_char, src: *const c_char) -> *mut c_char {
-    let mut i = 0;
-    loop {
-        let c = *src.add(i);
-        *dest.add(i) = c;
-        if c == 0 {
-            break;
-        }
-        i += 1;
-    }
+    let len = strlen(src);
+    fastmem::memcpy(dest as *mut u8, src as *const u8, len + 1);
     dest
 }
 
@@ -104,48 +98,20 @@ pub unsafe extern "C" fn strncat(
     n: usize,
 ) -> *mut c_char {
     let dest_len = strlen(dest);
-    let mut i = 0;
-    while i < n {
-        let c = *src.add(i);
-        if c == 0 {
-            break;
-        }
-        *dest.add(dest_len + i) = c;
-        i += 1;
-    }
-    *dest.add(dest_len + i) = 0;
+    let len = strnlen(src, n);
+    fastmem::memcpy(dest.add(dest_len) as *mut u8, src as *const u8, len);
+    *dest.add(dest_len + len) = 0;
     dest
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn strchr(s: *const c_char, c: c_int) -> *mut c_char {
-    let c = c as u8;
-    let mut p = s;
-    loop {
-        if *p as u8 == c {
-            return p as *mut c_char;
-        }
-        if *p == 0 {
-            return ptr::null_mut();
-        }
-        p = p.add(1);
-    }
+    fastmem::strchr(s as *const u8, c as u8) as *mut c_char
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn strrchr(s: *const c_char, c: c_int) -> *mut c_char {
-    let c = c as u8;
-    let mut last: *mut c_char = ptr::null_mut();
-    let mut p = s;
-    loop {
-        if *p as u8 == c {
-            last = p as *mut c_char;
-        }
-        if *p == 0 {
-            return last;
-        }
-        p = p.add(1);
-    }
+    fastmem::strrchr(s as *const u8, c as u8) as *mut c_char
 }
 
 #[no_mangle]
@@ -154,14 +120,18 @@ pub unsafe extern "C" fn strstr(haystack: *const c_char, needle: *const c_char)
         return haystack as *mut c_char;
     }
     let needle_len = strlen(needle);
-    let mut p = haystack;
-    while *p != 0 {
+    let mut p = haystack as *mut c_char;
+    loop {
+        // Only try a full comparison where the first character matches
+        p = strchr(p, *needle as c_int);
+        if p.is_null() {
+            return ptr::null_mut();
+        }
         if strncmp(p, needle, needle_len) == 0 {
-            return p as *mut c_char;
+            return p;
         }
         p = p.add(1);
     }
-    ptr::null_mut()
 }
 
 #[no_mangle]
@@ -325,36 +295,24 @@ unsafe fn is_delim(c: u8, delim: *const c_char) -> bool {
 // snprintf and strnlen used by various code
 #[no_mangle]
 pub unsafe extern "C" fn strnlen(s: *const c_char, maxlen: usize) -> usize {
-    let mut len = 0;
-    while len < maxlen && *s.add(len) != 0 {
-        len += 1;
+    let end = fastmem::memchr(s as *const u8, 0, maxlen);
+    if end.is_null() {
+        maxlen
+    } else {
+        end as usize - s as usize
     }
-    len
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn stpcpy(dest: *mut c_char, src: *const c_char) -> *mut c_char {
-    let mut i = 0;
-    loop {
-        let c = *src.add(i);
-        *dest.add(i) = c;
-        if c == 0 {
-            return dest.add(i);
-        }
-        i += 1;
-    }
+    let len = strlen(src);
+    fastmem::memcpy(dest as *mut u8, src as *const u8, len + 1);
+    dest.add(len)
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn memchr(s: *const c_void, c: c_int, n: usize) -> *mut c_void {
-    let s = s as *const u8;
-    let c = c as u8;
-    for i in 0..n {
-        if *s.add(i) == c {
-            return s.add(i) as *mut c_void;
-        }
-    }
-    ptr::null_mut()
+    fastmem::memchr(s as *const u8, c as u8, n) as *mut c_void
 }
 
 #[no_mangle]
@@ -1,12 +1,17 @@
 //! POSIX-like system calls.
 
 use core::ffi::{c_char, c_int, c_void};
+use core::ptr;
 
-use idos_api::io::{ASYNC_OP_CLOSE, FILE_OP_RMDIR, FILE_OP_UNLINK};
+use idos_api::io::file::FileStatus;
+use idos_api::io::{
+    Handle, ASYNC_OP_CLOSE, ASYNC_OP_OPEN, ASYNC_OP_READ, ASYNC_OP_WRITE, FILE_OP_RMDIR, FILE_OP_STAT,
+    FILE_OP_UNLINK, OPEN_FLAG_CREATE, OPEN_FLAG_EXCLUSIVE,
+};
 use idos_api::syscall::io::create_file_handle;
 use idos_api::syscall::syscall;
 
-use crate::stdio::{io_sync, translate_path_raw};
+use crate::stdio::{io_sync, translate_path_raw, SEEK_CUR, SEEK_END, SEEK_SET};
 
 #[no_mangle]
 pub unsafe extern "C" fn sleep(seconds: u32) -> u32 {
@@ -94,57 +99,176 @@ pub unsafe extern "C" fn geteuid() -> u32 {
 }
 
 // read/write/close as POSIX-like FD operations
-// These work with raw kernel handles, not FILE*
+// These work with raw kernel handles, not FILE*. Kernel handles have no
+// position of their own: every read and write carries an offset. The
+// position that read/write/lseek expect is kept here, per descriptor.
 
-#[no_mangle]
-pub unsafe extern "C" fn read(fd: c_int, buf: *mut c_void, count: usize) -> isize {
-    use idos_api::io::{AsyncOp, Handle, ASYNC_OP_READ};
-    use idos_api::syscall::exec::futex_wait_u32;
-    use idos_api::syscall::io::append_io_op;
-    use core::sync::atomic::Ordering;
+/// Descriptors with a tracked position. Kernel handles are small indices
+/// into the task's handle table, so this covers anything a program opens;
+/// beyond it, read and write always go to offset 0, and lseek fails.
+const MAX_FDS: usize = 64;
 
-    let handle = Handle::new(fd as u32);
-    let op = AsyncOp::new(ASYNC_OP_READ, buf as u32, count as u32, 0);
-    append_io_op(handle, &op, None);
+static mut FD_OFFSETS: [u32; MAX_FDS] = [0; MAX_FDS];
+static mut FD_APPEND: [bool; MAX_FDS] = [false; MAX_FDS];
+/// Translated path each descriptor was opened with, as a malloc'd copy.
+/// The kernel maps files by path, so this is what mmap hands it.
+static mut FD_PATHS: [(*mut u8, usize); MAX_FDS] = [(ptr::null_mut(), 0); MAX_FDS];
 
-    while op.signal.load(Ordering::SeqCst) == 0 {
-        futex_wait_u32(&op.signal, 0, None);
+const O_CREAT: c_int = 0o100;
+const O_EXCL: c_int = 0o200;
+const O_APPEND: c_int = 0o2000;
+
+fn fd_slot(fd: c_int) -> Option<usize> {
+    if fd >= 0 && (fd as usize) < MAX_FDS {
+        Some(fd as usize)
+    } else {
+        None
+    }
+}
+
+/// Remember the translated path a descriptor was opened with. The handle
+/// number may have been used before, so this also starts the descriptor
+/// over at offset 0 with append off.
+pub(crate) unsafe fn set_fd_path(fd: c_int, path: &[u8]) {
+    let slot = match fd_slot(fd) {
+        Some(slot) => slot,
+        None => return,
+    };
+    forget_fd_path(fd);
+    let copy = crate::allocator::malloc(path.len());
+    if !copy.is_null() {
+        ptr::copy_nonoverlapping(path.as_ptr(), copy, path.len());
+        FD_PATHS[slot] = (copy, path.len());
     }
+}
 
-    let ret = op.return_value.load(Ordering::SeqCst);
-    if ret & 0x80000000 != 0 {
-        -1
+/// The translated path a descriptor was opened with, if it was opened by
+/// path at all
+pub(crate) unsafe fn fd_path(fd: c_int) -> Option<&'static [u8]> {
+    let (path, len) = FD_PATHS[fd_slot(fd)?];
+    if path.is_null() {
+        None
     } else {
-        ret as isize
+        Some(core::slice::from_raw_parts(path, len))
+    }
+}
+
+/// Drop everything tracked for a descriptor whose handle is being closed,
+/// since the next open may reuse the handle number
+pub(crate) unsafe fn forget_fd_path(fd: c_int) {
+    if let Some(slot) = fd_slot(fd) {
+        crate::allocator::free(FD_PATHS[slot].0);
+        FD_PATHS[slot] = (ptr::null_mut(), 0);
+        FD_OFFSETS[slot] = 0;
+        FD_APPEND[slot] = false;
     }
 }
 
+/// Run a read or write on a handle at an explicit offset
+unsafe fn io_at(fd: c_int, op_code: u32, buf: u32, count: usize, offset: u32) -> isize {
+    if fd < 0 {
+        return -1;
+    }
+    match io_sync(Handle::new(fd as u32), op_code, buf, count as u32, offset) {
+        Ok(n) => n as isize,
+        Err(_) => -1,
+    }
+}
+
+unsafe fn fd_size(fd: c_int) -> Option<u32> {
+    let mut status = FileStatus::new();
+    io_sync(
+        Handle::new(fd as u32),
+        FILE_OP_STAT,
+        &mut status as *mut FileStatus as u32,
+        core::mem::size_of::<FileStatus>() as u32,
+        0,
+    )
+    .ok()?;
+    Some(status.byte_size)
+}
+
+/// Open a file and return its kernel handle as a descriptor. C callers
+/// declare this variadic; `mode` is only read when O_CREAT is set, and
+/// IDOS has no permissions to apply it to.
 #[no_mangle]
-pub unsafe extern "C" fn write(fd: c_int, buf: *const c_void, count: usize) -> isize {
-    use idos_api::io::{AsyncOp, Handle, ASYNC_OP_WRITE};
-    use idos_api::syscall::exec::futex_wait_u32;
-    use idos_api::syscall::io::append_io_op;
-    use core::sync::atomic::Ordering;
+pub unsafe extern "C" fn open(path: *const c_char, flags: c_int, _mode: u32) -> c_int {
+    if path.is_null() {
+        return -1;
+    }
+    let mut path_buf = [0u8; 256];
+    let path_len = translate_path_raw(path, &mut path_buf);
 
-    let handle = Handle::new(fd as u32);
-    let op = AsyncOp::new(ASYNC_OP_WRITE, buf as u32, count as u32, 0);
-    append_io_op(handle, &op, None);
+    let mut open_flags = 0;
+    if flags & O_CREAT != 0 {
+        open_flags |= OPEN_FLAG_CREATE;
+    }
+    if flags & O_EXCL != 0 {
+        open_flags |= OPEN_FLAG_EXCLUSIVE;
+    }
 
-    while op.signal.load(Ordering::SeqCst) == 0 {
-        futex_wait_u32(&op.signal, 0, None);
+    let handle = create_file_handle();
+    let result = io_sync(handle, ASYNC_OP_OPEN, path_buf.as_ptr() as u32, path_len as u32, open_flags);
+    if result.is_err() {
+        io_sync(handle, ASYNC_OP_CLOSE, 0, 0, 0).ok();
+        return -1;
     }
 
-    let ret = op.return_value.load(Ordering::SeqCst);
-    if ret & 0x80000000 != 0 {
-        -1
-    } else {
-        ret as isize
+    let fd = handle.as_u32() as c_int;
+    set_fd_path(fd, &path_buf[..path_len]);
+    if let Some(slot) = fd_slot(fd) {
+        FD_APPEND[slot] = flags & O_APPEND != 0;
+    }
+    fd
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn read(fd: c_int, buf: *mut c_void, count: usize) -> isize {
+    let slot = fd_slot(fd);
+    let offset = slot.map_or(0, |slot| FD_OFFSETS[slot]);
+    let n = io_at(fd, ASYNC_OP_READ, buf as u32, count, offset);
+    if let (Some(slot), true) = (slot, n > 0) {
+        FD_OFFSETS[slot] = offset + n as u32;
+    }
+    n
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn write(fd: c_int, buf: *const c_void, count: usize) -> isize {
+    let slot = fd_slot(fd);
+    let offset = match slot {
+        Some(slot) if FD_APPEND[slot] => fd_size(fd).unwrap_or(FD_OFFSETS[slot]),
+        Some(slot) => FD_OFFSETS[slot],
+        None => 0,
+    };
+    let n = io_at(fd, ASYNC_OP_WRITE, buf as u32, count, offset);
+    if let (Some(slot), true) = (slot, n > 0) {
+        FD_OFFSETS[slot] = offset + n as u32;
     }
+    n
+}
+
+/// Read at an explicit offset, without moving the descriptor's position
+#[no_mangle]
+pub unsafe extern "C" fn pread(fd: c_int, buf: *mut c_void, count: usize, offset: i32) -> isize {
+    if offset < 0 {
+        return -1;
+    }
+    io_at(fd, ASYNC_OP_READ, buf as u32, count, offset as u32)
+}
+
+/// Write at an explicit offset, without moving the descriptor's position
+#[no_mangle]
+pub unsafe extern "C" fn pwrite(fd: c_int, buf: *const c_void, count: usize, offset: i32) -> isize {
+    if offset < 0 {
+        return -1;
+    }
+    io_at(fd, ASYNC_OP_WRITE, buf as u32, count, offset as u32)
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn close(fd: c_int) -> c_int {
-    use idos_api::io::{AsyncOp, Handle, ASYNC_OP_CLOSE};
+    use idos_api::io::AsyncOp;
     use idos_api::syscall::exec::futex_wait_u32;
     use idos_api::syscall::io::append_io_op;
     use core::sync::atomic::Ordering;
@@ -157,12 +281,31 @@ pub unsafe extern "C" fn close(fd: c_int) -> c_int {
         futex_wait_u32(&op.signal, 0, None);
     }
 
+    // The handle number may be reused by the next open
+    forget_fd_path(fd);
+
     0
 }
 
 #[no_mangle]
-pub unsafe extern "C" fn lseek(_fd: c_int, _offset: i32, _whence: c_int) -> i32 {
-    // Kernel handles are position-less (offset is passed per-operation)
-    // This is a no-op; stdio tracks position itself
-    0
+pub unsafe extern "C" fn lseek(fd: c_int, offset: i32, whence: c_int) -> i32 {
+    let slot = match fd_slot(fd) {
+        Some(slot) => slot,
+        None => return -1,
+    };
+    let base = match whence {
+        SEEK_SET => 0,
+        SEEK_CUR => FD_OFFSETS[slot] as i64,
+        SEEK_END => match fd_size(fd) {
+            Some(size) => size as i64,
+            None => return -1,
+        },
+        _ => return -1,
+    };
+    let position = base + offset as i64;
+    if position < 0 || position > i32::MAX as i64 {
+        return -1;
+    }
+    FD_OFFSETS[slot] = position as u32;
+    position as i32
 }
@@ -0,0 +1,355 @@
+//! Host tests for the optimized string and memory routines. These check
+//! every combination of pointer alignment, length, and match position
+//! against straightforward byte-at-a-time reference versions.
+//!
+//! libc itself only builds for IDOS, so the module under test is included
+//! by path. Run with `make libctest`.
+
+#[path = "../src/fastmem.rs"]
+#[allow(dead_code)]
+mod fastmem;
+
+use std::ptr;
+
+const MAX_ALIGN: usize = 16;
+const MAX_LEN: usize = 160;
+/// Room on either side of the region under test, to catch stray writes
+const GUARD: usize = 32;
+const BUF_SIZE: usize = GUARD + MAX_ALIGN + MAX_LEN + GUARD;
+const GUARD_BYTE: u8 = 0xa5;
+
+/// A buffer aligned to 16 bytes, so that `offset` fully determines the
+/// alignment of the pointer under test
+#[repr(C, align(16))]
+struct Buffer([u8; BUF_SIZE]);
+
+impl Buffer {
+    fn new() -> Box<Self> {
+        Box::new(Buffer([GUARD_BYTE; BUF_SIZE]))
+    }
+
+    fn at(&mut self, offset: usize) -> *mut u8 {
+        unsafe { self.0.as_mut_ptr().add(GUARD + offset) }
+    }
+}
+
+/// Nonzero filler bytes, including values with the high bit set
+fn filler(i: usize) -> u8 {
+    (i * 37 % 255) as u8 + 1
+}
+
+fn sign(x: i32) -> i32 {
+    x.signum()
+}
+
+// ---- Reference versions ----
+
+unsafe fn ref_strlen(s: *const u8) -> usize {
+    let mut n = 0;
+    while *s.add(n) != 0 {
+        n += 1;
+    }
+    n
+}
+
+unsafe fn ref_memchr(s: *const u8, c: u8, n: usize) -> *const u8 {
+    for i in 0..n {
+        if *s.add(i) == c {
+            return s.add(i);
+        }
+    }
+    ptr::null()
+}
+
+unsafe fn ref_strncmp(a: *const u8, b: *const u8, n: usize) -> i32 {
+    for i in 0..n {
+        let (x, y) = (*a.add(i), *b.add(i));
+        if x != y || x == 0 {
+            return x as i32 - y as i32;
+        }
+    }
+    0
+}
+
+// ---- Tests ----
+
+#[test]
+fn strlen_all_alignments_and_lengths() {
+    let mut buf = Buffer::new();
+    for align in 0..MAX_ALIGN {
+        for len in 0..MAX_LEN {
+            let s = buf.at(align);
+            unsafe {
+                for i in 0..len {
+                    *s.add(i) = filler(i);
+                }
+                *s.add(len) = 0;
+                assert_eq!(fastmem::strlen_words(s), len, "align {} len {}", align, len);
+                #[cfg(target_feature = "sse2")]
+                assert_eq!(fastmem::strlen_sse2(s), len, "align {} len {}", align, len);
+                assert_eq!(fastmem::strlen(s), ref_strlen(s));
+            }
+        }
+    }
+}
+
+#[test]
+fn strlen_ignores_zero_before_start() {
+    let mut buf = Buffer::new();
+    for align in 1..MAX_ALIGN {
+        let s = buf.at(align);
+        unsafe {
+            *s.sub(1) = 0;
+            for i in 0..40 {
+                *s.add(i) = 0x80 | filler(i);
+            }
+            *s.add(40) = 0;
+            assert_eq!(fastmem::strlen_words(s), 40);
+            #[cfg(target_feature = "sse2")]
+            assert_eq!(fastmem::strlen_sse2(s), 40);
+        }
+    }
+}
+
+#[test]
+fn memchr_all_positions() {
+    let mut buf = Buffer::new();
+    for &needle in &[0u8, 1, 0x7f, 0x80, 0xff] {
+        for align in 0..MAX_ALIGN {
+            for len in 0..MAX_LEN {
+                // Position `len` means the needle lies just past the range
+                for pos in (0..=len).chain(core::iter::once(usize::MAX)) {
+                    let s = buf.at(align);
+                    unsafe {
+                        for i in 0..=len {
+                            let b = filler(i);
+                            *s.add(i) = if b == needle { b ^ 0x40 } else { b };
+                        }
+                        if pos <= len {
+                            *s.add(pos) = needle;
+                        }
+                        let expected = ref_memchr(s, needle, len);
+                        let ctx = format!("needle {} align {} len {} pos {}", needle, align, len, pos);
+                        assert_eq!(fastmem::memchr_words(s, needle, len), expected, "{}", ctx);
+                        #[cfg(target_feature = "sse2")]
+                        assert_eq!(fastmem::memchr_sse2(s, needle, len), expected, "{}", ctx);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn strchr_and_strrchr() {
+    let mut buf = Buffer::new();
+    for &needle in &[0u8, b'x', 0x80, 0xff] {
+        for align in 0..MAX_ALIGN {
+            for len in 0..64 {
+                for first in 0..=len {
+                    let s = buf.at(align);
+                    unsafe {
+                        for i in 0..len {
+                            let b = filler(i);
+                            *s.add(i) = if b == needle { b ^ 0x40 } else { b };
+                        }
+                        *s.add(len) = 0;
+                        // Place the needle at `first` and again near the end
+                        if first < len && needle != 0 {
+                            *s.add(first) = needle;
+                            *s.add(len - 1 - (len - 1 - first) / 2) = needle;
+                        }
+
+                        let mut expect_first: *const u8 = ptr::null();
+                        let mut expect_last = ptr::null();
+                        for i in 0..=len {
+                            if *s.add(i) == needle {
+                                if expect_first.is_null() {
+                                    expect_first = s.add(i) as *const u8;
+                                }
+                                expect_last = s.add(i) as *const u8;
+                            }
+                        }
+                        let ctx = format!("needle {} align {} len {} first {}", needle, align, len, first);
+                        assert_eq!(fastmem::strchr(s, needle), expect_first, "{}", ctx);
+                        assert_eq!(fastmem::strrchr(s, needle), expect_last, "{}", ctx);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn strcmp_and_strncmp() {
+    let mut buf_a = Buffer::new();
+    let mut buf_b = Buffer::new();
+    for align_a in 0..8 {
+        for align_b in 0..8 {
+            for len in 0..48 {
+                // diff == len compares equal strings; otherwise the strings
+                // differ at `diff`, in either direction
+                for diff in 0..=len {
+                    for &delta in &[1u8, 0x80] {
+                        let a = buf_a.at(align_a);
+                        let b = buf_b.at(align_b);
+                        unsafe {
+                            for i in 0..len {
+                                *a.add(i) = filler(i);
+                                *b.add(i) = filler(i);
+                            }
+                            *a.add(len) = 0;
+                            *b.add(len) = 0;
+                            if diff < len {
+                                let changed = filler(diff).wrapping_add(delta);
+                                *b.add(diff) = if changed == 0 { 1 } else { changed };
+                            }
+                            for n in [0, diff, diff + 1, len + 1, usize::MAX] {
+                                let ctx = format!("a {} b {} len {} diff {} n {}", align_a, align_b, len, diff, n);
+                                assert_eq!(
+                                    sign(fastmem::strncmp(a, b, n)),
+                                    sign(ref_strncmp(a, b, n)),
+                                    "{}",
+                                    ctx
+                                );
+                                assert_eq!(
+                                    sign(fastmem::strncmp(b, a, n)),
+                                    sign(ref_strncmp(b, a, n)),
+                                    "{}",
+                                    ctx
+                                );
+                            }
+                            assert_eq!(sign(fastmem::strcmp(a, b)), sign(ref_strncmp(a, b, usize::MAX)));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn strcmp_shorter_string_sorts_first() {
+    let mut buf_a = Buffer::new();
+    let mut buf_b = Buffer::new();
+    for align in 0..MAX_ALIGN {
+        let a = buf_a.at(align);
+        let b = buf_b.at(align);
+        unsafe {
+            ptr::copy_nonoverlapping(b"prefix\0".as_ptr(), a, 7);
+            ptr::copy_nonoverlapping(b"prefix-longer\0".as_ptr(), b, 14);
+            assert!(fastmem::strcmp(a, b) < 0);
+            assert!(fastmem::strcmp(b, a) > 0);
+            assert_eq!(fastmem::strncmp(a, b, 6), 0);
+        }
+    }
+}
+
+#[test]
+fn memcmp_all_alignments() {
+    let mut buf_a = Buffer::new();
+    let mut buf_b = Buffer::new();
+    for align_a in 0..8 {
+        for align_b in 0..8 {
+            for len in 0..48 {
+                for diff in 0..=len {
+                    let a = buf_a.at(align_a);
+                    let b = buf_b.at(align_b);
+                    unsafe {
+                        for i in 0..len {
+                            *a.add(i) = filler(i);
+                            *b.add(i) = filler(i);
+                        }
+                        let expected = if diff < len {
+                            // Make b greater at `diff`, with the high bit set
+                            *a.add(diff) = 0x10;
+                            *b.add(diff) = 0x90;
+                            -1
+                        } else {
+                            0
+                        };
+                        let ctx = format!("a {} b {} len {} diff {}", align_a, align_b, len, diff);
+                        assert_eq!(sign(fastmem::memcmp(a, b, len)), expected, "{}", ctx);
+                        assert_eq!(sign(fastmem::memcmp(b, a, len)), -expected, "{}", ctx);
+                    }
+                }
+            }
+        }
+    }
+}
+
+fn check_guards(buf: &Buffer, start: usize, len: usize, ctx: &str) {
+    for (i, &b) in buf.0.iter().enumerate() {
+        if i < GUARD + start || i >= GUARD + start + len {
+            assert_eq!(b, GUARD_BYTE, "byte {} overwritten: {}", i, ctx);
+        }
+    }
+}
+
+#[test]
+fn memcpy_all_alignments_and_lengths() {
+    let mut src = Buffer::new();
+    for i in 0..BUF_SIZE {
+        src.0[i] = filler(i);
+    }
+    for align_src in 0..MAX_ALIGN {
+        for align_dest in 0..MAX_ALIGN {
+            for len in 0..MAX_LEN {
+                let mut dest = Buffer::new();
+                unsafe {
+                    fastmem::memcpy(dest.at(align_dest), src.at(align_src), len);
+                }
+                let ctx = format!("src {} dest {} len {}", align_src, align_dest, len);
+                let copied = &dest.0[GUARD + align_dest..GUARD + align_dest + len];
+                let original = &src.0[GUARD + align_src..GUARD + align_src + len];
+                assert_eq!(copied, original, "{}", ctx);
+                check_guards(&dest, align_dest, len, &ctx);
+            }
+        }
+    }
+}
+
+#[test]
+fn memmove_overlapping_both_directions() {
+    for from in 0..MAX_ALIGN {
+        for to in 0..MAX_ALIGN {
+            for len in 0..MAX_LEN {
+                let mut buf = Buffer::new();
+                let mut expected = Buffer::new();
+                for i in GUARD..GUARD + MAX_ALIGN + MAX_LEN {
+                    buf.0[i] = filler(i);
+                }
+                expected.0 = buf.0;
+                expected
+                    .0
+                    .copy_within(GUARD + from..GUARD + from + len, GUARD + to);
+                unsafe {
+                    let base = buf.at(0);
+                    fastmem::memmove(base.add(to), base.add(from), len);
+                }
+                assert_eq!(buf.0[..], expected.0[..], "from {} to {} len {}", from, to, len);
+            }
+        }
+    }
+}
+
+#[test]
+fn memset_all_alignments_and_lengths() {
+    for &value in &[0u8, 0x5a, 0xff] {
+        for align in 0..MAX_ALIGN {
+            for len in 0..MAX_LEN {
+                let mut buf = Buffer::new();
+                unsafe {
+                    fastmem::memset(buf.at(align), value, len);
+                }
+                let ctx = format!("value {} align {} len {}", value, align, len);
+                assert!(
+                    buf.0[GUARD + align..GUARD + align + len].iter().all(|&b| b == value),
+                    "{}",
+                    ctx
+                );
+                check_guards(&buf, align, len, &ctx);
+            }
+        }
+    }
+}
@@ -0,0 +1,361 @@
+//! Host tests for the math kernels. Results are measured in ulps against
+//! the host C library, whose functions are good to within an ulp, across
+//! random arguments of every magnitude; the exact functions (sqrt, fmod,
+//! floor and friends) have to match bit for bit, and so do the special
+//! cases of pow. f32 results are compared with the host's double result
+//! rounded to float.
+//!
+//! libc itself only builds for IDOS, so the module under test is included
+//! by path. The kernels are x87 code, which runs on x86-64 hosts too. Run
+//! with `make libctest`.
+
+#[path = "../src/fpmath.rs"]
+#[allow(dead_code)]
+mod fpmath;
+
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+
+    /// A random finite double, uniformly spread over the exponents
+    /// `lo..=hi`, with either sign
+    fn spread(&mut self, lo: i32, hi: i32) -> f64 {
+        let exp = lo + (self.next() % (hi - lo + 1) as u64) as i32;
+        let bits = ((exp + 1023) as u64) << 52 | self.next() >> 12 | self.next() & (1 << 63);
+        f64::from_bits(bits)
+    }
+}
+
+/// Distance between two doubles in units in the last place
+fn ulps(a: f64, b: f64) -> u64 {
+    if a.is_nan() && b.is_nan() || a == b {
+        return 0;
+    }
+    if a.is_nan() || b.is_nan() {
+        return u64::MAX;
+    }
+    let key = |x: f64| {
+        let bits = x.to_bits() as i64;
+        if bits < 0 {
+            i64::MIN.wrapping_sub(bits)
+        } else {
+            bits
+        }
+    };
+    key(a).abs_diff(key(b))
+}
+
+fn ulps32(a: f32, b: f32) -> u64 {
+    if a.is_nan() && b.is_nan() || a == b {
+        return 0;
+    }
+    if a.is_nan() || b.is_nan() {
+        return u64::MAX;
+    }
+    let key = |x: f32| {
+        let bits = x.to_bits() as i32;
+        if bits < 0 {
+            i32::MIN.wrapping_sub(bits)
+        } else {
+            bits
+        }
+    };
+    key(a).abs_diff(key(b)) as u64
+}
+
+/// Check a function over `args` against the host, within `max_ulps`
+fn check1(name: &str, ours: fn(f64) -> f64, host: fn(f64) -> f64, args: &[f64], max_ulps: u64) {
+    let mut worst = (0, 0.0);
+    for &x in args {
+        let err = ulps(ours(x), host(x));
+        if err > worst.0 {
+            worst = (err, x);
+        }
+    }
+    let (err, x) = worst;
+    assert!(
+        err <= max_ulps,
+        "{}({:e}) = {:e}, host {:e}: {} ulps",
+        name,
+        x,
+        ours(x),
+        host(x),
+        err
+    );
+}
+
+fn check1f(name: &str, ours: fn(f32) -> f32, host: fn(f64) -> f64, args: &[f32], max_ulps: u64) {
+    for &x in args {
+        let expected = host(x as f64) as f32;
+        let err = ulps32(ours(x), expected);
+        assert!(
+            err <= max_ulps,
+            "{}({:e}) = {:e}, host {:e}: {} ulps",
+            name,
+            x,
+            ours(x),
+            expected,
+            err
+        );
+    }
+}
+
+fn spread_args(rng: &mut Rng, lo: i32, hi: i32, count: usize) -> Vec<f64> {
+    (0..count).map(|_| rng.spread(lo, hi)).collect()
+}
+
+const SPECIALS: &[f64] = &[
+    0.0,
+    -0.0,
+    1.0,
+    -1.0,
+    0.5,
+    2.0,
+    f64::INFINITY,
+    f64::NEG_INFINITY,
+    f64::NAN,
+    f64::MIN_POSITIVE,
+    5e-324,
+    f64::MAX,
+    -f64::MAX,
+];
+
+#[test]
+fn trig_matches_host() {
+    let mut rng = Rng(0x2545_f491_4f6c_dd1d);
+    let mut args = spread_args(&mut rng, -30, 1023, 20000);
+    args.extend(spread_args(&mut rng, -3, 6, 20000));
+    args.extend(SPECIALS);
+    // Near multiples of pi/2, where the FPU's own reduction falls apart
+    for k in 1..2000 {
+        args.push(k as f64 * std::f64::consts::FRAC_PI_2);
+    }
+    check1("sin", fpmath::sin, f64::sin, &args, 1);
+    check1("cos", fpmath::cos, f64::cos, &args, 1);
+    check1("tan", fpmath::tan, f64::tan, &args, 1);
+
+    // fsin gives back arguments past 2^63 unchanged
+    assert_eq!(fpmath::sin(1e22), -0.8522008497671888);
+    assert_eq!(fpmath::cos(1e22), 0.523214785395139);
+
+    // The double closest to a multiple of pi/2, 4.7e-19 past one. The host
+    // is several ulps out here; this is the exact value, rounded.
+    let worst = 6381956970095103.0 * 2f64.powi(797);
+    assert_eq!(fpmath::cos(worst), -4.687165924254628e-19);
+    assert_eq!(fpmath::sin(worst), 1.0);
+}
+
+#[test]
+fn inverse_trig_matches_host() {
+    let mut rng = Rng(77);
+    let mut args = spread_args(&mut rng, -60, -1, 20000);
+    args.extend([1.0 - 1e-16, -1.0 + 1e-16, 0.9999999, 1.5, -2.0]);
+    args.extend(SPECIALS);
+    check1("asin", fpmath::asin, f64::asin, &args, 1);
+    check1("acos", fpmath::acos, f64::acos, &args, 1);
+    args.extend(spread_args(&mut rng, 0, 1023, 10000));
+    check1("atan", fpmath::atan, f64::atan, &args, 1);
+    for _ in 0..20000 {
+        let (y, x) = (rng.spread(-40, 40), rng.spread(-40, 40));
+        assert!(ulps(fpmath::atan2(y, x), y.atan2(x)) <= 1, "atan2({:e}, {:e})", y, x);
+    }
+    for &y in SPECIALS {
+        for &x in SPECIALS {
+            assert!(ulps(fpmath::atan2(y, x), y.atan2(x)) <= 1, "atan2({:e}, {:e})", y, x);
+        }
+    }
+}
+
+#[test]
+fn exp_and_log_match_host() {
+    let mut rng = Rng(1234);
+    let mut args: Vec<f64> = (0..20000).map(|_| (rng.next() as i64 as f64) / 2f64.powi(53)).collect();
+    args.extend(args.clone().iter().map(|x| x * 1500.0));
+    args.extend([709.78, 709.8, -745.1, -745.2, -708.5, 1e300, -1e300]);
+    args.extend(SPECIALS);
+    check1("exp", fpmath::exp, f64::exp, &args, 1);
+
+    let mut args = spread_args(&mut rng, -1074, 1023, 20000);
+    args.extend(SPECIALS);
+    args.extend([1.0 + 1e-15, 1.0 - 1e-16, 0.999, 1.001]);
+    check1("log", fpmath::log, f64::ln, &args, 1);
+    check1("log2", fpmath::log2, f64::log2, &args, 1);
+    check1("log10", fpmath::log10, f64::log10, &args, 1);
+}
+
+#[test]
+fn pow_matches_host() {
+    let mut rng = Rng(99);
+    for _ in 0..40000 {
+        let x = f64::from_bits(rng.spread(-20, 20).to_bits() & !(1 << 63));
+        let y = rng.spread(-10, 9);
+        let err = ulps(fpmath::pow(x, y), x.powf(y));
+        assert!(err <= 1, "pow({:e}, {:e}) = {:e}, host {:e}", x, y, fpmath::pow(x, y), x.powf(y));
+    }
+    // Large results, where the exponent has to stay in extended precision
+    for _ in 0..20000 {
+        let x = 1.0 + (rng.next() >> 12) as f64 / 2f64.powi(52) * 15.0;
+        let y = (rng.next() % 2000) as f64 / x.log2() - 1000.0 / x.log2();
+        assert!(ulps(fpmath::pow(x, y), x.powf(y)) <= 1, "pow({:e}, {:e})", x, y);
+    }
+}
+
+/// Every combination of the special values, compared bit for bit
+#[test]
+fn pow_special_cases() {
+    let values = [
+        0.0,
+        -0.0,
+        1.0,
+        -1.0,
+        0.5,
+        -0.5,
+        2.0,
+        -2.0,
+        3.0,
+        -3.0,
+        2.5,
+        -2.5,
+        f64::INFINITY,
+        f64::NEG_INFINITY,
+        f64::NAN,
+        1e300,
+        -1e300,
+        9007199254740993.0,
+    ];
+    for &x in &values {
+        for &y in &values {
+            let (ours, host) = (fpmath::pow(x, y), x.powf(y));
+            assert!(
+                ours.to_bits() == host.to_bits() || (ours.is_nan() && host.is_nan()),
+                "pow({:e}, {:e}) = {:e}, host {:e}",
+                x,
+                y,
+                ours,
+                host
+            );
+        }
+    }
+}
+
+#[test]
+fn exact_functions_match_host() {
+    let mut rng = Rng(5);
+    let mut args = spread_args(&mut rng, -1074, 1023, 20000);
+    args.extend(spread_args(&mut rng, -4, 60, 20000));
+    args.extend(SPECIALS);
+    args.extend([0.5, 1.5, -1.5, 2.5, -0.3, 0.3, 4503599627370495.5, -4503599627370495.5]);
+    let same = |a: f64, b: f64| a.to_bits() == b.to_bits() || (a.is_nan() && b.is_nan());
+    for &x in &args {
+        assert!(same(fpmath::sqrt(x.abs()), x.abs().sqrt()), "sqrt({:e})", x);
+        assert!(same(fpmath::floor(x), x.floor()), "floor({:e})", x);
+        assert!(same(fpmath::ceil(x), x.ceil()), "ceil({:e})", x);
+        assert!(same(fpmath::fabs(x), x.abs()), "fabs({:e})", x);
+        let mut exp = 0;
+        let fraction = fpmath::frexp(x, &mut exp);
+        if x.is_finite() && x != 0.0 {
+            assert!((0.5..1.0).contains(&fraction.abs()), "frexp({:e})", x);
+            assert_eq!(fpmath::ldexp(fraction, exp), x);
+        }
+        let y = rng.spread(-40, 40);
+        assert!(same(fpmath::fmod(x, y), x % y), "fmod({:e}, {:e})", x, y);
+    }
+    assert!(fpmath::fmod(1.0f64, 0.0).is_nan());
+    assert!(fpmath::sqrt(-1.0f64).is_nan());
+    assert_eq!(fpmath::ldexp(1.0f64, -1074), 5e-324);
+    assert_eq!(fpmath::ldexp(1.0f64, 1024), f64::INFINITY);
+}
+
+/// sqrt must be correctly rounded, including where rounding the result to
+/// extended precision first would go the wrong way
+#[test]
+fn sqrt_rounds_once() {
+    let mut rng = Rng(31337);
+    for _ in 0..200000 {
+        let x = f64::from_bits(rng.next() >> 2);
+        assert_eq!(fpmath::sqrt(x).to_bits(), x.sqrt().to_bits(), "sqrt({:e})", x);
+        let x = f32::from_bits(rng.next() as u32 >> 2);
+        assert_eq!(fpmath::sqrt(x).to_bits(), x.sqrt().to_bits(), "sqrtf({:e})", x);
+    }
+}
+
+#[test]
+fn float_versions_match_host() {
+    let mut rng = Rng(8);
+    let mut args: Vec<f32> = (0..20000).map(|_| rng.spread(-20, 127) as f32).collect();
+    args.extend((0..20000).map(|_| rng.spread(-3, 6) as f32));
+    args.extend([0.0, -0.0, f32::INFINITY, f32::NEG_INFINITY, f32::NAN, f32::MAX, 1e-45]);
+    check1f("sinf", fpmath::sin, f64::sin, &args, 1);
+    check1f("cosf", fpmath::cos, f64::cos, &args, 1);
+    check1f("tanf", fpmath::tan, f64::tan, &args, 1);
+    check1f("atanf", fpmath::atan, f64::atan, &args, 1);
+    check1f("logf", fpmath::log, f64::ln, &args, 1);
+    check1f("log2f", fpmath::log2, f64::log2, &args, 1);
+    check1f("log10f", fpmath::log10, f64::log10, &args, 1);
+    check1f("floorf", fpmath::floor, f64::floor, &args, 0);
+    check1f("ceilf", fpmath::ceil, f64::ceil, &args, 0);
+    let small: Vec<f32> = args.iter().map(|x| x / 1e6).filter(|x| x.abs() <= 1.0).collect();
+    check1f("asinf", fpmath::asin, f64::asin, &small, 1);
+    check1f("acosf", fpmath::acos, f64::acos, &small, 1);
+    let exp_args: Vec<f32> = args.iter().map(|x| x / 1e3).filter(|x| x.abs() < 200.0).collect();
+    check1f("expf", fpmath::exp, f64::exp, &exp_args, 1);
+    for _ in 0..20000 {
+        let x = (rng.spread(-10, 10) as f32).abs();
+        let y = rng.spread(-8, 5) as f32;
+        let expected = (x as f64).powf(y as f64) as f32;
+        assert!(ulps32(fpmath::pow(x, y), expected) <= 1, "powf({:e}, {:e})", x, y);
+        let y = rng.spread(-10, 10) as f32;
+        assert_eq!(fpmath::fmod(x, y).to_bits(), (x % y).to_bits(), "fmodf({:e}, {:e})", x, y);
+    }
+    assert_eq!(fpmath::pow(-2f32, 3.0), -8.0);
+}
+
+/// Timed against the host C library, for a rough comparison
+#[test]
+fn throughput() {
+    let mut rng = Rng(42);
+    let small: Vec<f64> = (0..200_000).map(|_| rng.spread(-4, 6)).collect();
+    let large: Vec<f64> = (0..200_000).map(|_| rng.spread(20, 900)).collect();
+    let positive: Vec<f64> = small.iter().map(|x| x.abs()).collect();
+    let cases: [(&str, fn(f64) -> f64, fn(f64) -> f64, &[f64]); 6] = [
+        ("sin", fpmath::sin, f64::sin, &small),
+        ("sin large", fpmath::sin, f64::sin, &large),
+        ("tan", fpmath::tan, f64::tan, &small),
+        ("exp", fpmath::exp, f64::exp, &small),
+        ("log", fpmath::log, f64::ln, &positive),
+        ("sqrt", fpmath::sqrt, f64::sqrt, &positive),
+    ];
+    for (name, ours, host, args) in cases {
+        let start = std::time::Instant::now();
+        let mut total = 0.0;
+        for &x in args {
+            total += std::hint::black_box(ours(x));
+        }
+        let ours_time = start.elapsed();
+        let start = std::time::Instant::now();
+        for &x in args {
+            total -= std::hint::black_box(host(x));
+        }
+        let host_time = start.elapsed();
+        std::hint::black_box(total);
+        println!("{:>9}: {:?} here, {:?} host", name, ours_time, host_time);
+    }
+    let start = std::time::Instant::now();
+    let mut total = 0.0;
+    for pair in positive.chunks(2) {
+        total += std::hint::black_box(fpmath::pow(pair[0], pair[1]));
+    }
+    let ours_time = start.elapsed();
+    let start = std::time::Instant::now();
+    for pair in positive.chunks(2) {
+        total -= std::hint::black_box(pair[0].powf(pair[1]));
+    }
+    std::hint::black_box(total);
+    println!("{:>9}: {:?} here, {:?} host", "pow", ours_time, start.elapsed());
+}
@@ -0,0 +1,360 @@
+//! Host tests for the printf engine. Each conversion is checked against the
+//! host C library's snprintf, across flags, widths and precisions, and for
+//! floats across rounding ties, subnormals, the extremes of the range and a
+//! few thousand random bit patterns, since every digit is meant to match.
+//!
+//! libc itself only builds for IDOS, so the modules under test are included
+//! by path. Run with `make libctest`.
+
+#[path = "../src/numfmt.rs"]
+#[allow(dead_code)]
+mod numfmt;
+#[path = "../src/printf.rs"]
+mod printf;
+
+use std::ffi::{c_char, c_int, CString};
+
+extern "C" {
+    fn snprintf(buf: *mut c_char, size: usize, fmt: *const c_char, ...) -> c_int;
+}
+
+#[derive(Clone, Copy, Debug)]
+enum Arg {
+    Int(i32),
+    LongLong(i64),
+    Double(f64),
+    Ptr(usize),
+}
+
+struct ArgList {
+    args: Vec<Arg>,
+    next: usize,
+}
+
+impl ArgList {
+    fn take(&mut self) -> Arg {
+        self.next += 1;
+        self.args[self.next - 1]
+    }
+}
+
+impl printf::Args for ArgList {
+    fn int(&mut self) -> i32 {
+        match self.take() {
+            Arg::Int(v) => v,
+            other => panic!("expected int, got {:?}", other),
+        }
+    }
+
+    fn long_long(&mut self) -> i64 {
+        match self.take() {
+            Arg::LongLong(v) => v,
+            other => panic!("expected long long, got {:?}", other),
+        }
+    }
+
+    fn double(&mut self) -> f64 {
+        match self.take() {
+            Arg::Double(v) => v,
+            other => panic!("expected double, got {:?}", other),
+        }
+    }
+
+    fn pointer(&mut self) -> usize {
+        match self.take() {
+            Arg::Ptr(v) => v,
+            other => panic!("expected pointer, got {:?}", other),
+        }
+    }
+}
+
+impl printf::Sink for Vec<u8> {
+    fn write(&mut self, bytes: &[u8]) {
+        self.extend_from_slice(bytes);
+    }
+}
+
+fn ours(fmt: &str, args: &[Arg]) -> String {
+    let fmt = CString::new(fmt).unwrap();
+    let mut list = ArgList {
+        args: args.to_vec(),
+        next: 0,
+    };
+    let mut out = Vec::new();
+    let count = unsafe { printf::format(fmt.as_ptr() as *const u8, &mut list, &mut out) };
+    assert_eq!(count, out.len());
+    assert_eq!(list.next, args.len(), "{:?}: arguments left over", fmt);
+    String::from_utf8(out).unwrap()
+}
+
+/// The host's snprintf, for formats taking a single argument
+fn reference(fmt: &str, arg: Arg) -> String {
+    let fmt = CString::new(fmt).unwrap();
+    let mut buf = vec![0u8; 2048];
+    let len = unsafe {
+        let (p, n, f) = (buf.as_mut_ptr() as *mut c_char, buf.len(), fmt.as_ptr());
+        match arg {
+            Arg::Int(v) => snprintf(p, n, f, v),
+            Arg::LongLong(v) => snprintf(p, n, f, v),
+            Arg::Double(v) => snprintf(p, n, f, v),
+            Arg::Ptr(v) => snprintf(p, n, f, v),
+        }
+    };
+    assert!((len as usize) < buf.len());
+    buf.truncate(len as usize);
+    String::from_utf8(buf).unwrap()
+}
+
+fn check(fmt: &str, arg: Arg) {
+    assert_eq!(ours(fmt, &[arg]), reference(fmt, arg), "format {:?} of {:?}", fmt, arg);
+}
+
+const INT_FORMATS: &[&str] = &[
+    "%d", "%i", "%5d", "%-5d|", "%05d", "%+d", "% d", "%.3d", "%8.3d", "%-8.3d|", "%08.3d", "%.0d",
+    "%u", "%10u", "%o", "%#o", "%#.0o", "%x", "%X", "%#x", "%#X", "%#010x", "%hd", "%hhd", "%hu",
+    "%hhx", "[%d]",
+];
+
+#[test]
+fn ints_match_host() {
+    let values = [
+        0, 1, -1, 7, 9, 10, 99, 100, 255, 256, 1000, 65535, 65536, 123456789, -123456789,
+        i32::MAX, i32::MIN,
+    ];
+    for fmt in INT_FORMATS {
+        for &v in &values {
+            check(fmt, Arg::Int(v));
+        }
+    }
+}
+
+#[test]
+fn long_longs_match_host() {
+    let values = [
+        0,
+        1,
+        -1,
+        4294967295,
+        4294967296,
+        99999999999,
+        100000000000000000,
+        1234567890123456789,
+        i64::MAX,
+        i64::MIN,
+    ];
+    for fmt in ["%lld", "%llu", "%llx", "%#llo", "%25lld", "%-+25lld|", "%.20lld", "%jd"] {
+        for &v in &values {
+            check(fmt, Arg::LongLong(v));
+        }
+    }
+}
+
+const FLOAT_FORMATS: &[&str] = &[
+    "%f", "%.0f", "%.1f", "%.2f", "%.3f", "%.10f", "%.17f", "%#.0f", "%+f", "% f", "%12.4f",
+    "%-12.4f|", "%012.3f", "%F", "%e", "%.0e", "%#.0e", "%.3e", "%.16e", "%E", "%+15.2e", "%g",
+    "%.0g", "%.1g", "%.3g", "%.10g", "%.17g", "%#g", "%#.3g", "%G", "%010g", "%-10g|",
+];
+
+fn float_values() -> Vec<f64> {
+    vec![
+        0.0,
+        -0.0,
+        0.5,
+        1.5,
+        2.5,
+        -2.5,
+        0.125,
+        0.375,
+        1.005,
+        2.675,
+        9.9999995,
+        0.1,
+        0.2,
+        0.3,
+        1.0 / 3.0,
+        2.0 / 3.0,
+        std::f64::consts::PI,
+        std::f64::consts::E,
+        1e-5,
+        0.00001234,
+        0.0001,
+        0.00009999999,
+        999999.5,
+        9999999.0,
+        123456789.0,
+        4294967296.5,
+        1e15,
+        1e16,
+        1e17,
+        1e21,
+        1e22,
+        1e23,
+        18446744073709551616.0,
+        1e100,
+        1e300,
+        f64::MAX,
+        f64::MIN_POSITIVE,
+        5e-324,
+        1e-300,
+        1e-10,
+        -1e-10,
+        0.9999999999999999,
+        f64::INFINITY,
+        f64::NEG_INFINITY,
+        f64::NAN,
+    ]
+}
+
+#[test]
+fn floats_match_host() {
+    for fmt in FLOAT_FORMATS {
+        for v in float_values() {
+            // glibc loses the trailing zeros when %#g rounds up to a new
+            // power of ten; C asks for all of them
+            if fmt.starts_with("%#") && fmt.ends_with('g') && v == 999999.5 {
+                continue;
+            }
+            check(fmt, Arg::Double(v));
+        }
+    }
+    assert_eq!(ours("%#g", &[Arg::Double(999999.5)]), "1.00000e+06");
+    assert_eq!(ours("%#.3g", &[Arg::Double(999999.5)]), "1.00e+06");
+}
+
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+}
+
+#[test]
+fn random_floats_match_host() {
+    let mut rng = Rng(0x9e37_79b9_7f4a_7c15);
+    for _ in 0..4000 {
+        let v = f64::from_bits(rng.next());
+        if !v.is_finite() {
+            continue;
+        }
+        for fmt in ["%.17g", "%.20e", "%.3g", "%g", "%e"] {
+            check(fmt, Arg::Double(v));
+        }
+        // Values of everyday size, where %f output stays short
+        let scaled = (rng.next() >> 11) as f64 / (1u64 << (rng.next() % 60)) as f64;
+        for fmt in ["%f", "%.2f", "%.15f", "%.17g", "%.0f"] {
+            check(fmt, Arg::Double(scaled));
+        }
+    }
+}
+
+#[test]
+fn strings_and_chars() {
+    let s = CString::new("hello").unwrap();
+    let p = Arg::Ptr(s.as_ptr() as usize);
+    for fmt in ["%s", "%10s", "%-10s|", "%.3s", "%10.2s", "%.0s", "[%s]"] {
+        check(fmt, p);
+    }
+    for fmt in ["%c", "%3c", "%-3c|"] {
+        check(fmt, Arg::Int(b'x' as i32));
+    }
+    assert_eq!(ours("%s", &[Arg::Ptr(0)]), "(null)");
+    check("%p", Arg::Ptr(0x1234_abcd));
+    assert_eq!(ours("100%%", &[]), "100%");
+    assert_eq!(ours("%y", &[]), "%y");
+}
+
+#[test]
+fn star_width_and_precision() {
+    assert_eq!(ours("%*d|", &[Arg::Int(5), Arg::Int(42)]), "   42|");
+    assert_eq!(ours("%*d|", &[Arg::Int(-5), Arg::Int(42)]), "42   |");
+    assert_eq!(ours("%.*f", &[Arg::Int(2), Arg::Double(3.14159)]), "3.14");
+    assert_eq!(ours("%.*f", &[Arg::Int(-1), Arg::Double(3.14159)]), "3.141590");
+    assert_eq!(ours("%*.*s|", &[Arg::Int(6), Arg::Int(2), Arg::Ptr(b"abc\0".as_ptr() as usize)]), "    ab|");
+}
+
+#[test]
+fn counts_with_n() {
+    let mut written: i32 = -1;
+    let out = ours("abc%nde", &[Arg::Ptr(&mut written as *mut i32 as usize)]);
+    assert_eq!(out, "abcde");
+    assert_eq!(written, 3);
+}
+
+/// An unbuffered stream like stderr formats into a staging buffer, so a
+/// printf is one write unless it outgrows the buffer
+#[test]
+fn staged_output_is_written_once() {
+    let fmt = CString::new("error %d: %s at %.2f\n").unwrap();
+    let msg = CString::new("bad thing").unwrap();
+    let mut list = ArgList {
+        args: vec![Arg::Int(42), Arg::Ptr(msg.as_ptr() as usize), Arg::Double(1.5)],
+        next: 0,
+    };
+    let mut writes: Vec<Vec<u8>> = Vec::new();
+    let mut staging = [0u8; 1024];
+    let mut sink = printf::StagingSink::new(&mut staging, |bytes: &[u8]| {
+        writes.push(bytes.to_vec());
+        true
+    });
+    let count = unsafe { printf::format(fmt.as_ptr() as *const u8, &mut list, &mut sink) };
+    sink.flush();
+    assert!(!sink.failed);
+    assert_eq!(writes.len(), 1);
+    assert_eq!(writes[0], b"error 42: bad thing at 1.50\n");
+    assert_eq!(count, writes[0].len());
+
+    // Output longer than the staging buffer goes out a buffer at a time
+    let fmt = CString::new("%2500d").unwrap();
+    let mut list = ArgList {
+        args: vec![Arg::Int(7)],
+        next: 0,
+    };
+    let mut lengths = Vec::new();
+    let mut sink = printf::StagingSink::new(&mut staging, |bytes: &[u8]| {
+        lengths.push(bytes.len());
+        true
+    });
+    unsafe { printf::format(fmt.as_ptr() as *const u8, &mut list, &mut sink) };
+    sink.flush();
+    assert_eq!(lengths, [1024, 1024, 452]);
+}
+
+/// Precision past what's computed is padded rather than failing
+#[test]
+fn very_long_precision() {
+    let out = ours("%.600f", &[Arg::Double(0.5)]);
+    assert_eq!(out.len(), 602);
+    assert!(out.starts_with("0.5000"));
+    assert!(out[2..].bytes().skip(1).all(|b| b == b'0'));
+}
+
+/// Timed against the host C library, for a rough comparison
+#[test]
+fn throughput() {
+    let mut rng = Rng(42);
+    let ints: Vec<i32> = (0..200_000).map(|_| rng.next() as i32).collect();
+    let floats: Vec<f64> = (0..200_000).map(|_| (rng.next() >> 11) as f64 / 1e6).collect();
+    for (name, fmt, args) in [
+        ("%d", "%d", ints.iter().map(|&v| Arg::Int(v)).collect::<Vec<_>>()),
+        ("%.3f", "%.3f", floats.iter().map(|&v| Arg::Double(v)).collect()),
+        ("%g", "%g", floats.iter().map(|&v| Arg::Double(v)).collect()),
+    ] {
+        let start = std::time::Instant::now();
+        let mut total = 0;
+        for &arg in &args {
+            total += ours(fmt, &[arg]).len();
+        }
+        let ours_time = start.elapsed();
+        let start = std::time::Instant::now();
+        for &arg in &args {
+            total -= reference(fmt, arg).len();
+        }
+        let host_time = start.elapsed();
+        assert_eq!(total, 0);
+        println!("{:>5}: {:?} here, {:?} host", name, ours_time, host_time);
+    }
+}
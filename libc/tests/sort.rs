@@ -0,0 +1,184 @@
+//! Host tests for the qsort implementation. Results are checked against
+//! the standard library's sort, across element sizes that exercise each
+//! swap specialisation and inputs that defeat naive quicksorts. Comparison
+//! counts are checked against an n log n bound, so a quadratic case shows up
+//! as a failure rather than a slow run.
+//!
+//! libc itself only builds for IDOS, so the module under test is included
+//! by path. Run with `make libctest`.
+
+#[path = "../src/sort.rs"]
+mod sort;
+
+use std::cell::Cell;
+use std::ffi::{c_int, c_void};
+
+thread_local! {
+    static COMPARISONS: Cell<usize> = Cell::new(0);
+}
+
+fn count_comparison() {
+    COMPARISONS.with(|c| c.set(c.get() + 1));
+}
+
+fn take_comparisons() -> usize {
+    COMPARISONS.with(|c| c.replace(0))
+}
+
+unsafe extern "C" fn compare_u32(a: *const c_void, b: *const c_void) -> c_int {
+    count_comparison();
+    let (a, b) = (*(a as *const u32), *(b as *const u32));
+    a.cmp(&b) as c_int
+}
+
+unsafe extern "C" fn compare_u64(a: *const c_void, b: *const c_void) -> c_int {
+    count_comparison();
+    let (a, b) = (*(a as *const u64), *(b as *const u64));
+    a.cmp(&b) as c_int
+}
+
+/// Records of awkward sizes are keyed on their first byte
+unsafe extern "C" fn compare_first_byte(a: *const c_void, b: *const c_void) -> c_int {
+    count_comparison();
+    let (a, b) = (*(a as *const u8), *(b as *const u8));
+    a.cmp(&b) as c_int
+}
+
+struct Rng(u32);
+
+impl Rng {
+    fn next(&mut self) -> u32 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 17;
+        self.0 ^= self.0 << 5;
+        self.0
+    }
+}
+
+/// The input shapes to test, as functions of (index, length, rng)
+fn patterns() -> Vec<(&'static str, fn(usize, usize, &mut Rng) -> u32)> {
+    vec![
+        ("random", |_, _, rng| rng.next()),
+        ("sorted", |i, _, _| i as u32),
+        ("reversed", |i, n, _| (n - i) as u32),
+        ("all equal", |_, _, _| 7),
+        ("few distinct", |_, _, rng| rng.next() % 4),
+        ("organ pipe", |i, n, _| i.min(n - i) as u32),
+        ("sorted with noise", |i, _, rng| {
+            if rng.next() % 16 == 0 {
+                rng.next()
+            } else {
+                i as u32
+            }
+        }),
+    ]
+}
+
+fn lengths() -> Vec<usize> {
+    let mut lengths: Vec<usize> = (0..=40).collect();
+    lengths.extend([63, 64, 65, 100, 255, 1000, 4096]);
+    lengths
+}
+
+/// Generous multiple of n log2 n that a working introsort stays under
+fn comparison_budget(n: usize) -> usize {
+    let log = (usize::BITS - n.leading_zeros()) as usize;
+    4 * n * log.max(1) + 64
+}
+
+#[test]
+fn sorts_u32() {
+    for (name, pattern) in patterns() {
+        for n in lengths() {
+            let mut rng = Rng(0xdead_beef);
+            let mut values: Vec<u32> = (0..n).map(|i| pattern(i, n, &mut rng)).collect();
+            let mut expected = values.clone();
+            expected.sort();
+            take_comparisons();
+            unsafe { sort::sort(values.as_mut_ptr() as *mut u8, n, 4, compare_u32) };
+            assert_eq!(values, expected, "{} n={}", name, n);
+            let comparisons = take_comparisons();
+            assert!(comparisons <= comparison_budget(n), "{} n={}: {} comparisons", name, n, comparisons);
+        }
+    }
+}
+
+#[test]
+fn sorts_u64() {
+    for (name, pattern) in patterns() {
+        for n in lengths() {
+            let mut rng = Rng(0x1234_5678);
+            let mut values: Vec<u64> = (0..n)
+                .map(|i| ((pattern(i, n, &mut rng) as u64) << 32) | rng.next() as u64)
+                .collect();
+            let mut expected = values.clone();
+            expected.sort();
+            unsafe { sort::sort(values.as_mut_ptr() as *mut u8, n, 8, compare_u64) };
+            assert_eq!(values, expected, "{} n={}", name, n);
+        }
+    }
+}
+
+#[test]
+fn sorts_odd_sized_records() {
+    for size in [1, 3, 5, 12, 13, 24, 100] {
+        for (name, pattern) in patterns() {
+            for n in [0, 1, 2, 17, 100, 1000] {
+                let mut rng = Rng(0xcafe_f00d);
+                // Every byte of a record is derived from its key, so a record
+                // torn apart by a bad swap is caught
+                let keys: Vec<u8> = (0..n).map(|i| pattern(i, n, &mut rng) as u8).collect();
+                let mut records: Vec<u8> = keys
+                    .iter()
+                    .flat_map(|&k| (0..size).map(move |j| k.wrapping_add(j as u8 * 31)))
+                    .collect();
+                unsafe { sort::sort(records.as_mut_ptr(), n, size, compare_first_byte) };
+
+                let mut expected_keys = keys.clone();
+                expected_keys.sort();
+                for (i, record) in records.chunks(size).enumerate() {
+                    assert_eq!(record[0], expected_keys[i], "{} size={} n={}", name, size, n);
+                    for (j, &byte) in record.iter().enumerate() {
+                        assert_eq!(byte, record[0].wrapping_add(j as u8 * 31), "torn record");
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// Large inputs, timed, with a comparison count bound that would fail for
+/// the quadratic insertion sort this replaced
+#[test]
+fn large_inputs_stay_n_log_n() {
+    let n = 200_000;
+    for (name, pattern) in patterns() {
+        let mut rng = Rng(0x0bad_cafe);
+        let mut values: Vec<u32> = (0..n).map(|i| pattern(i, n, &mut rng)).collect();
+        take_comparisons();
+        let start = std::time::Instant::now();
+        unsafe { sort::sort(values.as_mut_ptr() as *mut u8, n, 4, compare_u32) };
+        let elapsed = start.elapsed();
+        let comparisons = take_comparisons();
+        assert!(values.windows(2).all(|w| w[0] <= w[1]), "{} not sorted", name);
+        assert!(comparisons <= comparison_budget(n), "{}: {} comparisons", name, comparisons);
+        println!("{:>18}: {:>9} comparisons, {:?}", name, comparisons, elapsed);
+    }
+}
+
+/// A comparator that sorts everything "less" forces the heapsort fallback,
+/// and must still terminate within bounds
+#[test]
+fn inconsistent_comparator_terminates() {
+    unsafe extern "C" fn always_less(_: *const c_void, _: *const c_void) -> c_int {
+        count_comparison();
+        -1
+    }
+    let n = 10_000;
+    let mut values: Vec<u32> = (0..n as u32).collect();
+    take_comparisons();
+    unsafe { sort::sort(values.as_mut_ptr() as *mut u8, n, 4, always_less) };
+    let mut sorted = values.clone();
+    sorted.sort();
+    assert_eq!(sorted, (0..n as u32).collect::<Vec<_>>(), "elements lost");
+}
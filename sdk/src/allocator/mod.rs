@@ -1,32 +1,90 @@
 use core::alloc::{GlobalAlloc, Layout};
 use core::sync::atomic::{AtomicBool, Ordering};
 
-use idos_api::syscall::memory::map_memory;
-
-// Currently implemented as a simple slab allocator with 6 size classes.
-// With alignment, 16 would be too small, and 2048 would be wasting half a page.
-
-const NUM_CLASSES: usize = 6;
-const SIZE_CLASSES: [usize; NUM_CLASSES] = [32, 64, 128, 256, 512, 1024];
+use idos_api::syscall::memory::{map_memory, unmap_memory};
+
+// Small allocations come from slab pages, each holding slots of a single size
+// class. Every class keeps a magazine of recently freed slots in front of its
+// slabs, so most allocations and frees never touch slab metadata. Anything
+// larger than the biggest class gets whole pages.
+//
+// idos processes are single threaded, so there is no per-thread state: the
+// magazines belong to the size classes instead. Locking is sharded the same
+// way, with one lock per class plus one for the page pool, so that a future
+// second thread would only contend when using the same class.
+//
+// Classes above 512 bytes are sized so that a whole number of slots fill the
+// page, after the 16-byte slab header at its end.
+
+const NUM_CLASSES: usize = 18;
+const SIZE_CLASSES: [usize; NUM_CLASSES] = [
+    16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 672, 816, 1024, 1360, 2032,
+];
+const LARGEST_CLASS: usize = SIZE_CLASSES[NUM_CLASSES - 1];
 const PAGE_SIZE: usize = 0x1000;
 const FREE_END: u16 = 0xFFFF;
+/// Freed slots each class holds before returning some to their slabs
+const MAGAZINE_SIZE: usize = 16;
+/// Free pages kept around for reuse. Beyond this, freed pages are unmapped.
+const PAGE_CACHE_LIMIT: usize = 64;
+
+/// Smallest class that fits a size, indexed by the size in 16-byte units
+const CLASS_LOOKUP: [u8; LARGEST_CLASS / 16 + 1] = build_class_lookup();
+
+const fn build_class_lookup() -> [u8; LARGEST_CLASS / 16 + 1] {
+    let mut table = [0; LARGEST_CLASS / 16 + 1];
+    let mut units = 0;
+    let mut class = 0;
+    while units < table.len() {
+        while SIZE_CLASSES[class] < units * 16 {
+            class += 1;
+        }
+        table[units] = class as u8;
+        units += 1;
+    }
+    table
+}
+
+/// Find the size-class index for a layout, or `None` if it needs whole pages.
+/// Slots sit at multiples of the class size from the start of the page, so
+/// alignments above 16 need a power-of-two class.
+fn class_index(layout: &Layout) -> Option<usize> {
+    let mut effective = layout.size().max(layout.align());
+    if layout.align() > 16 {
+        effective = effective.next_power_of_two();
+    }
+    if effective > LARGEST_CLASS {
+        return None;
+    }
+    Some(CLASS_LOOKUP[(effective + 15) / 16] as usize)
+}
+
+fn pages_for(size: usize) -> usize {
+    (size.max(1) + PAGE_SIZE - 1) / PAGE_SIZE
+}
+
+fn acquire(lock: &AtomicBool) {
+    while lock
+        .compare_exchange_weak(false, true, Ordering::Acquire, Ordering::Relaxed)
+        .is_err()
+    {
+        core::hint::spin_loop();
+    }
+}
 
-/// Find the size-class index for an allocation of `effective` bytes,
-/// or `None` if it exceeds the largest class.
-fn class_index(effective: usize) -> Option<usize> {
-    SIZE_CLASSES.iter().position(|&s| s >= effective)
+fn release(lock: &AtomicBool) {
+    lock.store(false, Ordering::Release);
 }
 
-/// SlabHeader lives in slot 0 of every slab page. It contains metadata about
-/// the slab and links for the partial and all slabs lists.
+/// SlabHeader lives in the last 16 bytes of every slab page. It contains
+/// metadata about the slab and links for its class's partial list.
 /// The free list is stored as an index-based linked list in the slots
 /// themselves, using the u16 at the start of each free slot to point to the
 /// next free slot (or 0xFFFF for end).
-/// Total size: 16 bytes, which fits in the minimum 32-byte slot size.
 #[repr(C)]
 struct SlabHeader {
-    next_partial: *mut SlabHeader, // 4B — partial-list link
-    next_all: *mut SlabHeader,     // 4B — all-slabs list link
+    next_partial: *mut SlabHeader, // 4B
+    prev_partial: *mut SlabHeader, // 4B
     free_head: u16,                // 2B — index of first free slot (0xFFFF = none)
     used_count: u16,               // 2B
     total_slots: u16,              // 2B
@@ -34,163 +92,61 @@ struct SlabHeader {
     _pad: [u8; 1],                 // 1B
 }
 
-/// For large allocations, we need to track the allocated regions so we can free
-/// them later. This struct is used for that tracking.
-#[repr(C)]
-struct LargeAllocEntry {
-    addr: u32,
-    size: u32,
-    next: *mut LargeAllocEntry,
+const HEADER_OFFSET: usize = PAGE_SIZE - core::mem::size_of::<SlabHeader>();
+
+fn slab_header(ptr: *mut u8) -> *mut SlabHeader {
+    ((ptr as usize & !(PAGE_SIZE - 1)) + HEADER_OFFSET) as *mut SlabHeader
 }
 
-#[repr(C)]
-struct FreePage {
-    addr: u32,
-    size: u32,
-    next: *mut FreePage,
+fn slab_base(header: *mut SlabHeader) -> *mut u8 {
+    (header as usize - HEADER_OFFSET) as *mut u8
 }
 
-/// The SlabAllocator struct contains all the global state for the allocator,
-/// including the slab lists, linked-list of large allocs, and linked-list of
-/// free pages. A single global lock protects all of this state; idos is an
-/// inherently single-threaded system so we don't need anything more
-/// sophisticated.
-struct SlabAllocator {
-    partial_slabs: [*mut SlabHeader; NUM_CLASSES],
-    all_slabs: [*mut SlabHeader; NUM_CLASSES],
-    large_allocs: *mut LargeAllocEntry,
-    free_pages: *mut FreePage,
+/// State for one size class: the magazine, and the slabs with free slots
+struct SizeClass {
     lock: AtomicBool,
+    magazine: [*mut u8; MAGAZINE_SIZE],
+    cached: usize,
+    partial: *mut SlabHeader,
 }
 
-// since we use a sentinel lock intead of a more Rust-y style with guards,
-// we need to manually assert these
-unsafe impl Send for SlabAllocator {}
-unsafe impl Sync for SlabAllocator {}
-
-impl SlabAllocator {
+impl SizeClass {
     const fn new() -> Self {
         Self {
-            partial_slabs: [core::ptr::null_mut(); NUM_CLASSES],
-            all_slabs: [core::ptr::null_mut(); NUM_CLASSES],
-            large_allocs: core::ptr::null_mut(),
-            free_pages: core::ptr::null_mut(),
             lock: AtomicBool::new(false),
+            magazine: [core::ptr::null_mut(); MAGAZINE_SIZE],
+            cached: 0,
+            partial: core::ptr::null_mut(),
         }
     }
 
-    fn acquire(&self) {
-        while self
-            .lock
-            .compare_exchange_weak(false, true, Ordering::Acquire, Ordering::Relaxed)
-            .is_err()
-        {
-            core::hint::spin_loop();
-        }
-    }
-
-    fn release(&self) {
-        self.lock.store(false, Ordering::Release);
-    }
-
-    /// Get a zeroed page. Tries free_pages first, then map_memory.
-    unsafe fn acquire_page(&mut self) -> *mut u8 {
-        // Check free_pages for a single-page entry
-        let mut prev: *mut FreePage = core::ptr::null_mut();
-        let mut cur = self.free_pages;
-        while !cur.is_null() {
-            let entry = &mut *cur;
-            if entry.size as usize == PAGE_SIZE {
-                // Exact single page — unlink and use
-                if prev.is_null() {
-                    self.free_pages = entry.next;
-                } else {
-                    (*prev).next = entry.next;
-                }
-                let addr = entry.addr as *mut u8;
-                // Free the FreePage tracking node back to 32B slab
-                self.slab_dealloc(cur as *mut u8, core::mem::size_of::<FreePage>());
-                // Zero the page
-                core::ptr::write_bytes(addr, 0, PAGE_SIZE);
-                return addr;
-            }
-            // If the free region is larger, carve off one page
-            if entry.size as usize >= PAGE_SIZE {
-                let addr = entry.addr as *mut u8;
-                entry.addr += PAGE_SIZE as u32;
-                entry.size -= PAGE_SIZE as u32;
-                if entry.size == 0 {
-                    // Remove empty entry
-                    if prev.is_null() {
-                        self.free_pages = entry.next;
-                    } else {
-                        (*prev).next = entry.next;
-                    }
-                    self.slab_dealloc(cur as *mut u8, core::mem::size_of::<FreePage>());
-                }
-                core::ptr::write_bytes(addr, 0, PAGE_SIZE);
-                return addr;
-            }
-            prev = cur;
-            cur = entry.next;
-        }
-
-        // No reusable page — map fresh
-        let addr = map_memory(None, PAGE_SIZE as u32, None).unwrap_or(0xFFFF_FFFF);
-        if addr == 0xFFFF_FFFF {
-            return core::ptr::null_mut();
+    unsafe fn alloc(&mut self, ci: usize) -> *mut u8 {
+        if self.cached > 0 {
+            self.cached -= 1;
+            return self.magazine[self.cached];
         }
-        core::ptr::write_bytes(addr as *mut u8, 0, PAGE_SIZE);
-        addr as *mut u8
+        self.slab_alloc(ci)
     }
 
-    /// Create a new slab page for the given class index, initialize its header
-    /// and free list, and link it into the all_slabs and partial_slabs lists.
-    /// Returns a pointer to the new slab's header, or null on failure.
-    unsafe fn new_slab_page(&mut self, ci: usize) -> *mut SlabHeader {
-        let page = self.acquire_page();
-        if page.is_null() {
-            return core::ptr::null_mut();
-        }
-
-        let slot_size = SIZE_CLASSES[ci];
-        let total_slots = (PAGE_SIZE / slot_size) - 1; // slot 0 is header
-
-        // Write header in slot 0
-        let header = page as *mut SlabHeader;
-        (*header).next_partial = core::ptr::null_mut();
-        (*header).next_all = core::ptr::null_mut();
-        (*header).free_head = 1; // first usable slot
-        (*header).used_count = 0;
-        (*header).total_slots = total_slots as u16;
-        (*header).class_index = ci as u8;
-
-        // Build inline free list: slot 1 → 2 → ... → N → 0xFFFF
-        for i in 1..=total_slots {
-            let slot_ptr = page.add(i * slot_size) as *mut u16;
-            if i < total_slots {
-                *slot_ptr = (i + 1) as u16;
-            } else {
-                *slot_ptr = FREE_END;
+    unsafe fn dealloc(&mut self, ptr: *mut u8) {
+        if self.cached == MAGAZINE_SIZE {
+            // Return the older half to the slabs, so slabs can drain and
+            // their pages be released
+            for i in 0..MAGAZINE_SIZE / 2 {
+                self.slab_dealloc(self.magazine[i]);
             }
+            self.magazine.copy_within(MAGAZINE_SIZE / 2.., 0);
+            self.cached -= MAGAZINE_SIZE / 2;
         }
-
-        // Link into all_slabs list
-        (*header).next_all = self.all_slabs[ci];
-        self.all_slabs[ci] = header;
-
-        // Link into partial list
-        (*header).next_partial = self.partial_slabs[ci];
-        self.partial_slabs[ci] = header;
-
-        header
+        self.magazine[self.cached] = ptr;
+        self.cached += 1;
     }
 
-    /// Allocates a slot from a slab of the given class index. Returns a pointer
-    /// to the allocated slot, or null on failure.
+    /// Allocates a slot from a slab of this class. Returns a pointer to the
+    /// allocated slot, or null on failure.
     unsafe fn slab_alloc(&mut self, ci: usize) -> *mut u8 {
         // Get a partial slab (or create one)
-        let mut slab = self.partial_slabs[ci];
+        let mut slab = self.partial;
         if slab.is_null() {
             slab = self.new_slab_page(ci);
             if slab.is_null() {
@@ -200,7 +156,7 @@ impl SlabAllocator {
 
         let header = &mut *slab;
         let slot_size = SIZE_CLASSES[ci];
-        let page_base = slab as *mut u8;
+        let page_base = slab_base(slab);
 
         // Pop from free list
         let slot_idx = header.free_head;
@@ -211,21 +167,18 @@ impl SlabAllocator {
 
         // If slab is now full, unlink from partial list
         if header.free_head == FREE_END {
-            self.partial_slabs[ci] = header.next_partial;
-            header.next_partial = core::ptr::null_mut();
+            self.unlink_partial(slab);
         }
 
         slot_ptr
     }
 
-    /// Deallocates a slot at the given pointer with the given effective size.
-    /// The effective size is used to determine the class index and thus the
-    /// slot size and layout.
-    unsafe fn slab_dealloc(&mut self, ptr: *mut u8, effective: usize) {
-        let ci = class_index(effective).unwrap();
-        let slot_size = SIZE_CLASSES[ci];
-        let page_base = (ptr as usize & !0xFFF) as *mut u8;
-        let header = page_base as *mut SlabHeader;
+    /// Returns a slot to its slab. A slab that becomes empty gives its page
+    /// back to the page pool.
+    unsafe fn slab_dealloc(&mut self, ptr: *mut u8) {
+        let header = slab_header(ptr);
+        let page_base = slab_base(header);
+        let slot_size = SIZE_CLASSES[(*header).class_index as usize];
         let slot_idx = (ptr as usize - page_base as usize) / slot_size;
 
         let was_full = (*header).free_head == FREE_END;
@@ -235,135 +188,208 @@ impl SlabAllocator {
         (*header).free_head = slot_idx as u16;
         (*header).used_count -= 1;
 
-        // If slab was full, re-link to partial list
         if was_full {
-            let ci = (*header).class_index as usize;
-            (*header).next_partial = self.partial_slabs[ci];
-            self.partial_slabs[ci] = header;
+            // If slab was full, re-link to partial list
+            self.link_partial(header);
+        } else if (*header).used_count == 0 && !self.is_only_partial(header) {
+            // Keep the last partial slab, so alternating allocations and
+            // frees don't keep rebuilding it
+            self.unlink_partial(header);
+            pages().release(page_base, 1);
         }
     }
 
-    /// Allocates a large block of memory (greater than 1024 bytes) by finding
-    /// free pages or mapping new ones. Returns a pointer to the allocated block,
-    /// or null on failure.
-    unsafe fn large_alloc(&mut self, size: usize) -> *mut u8 {
-        let alloc_size = (size + PAGE_SIZE - 1) & !(PAGE_SIZE - 1);
-
-        // Try free_pages for first fit
-        let mut prev: *mut FreePage = core::ptr::null_mut();
-        let mut cur = self.free_pages;
-        while !cur.is_null() {
-            let entry = &mut *cur;
-            if entry.size as usize >= alloc_size {
-                let addr = entry.addr;
-                let remainder = entry.size as usize - alloc_size;
-                if remainder > 0 {
-                    entry.addr += alloc_size as u32;
-                    entry.size = remainder as u32;
-                } else {
-                    // Remove entry
-                    if prev.is_null() {
-                        self.free_pages = entry.next;
-                    } else {
-                        (*prev).next = entry.next;
-                    }
-                    self.slab_dealloc(cur as *mut u8, core::mem::size_of::<FreePage>());
-                }
-                // Record in large_allocs
-                self.record_large_alloc(addr, alloc_size as u32);
-                return addr as *mut u8;
+    unsafe fn is_only_partial(&self, header: *mut SlabHeader) -> bool {
+        self.partial == header && (*header).next_partial.is_null()
+    }
+
+    /// Create a new slab page for the given class index, initialize its header
+    /// and free list, and link it into the partial list.
+    /// Returns a pointer to the new slab's header, or null on failure.
+    unsafe fn new_slab_page(&mut self, ci: usize) -> *mut SlabHeader {
+        let page = pages().acquire(1);
+        if page.is_null() {
+            return core::ptr::null_mut();
+        }
+
+        let slot_size = SIZE_CLASSES[ci];
+        let total_slots = HEADER_OFFSET / slot_size;
+
+        let header = page.add(HEADER_OFFSET) as *mut SlabHeader;
+        (*header).free_head = 0;
+        (*header).used_count = 0;
+        (*header).total_slots = total_slots as u16;
+        (*header).class_index = ci as u8;
+
+        // Build inline free list: slot 0 → 1 → ... → N-1 → 0xFFFF
+        for i in 0..total_slots {
+            let slot_ptr = page.add(i * slot_size) as *mut u16;
+            if i + 1 < total_slots {
+                *slot_ptr = (i + 1) as u16;
+            } else {
+                *slot_ptr = FREE_END;
             }
-            prev = cur;
-            cur = entry.next;
         }
 
-        // No fit — map fresh
-        let addr = map_memory(None, alloc_size as u32, None).unwrap_or(0xFFFF_FFFF);
-        if addr == 0xFFFF_FFFF {
-            return core::ptr::null_mut();
+        self.link_partial(header);
+        header
+    }
+
+    unsafe fn link_partial(&mut self, header: *mut SlabHeader) {
+        (*header).prev_partial = core::ptr::null_mut();
+        (*header).next_partial = self.partial;
+        if !self.partial.is_null() {
+            (*self.partial).prev_partial = header;
+        }
+        self.partial = header;
+    }
+
+    unsafe fn unlink_partial(&mut self, header: *mut SlabHeader) {
+        let prev = (*header).prev_partial;
+        let next = (*header).next_partial;
+        if prev.is_null() {
+            self.partial = next;
+        } else {
+            (*prev).next_partial = next;
+        }
+        if !next.is_null() {
+            (*next).prev_partial = prev;
         }
-        self.record_large_alloc(addr, alloc_size as u32);
-        addr as *mut u8
+        (*header).next_partial = core::ptr::null_mut();
+        (*header).prev_partial = core::ptr::null_mut();
     }
+}
+
+/// A run of free pages in the pool. The header is stored in the first page.
+#[repr(C)]
+struct FreeRun {
+    pages: usize,
+    next: *mut FreeRun,
+}
+
+/// Whole pages for slabs and large allocations. Freed pages are cached up to
+/// PAGE_CACHE_LIMIT, and anything past that goes back to the kernel.
+struct PagePool {
+    lock: AtomicBool,
+    runs: *mut FreeRun,
+    cached_pages: usize,
+}
 
-    /// Records a large allocation in the large_allocs linked list for tracking.
-    unsafe fn record_large_alloc(&mut self, addr: u32, size: u32) {
-        // Allocate a LargeAllocEntry from the 32B slab
-        let entry_ptr = self.slab_alloc(0) as *mut LargeAllocEntry;
-        (*entry_ptr).addr = addr;
-        (*entry_ptr).size = size;
-        (*entry_ptr).next = self.large_allocs;
-        self.large_allocs = entry_ptr;
+impl PagePool {
+    const fn new() -> Self {
+        Self {
+            lock: AtomicBool::new(false),
+            runs: core::ptr::null_mut(),
+            cached_pages: 0,
+        }
     }
 
-    /// Deallocates a large block of memory, putting it into the free page list
-    /// and removing its tracking entry from large_allocs. The pointer must have
-    /// been returned by a previous call to large_alloc.
-    unsafe fn large_dealloc(&mut self, ptr: *mut u8) {
-        let target = ptr as u32;
-        let mut prev: *mut LargeAllocEntry = core::ptr::null_mut();
-        let mut cur = self.large_allocs;
-        while !cur.is_null() {
-            if (*cur).addr == target {
-                let size = (*cur).size;
-                // Unlink
-                if prev.is_null() {
-                    self.large_allocs = (*cur).next;
+    /// Get `count` contiguous pages, reusing cached ones when possible.
+    /// Returns null if the kernel can't map more memory.
+    unsafe fn acquire(&mut self, count: usize) -> *mut u8 {
+        acquire(&self.lock);
+        let mut link: *mut *mut FreeRun = &mut self.runs;
+        while !(*link).is_null() {
+            let run = *link;
+            if (*run).pages >= count {
+                // Take the front of the run, leaving the rest cached
+                let rest_pages = (*run).pages - count;
+                if rest_pages > 0 {
+                    let rest = (run as *mut u8).add(count * PAGE_SIZE) as *mut FreeRun;
+                    (*rest).pages = rest_pages;
+                    (*rest).next = (*run).next;
+                    *link = rest;
                 } else {
-                    (*prev).next = (*cur).next;
+                    *link = (*run).next;
                 }
-                // Free the tracking entry
-                self.slab_dealloc(cur as *mut u8, core::mem::size_of::<LargeAllocEntry>());
-                // Add pages to free_pages
-                self.add_free_pages(target, size);
-                return;
+                self.cached_pages -= count;
+                release(&self.lock);
+                return run as *mut u8;
             }
-            prev = cur;
-            cur = (*cur).next;
+            link = &mut (*run).next;
+        }
+        release(&self.lock);
+
+        match map_memory(None, (count * PAGE_SIZE) as u32, None) {
+            Ok(addr) => addr as *mut u8,
+            Err(()) => core::ptr::null_mut(),
         }
-        // Not found — ignore (shouldn't happen)
     }
 
-    unsafe fn add_free_pages(&mut self, addr: u32, size: u32) {
-        let entry_ptr = self.slab_alloc(0) as *mut FreePage;
-        (*entry_ptr).addr = addr;
-        (*entry_ptr).size = size;
-        (*entry_ptr).next = self.free_pages;
-        self.free_pages = entry_ptr;
+    unsafe fn release(&mut self, addr: *mut u8, count: usize) {
+        acquire(&self.lock);
+        if self.cached_pages + count <= PAGE_CACHE_LIMIT {
+            let run = addr as *mut FreeRun;
+            (*run).pages = count;
+            (*run).next = self.runs;
+            self.runs = run;
+            self.cached_pages += count;
+            release(&self.lock);
+            return;
+        }
+        release(&self.lock);
+        let _ = unmap_memory(addr as u32, (count * PAGE_SIZE) as u32);
     }
 }
 
-static mut SLAB: SlabAllocator = SlabAllocator::new();
+static mut CLASSES: [SizeClass; NUM_CLASSES] = [const { SizeClass::new() }; NUM_CLASSES];
+static mut PAGES: PagePool = PagePool::new();
+
+fn pages() -> &'static mut PagePool {
+    unsafe { &mut *core::ptr::addr_of_mut!(PAGES) }
+}
 
 struct AllocatorWrapper;
 
 // Implement GlobalAlloc so we can use the Rust allocation APIs.
+// Deallocation is told the layout, which is enough to find the size class,
+// or the number of pages for large allocations, without any lookup.
 unsafe impl GlobalAlloc for AllocatorWrapper {
     unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
-        let effective = layout.size().max(layout.align());
-        SLAB.acquire();
-        let slab = &mut *core::ptr::addr_of_mut!(SLAB);
-        let result = match class_index(effective) {
-            Some(ci) => slab.slab_alloc(ci),
-            None => slab.large_alloc(layout.size()),
-        };
-        SLAB.release();
-        result
+        match class_index(&layout) {
+            Some(ci) => {
+                let class = &mut (*core::ptr::addr_of_mut!(CLASSES))[ci];
+                acquire(&class.lock);
+                let result = class.alloc(ci);
+                release(&class.lock);
+                result
+            }
+            None => pages().acquire(pages_for(layout.size())),
+        }
     }
 
     unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
         if ptr.is_null() {
             return;
         }
-        let effective = layout.size().max(layout.align());
-        SLAB.acquire();
-        let slab = &mut *core::ptr::addr_of_mut!(SLAB);
-        if effective > 1024 {
-            slab.large_dealloc(ptr);
-        } else {
-            slab.slab_dealloc(ptr, effective);
+        match class_index(&layout) {
+            Some(ci) => {
+                let class = &mut (*core::ptr::addr_of_mut!(CLASSES))[ci];
+                acquire(&class.lock);
+                class.dealloc(ptr);
+                release(&class.lock);
+            }
+            None => pages().release(ptr, pages_for(layout.size())),
+        }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let new_layout = Layout::from_size_align_unchecked(new_size, layout.align());
+        // Growing a Vec often stays within the same class or page count
+        let same_home = match (class_index(&layout), class_index(&new_layout)) {
+            (Some(old), Some(new)) => old == new,
+            (None, None) => pages_for(layout.size()) == pages_for(new_size),
+            _ => false,
+        };
+        if same_home {
+            return ptr;
+        }
+        let new_ptr = self.alloc(new_layout);
+        if !new_ptr.is_null() {
+            core::ptr::copy_nonoverlapping(ptr, new_ptr, layout.size().min(new_size));
+            self.dealloc(ptr, layout);
         }
-        SLAB.release();
+        new_ptr
     }
 }
 
@@ -1,14 +1,30 @@
 #ifndef _DIRENT_H
 #define _DIRENT_H
 
+#include <sys/stat.h>
+
 typedef struct _DIR DIR;
 
+#define DT_UNKNOWN 0
+#define DT_DIR     4
+#define DT_REG     8
+
 struct dirent {
+    unsigned char d_type;
     char d_name[256];
 };
 
+/* IDOS extension: an entry along with the attributes stat() would report.
+ * The filesystem supplies these with the listing, so readdir_plus() costs no
+ * more than readdir() where it's supported. */
+struct dirent_plus {
+    struct dirent d_ent;
+    struct stat d_stat;
+};
+
 DIR *opendir(const char *name);
 struct dirent *readdir(DIR *dirp);
+struct dirent_plus *readdir_plus(DIR *dirp);
 int closedir(DIR *dirp);
 
 #endif
@@ -34,7 +34,11 @@ double frexp(double x, int *exp);
 float sinf(float x);
 float cosf(float x);
 float tanf(float x);
+float asinf(float x);
+float acosf(float x);
+float atanf(float x);
 float atan2f(float y, float x);
+
 float sqrtf(float x);
 float fabsf(float x);
 float floorf(float x);
@@ -43,5 +47,9 @@ float fmodf(float x, float y);
 float powf(float base, float exponent);
 float expf(float x);
 float logf(float x);
+float log10f(float x);
+float log2f(float x);
+float ldexpf(float x, int exp);
+float frexpf(float x, int *exp);
 
 #endif
@@ -3,14 +3,34 @@
 
 #include <stddef.h>
 
+#define PROT_NONE   0
 #define PROT_READ   1
 #define PROT_WRITE  2
 #define PROT_EXEC   4
+#define MAP_SHARED     0x01
 #define MAP_PRIVATE    0x02
 #define MAP_ANONYMOUS  0x20
 #define MAP_FAILED  ((void *)-1)
 
+#define MS_ASYNC       1
+#define MS_INVALIDATE  2
+#define MS_SYNC        4
+
+#define MADV_NORMAL      0
+#define MADV_RANDOM      1
+#define MADV_SEQUENTIAL  2
+#define MADV_WILLNEED    3
+#define MADV_DONTNEED    4
+
+/* File mappings are made by path, so they outlive the descriptor. Writable
+ * MAP_SHARED mappings are private copies whose dirty pages are written back
+ * by msync(), munmap() and exit(). */
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, int offset);
 int munmap(void *addr, size_t length);
+/* PROT_EXEC is accepted but not enforced: without PAE, readable pages can
+ * always be executed. */
+int mprotect(void *addr, size_t length, int prot);
+int msync(void *addr, size_t length, int flags);
+int madvise(void *addr, size_t length, int advice);
 
 #endif
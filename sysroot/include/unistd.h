@@ -18,6 +18,12 @@ typedef int off_t;
 #define X_OK 1
 #define F_OK 0
 
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+#endif
+
 unsigned int sleep(unsigned int seconds);
 int usleep(unsigned int usec);
 int isatty(int fd);
@@ -33,5 +39,7 @@ ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
 int close(int fd);
 off_t lseek(int fd, off_t offset, int whence);
+ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
 
 #endif
@@ -0,0 +1,149 @@
+//! Just enough of ELF32 to read a function symbol table.
+
+use std::path::Path;
+
+struct Symbol {
+    start: u32,
+    size: u32,
+    name: String,
+}
+
+pub struct SymbolTable {
+    /// Sorted by start address
+    symbols: Vec<Symbol>,
+}
+
+const SHT_SYMTAB: u32 = 2;
+const STT_FUNC: u8 = 2;
+
+fn u16_at(data: &[u8], offset: usize) -> Option<u16> {
+    Some(u16::from_le_bytes(data.get(offset..offset + 2)?.try_into().ok()?))
+}
+
+fn u32_at(data: &[u8], offset: usize) -> Option<u32> {
+    Some(u32::from_le_bytes(data.get(offset..offset + 4)?.try_into().ok()?))
+}
+
+impl SymbolTable {
+    pub fn load(path: &Path) -> Result<Self, String> {
+        let data = std::fs::read(path).map_err(|e| format!("{}: {e}", path.display()))?;
+        Self::parse(&data).ok_or_else(|| format!("{}: not a 32-bit ELF with symbols", path.display()))
+    }
+
+    fn parse(data: &[u8]) -> Option<Self> {
+        // Little-endian, 32-bit
+        if data.get(0..6)? != b"\x7fELF\x01\x01" {
+            return None;
+        }
+        let section_offset = u32_at(data, 0x20)? as usize;
+        let section_size = u16_at(data, 0x2e)? as usize;
+        let section_count = u16_at(data, 0x30)? as usize;
+        let section = |index: usize| section_offset + index * section_size;
+
+        let symtab = (0..section_count).find(|&i| u32_at(data, section(i) + 4) == Some(SHT_SYMTAB))?;
+        let sym_start = u32_at(data, section(symtab) + 16)? as usize;
+        let sym_len = u32_at(data, section(symtab) + 20)? as usize;
+        let strtab = u32_at(data, section(symtab) + 24)? as usize;
+        let str_start = u32_at(data, section(strtab) + 16)? as usize;
+
+        let mut symbols = Vec::new();
+        for entry in data.get(sym_start..sym_start + sym_len)?.chunks_exact(16) {
+            let info = entry[12];
+            let start = u32_at(entry, 4)?;
+            if info & 0xf != STT_FUNC || start == 0 {
+                continue;
+            }
+            let name_start = str_start + u32_at(entry, 0)? as usize;
+            let name_len = data.get(name_start..)?.iter().position(|&b| b == 0)?;
+            let name = String::from_utf8_lossy(&data[name_start..name_start + name_len]);
+            symbols.push(Symbol {
+                start,
+                size: u32_at(entry, 8)?,
+                name: demangle(&name),
+            });
+        }
+        symbols.sort_by_key(|s| s.start);
+        Some(Self { symbols })
+    }
+
+    /// The function containing `addr`
+    pub fn lookup(&self, addr: u32) -> Option<&str> {
+        let index = self.symbols.partition_point(|s| s.start <= addr).checked_sub(1)?;
+        let symbol = &self.symbols[index];
+        if symbol.size != 0 && addr - symbol.start >= symbol.size {
+            return None;
+        }
+        Some(&symbol.name)
+    }
+}
+
+/// Demangle a legacy Rust symbol, dropping the trailing hash. Anything else is
+/// returned unchanged.
+pub fn demangle(name: &str) -> String {
+    let Some(mut rest) = name.strip_prefix("_ZN") else {
+        return name.to_string();
+    };
+    let mut parts = Vec::new();
+    while !rest.starts_with('E') {
+        let digits = rest.bytes().take_while(u8::is_ascii_digit).count();
+        let Ok(len) = rest[..digits].parse::<usize>() else {
+            return name.to_string();
+        };
+        rest = &rest[digits..];
+        if rest.len() < len {
+            return name.to_string();
+        }
+        let (part, remainder) = rest.split_at(len);
+        rest = remainder;
+        let is_hash = part.len() == 17
+            && part.starts_with('h')
+            && part[1..].bytes().all(|b| b.is_ascii_hexdigit());
+        if is_hash && rest == "E" {
+            break;
+        }
+        parts.push(unescape(part));
+    }
+    parts.join("::")
+}
+
+fn unescape(part: &str) -> String {
+    const ESCAPES: &[(&str, &str)] = &[
+        ("$LT$", "<"),
+        ("$GT$", ">"),
+        ("$RF$", "&"),
+        ("$BP$", "*"),
+        ("$SP$", "@"),
+        ("$C$", ","),
+        ("$u20$", " "),
+        ("$u27$", "'"),
+        ("$u5b$", "["),
+        ("$u5d$", "]"),
+        ("$u7b$", "{"),
+        ("$u7d$", "}"),
+        ("$u7e$", "~"),
+        ("..", "::"),
+    ];
+    let mut out = part.strip_prefix("_$").map(|p| format!("${p}")).unwrap_or_else(|| part.to_string());
+    for (from, to) in ESCAPES {
+        out = out.replace(from, to);
+    }
+    out
+}
+
+#[cfg(test)]
+mod tests {
+    use super::demangle;
+
+    #[test]
+    fn demangles_legacy_symbols() {
+        assert_eq!(
+            demangle("_ZN11idos_kernel4task10scheduling6switch17h0123456789abcdefE"),
+            "idos_kernel::task::scheduling::switch"
+        );
+        assert_eq!(
+            demangle("_ZN4core3ptr42drop_in_place$LT$alloc..string..String$GT$17h0123456789abcdefE"),
+            "core::ptr::drop_in_place<alloc::string::String>"
+        );
+        assert_eq!(demangle("memcpy"), "memcpy");
+    }
+}
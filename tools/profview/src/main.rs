@@ -0,0 +1,241 @@
+mod elf;
+mod profile;
+
+use std::collections::HashMap;
+use std::path::PathBuf;
+
+use elf::SymbolTable;
+use profile::{Profile, Sample, SAMPLE_USER, SAMPLE_VM86};
+
+struct Options {
+    profile: PathBuf,
+    kernel: PathBuf,
+    programs: Vec<PathBuf>,
+    program_dir: PathBuf,
+    top: usize,
+}
+
+fn main() {
+    let options = parse_args();
+    let data = std::fs::read(&options.profile).unwrap_or_else(|e| {
+        eprintln!("{}: {e}", options.profile.display());
+        std::process::exit(1);
+    });
+    let profile = profile::parse(&data).unwrap_or_else(|e| {
+        eprintln!("{}: {e}", options.profile.display());
+        std::process::exit(1);
+    });
+
+    let mut symbolizer = Symbolizer::new(&options);
+    report(&profile, &mut symbolizer, options.top);
+}
+
+fn parse_args() -> Options {
+    let args: Vec<String> = std::env::args().collect();
+    let mut options = Options {
+        profile: PathBuf::new(),
+        kernel: PathBuf::from("target/i386-kernel/release/idos_kernel"),
+        programs: Vec::new(),
+        program_dir: PathBuf::from("target/i386-idos/release"),
+        top: 20,
+    };
+    let mut i = 1;
+    while i < args.len() {
+        let arg = args[i].clone();
+        let mut value = |name: &str| {
+            i += 1;
+            args.get(i).cloned().unwrap_or_else(|| {
+                eprintln!("{name} requires a value");
+                std::process::exit(1);
+            })
+        };
+        match arg.as_str() {
+            "--kernel" => options.kernel = PathBuf::from(value("--kernel")),
+            "--program" => options.programs.push(PathBuf::from(value("--program"))),
+            "--program-dir" => options.program_dir = PathBuf::from(value("--program-dir")),
+            "--top" => {
+                options.top = value("--top").parse().unwrap_or_else(|_| {
+                    eprintln!("--top requires a number");
+                    std::process::exit(1);
+                })
+            }
+            "--help" | "-h" => {
+                eprintln!("Usage: profview [options] <profile>");
+                eprintln!();
+                eprintln!("Symbolizes samples copied from SYS:\\PROFILE and prints flat and per-task profiles.");
+                eprintln!();
+                eprintln!("  --kernel <elf>       Kernel ELF (default target/i386-kernel/release/idos_kernel)");
+                eprintln!("  --program <elf>      A user program ELF, matched to tasks by file stem");
+                eprintln!("  --program-dir <dir>  Where else to look for program ELFs (default target/i386-idos/release)");
+                eprintln!("  --top <n>            Symbols shown per table (default 20)");
+                std::process::exit(0);
+            }
+            other if other.starts_with("--") => {
+                eprintln!("Unknown argument: {other}");
+                std::process::exit(1);
+            }
+            other => options.profile = PathBuf::from(other),
+        }
+        i += 1;
+    }
+    if options.profile.as_os_str().is_empty() {
+        eprintln!("Usage: profview [options] <profile>");
+        std::process::exit(1);
+    }
+    options
+}
+
+/// Turns samples into "image: symbol" labels, loading each program's symbols
+/// the first time one of its tasks shows up
+struct Symbolizer {
+    kernel: Option<SymbolTable>,
+    programs: HashMap<String, PathBuf>,
+    program_dir: PathBuf,
+    loaded: HashMap<String, Option<SymbolTable>>,
+}
+
+/// "C:\DIR\PROG.ELF" becomes "prog"
+fn stem_of(name: &str) -> String {
+    let file = name.rsplit(['\\', '/', ':']).next().unwrap_or(name);
+    let stem = file.split('.').next().unwrap_or(file);
+    stem.to_ascii_lowercase()
+}
+
+impl Symbolizer {
+    fn new(options: &Options) -> Self {
+        let kernel = match SymbolTable::load(&options.kernel) {
+            Ok(table) => Some(table),
+            Err(e) => {
+                eprintln!("warning: {e}; kernel samples will not be symbolized");
+                None
+            }
+        };
+        let programs = options
+            .programs
+            .iter()
+            .map(|path| (stem_of(&path.to_string_lossy()), path.clone()))
+            .collect();
+        Self {
+            kernel,
+            programs,
+            program_dir: options.program_dir.clone(),
+            loaded: HashMap::new(),
+        }
+    }
+
+    fn program(&mut self, stem: &str) -> Option<&SymbolTable> {
+        if !self.loaded.contains_key(stem) {
+            let path = self
+                .programs
+                .get(stem)
+                .cloned()
+                .unwrap_or_else(|| self.program_dir.join(stem));
+            let table = if path.exists() {
+                SymbolTable::load(&path)
+                    .map_err(|e| eprintln!("warning: {e}"))
+                    .ok()
+            } else {
+                None
+            };
+            self.loaded.insert(stem.to_string(), table);
+        }
+        self.loaded[stem].as_ref()
+    }
+
+    fn label(&mut self, sample: &Sample, task_name: Option<&str>) -> String {
+        if sample.flags & SAMPLE_VM86 != 0 {
+            // Real mode code has no symbols, so group it by segment
+            return format!("vm86: segment {:04x}", sample.cs);
+        }
+        if sample.flags & SAMPLE_USER == 0 {
+            let symbol = self.kernel.as_ref().and_then(|k| k.lookup(sample.eip));
+            return format!("kernel: {}", symbol_or_address(symbol, sample.eip));
+        }
+        let Some(stem) = task_name.map(stem_of) else {
+            return format!("user: {:#010x}", sample.eip);
+        };
+        let symbol = self
+            .program(&stem)
+            .and_then(|p| p.lookup(sample.eip))
+            .map(String::from);
+        format!("{stem}: {}", symbol_or_address(symbol.as_deref(), sample.eip))
+    }
+}
+
+fn symbol_or_address(symbol: Option<&str>, addr: u32) -> String {
+    match symbol {
+        Some(name) => name.to_string(),
+        None => format!("{addr:#010x}"),
+    }
+}
+
+struct TaskSummary {
+    total: usize,
+    user: usize,
+    labels: HashMap<String, usize>,
+}
+
+fn report(profile: &Profile, symbolizer: &mut Symbolizer, top: usize) {
+    let total = profile.samples.len();
+    println!(
+        "{} samples, {} ms apart on each CPU, {} dropped",
+        total, profile.interval_ms, profile.dropped
+    );
+    if total == 0 {
+        return;
+    }
+
+    let mut flat: HashMap<String, usize> = HashMap::new();
+    let mut tasks: HashMap<u32, TaskSummary> = HashMap::new();
+    for sample in profile.samples.iter() {
+        let name = profile.tasks.get(&sample.task).map(String::as_str);
+        let label = symbolizer.label(sample, name);
+        *flat.entry(label.clone()).or_default() += 1;
+        let summary = tasks.entry(sample.task).or_insert_with(|| TaskSummary {
+            total: 0,
+            user: 0,
+            labels: HashMap::new(),
+        });
+        summary.total += 1;
+        if sample.flags & SAMPLE_USER != 0 {
+            summary.user += 1;
+        }
+        *summary.labels.entry(label).or_default() += 1;
+    }
+
+    println!();
+    println!("Flat profile:");
+    print_table(&flat, total, top);
+
+    let mut by_load: Vec<(&u32, &TaskSummary)> = tasks.iter().collect();
+    by_load.sort_by(|a, b| b.1.total.cmp(&a.1.total).then(a.0.cmp(b.0)));
+    for (id, summary) in by_load {
+        let name = profile.tasks.get(id).map(String::as_str).unwrap_or("(exited)");
+        println!();
+        println!(
+            "Task {id} {name}: {} samples ({:.1}%), {} user, {} kernel",
+            summary.total,
+            percent(summary.total, total),
+            summary.user,
+            summary.total - summary.user,
+        );
+        print_table(&summary.labels, summary.total, top);
+    }
+}
+
+fn print_table(counts: &HashMap<String, usize>, total: usize, top: usize) {
+    let mut rows: Vec<(&String, &usize)> = counts.iter().collect();
+    rows.sort_by(|a, b| b.1.cmp(a.1).then(a.0.cmp(b.0)));
+    println!("  {:>8} {:>6}  symbol", "samples", "%");
+    for (label, count) in rows.iter().take(top) {
+        println!("  {:>8} {:>5.1}%  {}", count, percent(**count, total), label);
+    }
+    if rows.len() > top {
+        let rest: usize = rows[top..].iter().map(|(_, c)| **c).sum();
+        println!("  {:>8} {:>5.1}%  ({} more)", rest, percent(rest, total), rows.len() - top);
+    }
+}
+
+fn percent(count: usize, total: usize) -> f64 {
+    count as f64 * 100.0 / total as f64
+}
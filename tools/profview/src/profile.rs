@@ -0,0 +1,84 @@
+//! Reader for the profiler's output in `SYS:\PROFILE`. The layout mirrors
+//! `ProfileHeader`, `ProfileSample` and `ProfileTask` in `idos_api::stats`,
+//! which can't be built for the host.
+
+use std::collections::HashMap;
+
+const PROFILE_VERSION: u32 = 1;
+const HEADER_LEN: usize = 20;
+const SAMPLE_LEN: usize = 12;
+const NAME_LEN: usize = 60;
+const TASK_LEN: usize = 4 + NAME_LEN;
+
+pub const SAMPLE_USER: u8 = 1;
+pub const SAMPLE_VM86: u8 = 2;
+
+pub struct Sample {
+    pub eip: u32,
+    pub task: u32,
+    pub cs: u16,
+    pub flags: u8,
+}
+
+pub struct Profile {
+    pub interval_ms: u32,
+    pub dropped: u32,
+    pub samples: Vec<Sample>,
+    /// Filenames of the tasks that were still alive when the profile was read
+    pub tasks: HashMap<u32, String>,
+}
+
+fn u32_at(data: &[u8], offset: usize) -> u32 {
+    u32::from_le_bytes(data[offset..offset + 4].try_into().unwrap())
+}
+
+pub fn parse(data: &[u8]) -> Result<Profile, String> {
+    if data.len() < HEADER_LEN {
+        return Err("file is too short for a profile header".into());
+    }
+    let version = u32_at(data, 0);
+    if version != PROFILE_VERSION {
+        return Err(format!("unsupported profile version {version}"));
+    }
+    let sample_count = u32_at(data, 4) as usize;
+    let task_count = u32_at(data, 8) as usize;
+    let expected = HEADER_LEN + sample_count * SAMPLE_LEN + task_count * TASK_LEN;
+    if data.len() < expected {
+        return Err(format!(
+            "file is truncated: {} bytes, expected {expected}",
+            data.len()
+        ));
+    }
+
+    let samples = (0..sample_count)
+        .map(|i| {
+            let offset = HEADER_LEN + i * SAMPLE_LEN;
+            Sample {
+                eip: u32_at(data, offset),
+                task: u32_at(data, offset + 4),
+                cs: u16::from_le_bytes([data[offset + 8], data[offset + 9]]),
+                flags: data[offset + 11],
+            }
+        })
+        .collect();
+
+    let tasks_start = HEADER_LEN + sample_count * SAMPLE_LEN;
+    let tasks = (0..task_count)
+        .map(|i| {
+            let offset = tasks_start + i * TASK_LEN;
+            let name = &data[offset + 4..offset + TASK_LEN];
+            let len = name.iter().position(|&b| b == 0).unwrap_or(NAME_LEN);
+            (
+                u32_at(data, offset),
+                String::from_utf8_lossy(&name[..len]).into_owned(),
+            )
+        })
+        .collect();
+
+    Ok(Profile {
+        interval_ms: u32_at(data, 16),
+        dropped: u32_at(data, 12),
+        samples,
+        tasks,
+    })
+}